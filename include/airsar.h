@@ -152,4 +152,11 @@ airsar_param_header *read_airsar_params(const char *dataFile);
 airsar_dem_header *read_airsar_dem(const char *dataFile);
 airsar_cal_header *read_airsar_cal(const char *dataFile);
 
+// Compressed Stokes matrix data: 10 bytes per pixel, read and decoded
+// AIRSAR_STOKES_BLOCK_LINES lines at a time.
+#define AIRSAR_STOKES_BYTES 10
+#define AIRSAR_STOKES_BLOCK_LINES 128
+void airsar_stokes_total_power(const char *rec, int sample_count,
+			       double *total_power);
+
 #endif
@@ -48,6 +48,32 @@ void ifft2d(float *data, int M2, int M);
 /* OUTPUTS */
 /* *data = output data array	*/
 
+#define FFT2D_WORK_SIZE(M2) (4*2*(1<<(M2)))
+/* number of floats of column storage needed by fft2d_work and ifft2d_work */
+
+void fft2d_work(float *data, int M2, int M, float *work);
+/* Compute 2D complex fft and return results in-place, like fft2d, but */
+/* using the caller's column storage.  Once fft2dInit has been called, */
+/* threads with separate work arrays can call this at the same time. */
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows */
+/* M = log2 of fft size number of columns */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
+/* OUTPUTS */
+/* *data = output data array	*/
+
+void ifft2d_work(float *data, int M2, int M, float *work);
+/* Compute 2D complex ifft and return results in-place, like ifft2d, but */
+/* using the caller's column storage (see fft2d_work). */
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows */
+/* M = log2 of fft size number of columns */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
+/* OUTPUTS */
+/* *data = output data array	*/
+
 int fft3dInit(int L, int M2, int M);
 	/* init for fft3d, ifft3d*/
 	/* malloc storage for 4 columns and 4 pages of 3d ffts*/
@@ -111,6 +137,28 @@ void rifft2d(float *data, int M2, int M);
 /* OUTPUTS */
 /* *data = output data array	*/
 
+void rfft2d_work(float *data, int M2, int M, float *work);
+/* Compute 2D real fft and return results in-place, like rfft2d, but */
+/* using the caller's column storage (see fft2d_work). */
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows in */
+/* M = log2 of fft size number of columns in */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
+/* OUTPUTS */
+/* *data = output data array	*/
+
+void rifft2d_work(float *data, int M2, int M, float *work);
+/* Compute 2D real ifft and return results in-place, like rifft2d, but */
+/* using the caller's column storage (see fft2d_work). */
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows out */
+/* M = log2 of fft size number of columns out */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
+/* OUTPUTS */
+/* *data = output data array	*/
+
 void rspect2dprod(float *data1, float *data2, float *outdata, int N2, int N1);
 /* When multiplying a pair of 2d spectra from rfft2d care must be taken to multiply the*/
 /* four real values seperately from the complex ones. This routine does it correctly.*/
@@ -276,6 +276,7 @@ on_execute_button_clicked(GtkWidget *w)
         if (pid == 0)
         {
             /* This is the background thread: runs ips */
+            asf_watch_stop_file();
             write_settings(params);
             ips(params->cfg, params->name, FALSE);
             exit(EXIT_SUCCESS);
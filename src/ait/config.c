@@ -1331,9 +1331,8 @@ void apply_settings_to_gui(ait_params_t *params)
     add_to_image_list2(path, "out_dem_phase.img");
 
     add_section_to_image_list("Phase Unwrapping");
-    add_to_image_list2(path, "filtered_phase.img");
-    add_to_image_list2(path, "escher_in_phase.img");
-    add_to_image_list2(path, "unwrap_dem.img");
+    add_to_image_list2(path, "unwrap_nod_phase.img");
+    add_to_image_list2(path, "unwrap_dem_mask.img");
 
     sprintf(tmp, "%s_igram_ml_rgb.img", cfg->general->base);
     add_to_image_list2(path, tmp);
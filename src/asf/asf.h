@@ -373,6 +373,44 @@ typedef double solve1d_fn(void *params, double x);
 int solve1d(solve1d_fn *f, void *params, int min_x, int max_x, double acc,
             double *root);
 
+// parallel.c
+/* Callback for asf_parallel_for: process items start <= i < end. */
+typedef void asf_parallel_fn(int start, int end, void *data);
+/* Run fn over [0,n) in chunks of 'chunk' items, spread across threads. */
+void asf_parallel_for(int n, int chunk, asf_parallel_fn *fn, void *data);
+int asf_get_thread_count(void);
+void asf_set_thread_count(int n);
+
+// trace.c
+/* Counters recorded with every timing span. */
+typedef enum {
+  ASF_COUNT_BYTES_READ,
+  ASF_COUNT_BYTES_WRITTEN,
+  ASF_COUNT_PIXELS,
+  ASF_NUM_COUNTERS
+} asf_counter_t;
+/* Tracing is off unless started here, or with ASF_TRACE=<trace file>. */
+void asf_trace_start(const char *trace_file);
+void asf_trace_stop(void);
+int asf_trace_enabled(void);
+/* Spans nest; asf_trace_end() closes the innermost open one. */
+void asf_trace_begin(const char *name);
+void asf_trace_end(void);
+void asf_trace_count(asf_counter_t counter, long long n);
+long long asf_trace_counter(asf_counter_t counter);
+
+// cancel.c
+/* Ask a running program to stop; safe to call from a signal handler.  The
+   status routines in print_alerts.c check the flag and exit. */
+void asf_request_cancel(void);
+int asf_cancel_requested(void);
+void asf_clear_cancel(void);
+void asf_catch_cancel_signal(int signum);
+/* Processing tools stop when stop.txt appears in the ASF temporary
+   directory, once they have called asf_watch_stop_file(). */
+void asf_watch_stop_file(void);
+int asf_stop_file_found(void);
+
 // httpUtil.c
 unsigned char *download_url(const char *url, int verbose, int *length);
 int download_url_to_file(const char *url, const char *filename);
@@ -0,0 +1,87 @@
+/* Cancelling a running program.
+
+   Long running tools can be stopped from outside in two ways: by creating
+   a file called stop.txt in the ASF temporary directory (this is what the
+   GUIs do), or, if the program has asked for it with
+   asf_catch_cancel_signal(), by sending it a signal.  The status and
+   progress reporting routines in print_alerts.c check for both at
+   convenient points, and stop the program with "Interrupted by user."
+
+   Only processing tools look for the stop file, after calling
+   asf_watch_stop_file() (asfSplashScreen() does this).  The GUIs write
+   the file for the tools they have started, so they must not react to it
+   themselves.  The file is looked for at most every STOP_POLL_USEC
+   microseconds, so the status routines can check for it on every call.  */
+
+#include <signal.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "asf.h"
+
+#define STOP_POLL_USEC 500000
+
+static volatile sig_atomic_t cancel_flag = 0;
+
+static int watching = FALSE;
+static long long last_poll = 0;
+
+void asf_request_cancel(void)
+{
+  cancel_flag = 1;
+}
+
+int asf_cancel_requested(void)
+{
+  return cancel_flag;
+}
+
+void asf_clear_cancel(void)
+{
+  cancel_flag = 0;
+}
+
+static void cancel_signal_handler(int signum)
+{
+  asf_request_cancel();
+}
+
+/* Have the given signal request cancellation instead of doing whatever it
+   would normally do. */
+void asf_catch_cancel_signal(int signum)
+{
+  signal(signum, cancel_signal_handler);
+}
+
+/* Have asf_stop_file_found() look for stop.txt in the ASF temporary
+   directory from now on. */
+void asf_watch_stop_file(void)
+{
+  watching = TRUE;
+}
+
+/* Returns TRUE, and removes the file, if stop.txt has turned up since the
+   last look.  Returns FALSE without looking if the program does not watch
+   for the file, or if it was looked for less than STOP_POLL_USEC ago. */
+int asf_stop_file_found(void)
+{
+  char stop_file[1024];
+  struct timeval tv;
+  long long now;
+
+  if (!watching)
+    return FALSE;
+
+  // Several threads may get here at once; at worst they all look.
+  gettimeofday(&tv, NULL);
+  now = (long long)tv.tv_sec*1000000 + tv.tv_usec;
+  if (now - __atomic_load_n(&last_poll, __ATOMIC_RELAXED) < STOP_POLL_USEC)
+    return FALSE;
+  __atomic_store_n(&last_poll, now, __ATOMIC_RELAXED);
+
+  snprintf(stop_file, sizeof(stop_file), "%s/stop.txt", get_asf_tmp_dir());
+  if (access(stop_file, F_OK) != 0)
+    return FALSE;
+  remove(stop_file);
+  return TRUE;
+}
@@ -17,6 +17,7 @@ This way, we can have maximum trust in these routines, and use them as much as
 possible.
 ******************************************************************************/
 
+#include "asf.h"
 #include "caplib.h"
 #include "log.h"
 
@@ -310,6 +311,7 @@ size_t ASF_FREAD(void *ptr,size_t size,size_t nitems,FILE *stream)
     if (stream==NULL)
         programmer_error("NULL file pointer passed to ASF_FREAD.\n");
     ret=fread(ptr,size,nitems,stream);
+    asf_trace_count(ASF_COUNT_BYTES_READ, (long long)ret*size);
     if (ret < nitems)
     {
         if (feof(stream)) {
@@ -400,6 +402,7 @@ size_t FREAD_CHECKED(void *ptr, size_t size, size_t nitems, FILE *stream, int sh
     }
 
     ret = fread(ptr, size, nitems, stream);
+    asf_trace_count(ASF_COUNT_BYTES_READ, (long long)ret*size);
 
     if (ret < nitems && !short_ok) {
         asfPrintError("File too short.  FREAD_CHECKED attempted to read %d bytes past end of file\n",
@@ -419,6 +422,7 @@ size_t ASF_FWRITE(const void *ptr,size_t size,size_t nitems,FILE *stream)
     if (stream==NULL)
         programmer_error("NULL file pointer passed to ASF_FWRITE.\n");
     ret=fwrite(ptr,size,nitems,stream);
+    asf_trace_count(ASF_COUNT_BYTES_WRITTEN, (long long)ret*size);
     if (ret!=nitems)
     {
         sprintf(error_message,
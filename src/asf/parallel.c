@@ -0,0 +1,110 @@
+/* Splitting loops across worker threads.
+
+   asf_parallel_for() cuts the range [0,n) into chunks and hands them out
+   to a small set of threads, the calling thread included.  Chunks are
+   claimed in increasing order, but may finish in any order, so the
+   callback must only write to output it owns for its [start,end) range.
+
+   The number of threads defaults to the number of processors, and can be
+   overridden with the ASF_THREADS environment variable or with
+   asf_set_thread_count().  With one thread, the callback is simply run
+   over the whole range in the calling thread.
+
+   Only pthreads and the compiler's atomic builtins are used, so programs
+   linked against asf.a do not have to link glib.  */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "asf.h"
+
+static int thread_count = 0;
+
+typedef struct {
+  int n;
+  int chunk;
+  int next;
+  asf_parallel_fn *fn;
+  void *data;
+} parallel_job_t;
+
+int asf_get_thread_count(void)
+{
+  if (thread_count <= 0) {
+    const char *env = getenv("ASF_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n <= 0)
+#ifdef _SC_NPROCESSORS_ONLN
+      n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#else
+      n = 1;
+#endif
+    thread_count = n > 0 ? n : 1;
+  }
+  return thread_count;
+}
+
+void asf_set_thread_count(int n)
+{
+  // zero or less means "back to the default"
+  thread_count = n;
+}
+
+static void run_chunks(parallel_job_t *job)
+{
+  for (;;) {
+    int start = __atomic_fetch_add(&job->next, job->chunk, __ATOMIC_RELAXED);
+    if (start >= job->n)
+      break;
+    int end = start + job->chunk;
+    if (end > job->n)
+      end = job->n;
+    job->fn(start, end, job->data);
+  }
+}
+
+static void *parallel_worker(void *data)
+{
+  run_chunks((parallel_job_t *)data);
+  return NULL;
+}
+
+void asf_parallel_for(int n, int chunk, asf_parallel_fn *fn, void *data)
+{
+  int i, nchunks, nthreads;
+  parallel_job_t job;
+  pthread_t *threads;
+
+  if (n <= 0)
+    return;
+  if (chunk <= 0)
+    chunk = 1;
+
+  nchunks = (n + chunk - 1) / chunk;
+  nthreads = asf_get_thread_count();
+  if (nthreads > nchunks)
+    nthreads = nchunks;
+
+  if (nthreads <= 1) {
+    fn(0, n, data);
+    return;
+  }
+
+  job.n = n;
+  job.chunk = chunk;
+  job.next = 0;
+  job.fn = fn;
+  job.data = data;
+
+  // If a thread can't be started, the ones that did (and this one) just
+  // get more of the chunks.
+  threads = (pthread_t *) MALLOC(sizeof(pthread_t) * (nthreads - 1));
+  for (i = 0; i < nthreads - 1; ++i)
+    if (pthread_create(&threads[i], NULL, parallel_worker, &job) != 0)
+      break;
+  nthreads = i + 1;
+  run_chunks(&job);
+  for (i = 0; i < nthreads - 1; ++i)
+    pthread_join(threads[i], NULL);
+  FREE(threads);
+}
@@ -10,15 +10,36 @@ DESCRIPTION:
 
 report_level_t g_report_level=REPORT_LEVEL_WARNING;
 
+/* Status output is flushed at most this often (plus on warnings and
+   errors), instead of after every message */
+#define FLUSH_INTERVAL_USEC 250000
+
 static void check_stop()
 {
-    snprintf(logbuf, sizeof(logbuf), "%s/stop.txt", get_asf_tmp_dir());
-    if (fileExists(logbuf)) {
-        remove(logbuf);
+    if (asf_cancel_requested() || asf_stop_file_found()) {
+        asf_clear_cancel();
         asfPrintError("Interrupted by user.\n");
     }
 }
 
+static void flush_output(int force)
+{
+    static long long last_flush = 0;
+    struct timeval tv;
+    long long now;
+
+    gettimeofday(&tv, NULL);
+    now = (long long)tv.tv_sec*1000000 + tv.tv_usec;
+
+    if (!force && now - last_flush < FLUSH_INTERVAL_USEC)
+        return;
+    last_flush = now;
+
+    fflush(stdout);
+    if (logflag && fLog)
+        fflush(fLog);
+}
+
 /* Do not print to the terminal, only report to the log file */
 void asfPrintToLogOnly(const char *format, ...)
 {
@@ -26,7 +47,7 @@ void asfPrintToLogOnly(const char *format, ...)
   va_start(ap, format);
   if (logflag) {
     vfprintf(fLog, format, ap);
-    fflush (fLog);
+    flush_output(FALSE);
   }
   va_end(ap);
 }
@@ -39,8 +60,6 @@ void asfPrintStatus(const char *format, ...)
     va_start(ap, format);
     vprintf(format, ap);
     va_end(ap);
-  
-    fflush (stdout);
   }
   if (logflag) {
     if (!fLog) {
@@ -50,10 +69,9 @@ void asfPrintStatus(const char *format, ...)
     va_start(ap, format);
     vfprintf(fLog, format, ap);
     va_end(ap);
-
-    fflush (fLog);
   }
 
+  flush_output(FALSE);
   check_stop();
 }
 
@@ -74,9 +92,9 @@ void asfForcePrintStatus(const char *format, ...)
     va_start(ap, format);
     vfprintf(fLog, format, ap);
     va_end(ap);
-
-    fflush (fLog);
   }
+
+  flush_output(FALSE);
 }
 
 /* Report warning to user & log file, then continue the program  */
@@ -109,14 +127,12 @@ void asfPrintWarning(const char *format, ...)
     va_end(ap);
   }
   
-  if (quietflag < 2) {
+  if (quietflag < 2)
     printf("%s", warningEnd);
-    fflush (stdout);
-  }
-  if (logflag) {
+  if (logflag)
     fprintf(fLog, "%s", warningEnd);
-    fflush (fLog);
-  }
+
+  flush_output(TRUE);
 }
 
 
@@ -222,10 +238,8 @@ void asfLineMeter(int currentLine, int totalLines)
           tense, currentLine, totalLines, endline);
 
   /* Report to terminal */
-  if (!quietflag) {
+  if (!quietflag)
     printf("%c%s",'\r',logbuf);
-    fflush(NULL);
-  }
 
   /* Report to the log as well */
   /* Only on the last line */
@@ -234,9 +248,8 @@ void asfLineMeter(int currentLine, int totalLines)
     printLog(logbuf);
   }
 
-  /* Check if we should abort every once in a while */
-  if (currentLine%640==0 || currentLine==totalLines)
-    check_stop();
+  flush_output(currentLine==totalLines);
+  check_stop();
 }
 
 /******************************************************************************
@@ -265,7 +278,6 @@ void asfPercentMeter(double inPercent)
   /* Report to terminal */
   if (!quietflag) {
     printf("%c%s",'\r',logbuf);
-    fflush(NULL);
     inPercent++;
   }
   /* Report to the log as well */
@@ -275,9 +287,8 @@ void asfPercentMeter(double inPercent)
     printLog(logbuf);
   }
 
-  /* Check if we should abort, 10 times during processing */
-  if (newPercent%10==0)
-    check_stop();
+  flush_output(newPercent==100);
+  check_stop();
 }
 
 // Cute watch dog indicator ...just something on the screen
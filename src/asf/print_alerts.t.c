@@ -0,0 +1,84 @@
+#include "CUnit/Basic.h"
+#include "asf.h"
+#include <unistd.h>
+
+// Number of write() calls made by this process so far, or -1 if the
+// kernel doesn't tell us
+static long long write_syscalls()
+{
+  long long n = -1;
+  char line[256];
+  FILE *fp = fopen("/proc/self/io", "r");
+  if (fp) {
+    while (fgets(line, sizeof(line), fp))
+      if (sscanf(line, "syscw: %lld", &n) == 1)
+        break;
+    fclose(fp);
+  }
+  return n;
+}
+
+void test_print_alerts()
+{
+  const int n_msgs = 10000;
+  int i, save_quiet = quietflag, save_log = logflag;
+  FILE *save_fLog = fLog;
+  long long before, after;
+
+  // Status messages to the log only
+  quietflag = TRUE;
+  logflag = TRUE;
+  fLog = fopen("test_print_alerts.log", "w");
+  CU_ASSERT(fLog != NULL);
+
+  before = write_syscalls();
+  for (i = 0; i < n_msgs; ++i)
+    asfPrintStatus("Status message %d\n", i);
+  after = write_syscalls();
+
+  // Flushing after every message took one write per message; now they
+  // are batched
+  if (before >= 0) {
+    printf("\n  %d status messages: %lld write() calls\n",
+           n_msgs, after - before);
+    CU_ASSERT(after - before < n_msgs/10);
+  }
+
+  fclose(fLog);
+  fLog = save_fLog;
+  logflag = save_log;
+  quietflag = save_quiet;
+
+  // Nothing may be lost
+  FILE *fp = fopen("test_print_alerts.log", "r");
+  char line[256];
+  int n_lines = 0;
+  while (fgets(line, sizeof(line), fp))
+    ++n_lines;
+  fclose(fp);
+  CU_ASSERT(n_lines == n_msgs);
+  remove("test_print_alerts.log");
+
+  // Cancellation: a signal, or the stop file appearing, sets the flag
+  CU_ASSERT(!asf_cancel_requested());
+  asf_request_cancel();
+  CU_ASSERT(asf_cancel_requested());
+  asf_clear_cancel();
+  CU_ASSERT(!asf_cancel_requested());
+
+  char stop_file[1024];
+  snprintf(stop_file, sizeof(stop_file), "%s/stop.txt", get_asf_tmp_dir());
+  fp = fopen(stop_file, "w");
+  if (fp) {
+    fclose(fp);
+    // Not watching yet: the file is left alone
+    usleep(600000);
+    CU_ASSERT(!asf_stop_file_found());
+    CU_ASSERT(fileExists(stop_file));
+    asf_watch_stop_file();
+    for (i = 0; i < 10 && !asf_stop_file_found(); ++i)
+      usleep(100000);
+    CU_ASSERT(i < 10);
+    CU_ASSERT(!fileExists(stop_file));
+  }
+}
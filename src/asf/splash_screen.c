@@ -10,6 +10,10 @@ void asfSplashScreen(int argc, char* argv[])
 {
   int ii;
 
+  // Tools that announce themselves are processing tools, which the GUIs
+  // stop by writing stop.txt
+  asf_watch_stop_file();
+
   sprintf(logbuf, "\nCommand line:\n");
   for (ii = 0; ii < argc; ii++) {
     sprintf(logbuf, "%s %s",logbuf, argv[ii]);
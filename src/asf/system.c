@@ -97,6 +97,8 @@ asfSystem_imp(int wait, const char *cmd)
 
 #else
 
+  // status output is buffered; get it out ahead of the command's own
+  fflush(NULL);
   int ret = system(cmd);
 
   if (ret != 0) {
@@ -4,6 +4,8 @@ void test_vector();
 void test_strUtil();
 void test_complex();
 void test_solve1d();
+void test_trace();
+void test_print_alerts();
 
 int main()
 {
@@ -24,7 +26,9 @@ int main()
    if ((NULL == CU_add_test(pSuite, "vector", test_vector)) ||
        (NULL == CU_add_test(pSuite, "strUtil", test_strUtil)) ||
        (NULL == CU_add_test(pSuite, "solve1d", test_solve1d)) ||
-       (NULL == CU_add_test(pSuite, "complex", test_complex)))
+       (NULL == CU_add_test(pSuite, "complex", test_complex)) ||
+       (NULL == CU_add_test(pSuite, "trace", test_trace)) ||
+       (NULL == CU_add_test(pSuite, "print_alerts", test_print_alerts)))
    {
       CU_cleanup_registry();
       return CU_get_error();
@@ -0,0 +1,380 @@
+/* Timing spans and I/O counters.
+
+   asf_trace_begin() and asf_trace_end() bracket a named stage of
+   processing.  Spans nest, and each thread keeps its own stack of them.
+   For every span the wall clock time, the CPU time of the calling thread,
+   and the change in the global counters (bytes read and written through
+   the caplib I/O routines, and pixels written through put_data_lines) are
+   recorded.
+
+   Nothing is recorded unless tracing has been started, either with
+   asf_trace_start() or by setting the ASF_TRACE environment variable to
+   the name of a trace file.  When tracing is off every call returns after
+   a single test, so the calls can stay in production code.
+
+   When tracing stops (asf_trace_stop(), or at program exit) a summary of
+   all spans is printed, and if a trace file was given, every span is
+   written to it in the Chrome trace event format, which can be loaded
+   into chrome://tracing or https://ui.perfetto.dev for a timeline.
+
+   caplib.c counts its I/O here, so this file ends up in every program
+   linked against asf.a.  It only uses pthreads and the compiler's atomic
+   builtins, so those programs do not have to link glib.  */
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asf.h"
+
+#define MAX_SPAN_DEPTH   64
+#define MAX_TRACE_EVENTS 1000000
+
+typedef struct {
+  const char *name;
+  long long wall0;                     // microseconds
+  double cpu0;                         // seconds
+  long long count0[ASF_NUM_COUNTERS];
+} span_t;
+
+typedef struct {
+  int tid;
+  int depth;
+  span_t stack[MAX_SPAN_DEPTH];
+} thread_spans_t;
+
+// One finished span, for the trace file
+typedef struct {
+  const char *name;
+  int tid;
+  long long start, dur;                // microseconds
+  double cpu;
+  long long counts[ASF_NUM_COUNTERS];
+} trace_event_t;
+
+// Totals over all finished spans of the same name, for the summary
+typedef struct {
+  const char *name;
+  int depth;
+  int calls;
+  double wall, cpu;
+  long long counts[ASF_NUM_COUNTERS];
+} span_total_t;
+
+enum { TRACE_UNKNOWN = 0, TRACE_OFF, TRACE_ON };
+
+static int trace_state = TRACE_UNKNOWN;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+static char *trace_file = NULL;
+static long long trace_t0;
+static long long counters[ASF_NUM_COUNTERS];
+static trace_event_t *events = NULL;
+static int n_events = 0, max_events = 0;
+static span_total_t *totals = NULL;
+static int n_totals = 0, max_totals = 0;
+static int next_tid = 0;
+
+static const char *counter_names[ASF_NUM_COUNTERS] = {
+  "bytes_read", "bytes_written", "pixels"
+};
+
+static long long monotonic_usec(void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#endif
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (long long)tv.tv_sec*1000000 + tv.tv_usec;
+}
+
+static double thread_cpu_time(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec*1.0e-9;
+#endif
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void trace_at_exit(void)
+{
+  asf_trace_stop();
+}
+
+static void start_tracing(const char *file)
+{
+  static int registered = FALSE;
+
+  int i;
+
+  pthread_mutex_lock(&trace_lock);
+  FREE(trace_file);
+  trace_file = file && *file ? STRDUP(file) : NULL;
+  trace_t0 = monotonic_usec();
+  for (i = 0; i < ASF_NUM_COUNTERS; ++i)
+    __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+  n_events = 0;
+  n_totals = 0;
+  if (!registered) {
+    atexit(trace_at_exit);
+    registered = TRUE;
+  }
+  __atomic_store_n(&trace_state, TRACE_ON, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&trace_lock);
+}
+
+static void init_tracing(void)
+{
+  const char *env = getenv("ASF_TRACE");
+
+  pthread_key_create(&thread_key, free);
+  if (env && *env)
+    start_tracing(env);
+  else
+    __atomic_store_n(&trace_state, TRACE_OFF, __ATOMIC_RELEASE);
+}
+
+int asf_trace_enabled(void)
+{
+  int state = __atomic_load_n(&trace_state, __ATOMIC_ACQUIRE);
+
+  if (state == TRACE_UNKNOWN) {
+    pthread_once(&trace_once, init_tracing);
+    state = __atomic_load_n(&trace_state, __ATOMIC_ACQUIRE);
+  }
+  return state == TRACE_ON;
+}
+
+void asf_trace_start(const char *file)
+{
+  asf_trace_enabled();    // so ASF_TRACE can't switch it back on later
+  start_tracing(file);
+}
+
+static thread_spans_t *get_thread_spans(void)
+{
+  thread_spans_t *t = (thread_spans_t *) pthread_getspecific(thread_key);
+  if (!t) {
+    // Plain calloc(), as the key's destructor is free()
+    t = (thread_spans_t *) calloc(1, sizeof(thread_spans_t));
+    if (!t)
+      return NULL;
+    t->tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(thread_key, t);
+  }
+  return t;
+}
+
+void asf_trace_begin(const char *name)
+{
+  thread_spans_t *t;
+  span_t *s;
+  int i;
+
+  if (!asf_trace_enabled())
+    return;
+
+  t = get_thread_spans();
+  if (!t)
+    return;
+  if (t->depth < MAX_SPAN_DEPTH) {
+    s = &t->stack[t->depth];
+    s->name = name;
+    for (i = 0; i < ASF_NUM_COUNTERS; ++i)
+      s->count0[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    s->cpu0 = thread_cpu_time();
+    s->wall0 = monotonic_usec();
+  }
+  t->depth++;
+}
+
+static span_total_t *find_total(const char *name, int depth)
+{
+  int i;
+
+  for (i = 0; i < n_totals; ++i)
+    if (strcmp(totals[i].name, name) == 0)
+      return &totals[i];
+
+  if (n_totals == max_totals) {
+    int n = max_totals ? 2*max_totals : 32;
+    span_total_t *p = (span_total_t *) realloc(totals, sizeof(span_total_t)*n);
+    if (!p)
+      return NULL;
+    totals = p;
+    max_totals = n;
+  }
+  memset(&totals[n_totals], 0, sizeof(span_total_t));
+  totals[n_totals].name = name;
+  totals[n_totals].depth = depth;
+  return &totals[n_totals++];
+}
+
+// Room for one more event in the trace file.  Tracing is only a
+// diagnostic, so running out of memory just drops events.
+static int room_for_event(void)
+{
+  if (n_events == max_events) {
+    int n = max_events ? 2*max_events : 1024;
+    trace_event_t *p = (trace_event_t *) realloc(events,
+                                                 sizeof(trace_event_t)*n);
+    if (!p)
+      return FALSE;
+    events = p;
+    max_events = n;
+  }
+  return TRUE;
+}
+
+void asf_trace_end(void)
+{
+  thread_spans_t *t;
+  span_t *s;
+  span_total_t *total;
+  long long wall1, count[ASF_NUM_COUNTERS];
+  double cpu;
+  int i;
+
+  if (!asf_trace_enabled())
+    return;
+
+  t = get_thread_spans();
+  if (!t || t->depth == 0)
+    return;     // unbalanced, or tracing started inside this span
+  t->depth--;
+  if (t->depth >= MAX_SPAN_DEPTH)
+    return;
+
+  s = &t->stack[t->depth];
+  wall1 = monotonic_usec();
+  cpu = thread_cpu_time() - s->cpu0;
+  for (i = 0; i < ASF_NUM_COUNTERS; ++i)
+    count[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED) - s->count0[i];
+
+  pthread_mutex_lock(&trace_lock);
+  if (s->wall0 >= trace_t0) {
+    total = find_total(s->name, t->depth);
+    if (total) {
+      total->calls++;
+      total->wall += (wall1 - s->wall0)*1.0e-6;
+      total->cpu += cpu;
+      for (i = 0; i < ASF_NUM_COUNTERS; ++i)
+        total->counts[i] += count[i];
+    }
+
+    if (trace_file && n_events < MAX_TRACE_EVENTS && room_for_event()) {
+      trace_event_t *e = &events[n_events++];
+      e->name = s->name;
+      e->tid = t->tid;
+      e->start = s->wall0 - trace_t0;
+      e->dur = wall1 - s->wall0;
+      e->cpu = cpu;
+      for (i = 0; i < ASF_NUM_COUNTERS; ++i)
+        e->counts[i] = count[i];
+    }
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
+
+void asf_trace_count(asf_counter_t counter, long long n)
+{
+  if (!asf_trace_enabled())
+    return;
+
+  __atomic_add_fetch(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+long long asf_trace_counter(asf_counter_t counter)
+{
+  return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+static void write_json_string(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", *s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void write_trace_file(const char *file)
+{
+  FILE *fp = fopen(file, "w");
+  int i, j, pid = (int) getpid();
+
+  if (!fp) {
+    asfPrintWarning("Could not write trace file %s\n", file);
+    return;
+  }
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (i = 0; i < n_events; ++i) {
+    trace_event_t *e = &events[i];
+    fprintf(fp, "%s{\"name\":", i ? ",\n" : "");
+    write_json_string(fp, e->name);
+    fprintf(fp, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%lld,\"dur\":%lld,\"args\":{\"cpu_ms\":%.3f",
+            pid, e->tid, (long long)e->start, (long long)e->dur,
+            e->cpu*1000.0);
+    for (j = 0; j < ASF_NUM_COUNTERS; ++j)
+      fprintf(fp, ",\"%s\":%lld", counter_names[j], e->counts[j]);
+    fprintf(fp, "}}");
+  }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+
+  if (n_events == MAX_TRACE_EVENTS)
+    asfPrintWarning("Trace file %s only holds the first %d spans\n",
+                    file, MAX_TRACE_EVENTS);
+}
+
+static void print_summary(void)
+{
+  int i;
+
+  if (n_totals == 0)
+    return;
+
+  asfPrintStatus("\nTiming summary:\n"
+                 "   calls    wall (s)     cpu (s)   read (MB)  "
+                 "write (MB)   Mpixels  span\n");
+  for (i = 0; i < n_totals; ++i) {
+    span_total_t *t = &totals[i];
+    asfPrintStatus("%8d %11.3f %11.3f %11.1f %11.1f %9.1f  %*s%s\n",
+                   t->calls, t->wall, t->cpu,
+                   t->counts[ASF_COUNT_BYTES_READ]/1048576.0,
+                   t->counts[ASF_COUNT_BYTES_WRITTEN]/1048576.0,
+                   t->counts[ASF_COUNT_PIXELS]/1.0e6,
+                   2*t->depth, "", t->name);
+  }
+  asfPrintStatus("\n");
+}
+
+void asf_trace_stop(void)
+{
+  if (!asf_trace_enabled())
+    return;
+
+  pthread_mutex_lock(&trace_lock);
+  __atomic_store_n(&trace_state, TRACE_OFF, __ATOMIC_RELEASE);
+  print_summary();
+  if (trace_file) {
+    write_trace_file(trace_file);
+    FREE(trace_file);
+    trace_file = NULL;
+  }
+  pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,46 @@
+#include "CUnit/Basic.h"
+#include "asf.h"
+
+void test_trace()
+{
+  char *file = "test_trace.json";
+  char buf[4096];
+  FILE *fp;
+  size_t n;
+
+  asf_trace_start(file);
+  CU_ASSERT(asf_trace_enabled());
+
+  asf_trace_begin("outer");
+  asf_trace_count(ASF_COUNT_BYTES_READ, 100);
+  asf_trace_begin("inner");
+  asf_trace_count(ASF_COUNT_PIXELS, 25);
+  asf_trace_end();
+  asf_trace_count(ASF_COUNT_BYTES_WRITTEN, 40);
+  asf_trace_end();
+
+  CU_ASSERT(asf_trace_counter(ASF_COUNT_BYTES_READ) == 100);
+  CU_ASSERT(asf_trace_counter(ASF_COUNT_BYTES_WRITTEN) == 40);
+  CU_ASSERT(asf_trace_counter(ASF_COUNT_PIXELS) == 25);
+
+  asf_trace_stop();
+  CU_ASSERT(!asf_trace_enabled());
+
+  // counting is a no-op once tracing is off
+  asf_trace_count(ASF_COUNT_PIXELS, 1000);
+  CU_ASSERT(asf_trace_counter(ASF_COUNT_PIXELS) == 25);
+
+  fp = fopen(file, "r");
+  CU_ASSERT(fp != NULL);
+  if (fp) {
+    n = fread(buf, 1, sizeof(buf)-1, fp);
+    buf[n] = '\0';
+    fclose(fp);
+    CU_ASSERT(strstr(buf, "\"traceEvents\"") != NULL);
+    CU_ASSERT(strstr(buf, "\"name\":\"outer\"") != NULL);
+    CU_ASSERT(strstr(buf, "\"name\":\"inner\"") != NULL);
+    CU_ASSERT(strstr(buf, "\"bytes_read\":100") != NULL);
+    CU_ASSERT(strstr(buf, "\"pixels\":25") != NULL);
+  }
+  remove(file);
+}
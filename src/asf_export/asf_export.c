@@ -12,6 +12,7 @@ following defines.
 "   "ASF_NAME_STRING" [-format <output_format>] [-byte <sample mapping option>]\n"\
 "              [-rgb <red> <green> <blue>] [-band <band_id | all>]\n"\
 "              [-lut <look up table file>] [-truecolor] [-falsecolor]\n"\
+"              [-tile <size>] [-compression <deflate | zstd>]\n"\
 "              [-log <log_file>] [-quiet] [-license] [-version] [-help]\n"\
 "              <in_base_name> <out_full_name>\n"
 
@@ -34,6 +35,8 @@ following defines.
 "        Format to export to. Must be one of the following:\n"\
 "            tiff      - Tagged Image File Format, with byte valued pixels\n"\
 "            geotiff   - GeoTIFF file, with floating point or byte valued pixels\n"\
+"            cog       - Cloud Optimized GeoTIFF: a tiled GeoTIFF with\n"\
+"                        internal overviews, for web and GIS streaming\n"\
 "            jpeg      - Lossy compressed image, with byte valued pixels\n"\
 "            pgm       - Portable graymap image, with byte valued pixels\n"\
 "            png       - Portable network graphic, with byte valued pixels\n"\
@@ -146,6 +149,12 @@ following defines.
 "        specified rather than a band_id, then export all available bands into\n"\
 "        individual files, one for each band.  Default is '-band all'.\n"\
 "        Cannot be chosen together with the -rgb option.\n"\
+"   -tile <size>\n"\
+"        Tile size, in pixels, for Cloud Optimized GeoTIFF output.  Must be a\n"\
+"        multiple of 16.  Default is 512.\n"\
+"   -compression <deflate | zstd>\n"\
+"        Compression for Cloud Optimized GeoTIFF output.  Default is deflate.\n"\
+"        zstd requires a libtiff built with ZSTD support.\n"\
 "   -log <logFile>\n"\
 "        Output will be written to a specified log file.\n"\
 "   -quiet\n"\
@@ -300,7 +309,7 @@ main (int argc, char *argv[])
   command_line.use_pixel_is_point = 0;
 
   int formatFlag, logFlag, quietFlag, byteFlag, rgbFlag, bandFlag, lutFlag, pixelIsPointFlag;
-  int truecolorFlag, falsecolorFlag;
+  int truecolorFlag, falsecolorFlag, tileFlag, compressionFlag;
   int needed_args = 3;  //command & argument & argument
   int ii;
   char sample_mapping_string[25];
@@ -324,6 +333,8 @@ main (int argc, char *argv[])
   truecolorFlag = checkForOption("-truecolor", argc, argv);
   falsecolorFlag = checkForOption("-falsecolor", argc, argv);
   pixelIsPointFlag = checkForOption("-point", argc, argv);
+  tileFlag = checkForOption("-tile", argc, argv);
+  compressionFlag = checkForOption("-compression", argc, argv);
 
   if ( formatFlag != FLAG_NOT_SET ) {
     needed_args += 2;           // Option & parameter.
@@ -355,6 +366,12 @@ main (int argc, char *argv[])
   if ( pixelIsPointFlag != FLAG_NOT_SET ) {
     needed_args += 1;
   }
+  if ( tileFlag != FLAG_NOT_SET ) {
+    needed_args += 2;           // Option & parameter.
+  }
+  if ( compressionFlag != FLAG_NOT_SET ) {
+    needed_args += 2;           // Option & parameter.
+  }
   if ( argc != needed_args ) {
     print_usage ();                   // This exits with a failure.
   }
@@ -399,6 +416,16 @@ main (int argc, char *argv[])
       print_usage ();
     }
   }
+  if ( tileFlag != FLAG_NOT_SET ) {
+    if ( argv[tileFlag + 1][0] == '-' || tileFlag >= argc - 3 ) {
+      print_usage ();
+    }
+  }
+  if ( compressionFlag != FLAG_NOT_SET ) {
+    if ( argv[compressionFlag + 1][0] == '-' || compressionFlag >= argc - 3 ) {
+      print_usage ();
+    }
+  }
 
   // Make sure there are no flag incompatibilities
   if ( (rgbFlag != FLAG_NOT_SET           &&
@@ -509,7 +536,8 @@ main (int argc, char *argv[])
     {
       command_line.sample_mapping = SIGMA;
     }
-    else if (strcmp_case (command_line.format, "GEOTIFF") == 0) {
+    else if (strcmp_case (command_line.format, "GEOTIFF") == 0 ||
+             strcmp_case (command_line.format, "COG") == 0) {
       command_line.sample_mapping = NONE;
     }
 
@@ -760,6 +788,7 @@ main (int argc, char *argv[])
   }
 
   if (strcmp_case(command_line.format, "GEOTIFF") != 0 &&
+      strcmp_case(command_line.format, "COG") != 0 &&
       pixelIsPointFlag != FLAG_NOT_SET )
   {
     asfPrintWarning("-point option has no effect");
@@ -780,6 +809,9 @@ main (int argc, char *argv[])
             strcmp_case (command_line.format, "GEOTIF") == 0) {
     format = GEOTIFF;
   }
+  else if ( strcmp_case (command_line.format, "COG") == 0 ) {
+    format = COG;
+  }
   else if ( strcmp_case (command_line.format, "TIFF") == 0 ||
             strcmp_case (command_line.format, "TIF") == 0) {
     format = TIF;
@@ -816,6 +848,23 @@ main (int argc, char *argv[])
     asfPrintError("Unrecognized output format specified\n");
   }
 
+  if (tileFlag != FLAG_NOT_SET || compressionFlag != FLAG_NOT_SET) {
+    int tile_size = COG_DEFAULT_TILE_SIZE;
+    cog_compression_t compression = COG_DEFLATE;
+    if (format != COG)
+      asfPrintWarning("-tile and -compression only apply to COG output\n");
+    if (tileFlag != FLAG_NOT_SET)
+      tile_size = atoi(argv[tileFlag + 1]);
+    if (compressionFlag != FLAG_NOT_SET) {
+      if (strcmp_case(argv[compressionFlag + 1], "ZSTD") == 0)
+        compression = COG_ZSTD;
+      else if (strcmp_case(argv[compressionFlag + 1], "DEFLATE") != 0)
+        asfPrintError("Unrecognized compression: %s\n",
+                      argv[compressionFlag + 1]);
+    }
+    set_cog_options(tile_size, compression);
+  }
+
   /* Complex data generally can't be output into meaningful images, so
      we refuse to deal with it.  */
   /*
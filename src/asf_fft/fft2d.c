@@ -67,31 +67,59 @@ void fft2d(float *data, int M2, int M){
 /* M = log2 of fft size number of columns */
 /* OUTPUTS */
 /* *data = output data array	*/
+fft2d_work(data, M2, M, Array2d[M2]);
+}
+
+void ifft2d(float *data, int M2, int M){
+/* Compute 2D complex ifft and return results in-place	*/
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows */
+/* M = log2 of fft size number of columns */
+/* OUTPUTS */
+/* *data = output data array	*/
+ifft2d_work(data, M2, M, Array2d[M2]);
+}
+
+void fft2d_work(float *data, int M2, int M, float *work){
+/* Compute 2D complex fft and return results in-place, using the caller's	*/
+/* column storage instead of the private storage.  Only the (read-only)	*/
+/* cosine and bit reversed tables are shared, so several threads can	*/
+/* transform different arrays at once, each with its own work array.	*/
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows */
+/* M = log2 of fft size number of columns */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
+/* OUTPUTS */
+/* *data = output data array	*/
 int i1;
 if((M2>0)&&(M>0)){
 	ffts(data, M, POW2(M2));
 	if (M>2)
 		for (i1=0; i1<POW2(M); i1+=4){
-			cxpose(data + i1*2, POW2(M), Array2d[M2], POW2(M2), POW2(M2), 4);
-			ffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M), work, POW2(M2), POW2(M2), 4);
+			ffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
 		}
 	else{
-		cxpose(data, POW2(M), Array2d[M2], POW2(M2), POW2(M2), POW2(M));
-		ffts(Array2d[M2], M2, POW2(M));
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M), POW2(M), POW2(M2));
+		cxpose(data, POW2(M), work, POW2(M2), POW2(M2), POW2(M));
+		ffts(work, M2, POW2(M));
+		cxpose(work, POW2(M2), data, POW2(M), POW2(M), POW2(M2));
 	}
 }
 else
 	ffts(data, M2+M, 1);
 }
 
-void ifft2d(float *data, int M2, int M){
-/* Compute 2D complex ifft and return results in-place	*/
+void ifft2d_work(float *data, int M2, int M, float *work){
+/* Compute 2D complex ifft and return results in-place, using the caller's	*/
+/* column storage (see fft2d_work)	*/
 /* INPUTS */
 /* *data = input data array	*/
 /* M2 = log2 of fft size number of rows */
 /* M = log2 of fft size number of columns */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
 /* OUTPUTS */
 /* *data = output data array	*/
 int i1;
@@ -99,14 +127,14 @@ if((M2>0)&&(M>0)){
 	iffts(data, M, POW2(M2));
 	if (M>2)
 		for (i1=0; i1<POW2(M); i1+=4){
-			cxpose(data + i1*2, POW2(M), Array2d[M2], POW2(M2), POW2(M2), 4);
-			iffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M), work, POW2(M2), POW2(M2), 4);
+			iffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M), 4, POW2(M2));
 		}
 	else{
-		cxpose(data, POW2(M), Array2d[M2], POW2(M2), POW2(M2), POW2(M));
-		iffts(Array2d[M2], M2, POW2(M));
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M), POW2(M), POW2(M2));
+		cxpose(data, POW2(M), work, POW2(M2), POW2(M2), POW2(M));
+		iffts(work, M2, POW2(M));
+		cxpose(work, POW2(M2), data, POW2(M), POW2(M), POW2(M2));
 	}
 }
 else
@@ -267,38 +295,51 @@ void rfft2d(float *data, int M2, int M){
 /* M = log2 of fft size number of columns in */
 /* OUTPUTS */
 /* *data = output data array	*/
+rfft2d_work(data, M2, M, Array2d[M2]);
+}
+
+void rfft2d_work(float *data, int M2, int M, float *work){
+/* Compute 2D real fft and return results in-place, like rfft2d, but */
+/* using the caller's column storage (see fft2d_work). */
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows in */
+/* M = log2 of fft size number of columns in */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
+/* OUTPUTS */
+/* *data = output data array	*/
 int i1;
 if((M2>0)&&(M>0)){
 	rffts(data, M, POW2(M2));
 	if (M==1){
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(work+POW2(M2)*2, 2, work, POW2(M2), POW2(M2), 2);
+		rffts(work, M2, 2);
+		cxpose(work, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 	}
 	else if (M==2){
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(work+POW2(M2)*2, 2, work, POW2(M2), POW2(M2), 2);
+		rffts(work, M2, 2);
+		cxpose(work, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		ffts(Array2d[M2], M2, 1);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		ffts(work, M2, 1);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
 	}
 	else{
-		cxpose(data, POW2(M)/2, Array2d[M2]+POW2(M2)*2, POW2(M2), POW2(M2), 1);
-		xpose(Array2d[M2]+POW2(M2)*2, 2, Array2d[M2], POW2(M2), POW2(M2), 2);
-		rffts(Array2d[M2], M2, 2);
-		cxpose(Array2d[M2], POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work+POW2(M2)*2, POW2(M2), POW2(M2), 1);
+		xpose(work+POW2(M2)*2, 2, work, POW2(M2), POW2(M2), 2);
+		rffts(work, M2, 2);
+		cxpose(work, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 3);
-		ffts(Array2d[M2], M2, 3);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 3);
+		ffts(work, M2, 3);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
 		for (i1=4; i1<POW2(M)/2; i1+=4){
-			cxpose(data + i1*2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 4);
-			ffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M)/2, work, POW2(M2), POW2(M2), 4);
+			ffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
 		}
 	}
 }
@@ -315,37 +356,50 @@ void rifft2d(float *data, int M2, int M){
 /* M = log2 of fft size number of columns out */
 /* OUTPUTS */
 /* *data = output data array	*/
+rifft2d_work(data, M2, M, Array2d[M2]);
+}
+
+void rifft2d_work(float *data, int M2, int M, float *work){
+/* Compute 2D real ifft and return results in-place, like rifft2d, but */
+/* using the caller's column storage (see fft2d_work). */
+/* INPUTS */
+/* *data = input data array	*/
+/* M2 = log2 of fft size number of rows out */
+/* M = log2 of fft size number of columns out */
+/* *work = storage for FFT2D_WORK_SIZE(M2) floats */
+/* OUTPUTS */
+/* *data = output data array	*/
 int i1;
 if((M2>0)&&(M>0)){
 	if (M==1){
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2));
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		riffts(work, M2, 2);
+		xpose(work, POW2(M2), work+POW2(M2)*2, 2, 2, POW2(M2));
+		cxpose(work+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 	}
 	else if (M==2){
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2)); 
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		riffts(work, M2, 2);
+		xpose(work, POW2(M2), work+POW2(M2)*2, 2, 2, POW2(M2)); 
+		cxpose(work+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		iffts(Array2d[M2], M2, 1);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		iffts(work, M2, 1);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 1, POW2(M2));
 	}
 	else{
-		cxpose(data, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 1);
-		riffts(Array2d[M2], M2, 2);
-		xpose(Array2d[M2], POW2(M2), Array2d[M2]+POW2(M2)*2, 2, 2, POW2(M2));
-		cxpose(Array2d[M2]+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
+		cxpose(data, POW2(M)/2, work, POW2(M2), POW2(M2), 1);
+		riffts(work, M2, 2);
+		xpose(work, POW2(M2), work+POW2(M2)*2, 2, 2, POW2(M2));
+		cxpose(work+POW2(M2)*2, POW2(M2), data, POW2(M)/2, 1, POW2(M2));
 
-		cxpose(data + 2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 3);
-		iffts(Array2d[M2], M2, 3);
-		cxpose(Array2d[M2], POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
+		cxpose(data + 2, POW2(M)/2, work, POW2(M2), POW2(M2), 3);
+		iffts(work, M2, 3);
+		cxpose(work, POW2(M2), data + 2, POW2(M)/2, 3, POW2(M2));
 		for (i1=4; i1<POW2(M)/2; i1+=4){
-			cxpose(data + i1*2, POW2(M)/2, Array2d[M2], POW2(M2), POW2(M2), 4);
-			iffts(Array2d[M2], M2, 4);
-			cxpose(Array2d[M2], POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
+			cxpose(data + i1*2, POW2(M)/2, work, POW2(M2), POW2(M2), 4);
+			iffts(work, M2, 4);
+			cxpose(work, POW2(M2), data + i1*2, POW2(M)/2, 4, POW2(M2));
 		}
 	}
 	riffts(data, M, POW2(M2));
@@ -611,6 +611,17 @@ void ddr2meta(struct DDR *ddr, meta_parameters *meta);
 /* In meta_copy.c: Allocates new structure and fills it will values from src */
 meta_parameters *meta_copy(meta_parameters *src);
 
+/* In meta_cache.c: remembers parsed metadata between meta_read calls,
+   and reads/writes the optional binary ".metab" sidecar */
+meta_parameters *meta_cache_get(const char *meta_name);
+void meta_cache_put(const char *meta_name, meta_parameters *meta);
+void meta_cache_invalidate(const char *meta_name);
+void meta_cache_clear(void);
+meta_parameters *meta_cache_read_sidecar(const char *meta_name);
+void meta_write_sidecar(meta_parameters *meta, const char *file_name);
+void meta_cache_parsed(const char *meta_name, meta_parameters *meta);
+void meta_cache_written(meta_parameters *meta, const char *file_name);
+
 /* In meta_write.c */
 char *data_type2str(data_type_t data_type);
 char *image_data_type2str(image_data_type_t image_data_type);
@@ -1016,6 +1027,8 @@ float get_cal_dn(meta_parameters *meta, float incidence_angle, int sample,
 		 float inDn, char *bandExt, int dbFlag);
 float get_rad_cal_dn(meta_parameters *meta, int line, int sample, char *bandExt,
 		     float inDn, float radCorr);
+float get_rad_cal_dn_incid(meta_parameters *meta, double incid, int sample,
+			   char *bandExt, float inDn, float radCorr);
 float cal2amp(meta_parameters *meta, float incid, int sample, char *bandExt, 
 	      float calValue);
 quadratic_2d find_quadratic(const double *out, const double *x,
@@ -938,7 +938,20 @@ float get_rad_cal_dn(meta_parameters *meta, int line, int sample, char *bandExt,
     return 0.0;
 
   meta->general->radiometry = r_SIGMA;
-  double incid = meta_incid(meta, line, sample);
+  return get_rad_cal_dn_incid(meta, meta_incid(meta, line, sample), sample,
+			      bandExt, inDn, radCorr);
+}
+
+// Same as get_rad_cal_dn, for callers that already have the incidence
+// angle (in radians) for the pixel.  The metadata is only read, and its
+// radiometry must already be r_SIGMA, so this can be called from several
+// threads at once.
+float get_rad_cal_dn_incid(meta_parameters *meta, double incid, int sample,
+			   char *bandExt, float inDn, float radCorr)
+{
+  if (FLOAT_EQUIVALENT(inDn, 0.0))
+    return 0.0;
+
   double sigma = get_cal_dn(meta, incid, sample, inDn, bandExt, FALSE);
   double calValue=0, invIncAngle=1;
 
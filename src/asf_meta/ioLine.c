@@ -541,6 +541,7 @@ static int put_data_lines(FILE *file, meta_parameters *meta, int band_number,
       break;
   }
   samples_put = ASF_FWRITE(out_buffer, sample_size, num_samples_to_put, file);
+  asf_trace_count(ASF_COUNT_PIXELS, samples_put);
   FREE(out_buffer);
 
   if ( samples_put != num_samples_to_put ) {
@@ -11,4 +11,24 @@
 /* Maximum length of a file name to be handles by the parser.  */
 #define MAX_FILE_NAME 256
 
+#include <stdio.h>
+
+/* Lexer state for one parse, kept as the scanner's extra data.  */
+typedef struct {
+  int line_number;              /* Position in source file.  */
+
+  /* Flag true if we are looking a string of numbers that we want to
+     parser to interpret as a string pointer, not a double.  */
+  int looking_at_numeric_string;
+} meta_lex_state;
+
+/* Parser state for one parse (see metadata_parser.y).  */
+typedef struct meta_parse_context_struct meta_parse_context;
+
+/* The reentrant lexer interface used by the parser (scanners are void *,
+   as flex's yyscan_t).  */
+int meta_yylex_init_extra(meta_lex_state *extra, void **scanner);
+void meta_yyset_in(FILE *in, void *scanner);
+int meta_yylex_destroy(void *scanner);
+
 #endif /* not __LEX_YACC__ */
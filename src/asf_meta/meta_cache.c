@@ -0,0 +1,558 @@
+/****************************************************************
+ * meta_cache.c: keeps parsed metadata around between meta_read calls.
+ *
+ * Parsing a .meta file is slow compared to everything else meta_read
+ * does, and many tools read the same few metadata files over and over
+ * (once per band, once per grid point, ...).  So the parsed structure
+ * is remembered, keyed on the name of the .meta file, and handed out
+ * again -- as a fresh copy, since callers are free to change and
+ * meta_free what they get -- as long as the file's size, modification
+ * time, device and inode still match (so a file renamed over it within
+ * the same second is noticed), and so do those of the .ddr file next to
+ * it, which meta_read also uses for old style metadata.  meta_write
+ * drops the entry of any file it writes.
+ *
+ * Optionally, the parsed structure is also saved next to the .meta file
+ * as a binary ".metab" sidecar, which meta_read can load without
+ * parsing.  The sidecar records the same stamp of the .meta (and .ddr)
+ * file it was made from and is ignored if that has changed, or if it was
+ * written by a build with a different structure layout.  Sidecars are
+ * only written when the ASF_META_SIDECAR environment variable is set to
+ * something other than "0".  ASF_META_CACHE=0 turns the cache off.
+ */
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+
+#define META_CACHE_MAX_ENTRIES 64
+#define META_CACHE_BUCKETS 64
+
+#define METAB_MAGIC "ASFMETAB"
+#define METAB_VERSION 2
+
+typedef struct {
+  long long size;
+  long long mtime;     // seconds
+  long mtime_nsec;
+  long long dev, ino;
+} file_id;
+
+typedef struct {
+  file_id meta;        // the .meta file
+  file_id ddr;         // the .ddr file next to it; all zero if none
+} file_stamp;
+
+typedef struct cache_entry {
+  char *meta_name;
+  file_stamp stamp;
+  meta_parameters *meta;
+  struct cache_entry *next;   // next entry in the same bucket
+} cache_entry;
+
+// A small chained hash table, keyed on the .meta file name.  When it
+// holds META_CACHE_MAX_ENTRIES entries it is emptied and starts over.
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry *cache[META_CACHE_BUCKETS];
+static int cache_count = 0;
+
+static int env_flag(const char *name, int def)
+{
+  const char *s = getenv(name);
+  if (!s || !*s)
+    return def;
+  return strcmp(s, "0") != 0;
+}
+
+static int cache_enabled(void)
+{
+  static int enabled = -1;
+  if (enabled < 0)
+    enabled = env_flag("ASF_META_CACHE", TRUE);
+  return enabled;
+}
+
+static int sidecar_enabled(void)
+{
+  static int enabled = -1;
+  if (enabled < 0)
+    enabled = env_flag("ASF_META_SIDECAR", FALSE);
+  return enabled;
+}
+
+static int get_file_id(const char *file, file_id *id)
+{
+  struct stat st;
+  memset(id, 0, sizeof(file_id));
+  if (stat(file, &st) != 0)
+    return FALSE;
+  id->size = st.st_size;
+  id->mtime = st.st_mtime;
+#if defined(__linux__)
+  id->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+  id->dev = st.st_dev;
+  id->ino = st.st_ino;
+  return TRUE;
+}
+
+static int same_file_id(const file_id *a, const file_id *b)
+{
+  return a->size == b->size && a->mtime == b->mtime &&
+    a->mtime_nsec == b->mtime_nsec && a->dev == b->dev && a->ino == b->ino;
+}
+
+static int get_stamp(const char *meta_name, file_stamp *stamp)
+{
+  char *ddr_name;
+
+  if (!get_file_id(meta_name, &stamp->meta))
+    return FALSE;
+  ddr_name = appendExt(meta_name, ".ddr");
+  get_file_id(ddr_name, &stamp->ddr);
+  FREE(ddr_name);
+  return TRUE;
+}
+
+static int same_stamp(const file_stamp *a, const file_stamp *b)
+{
+  return same_file_id(&a->meta, &b->meta) && same_file_id(&a->ddr, &b->ddr);
+}
+
+static void free_entry(cache_entry *e)
+{
+  meta_free(e->meta);
+  FREE(e->meta_name);
+  FREE(e);
+}
+
+static unsigned int hash_name(const char *name)
+{
+  unsigned int h = 5381;
+  while (*name)
+    h = h*33 + (unsigned char)*name++;
+  return h % META_CACHE_BUCKETS;
+}
+
+/* Returns the link pointing at the entry for meta_name -- or the NULL at
+   the end of its bucket if there isn't one.  Call with cache_lock held. */
+static cache_entry **find_entry(const char *meta_name)
+{
+  cache_entry **link = &cache[hash_name(meta_name)];
+  while (*link && strcmp((*link)->meta_name, meta_name) != 0)
+    link = &(*link)->next;
+  return link;
+}
+
+/* Unlink and free the entry *link points at.  Call with cache_lock held. */
+static void remove_entry(cache_entry **link)
+{
+  cache_entry *e = *link;
+  *link = e->next;
+  free_entry(e);
+  --cache_count;
+}
+
+/* Call with cache_lock held. */
+static void remove_all_entries(void)
+{
+  int ii;
+  for (ii=0; ii<META_CACHE_BUCKETS; ii++)
+    while (cache[ii])
+      remove_entry(&cache[ii]);
+}
+
+/* Return a copy of the cached metadata for the given .meta file, or NULL
+   if it isn't cached or the file has changed since. */
+meta_parameters *meta_cache_get(const char *meta_name)
+{
+  meta_parameters *ret = NULL;
+  file_stamp stamp;
+
+  if (!cache_enabled() || !get_stamp(meta_name, &stamp))
+    return NULL;
+
+  pthread_mutex_lock(&cache_lock);
+  {
+    cache_entry **link = find_entry(meta_name);
+    if (*link && same_stamp(&(*link)->stamp, &stamp))
+      ret = meta_copy((*link)->meta);
+    else if (*link)
+      remove_entry(link);
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  return ret;
+}
+
+/* Remember (a copy of) the metadata just read from the given .meta file */
+void meta_cache_put(const char *meta_name, meta_parameters *meta)
+{
+  cache_entry *e, **link;
+  file_stamp stamp;
+
+  if (!cache_enabled() || !get_stamp(meta_name, &stamp))
+    return;
+
+  e = (cache_entry *) MALLOC(sizeof(cache_entry));
+  e->meta_name = STRDUP(meta_name);
+  e->stamp = stamp;
+  e->meta = meta_copy(meta);
+
+  pthread_mutex_lock(&cache_lock);
+  link = find_entry(meta_name);
+  if (*link)
+    remove_entry(link);
+  else if (cache_count >= META_CACHE_MAX_ENTRIES)
+    remove_all_entries();
+  link = &cache[hash_name(meta_name)];
+  e->next = *link;
+  *link = e;
+  ++cache_count;
+  pthread_mutex_unlock(&cache_lock);
+}
+
+/* Forget anything cached for the given .meta file */
+void meta_cache_invalidate(const char *meta_name)
+{
+  cache_entry **link;
+
+  pthread_mutex_lock(&cache_lock);
+  link = find_entry(meta_name);
+  if (*link)
+    remove_entry(link);
+  pthread_mutex_unlock(&cache_lock);
+}
+
+/* Forget everything */
+void meta_cache_clear(void)
+{
+  pthread_mutex_lock(&cache_lock);
+  remove_all_entries();
+  pthread_mutex_unlock(&cache_lock);
+}
+
+/***************************************************************
+ * The .metab sidecar.
+ *
+ * After the header, each block of the meta structure is written as a
+ * byte count followed by the raw bytes of the structure (a count of 0
+ * means the block is NULL).  Blocks that hold pointers are followed by
+ * the blocks they point to, so the raw pointer values read back are
+ * never used.  Since the raw structures are written, the header carries
+ * the sizes of all of them; a sidecar from a build where any of them
+ * differ is not used.
+ */
+
+typedef struct {
+  char magic[8];
+  int version;
+  int endian_check;
+  int layout[24];
+  file_stamp stamp;
+} metab_header;
+
+static void get_layout(int *layout)
+{
+  memset(layout, 0, sizeof(int)*24);
+  layout[0] = sizeof(meta_parameters);
+  layout[1] = sizeof(meta_general);
+  layout[2] = sizeof(meta_sar);
+  layout[3] = sizeof(meta_optical);
+  layout[4] = sizeof(meta_thermal);
+  layout[5] = sizeof(meta_projection);
+  layout[6] = sizeof(meta_transform);
+  layout[7] = sizeof(meta_airsar);
+  layout[8] = sizeof(meta_uavsar);
+  layout[9] = sizeof(meta_statistics);
+  layout[10] = sizeof(meta_state_vectors);
+  layout[11] = sizeof(meta_location);
+  layout[12] = sizeof(meta_calibration);
+  layout[13] = sizeof(meta_colormap);
+  layout[14] = sizeof(meta_doppler);
+  layout[15] = sizeof(meta_insar);
+  layout[16] = sizeof(meta_dem);
+  layout[17] = sizeof(meta_quality);
+  layout[18] = sizeof(asf_cal_params);
+  layout[19] = sizeof(asf_scansar_cal_params) + sizeof(esa_cal_params);
+  layout[20] = sizeof(rsat_cal_params) + sizeof(alos_cal_params);
+  layout[21] = sizeof(tsx_cal_params) + sizeof(r2_cal_params);
+  layout[22] = sizeof(uavsar_cal_params) + sizeof(sentinel_cal_params);
+  layout[23] = sizeof(tsx_doppler_params) + sizeof(tsx_doppler_t) +
+    sizeof(radarsat2_doppler_params);
+}
+
+static void put_block(FILE *fp, const void *p, int size)
+{
+  int n = p ? size : 0;
+  ASF_FWRITE(&n, sizeof(int), 1, fp);
+  if (n > 0)
+    ASF_FWRITE(p, 1, n, fp);
+}
+
+/* Read a block written by put_block; returns NULL for a NULL block, and
+   sets *ok to FALSE if the file ends early or the block isn't the
+   expected size (when expected >= 0). */
+static void *get_block(FILE *fp, int expected, int *ok)
+{
+  int n;
+  void *p;
+
+  if (!*ok || fread(&n, sizeof(int), 1, fp) != 1 || n < 0 ||
+      (expected >= 0 && n != 0 && n != expected)) {
+    *ok = FALSE;
+    return NULL;
+  }
+  if (n == 0)
+    return NULL;
+  p = MALLOC(n);
+  if (fread(p, 1, n, fp) != (size_t)n) {
+    FREE(p);
+    *ok = FALSE;
+    return NULL;
+  }
+  return p;
+}
+
+static int stats_size(const meta_statistics *stats)
+{
+  return sizeof(meta_statistics) + stats->band_count*sizeof(meta_stats);
+}
+
+static int state_vectors_size(const meta_state_vectors *sv)
+{
+  return sizeof(meta_state_vectors) + sv->vector_count*sizeof(state_loc);
+}
+
+/* Write the sidecar for the given metadata, which matches the current
+   contents of meta_name. */
+static void write_sidecar(meta_parameters *meta, const char *meta_name,
+                          const char *metab_name)
+{
+  metab_header h;
+  FILE *fp;
+  int ii;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, METAB_MAGIC, 8);
+  h.version = METAB_VERSION;
+  h.endian_check = 1;
+  get_layout(h.layout);
+  if (!get_stamp(meta_name, &h.stamp))
+    return;
+
+  // Quietly give up if we can't write next to the .meta file
+  fp = fopen(metab_name, "wb");
+  if (!fp)
+    return;
+
+  ASF_FWRITE(&h, sizeof(h), 1, fp);
+  put_block(fp, &meta->meta_version, sizeof(meta->meta_version));
+  put_block(fp, meta->general, sizeof(meta_general));
+  put_block(fp, meta->sar, sizeof(meta_sar));
+  put_block(fp, meta->optical, sizeof(meta_optical));
+  put_block(fp, meta->thermal, sizeof(meta_thermal));
+  put_block(fp, meta->projection, sizeof(meta_projection));
+  put_block(fp, meta->transform, sizeof(meta_transform));
+  put_block(fp, meta->airsar, sizeof(meta_airsar));
+  put_block(fp, meta->uavsar, sizeof(meta_uavsar));
+  put_block(fp, meta->stats, meta->stats ? stats_size(meta->stats) : 0);
+  put_block(fp, meta->state_vectors,
+            meta->state_vectors ? state_vectors_size(meta->state_vectors) : 0);
+  put_block(fp, meta->location, sizeof(meta_location));
+  put_block(fp, meta->insar, sizeof(meta_insar));
+  put_block(fp, meta->dem, sizeof(meta_dem));
+  put_block(fp, meta->quality, sizeof(meta_quality));
+
+  put_block(fp, meta->calibration, sizeof(meta_calibration));
+  if (meta->calibration) {
+    meta_calibration *cal = meta->calibration;
+    put_block(fp, cal->asf, sizeof(asf_cal_params));
+    put_block(fp, cal->asf_scansar, sizeof(asf_scansar_cal_params));
+    put_block(fp, cal->esa, sizeof(esa_cal_params));
+    put_block(fp, cal->rsat, sizeof(rsat_cal_params));
+    put_block(fp, cal->alos, sizeof(alos_cal_params));
+    put_block(fp, cal->tsx, sizeof(tsx_cal_params));
+    put_block(fp, cal->r2, sizeof(r2_cal_params));
+    put_block(fp, cal->uavsar, sizeof(uavsar_cal_params));
+    put_block(fp, cal->sentinel, sizeof(sentinel_cal_params));
+  }
+
+  put_block(fp, meta->colormap, sizeof(meta_colormap));
+  if (meta->colormap)
+    put_block(fp, meta->colormap->rgb,
+              sizeof(meta_rgb)*meta->colormap->num_elements);
+
+  put_block(fp, meta->doppler, sizeof(meta_doppler));
+  if (meta->doppler) {
+    tsx_doppler_params *tsx = meta->doppler->tsx;
+    radarsat2_doppler_params *r2 = meta->doppler->r2;
+    put_block(fp, tsx, sizeof(tsx_doppler_params));
+    if (tsx) {
+      put_block(fp, tsx->dop, sizeof(tsx_doppler_t)*tsx->doppler_count);
+      for (ii=0; ii<tsx->doppler_count; ii++)
+        put_block(fp, tsx->dop[ii].coefficient,
+                  sizeof(double)*(tsx->dop[ii].poly_degree+1));
+    }
+    put_block(fp, r2, sizeof(radarsat2_doppler_params));
+    if (r2) {
+      put_block(fp, r2->centroid, sizeof(double)*r2->doppler_count);
+      put_block(fp, r2->rate, sizeof(double)*r2->doppler_count);
+    }
+  }
+
+  FCLOSE(fp);
+}
+
+/* Load the sidecar for meta_name, if there is an up to date one.
+   Returns NULL otherwise. */
+static meta_parameters *read_sidecar(const char *meta_name,
+                                     const char *metab_name)
+{
+  metab_header h;
+  int layout[24];
+  file_stamp stamp;
+  meta_parameters *meta;
+  FILE *fp;
+  double *version;
+  int ok = TRUE, ii;
+
+  if (!get_stamp(meta_name, &stamp))
+    return NULL;
+  fp = fopen(metab_name, "rb");
+  if (!fp)
+    return NULL;
+
+  get_layout(layout);
+  if (fread(&h, sizeof(h), 1, fp) != 1 ||
+      memcmp(h.magic, METAB_MAGIC, 8) != 0 ||
+      h.version != METAB_VERSION || h.endian_check != 1 ||
+      memcmp(h.layout, layout, sizeof(layout)) != 0 ||
+      !same_stamp(&h.stamp, &stamp)) {
+    FCLOSE(fp);
+    return NULL;
+  }
+
+  meta = raw_init();
+  FREE(meta->general);
+  version = get_block(fp, sizeof(meta->meta_version), &ok);
+  if (version) {
+    meta->meta_version = *version;
+    FREE(version);
+  }
+  meta->general = get_block(fp, sizeof(meta_general), &ok);
+  meta->sar = get_block(fp, sizeof(meta_sar), &ok);
+  meta->optical = get_block(fp, sizeof(meta_optical), &ok);
+  meta->thermal = get_block(fp, sizeof(meta_thermal), &ok);
+  meta->projection = get_block(fp, sizeof(meta_projection), &ok);
+  meta->transform = get_block(fp, sizeof(meta_transform), &ok);
+  meta->airsar = get_block(fp, sizeof(meta_airsar), &ok);
+  meta->uavsar = get_block(fp, sizeof(meta_uavsar), &ok);
+  meta->stats = get_block(fp, -1, &ok);
+  meta->state_vectors = get_block(fp, -1, &ok);
+  meta->location = get_block(fp, sizeof(meta_location), &ok);
+  meta->insar = get_block(fp, sizeof(meta_insar), &ok);
+  meta->dem = get_block(fp, sizeof(meta_dem), &ok);
+  meta->quality = get_block(fp, sizeof(meta_quality), &ok);
+
+  meta->calibration = get_block(fp, sizeof(meta_calibration), &ok);
+  if (meta->calibration) {
+    meta_calibration *cal = meta->calibration;
+    cal->asf = get_block(fp, sizeof(asf_cal_params), &ok);
+    cal->asf_scansar = get_block(fp, sizeof(asf_scansar_cal_params), &ok);
+    cal->esa = get_block(fp, sizeof(esa_cal_params), &ok);
+    cal->rsat = get_block(fp, sizeof(rsat_cal_params), &ok);
+    cal->alos = get_block(fp, sizeof(alos_cal_params), &ok);
+    cal->tsx = get_block(fp, sizeof(tsx_cal_params), &ok);
+    cal->r2 = get_block(fp, sizeof(r2_cal_params), &ok);
+    cal->uavsar = get_block(fp, sizeof(uavsar_cal_params), &ok);
+    cal->sentinel = get_block(fp, sizeof(sentinel_cal_params), &ok);
+  }
+
+  meta->colormap = get_block(fp, sizeof(meta_colormap), &ok);
+  if (meta->colormap)
+    meta->colormap->rgb = get_block(fp, -1, &ok);
+
+  meta->doppler = get_block(fp, sizeof(meta_doppler), &ok);
+  if (meta->doppler) {
+    tsx_doppler_params *tsx;
+    radarsat2_doppler_params *r2;
+    tsx = meta->doppler->tsx =
+      get_block(fp, sizeof(tsx_doppler_params), &ok);
+    if (tsx) {
+      tsx->dop = get_block(fp, -1, &ok);
+      for (ii=0; ii<tsx->doppler_count; ii++) {
+        if (ok)
+          tsx->dop[ii].coefficient = get_block(fp, -1, &ok);
+        else if (tsx->dop)
+          tsx->dop[ii].coefficient = NULL;
+      }
+      if (!tsx->dop)
+        tsx->doppler_count = 0;
+    }
+    r2 = meta->doppler->r2 =
+      get_block(fp, sizeof(radarsat2_doppler_params), &ok);
+    if (r2) {
+      r2->centroid = get_block(fp, -1, &ok);
+      r2->rate = get_block(fp, -1, &ok);
+    }
+  }
+  FCLOSE(fp);
+
+  if (!ok || !meta->general) {
+    // Truncated or otherwise damaged; meta_free copes with the NULLs
+    meta_free(meta);
+    return NULL;
+  }
+  return meta;
+}
+
+/* Write the sidecar for the given (base) file name, whose .meta file must
+   already hold this metadata.  meta_read and meta_write do this on their
+   own when ASF_META_SIDECAR is set. */
+void meta_write_sidecar(meta_parameters *meta, const char *file_name)
+{
+  char *meta_name = appendExt(file_name, ".meta");
+  char *metab_name = appendExt(file_name, ".metab");
+  write_sidecar(meta, meta_name, metab_name);
+  FREE(metab_name);
+  FREE(meta_name);
+}
+
+/* Called by meta_read for a .meta file it had to read.  Returns the
+   metadata from the sidecar if there is a usable one, NULL if not. */
+meta_parameters *meta_cache_read_sidecar(const char *meta_name)
+{
+  char *metab_name = appendExt(meta_name, ".metab");
+  meta_parameters *meta = read_sidecar(meta_name, metab_name);
+  FREE(metab_name);
+  return meta;
+}
+
+/* Called by meta_read after parsing a .meta file */
+void meta_cache_parsed(const char *meta_name, meta_parameters *meta)
+{
+  if (sidecar_enabled()) {
+    char *metab_name = appendExt(meta_name, ".metab");
+    write_sidecar(meta, meta_name, metab_name);
+    FREE(metab_name);
+  }
+}
+
+/* Called by meta_write once the .meta file is written: the cache entry
+   and any sidecar for it are now out of date. */
+void meta_cache_written(meta_parameters *meta, const char *file_name)
+{
+  char *meta_name = appendExt(file_name, ".meta");
+  char *metab_name = appendExt(file_name, ".metab");
+
+  meta_cache_invalidate(meta_name);
+  if (sidecar_enabled())
+    write_sidecar(meta, meta_name, metab_name);
+  else if (fileExists(metab_name))
+    remove(metab_name);
+
+  FREE(metab_name);
+  FREE(meta_name);
+}
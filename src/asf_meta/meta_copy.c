@@ -40,8 +40,10 @@ meta_parameters *meta_copy(meta_parameters *src)
     ret->state_vectors = NULL;
 
   if (src->stats) {
-    if (!ret->stats) ret->stats = meta_statistics_init(src->stats->band_count);
-    memcpy(ret->stats, src->stats, sizeof(meta_stats));
+    int band_count = src->stats->band_count;
+    ret->stats = meta_statistics_init(band_count);
+    memcpy(ret->stats, src->stats,
+           sizeof(meta_statistics) + band_count*sizeof(meta_stats));
   } else
     ret->stats = NULL;
 
@@ -126,6 +128,16 @@ meta_parameters *meta_copy(meta_parameters *src)
       memcpy(ret->calibration->uavsar, src->calibration->uavsar,
 	     sizeof(uavsar_cal_params));
     }
+    if(src->calibration->r2) {
+      ret->calibration->r2 = (r2_cal_params *) MALLOC(sizeof(r2_cal_params));
+      memcpy(ret->calibration->r2, src->calibration->r2, sizeof(r2_cal_params));
+    }
+    if(src->calibration->sentinel) {
+      ret->calibration->sentinel =
+	(sentinel_cal_params *) MALLOC(sizeof(sentinel_cal_params));
+      memcpy(ret->calibration->sentinel, src->calibration->sentinel,
+	     sizeof(sentinel_cal_params));
+    }
   } else
     ret->calibration = NULL;
 
@@ -143,6 +155,53 @@ meta_parameters *meta_copy(meta_parameters *src)
     memcpy(ret->colormap->rgb, src->colormap->rgb, sz);
   }
 
+  if (src->doppler) {
+    ret->doppler = meta_doppler_init();
+    memcpy(ret->doppler, src->doppler, sizeof(meta_doppler));
+    if (src->doppler->tsx) {
+      tsx_doppler_params *tsx = src->doppler->tsx;
+      int ii;
+      ret->doppler->tsx =
+        (tsx_doppler_params *) MALLOC(sizeof(tsx_doppler_params));
+      memcpy(ret->doppler->tsx, tsx, sizeof(tsx_doppler_params));
+      ret->doppler->tsx->dop =
+        (tsx_doppler_t *) MALLOC(sizeof(tsx_doppler_t)*tsx->doppler_count);
+      memcpy(ret->doppler->tsx->dop, tsx->dop,
+             sizeof(tsx_doppler_t)*tsx->doppler_count);
+      for (ii=0; ii<tsx->doppler_count; ii++) {
+        size_t sz = sizeof(double)*(tsx->dop[ii].poly_degree+1);
+        ret->doppler->tsx->dop[ii].coefficient = (double *) MALLOC(sz);
+        memcpy(ret->doppler->tsx->dop[ii].coefficient,
+               tsx->dop[ii].coefficient, sz);
+      }
+    }
+    if (src->doppler->r2) {
+      radarsat2_doppler_params *r2 = src->doppler->r2;
+      size_t sz = sizeof(double)*r2->doppler_count;
+      ret->doppler->r2 = (radarsat2_doppler_params *)
+        MALLOC(sizeof(radarsat2_doppler_params));
+      memcpy(ret->doppler->r2, r2, sizeof(radarsat2_doppler_params));
+      ret->doppler->r2->centroid = (double *) MALLOC(sz);
+      memcpy(ret->doppler->r2->centroid, r2->centroid, sz);
+      ret->doppler->r2->rate = (double *) MALLOC(sz);
+      memcpy(ret->doppler->r2->rate, r2->rate, sz);
+    }
+  }
+
+  if (src->latlon) {
+    int line_count = src->general->line_count;
+    int sample_count = src->general->sample_count;
+    size_t sz = sizeof(float)*line_count*sample_count;
+    ret->latlon = meta_latlon_init(line_count, sample_count);
+    memcpy(ret->latlon->lat, src->latlon->lat, sz);
+    memcpy(ret->latlon->lon, src->latlon->lon, sz);
+  }
+
+  if (src->quality) {
+    ret->quality = meta_quality_init();
+    memcpy(ret->quality, src->quality, sizeof(meta_quality));
+  }
+
 /* Copy Depricated structures
   memcpy(ret->geo, src->geo, sizeof(geo_parameters));
   memcpy(ret->ifm, src->ifm, sizeof(ifm_parameters));
@@ -212,6 +212,7 @@ meta_calibration *meta_calibration_init(void)
   cal->rsat = NULL;
   cal->alos = NULL;
   cal->tsx = NULL;
+  cal->r2 = NULL;
   cal->uavsar = NULL;
   cal->sentinel = NULL;
   return cal;
@@ -222,6 +223,7 @@ meta_doppler *meta_doppler_init(void)
   meta_doppler *dop = (meta_doppler *) MALLOC(sizeof(meta_doppler));
   dop->type = unknown_doppler;
   dop->tsx = NULL;
+  dop->r2 = NULL;
 
   return dop;
 }
@@ -632,6 +634,12 @@ void meta_free(meta_parameters *meta)
       FREE(meta->doppler->tsx);
       meta->doppler->tsx = NULL;
     }
+    if (meta->doppler && meta->doppler->r2) {
+      FREE(meta->doppler->r2->centroid);
+      FREE(meta->doppler->r2->rate);
+      FREE(meta->doppler->r2);
+      meta->doppler->r2 = NULL;
+    }
     FREE(meta->doppler);
     meta->doppler = NULL;
     if (meta->calibration) {
@@ -641,6 +649,7 @@ void meta_free(meta_parameters *meta)
       FREE(meta->calibration->asf);
       FREE(meta->calibration->asf_scansar);
       FREE(meta->calibration->tsx);
+      FREE(meta->calibration->r2);
       FREE(meta->calibration->uavsar);
       FREE(meta->calibration->sentinel);
       FREE(meta->calibration);
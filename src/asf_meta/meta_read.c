@@ -69,11 +69,27 @@ meta_parameters *meta_read(const char *inName)
      meta_name, ddr_name);*/
   }
   else if ( fileExists(meta_name) ) {
-    if ( !meta_is_new_style(meta_name) ) {
-      meta_read_old(meta, meta_name);
+    // Parsing is slow, so use the result of an earlier parse if the file
+    // hasn't changed since (see meta_cache.c)
+    meta_parameters *cached = meta_cache_get(meta_name);
+    if (!cached) {
+      cached = meta_cache_read_sidecar(meta_name);
+      if (cached)
+        meta_cache_put(meta_name, cached);
+    }
+    if (cached) {
+      meta_free(meta);
+      meta = cached;
     }
     else {
-      parse_metadata(meta, meta_name);
+      if ( !meta_is_new_style(meta_name) ) {
+        meta_read_old(meta, meta_name);
+      }
+      else {
+        parse_metadata(meta, meta_name);
+      }
+      meta_cache_put(meta_name, meta);
+      meta_cache_parsed(meta_name, meta);
     }
   }
   // Generate metadata if CEOS files could be detected
@@ -1,5 +1,6 @@
 #include "CUnit/Basic.h"
 #include "asf_meta.h"
+#include <utime.h>
 
 int is_valid_ll2s_transform(meta_parameters *meta);
 
@@ -208,10 +209,76 @@ static void test_meta(const char *meta_file, test_function *test_fn)
   meta_free(mc);
 }
 
+static void test_cached(const char *meta_file, test_function *test_fn)
+{
+  // Every read hands out its own copy, even when it came from the cache
+  meta_parameters *meta = meta_read(meta_file);
+  meta->general->orbit = -1;
+  strcpy(meta->general->sensor, "changed");
+  meta_free(meta);
+  meta = meta_read(meta_file);
+  test_fn(meta);
+
+  // Writing a file drops whatever was cached for it
+  meta_write(meta, "tmp.meta");
+  meta_free(meta);
+  meta = meta_read("tmp.meta");
+  meta->general->orbit = 12345;
+  meta_write(meta, "tmp.meta");
+  meta_free(meta);
+  meta = meta_read("tmp.meta");
+  CU_ASSERT(meta->general->orbit == 12345);
+
+  // The binary sidecar gives back the same thing as the .meta it was
+  // made from, and is ignored once that .meta changes
+  meta_free(meta);
+  meta = meta_read(meta_file);
+  meta_write(meta, "tmp.meta");
+  meta_write_sidecar(meta, "tmp");
+  meta_free(meta);
+  meta_cache_clear();
+  meta = meta_cache_read_sidecar("tmp.meta");
+  CU_ASSERT(meta!=NULL);
+  if (meta) {
+    test_fn(meta);
+    meta->general->orbit = 54321;
+    meta_write(meta, "tmp.meta");
+    meta_free(meta);
+  }
+  CU_ASSERT(!fileExists("tmp.metab"));
+  meta = meta_read("tmp.meta");
+  CU_ASSERT(meta->general->orbit == 54321);
+  meta_free(meta);
+
+  // A file renamed over the .meta is noticed, even with the same size
+  // and modification time
+  struct utimbuf times = { 1000000000, 1000000000 };
+  meta = meta_read(meta_file);
+  meta->general->orbit = 11111;
+  meta_write(meta, "tmp.meta");
+  meta->general->orbit = 22222;
+  meta_write(meta, "tmp2.meta");
+  meta_free(meta);
+  utime("tmp.meta", &times);
+  utime("tmp2.meta", &times);
+  meta = meta_read("tmp.meta");
+  CU_ASSERT(meta->general->orbit == 11111);
+  meta_free(meta);
+  rename("tmp2.meta", "tmp.meta");
+  meta = meta_read("tmp.meta");
+  CU_ASSERT(meta->general->orbit == 22222);
+  meta_free(meta);
+
+  unlink("tmp.meta");
+  unlink("tmp.metab");
+}
+
 static void test_ers1()
 {
   test_meta("test_input/ers1.meta", test_ers1_values);
   test_meta("test_input/palsar_fbd.meta", test_palsar_fbd_values);
+  test_cached("test_input/ers1.meta", test_ers1_values);
+  test_cached("test_input/palsar_fbd.meta", test_palsar_fbd_values);
 }
 
 void test_meta_read()
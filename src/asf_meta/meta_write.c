@@ -1288,6 +1288,7 @@ void meta_write(meta_parameters *meta, const char *file_name)
   }
 
   FCLOSE(fp);
+  meta_cache_written(meta, file_name);
 
   return;
 }
@@ -1474,6 +1475,7 @@ void meta_write_old(meta_parameters *meta, const char *file_name)
   meta_put_string(fp,"}","","end extra");
 
   FCLOSE(fp);
+  meta_cache_written(meta, file_name);
 
   return;
 }
@@ -21,9 +21,6 @@
 
 extern report_level_t level; // default: WARNING
 
-/* Lex provides this parser function.  */
-int yylex(void);
-
 /* Node type for stack of pointers to structure subelements.  */
 typedef struct block_stack_node_struct {
   char block_name[MAX_SYMBOL_STRING + 1]; /* Name of block.  */
@@ -31,11 +28,33 @@ typedef struct block_stack_node_struct {
   struct block_stack_node_struct *next;
 } block_stack_node;
 
-/* Top of the push down stack.  */
-block_stack_node *stack_top;
+/* Everything the parser needs to remember while reading one file.  Each
+   call to parse_metadata() has its own, so several files can be parsed
+   at once.  */
+struct meta_parse_context_struct {
+  meta_parameters *meta;        /* Meta structure getting read in.  */
+  block_stack_node *stack_top;  /* Top of the push down stack.  */
+  char current_file[MAX_FILE_NAME + 1]; /* For error reporting.  */
+  meta_lex_state lex;           /* Lexer state, including the line number.  */
+
+  /* Arrays of vectors are stored in the metadata structure, this keeps
+     track of how many of them we have seen so far.  */
+  int vector_count;
+
+  int doppler_count;
+
+  /* Arrays of stats blocks are stored in the metadata structure, this keeps
+     track of how many of them we have seen so far.  */
+  int stats_block_count;
+
+  /* Maintains fact that a 'P' was found in the sar block image_type
+     field.  */
+  int sar_projected;
 
-/* Global pointer to meta structure getting read in */
-meta_parameters *global_meta;
+  /* Maintains the fact that a recognized map projection type
+     was found in the projection block.  */
+  int map_projection_type;
+};
 
 static void block_stack_push(block_stack_node **stack_top_p,
                              const char *block_name, void *new_block)
@@ -57,27 +76,14 @@ static void *block_stack_pop(block_stack_node **stack_top_p)
   return ret_val;
 }
 
-/* Arrays of vectors are stored in the metadata structure, this keeps
-   track of how many of them we have seen so far.  */
-static int vector_count;
-
-static int doppler_count;
-
-/* Arrays of stats blocks are stored in the metadata structure, this keeps
-   track of how many of them we have seen so far.  */
-static int stats_block_count;
-
-char current_file[MAX_FILE_NAME];
-extern int line_number;         /* Line number of file being parsed.  */
-
 /* Help parser handle errors.  */
-int yyerror(char *s)
+static int yyerror(void *scanner, meta_parse_context *ctx, const char *s)
 {
   if ( !strcmp(s, "parse error") ){
     fprintf(stderr,
             " ** Error parsing %s around line %d:\n"
             " ** Untrapped parse error, dying in yyerror\n",
-            current_file, line_number);
+            ctx->current_file, ctx->lex.line_number);
     exit(EXIT_FAILURE);
   }
   return -1;                    /* No error codes yet.  */
@@ -85,14 +91,15 @@ int yyerror(char *s)
 
 
 /* Allow parser to spit out warnings about metadata values.  */
-void warning_message(const char *warn_msg, ...)
+static void warning_message(meta_parse_context *ctx, const char *warn_msg, ...)
 {
 #define MAX_MESSAGE_LENGTH 4096
   va_list ap;
   char buffer[MAX_MESSAGE_LENGTH];
   char temp[MAX_MESSAGE_LENGTH];
 
-  sprintf(buffer, "Parsing %s around line %d:\n", current_file, line_number);
+  sprintf(buffer, "Parsing %s around line %d:\n", ctx->current_file,
+          ctx->lex.line_number);
   va_start(ap, warn_msg);
   vsprintf(temp, warn_msg, ap);
   strcat(buffer, temp);
@@ -101,10 +108,11 @@ void warning_message(const char *warn_msg, ...)
 }
 
 /* Have parser choke on bad metadata values.  */
-void error_message(const char *err_mes, ...)
+static void error_message(meta_parse_context *ctx, const char *err_mes, ...)
 {
   va_list ap;
-  fprintf(stderr, " ** Error: Parsing %s around line %d: ", current_file, line_number);
+  fprintf(stderr, " ** Error: Parsing %s around line %d: ", ctx->current_file,
+          ctx->lex.line_number);
   va_start(ap, err_mes);
   vfprintf(stderr, err_mes, ap);
   va_end(ap);
@@ -138,9 +146,9 @@ void error_message(const char *err_mes, ...)
 #define MDEM ( (meta_dem *) current_block)
 #define MQUALITY ( (meta_quality *) current_block)
 
-void select_current_block(char *block_name)
+static void select_current_block(meta_parse_context *ctx, char *block_name)
 {
-  void *current_block = stack_top->block;
+  void *current_block = ctx->stack_top->block;
 
   if ( !strcmp(block_name, "general") ) {
     current_block = MTL->general;
@@ -160,14 +168,14 @@ void select_current_block(char *block_name)
   }
   if ( !strcmp(block_name, "state") ) {
     if (MTL->state_vectors == NULL)
-      { MTL->state_vectors = meta_state_vectors_init(vector_count); }
+      { MTL->state_vectors = meta_state_vectors_init(ctx->vector_count); }
     current_block = MTL->state_vectors;
     goto MATCHED;
   }
   if ( !strcmp(block_name, "vector") ) {
-    global_meta->state_vectors = realloc( global_meta->state_vectors,
-                     sizeof(meta_state_vectors) + (vector_count+1)*sizeof(state_loc));
-    current_block = &( global_meta->state_vectors->vecs[vector_count++]);
+    ctx->meta->state_vectors = realloc( ctx->meta->state_vectors,
+                     sizeof(meta_state_vectors) + (ctx->vector_count+1)*sizeof(state_loc));
+    current_block = &( ctx->meta->state_vectors->vecs[ctx->vector_count++]);
     goto MATCHED;
   }
 
@@ -234,20 +242,20 @@ void select_current_block(char *block_name)
 
   if ( !strcmp(block_name, "stats") ) { // Stats block for versions lower than v2.4 (single-band stats)
     if (MTL->stats == NULL)
-    { MTL->stats = meta_statistics_init(1); stats_block_count++;}
+    { MTL->stats = meta_statistics_init(1); ctx->stats_block_count++;}
     current_block = MTL->stats;
     goto MATCHED;
   }
   if ( !strcmp(block_name, "statistics") ) { // Stats block for v2.4+ (multi-band stats)
     if (MTL->stats == NULL)
-       { MTL->stats = meta_statistics_init(stats_block_count); }
+       { MTL->stats = meta_statistics_init(ctx->stats_block_count); }
     current_block = MTL->stats;
     goto MATCHED;
   }
   if ( !strcmp(block_name, "band_stats") ) { // Band stats blocks for v2.4+ (multi-band stats)
-    global_meta->stats = realloc( global_meta->stats,
-                      sizeof(meta_statistics) + (stats_block_count+1)*sizeof(meta_stats));
-    current_block = &( global_meta->stats->band_stats[stats_block_count++]);
+    ctx->meta->stats = realloc( ctx->meta->stats,
+                      sizeof(meta_statistics) + (ctx->stats_block_count+1)*sizeof(meta_stats));
+    current_block = &( ctx->meta->stats->band_stats[ctx->stats_block_count++]);
     goto MATCHED;
   }
 
@@ -294,15 +302,15 @@ void select_current_block(char *block_name)
   }
 
   if ( !strcmp(block_name, "estimate") ) {
-    current_block = &( global_meta->doppler->tsx->dop[doppler_count++]);
+    current_block = &( ctx->meta->doppler->tsx->dop[ctx->doppler_count++]);
     goto MATCHED;
   }
 
   /* Got an unknown block name, so report.  */
-  warning_message("unknown block name: %s\n", block_name);
+  warning_message(ctx, "unknown block name: %s\n", block_name);
 
 MATCHED:
-  block_stack_push(&stack_top, block_name, current_block);
+  block_stack_push(&ctx->stack_top, block_name, current_block);
   return;
 }
 
@@ -311,44 +319,29 @@ MATCHED:
 #define VALP_AS_DOUBLE *( (double *) valp)
 #define VALP_AS_CHAR_POINTER ( (char *) valp)
 
-void fill_structure_field(char *field_name, void *valp)
+static void fill_structure_field(meta_parse_context *ctx, char *field_name,
+                                 void *valp)
 {
   /* Pointer to substructure corresponding to current block.  */
-  void *current_block = stack_top->block;
+  void *current_block = ctx->stack_top->block;
 
   /* FIXME: Because the yacc parser returns after each token is found, there
-  is no token-to-token state inherent in the code.  I added 2 static ints for
-  'remembering' the sar block image_type and a 'map projected' flag that indicates
-  whether or not a map-projected type of projection was found in the projection
-  block ('type' field).  These are utilized in calls to warning_message() after
-  parsing projection type, spheroid, and datum type tokens from the metadata.
-
-  This presents 2 problems that we should probably resolve in the
-  future:
-          1) If we re-order the SAR and Projection blocks, then the logic
-      on the warning messages will break
-          2) This solution only works for sequentially-called parsing, e.g.
-      meta_read().  If child processes are forked off and both are
-          reading a metadata file then the shared static vars will
-          be in a race condition that will likely break the logic on
-          the warning messages.
-
-  Neither of these two issues is critical since it only impacts warning messages,
-  but we ought to re-think the warning message methodology and maybe consider moving
-  the warning message logic to the code that uses the parser rather than having the
-  parser itself issue the warnings ...just let it return tokens silently.
+  is no token-to-token state inherent in the code.  The parse context has 2
+  ints for 'remembering' the sar block image_type (sar_projected) and a 'map
+  projected' flag that indicates whether or not a map-projected type of
+  projection was found in the projection block ('type' field,
+  map_projection_type).  These are utilized in calls to warning_message()
+  after parsing projection type, spheroid, and datum type tokens from the
+  metadata.
+
+  If we re-order the SAR and Projection blocks, then the logic on the warning
+  messages will break.  This is not critical since it only impacts warning
+  messages, but we ought to re-think the warning message methodology and maybe
+  consider moving the warning message logic to the code that uses the parser
+  rather than having the parser itself issue the warnings ...just let it return
+  tokens silently.
   */
 
-  /* Maintains fact that a 'P' was found in the sar block image_type
-     field
-  */
-  static int sar_projected;
-
-  /* Maintains the fact that a recognized map projection type
-     was found in the projection block
-  */
-  static int map_projection_type;
-
 #ifdef DEBUG_METADATA_PARSER
     extern int yydebug;
     yydebug = 1;
@@ -361,7 +354,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields which normally go in the general block of the metadata file.  */
-  if ( !strcmp(stack_top->block_name, "general") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "general") ) {
     if ( !strcmp(field_name, "name") )
       { strcpy(MGENERAL->basename, VALP_AS_CHAR_POINTER); return; }
     if ( !strcmp(field_name, "sensor") )
@@ -371,7 +364,7 @@ void fill_structure_field(char *field_name, void *valp)
     if ( !strcmp(field_name, "mode") ) {
       if ( strlen(VALP_AS_CHAR_POINTER) > MODE_FIELD_STRING_MAX - 1 ) {
                                           /* (-1 for trailing null)  */
-        error_message("mode = '%s'; string should not exceed %d characters.",
+        error_message(ctx, "mode = '%s'; string should not exceed %d characters.",
                       VALP_AS_CHAR_POINTER, MODE_FIELD_STRING_MAX-1);
      }
       strncpy(MGENERAL->mode, VALP_AS_CHAR_POINTER, MODE_FIELD_STRING_MAX);
@@ -380,7 +373,7 @@ void fill_structure_field(char *field_name, void *valp)
     if ( !strcmp(field_name, "receiving_station") ) {
       if ( strlen(VALP_AS_CHAR_POINTER) > MODE_FIELD_STRING_MAX - 1 ) {
                                           /* (-1 for trailing null)  */
-        error_message("receiving_station = '%s'; string should not exceed %d characters.",
+        error_message(ctx, "receiving_station = '%s'; string should not exceed %d characters.",
                       VALP_AS_CHAR_POINTER, MODE_FIELD_STRING_MAX-1);
      }
       strncpy(MGENERAL->receiving_station, VALP_AS_CHAR_POINTER, MODE_FIELD_STRING_MAX);
@@ -410,7 +403,7 @@ void fill_structure_field(char *field_name, void *valp)
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "COMPLEX_REAL64") )
         MGENERAL->data_type = COMPLEX_REAL64;
       else {
-        warning_message("Unrecognized data_type (%s).\n",VALP_AS_CHAR_POINTER);
+        warning_message(ctx, "Unrecognized data_type (%s).\n",VALP_AS_CHAR_POINTER);
         MGENERAL->data_type = MAGIC_UNSET_INT;
       }
       return;
@@ -503,7 +496,7 @@ void fill_structure_field(char *field_name, void *valp)
       else if (!strcmp(VALP_AS_CHAR_POINTER, "MODEL_OUTPUT"))
         MGENERAL->image_data_type = MODEL_OUTPUT;
       else {
-        warning_message("Unrecognized image_data_type (%s).\n",VALP_AS_CHAR_POINTER);
+        warning_message(ctx, "Unrecognized image_data_type (%s).\n",VALP_AS_CHAR_POINTER);
         MGENERAL->image_data_type = MAGIC_UNSET_INT;
       }
       return;
@@ -536,7 +529,7 @@ void fill_structure_field(char *field_name, void *valp)
 	    (MGENERAL->image_data_type >= POLARIMETRIC_C2_MATRIX &&
 	     MGENERAL->image_data_type <= POLARIMETRIC_STOKES_MATRIX))
         {
-          warning_message("Unrecognized radiometry (%s).\n",VALP_AS_CHAR_POINTER);
+          warning_message(ctx, "Unrecognized radiometry (%s).\n",VALP_AS_CHAR_POINTER);
         }
         MGENERAL->radiometry = r_AMP;
       }
@@ -562,7 +555,7 @@ void fill_structure_field(char *field_name, void *valp)
         return;
       }
       else {
-        warning_message("Bad value: orbit_direction = '%s'.\n",
+        warning_message(ctx, "Bad value: orbit_direction = '%s'.\n",
                         VALP_AS_CHAR_POINTER);
         return;
       }
@@ -614,7 +607,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields which normally go in the sar block of the metadata file.  */
-  if ( !strcmp(stack_top->block_name, "sar") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "sar") ) {
     int ii;
     char coeff[15];
     if ( !strcmp(field_name, "polarization") )
@@ -622,17 +615,17 @@ void fill_structure_field(char *field_name, void *valp)
     if ( !strcmp(field_name, "image_type") ) {
       if ( !strcmp(VALP_AS_CHAR_POINTER, "S") ) {
         MSAR->image_type = 'S';
-        sar_projected = 0;
+        ctx->sar_projected = 0;
         return;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "G") ) {
         MSAR->image_type = 'G';
-        sar_projected = 0;
+        ctx->sar_projected = 0;
         return;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "P") ) {
         MSAR->image_type = 'P';
-        sar_projected = 1;
+        ctx->sar_projected = 1;
         return;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "R") ) {
@@ -642,13 +635,13 @@ void fill_structure_field(char *field_name, void *valp)
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "?") ) {
        /* if its a question mark don't bother the user with a warning, this happens often with DDRs */
         MSAR->image_type = '?';
-        sar_projected = 0;
+        ctx->sar_projected = 0;
         return;
       }
       else {
-        warning_message("Bad value: image_type = '%s'.\n",
+        warning_message(ctx, "Bad value: image_type = '%s'.\n",
       VALP_AS_CHAR_POINTER);
-        sar_projected = 0;
+        ctx->sar_projected = 0;
         return;
       }
     }
@@ -663,7 +656,7 @@ void fill_structure_field(char *field_name, void *valp)
        /* if its a question mark don't bother the user with a warning, this happens often with DDRs */
         MSAR->look_direction = '?'; return;
       }
-      warning_message("Bad value: look_direction = '%c'.\n",
+      warning_message(ctx, "Bad value: look_direction = '%c'.\n",
           VALP_AS_CHAR_POINTER[0]);
       return;
     }
@@ -744,7 +737,7 @@ void fill_structure_field(char *field_name, void *valp)
 }
 
   /* Fields which normally go in the optical block of the metadata file.  */
-  if ( !strcmp(stack_top->block_name, "optical") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "optical") ) {
     if ( !strcmp(field_name, "pointing_direction") )
       { strcpy(MOPTICAL->pointing_direction, VALP_AS_CHAR_POINTER); return; }
     if ( !strcmp(field_name, "off_nadir_angle") )
@@ -760,7 +753,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields which normally go in the state block of the metadata file.  */
-  if ( !strcmp(stack_top->block_name, "state") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "state") ) {
     if ( !strcmp(field_name, "year") )
       { MSTATE->year = VALP_AS_INT; return; }
     if ( !strcmp(field_name, "julDay") )
@@ -777,7 +770,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
     /* Fields which normally go in a vector block.  */
-  if ( !strcmp(stack_top->block_name, "vector") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "vector") ) {
     if ( !strcmp(field_name, "time") )
       { MVECTOR->time = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "x") )
@@ -799,73 +792,73 @@ void fill_structure_field(char *field_name, void *valp)
 
   /* Fields which normaly go in the projection block of the metadata file.  */
 
-  if ( !strcmp(stack_top->block_name, "projection") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "projection") ) {
     if ( !strcmp(field_name, "type") ) {
       if ( !strcmp(VALP_AS_CHAR_POINTER, "UNIVERSAL_TRANSVERSE_MERCATOR") ) {
         MPROJ->type = UNIVERSAL_TRANSVERSE_MERCATOR;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "POLAR_STEREOGRAPHIC") ) {
         MPROJ->type = POLAR_STEREOGRAPHIC;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "ALBERS_EQUAL_AREA") ) {
         MPROJ->type = ALBERS_EQUAL_AREA;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "LAMBERT_CONFORMAL_CONIC") ) {
         MPROJ->type = LAMBERT_CONFORMAL_CONIC;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "LAMBERT_AZIMUTHAL_EQUAL_AREA") ) {
         MPROJ->type = LAMBERT_AZIMUTHAL_EQUAL_AREA;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "STATE_PLANE") ) {
         MPROJ->type = STATE_PLANE;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "SCANSAR_PROJECTION") ) {
         MPROJ->type = SCANSAR_PROJECTION;
-        map_projection_type = 0;
+        ctx->map_projection_type = 0;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "LAT_LONG_PSEUDO_PROJECTION") ) {
         MPROJ->type = LAT_LONG_PSEUDO_PROJECTION;
-        map_projection_type = 0;
+        ctx->map_projection_type = 0;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "MERCATOR") ) {
         MPROJ->type = MERCATOR;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "EQUI_RECTANGULAR") ) {
         MPROJ->type = EQUI_RECTANGULAR;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "EQUIDISTANT") ) {
         MPROJ->type = EQUIDISTANT;
-        map_projection_type = 1;
+        ctx->map_projection_type = 1;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "SINUSOIDAL") ) {
         MPROJ->type = SINUSOIDAL;
-        map_projection_type = 0;
+        ctx->map_projection_type = 0;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "EASE_GRID_GLOBAL") ) {
 	MPROJ->type = EASE_GRID_GLOBAL;
-	map_projection_type = 0;
+	ctx->map_projection_type = 0;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "EASE_GRID_NORTH") ) {
 	MPROJ->type = EASE_GRID_NORTH;
-	map_projection_type = 0;
+	ctx->map_projection_type = 0;
       }
       else if ( !strcmp(VALP_AS_CHAR_POINTER, "EASE_GRID_SOUTH") ) {
 	MPROJ->type = EASE_GRID_SOUTH;
-	map_projection_type = 0;
+	ctx->map_projection_type = 0;
       }
       else {
         MPROJ->type = UNKNOWN_PROJECTION;
         // Only complain if the image is truly map projected
-        if (sar_projected && map_projection_type) {
-          warning_message("Bad value: type = '%s'.\n",VALP_AS_CHAR_POINTER);
+        if (ctx->sar_projected && ctx->map_projection_type) {
+          warning_message(ctx, "Bad value: type = '%s'.\n",VALP_AS_CHAR_POINTER);
         }
       }
       return;
@@ -916,8 +909,8 @@ void fill_structure_field(char *field_name, void *valp)
       else {
         MPROJ->spheroid = UNKNOWN_SPHEROID;
         // Only complain if the image is truly map projected
-        if (sar_projected && map_projection_type) {
-          warning_message("Bad value: spheroid = '%s'.\n",
+        if (ctx->sar_projected && ctx->map_projection_type) {
+          warning_message(ctx, "Bad value: spheroid = '%s'.\n",
         VALP_AS_CHAR_POINTER);
         }
       }
@@ -953,8 +946,8 @@ void fill_structure_field(char *field_name, void *valp)
       else {
         MPROJ->datum = UNKNOWN_DATUM;
         // Only complain if the mage is truly map projected
-        if (sar_projected && map_projection_type) {
-          warning_message("Bad value: datum = '%s'.\n", VALP_AS_CHAR_POINTER);
+        if (ctx->sar_projected && ctx->map_projection_type) {
+          warning_message(ctx, "Bad value: datum = '%s'.\n", VALP_AS_CHAR_POINTER);
         }
       }
       return;
@@ -964,7 +957,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields that go in the (proj->param).atct block.  */
-  if ( !strcmp(stack_top->block_name, "atct") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "atct") ) {
     if ( !strcmp(field_name, "rlocal") )
       { (*MPARAM).atct.rlocal = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "alpha1") )
@@ -977,7 +970,7 @@ void fill_structure_field(char *field_name, void *valp)
 
   /* Fields that go in the (proj->param).albers block.  */
   /* Check for both lamcc and lambert for backwards compatibility */
-  if ( !strcmp(stack_top->block_name, "albers")) {
+  if ( !strcmp(ctx->stack_top->block_name, "albers")) {
     if ( !strcmp(field_name, "std_parallel1") )
       { (*MPARAM).albers.std_parallel1 = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "std_parallel2") )
@@ -995,7 +988,7 @@ void fill_structure_field(char *field_name, void *valp)
   /* Fields that go in the (proj->param).lamaz block.  */
   /* Check for both lamcc and lambert for backwards compatibility */
   // Could also be EASE polar grids - fill in just in case
-  if ( !strcmp(stack_top->block_name, "lamaz")) {
+  if ( !strcmp(ctx->stack_top->block_name, "lamaz")) {
     if ( !strcmp(field_name, "center_lon") )
       { (*MPARAM).lamaz.center_lon = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "center_lat") )
@@ -1008,7 +1001,7 @@ void fill_structure_field(char *field_name, void *valp)
 
   /* Fields that go in the (proj->param).lamcc block.  */
   /* Check for both lamcc and lambert for backwards compatibility */
-  if ( !strcmp(stack_top->block_name, "lamcc") ||  !strcmp(stack_top->block_name, "lambert")) {
+  if ( !strcmp(ctx->stack_top->block_name, "lamcc") ||  !strcmp(ctx->stack_top->block_name, "lambert")) {
     if ( !strcmp(field_name, "plat1") )
       { (*MPARAM).lamcc.plat1 = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "plat2") )
@@ -1026,7 +1019,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields that go in the (proj->param).ps block.  */
-  if ( !strcmp(stack_top->block_name, "ps") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "ps") ) {
     if ( !strcmp(field_name, "slat") )
       { (*MPARAM).ps.slat = VALP_AS_DOUBLE;
         (*MPARAM).ps.is_north_pole = (*MPARAM).ps.slat > 0;
@@ -1041,7 +1034,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields that go in the (proj->param).utm block.  */
-  if ( !strcmp(stack_top->block_name, "utm") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "utm") ) {
     if ( !strcmp(field_name, "zone") )
       { (*MPARAM).utm.zone = VALP_AS_INT; return; }
     if ( !strcmp(field_name, "latitude") )
@@ -1057,13 +1050,13 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields that go in the (proj->param).state block.  */
-  if ( !strcmp(stack_top->block_name, "state") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "state") ) {
     if ( !strcmp(field_name, "zone") )
       { (*MPARAM).state.zone = VALP_AS_INT; return; }
   }
 
   /* Fields that go in the (proj->param).mer block.  */
-  if ( !strcmp(stack_top->block_name, "mer")) {
+  if ( !strcmp(ctx->stack_top->block_name, "mer")) {
     if ( !strcmp(field_name, "standard_parallel") )
       { (*MPARAM).mer.standard_parallel = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "central_meridian") )
@@ -1077,7 +1070,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields that go in the (proj->param).eqr block.  */
-  if ( !strcmp(stack_top->block_name, "eqr")) {
+  if ( !strcmp(ctx->stack_top->block_name, "eqr")) {
     if ( !strcmp(field_name, "central_meridian") )
       { (*MPARAM).eqr.central_meridian = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "orig_latitude") )
@@ -1089,7 +1082,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields that go in the (proj->param).eqc block.  */
-  if ( !strcmp(stack_top->block_name, "eqc")) {
+  if ( !strcmp(ctx->stack_top->block_name, "eqc")) {
     if ( !strcmp(field_name, "central_meridian") )
       { (*MPARAM).eqc.central_meridian = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "orig_latitude") )
@@ -1097,7 +1090,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields that go in the (proj->param).sin block.  */
-  if ( !strcmp(stack_top->block_name, "sin")) {
+  if ( !strcmp(ctx->stack_top->block_name, "sin")) {
     if ( !strcmp(field_name, "longitude_center") )
       { (*MPARAM).sin.longitude_center = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "false_easting") )
@@ -1107,7 +1100,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   // Fields that go in the (proj->param).cea block
-  if ( !strcmp(stack_top->block_name, "cea")) {
+  if ( !strcmp(ctx->stack_top->block_name, "cea")) {
     if ( !strcmp(field_name, "standard_parallel") )
       { (*MPARAM).cea.standard_parallel = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "central_meridian") )
@@ -1124,7 +1117,7 @@ void fill_structure_field(char *field_name, void *valp)
      main block.  */
 
   // Fields which normally go in the transform block of the metadata file. */
-  if ( !strcmp(stack_top->block_name, "transform") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "transform") ) {
     int ii;
     char coeff[15];
     if ( !strcmp(field_name, "type") )
@@ -1186,7 +1179,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   // Fields which normally go in the airsar block of the metadata file
-  if ( !strcmp(stack_top->block_name, "airsar") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "airsar") ) {
     if ( !strcmp(field_name, "scale_factor") )
       { MAIRSAR->scale_factor = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "gps_altitude") )
@@ -1204,7 +1197,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   // Fields which normally go in the uavsar block of the metadata file
-  if ( !strcmp(stack_top->block_name, "uavsar") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "uavsar") ) {
     if ( !strcmp(field_name, "id") )
       { strcpy(MUAVSAR->id, VALP_AS_CHAR_POINTER); return; }
     if ( !strcmp(field_name, "scale_factor") )
@@ -1224,7 +1217,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   // Fields which normally go in the dem block of the metadata file
-  if ( !strcmp(stack_top->block_name, "dem") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "dem") ) {
     if ( !strcmp(field_name, "source") )
       { strcpy(MDEM->source, VALP_AS_CHAR_POINTER); return; }
     if ( !strcmp(field_name, "format") )
@@ -1245,7 +1238,7 @@ void fill_structure_field(char *field_name, void *valp)
       { MDEM->no_data = VALP_AS_DOUBLE; return; }
   }
   
-  if ( !strcmp(stack_top->block_name, "quality") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "quality") ) {
 		if ( !strcmp(field_name, "bit_error_rate") )
 			{ MQUALITY->bit_error_rate = VALP_AS_DOUBLE; return; }
 		if ( !strcmp(field_name, "azimuth_resolution") )
@@ -1264,12 +1257,12 @@ void fill_structure_field(char *field_name, void *valp)
   //
   //
   // Statistics block(s) for metadata v2.4 and beyond (multi-band)
-  if ( !strcmp(stack_top->block_name, "statistics") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "statistics") ) {
     if ( !strcmp(field_name, "band_count") )
     { (MSTATISTICS)->band_count = VALP_AS_INT; return; }
   }
   // Band stats block for metadata v2.4+
-  if ( !strcmp(stack_top->block_name, "band_stats") )
+  if ( !strcmp(ctx->stack_top->block_name, "band_stats") )
   {
     if ( !strcmp(field_name, "band_id") )
     { strcpy((MSTATSBLOCK)->band_id, VALP_AS_CHAR_POINTER); return; }
@@ -1289,7 +1282,7 @@ void fill_structure_field(char *field_name, void *valp)
     { (MSTATSBLOCK)->mask = VALP_AS_DOUBLE; return; }
   }
   // Band stats block for metadata v2.3-
-  if ( !strcmp(stack_top->block_name, "stats") )
+  if ( !strcmp(ctx->stack_top->block_name, "stats") )
   {
     if ( !strcmp(field_name, "band_id") )
     { strcpy((MSTATS)->band_id, VALP_AS_CHAR_POINTER); return; }
@@ -1310,7 +1303,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields which go in the location block of the metadata file. */
-  if ( !strcmp(stack_top->block_name, "location") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "location") ) {
     if ( !strcmp(field_name, "lat_start_near_range") )
       { (MLOCATION)->lat_start_near_range = VALP_AS_DOUBLE; return; }
     if ( !strcmp(field_name, "lon_start_near_range") )
@@ -1330,7 +1323,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   // Fields which go in the insar block of the metadata file.
-  if ( !strcmp(stack_top->block_name, "insar") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "insar") ) {
     if ( !strcmp(field_name, "processor") )
       { strcpy((MINSAR)->processor, VALP_AS_CHAR_POINTER); return; }
     if ( !strcmp(field_name, "master_image") )
@@ -1364,7 +1357,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   // Fields which go in the doppler block of the metadata file.
-  if ( !strcmp(stack_top->block_name, "doppler") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "doppler") ) {
     int ii;
     char str[25];
     if ( !strcmp(field_name, "type") ) {
@@ -1430,7 +1423,7 @@ void fill_structure_field(char *field_name, void *valp)
       { (MDOPPLER)->r2->time_first_sample = VALP_AS_DOUBLE; return; }
   }
   // TSX Doppler estimates
-  if ( !strcmp(stack_top->block_name, "estimate") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "estimate") ) {
     int ii;
     char str[15];
     if ( !strcmp(field_name, "time") )
@@ -1453,7 +1446,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields which go in the calibration block of the metadata file. */
-  if ( !strcmp(stack_top->block_name, "calibration") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "calibration") ) {
     int ii;
     char str[15];
     if ( !strcmp(field_name, "type") ) {
@@ -1675,7 +1668,7 @@ void fill_structure_field(char *field_name, void *valp)
   }
 
   /* Fields which normally go in a colormap block.  */
-  if ( !strcmp(stack_top->block_name, "colormap") ) {
+  if ( !strcmp(ctx->stack_top->block_name, "colormap") ) {
       int ii;
       char val[256], val2[256];
       if ( !strcmp(field_name, "look_up_table") )
@@ -1708,19 +1701,30 @@ void fill_structure_field(char *field_name, void *valp)
      let's just comment it out... very annoying */
   // fprintf (stderr, "Warning: Unknown field name: %s\n", field_name);
   return;
-  // error_message("Unknown field name: %s", field_name);
+  // error_message(ctx, "Unknown field name: %s", field_name);
 }
 
 %}
 
 %start element_seq
 
+/* Reentrant parser: all state is in the scanner and the parse context.  */
+%define api.pure
+%parse-param {void *scanner}
+%parse-param {meta_parse_context *ctx}
+%lex-param {void *scanner}
+
 %union {                           /* Define parser stack type.  */
   double double_val;
   char string_val[MAX_SYMBOL_STRING + 1];   /* Null terminated so +1.  */
   void *var_type;
 }
 
+%{
+/* Lex provides this parser function.  */
+int yylex(YYSTYPE *lvalp, void *scanner);
+%}
+
 %token <double_val> DOUBLE
 %token <string_val> NAME
 %token <string_val> STRING
@@ -1738,7 +1742,7 @@ element:   field
          ;
 
 field:   NAME ':' field_value
-             { fill_structure_field($1, $3);
+             { fill_structure_field(ctx, $1, $3);
                free($3); }
        ;
 
@@ -1749,75 +1753,85 @@ field_value:   DOUBLE { double *tmp = (double *) malloc(sizeof(double));
              ;
 
 block:   block_start element_seq '}'
-             { block_stack_pop(&stack_top); }
+             { block_stack_pop(&ctx->stack_top); }
        | block_start '}'
-             { block_stack_pop(&stack_top); }
+             { block_stack_pop(&ctx->stack_top); }
        ;
 block_start:   NAME '{'
-                   { select_current_block($1); }
+                   { select_current_block(ctx, $1); }
              ;
 
 %%
 
 /* Main parser interface function.  Gets passed in a pointer to a
    structure to be filled in and a file name to fill it from.  Returns
-   true if the parse succeeded, false otherwise.  */
+   true if the parse succeeded, false otherwise.  All the parser state
+   is local to the call, so it is safe to parse several files at once.  */
 int parse_metadata(meta_parameters *dest, char *file_name)
 {
-  extern FILE *meta_yyin;
+  meta_parse_context ctx;
+  void *scanner;
+  FILE *fp;
   int ret_val;
 
-  global_meta = dest;
+  ctx.meta = dest;
+
+  /* Keep the file name for error reporting.  */
+  strncpy(ctx.current_file, file_name, MAX_FILE_NAME);
+  ctx.current_file[MAX_FILE_NAME] = '\0';
 
-  /***                                             ***/
-  /* FIXME: current_file should be forcefully null-  */
-  /*   terminated after the strncpy() below.         */
-  /***                                             ***/
-  /* Put file name in a global for error reporting.  */
-  strncpy(current_file, file_name, MAX_FILE_NAME);
+  /* Start at the first line */
+  ctx.lex.line_number = 1;
+  ctx.lex.looking_at_numeric_string = 0;
 
-  /* (Re)set line_number to first line */
-  line_number = 1;
+  /* Nothing seen yet.  */
+  ctx.vector_count = 0;
+  ctx.doppler_count = 0;
+  ctx.stats_block_count = 0;
+  ctx.sar_projected = 0;
+  ctx.map_projection_type = 0;
 
-  /* (Re)set file scope variable which counts number of vector blocks seen.  */
-  vector_count = 0;
-  doppler_count = 0;
-  stats_block_count = 0;
+  fp = FOPEN(file_name, "r");
+  if ( meta_yylex_init_extra(&ctx.lex, &scanner) != 0 )
+    asfPrintError("Could not initialize the metadata lexer\n");
+  meta_yyset_in(fp, scanner);
 
-  meta_yyin = FOPEN(file_name, "r");
-  stack_top = NULL;
-  block_stack_push(&stack_top, "outermost_section", dest);
+  ctx.stack_top = NULL;
+  block_stack_push(&ctx.stack_top, "outermost_section", dest);
 
   /* Parse metadata file.  */
-  ret_val = yyparse();
+  ret_val = yyparse(scanner, &ctx);
 
   /* Fill in number of state vectors seen.  */
-  if ((dest->state_vectors) && (dest->state_vectors->vector_count != vector_count)) {
-    warning_message("Said number of vectors in state vector block (%d)\n"
+  if ((dest->state_vectors) &&
+      (dest->state_vectors->vector_count != ctx.vector_count)) {
+    warning_message(&ctx,
+                    "Said number of vectors in state vector block (%d)\n"
                     "differs from the actual amount of vectors (%d)...\n"
                     "Using actual number of vectors for vector_count.\n",
-                    dest->state_vectors->vector_count, vector_count);
-    dest->state_vectors->vector_count = vector_count;
-    dest->state_vectors->num = vector_count; /* Backward compat alias.  */
+                    dest->state_vectors->vector_count, ctx.vector_count);
+    dest->state_vectors->vector_count = ctx.vector_count;
+    dest->state_vectors->num = ctx.vector_count; /* Backward compat alias.  */
   }
 
   /* Fill in number of stats blocks seen.  */
   if (dest->stats             &&
-      dest->stats->band_count != stats_block_count)
+      dest->stats->band_count != ctx.stats_block_count)
   {
-    warning_message("Said number of stats blocks in stats (%d)\n"
+    warning_message(&ctx, "Said number of stats blocks in stats (%d)\n"
         "differs from the actual amount of stats blocks (%d)...\n"
         "Using actual number of stats blocks for stats_blocks_count.\n",
-    dest->stats->band_count, stats_block_count);
-    dest->stats->band_count = stats_block_count;
+    dest->stats->band_count, ctx.stats_block_count);
+    dest->stats->band_count = ctx.stats_block_count;
   }
 
   /* Done with the block stack, so empty it.  */
-  while ( stack_top != NULL ) {
-    block_stack_pop (&stack_top);
+  while ( ctx.stack_top != NULL ) {
+    block_stack_pop (&ctx.stack_top);
   }
 
-  FCLOSE(meta_yyin);
+  meta_yylex_destroy(scanner);
+  FCLOSE(fp);
 
   return ret_val;
 }
@@ -103,6 +103,25 @@ static void help()
     "       greyscale pixel values to RGB values.  If the specified colormap\n"
     "       is not found in the current directory, the ASF share directory is\n"
     "       checked.\n"
+    "\n"
+    "   -benchmark-cache <path_file>\n"
+    "       Don't open a window; instead, replay the pan/zoom path in the\n"
+    "       given file over the image and report how long each view took to\n"
+    "       draw.  Each line of the file is '<line> <sample> <zoom> [<pause>]'\n"
+    "       with the pause in milliseconds.  Use 'auto' for a path that pans\n"
+    "       down the whole image and back.\n"
+    "\n"
+    "Environment:\n"
+    "   ASF_VIEW_CACHE_MB\n"
+    "       How much memory to use for caching image data, in megabytes.\n"
+    "       The default is 1536.\n"
+    "   ASF_VIEW_OVERVIEW_DIR\n"
+    "       Where to keep the reduced resolution copies of large images\n"
+    "       used when zoomed out.  The default is asf_view in the user's\n"
+    "       cache directory.\n"
+    "   ASF_VIEW_OVERVIEW_MB\n"
+    "       Size limit for that directory, in megabytes.  The default is\n"
+    "       4096.  Set ASF_VIEW_OVERVIEWS to 0 to not use them at all.\n"
     "\n");
   asfPrintStatus("Contact:\n" ASF_CONTACT_STRING "\n");
   asfPrintStatus("Version:\n   " SVN_REV " (part of " TOOL_SUITE_NAME " " MAPREADY_VERSION_STRING ")\n\n");
@@ -195,6 +214,9 @@ main(int argc, char **argv)
         "-mask", "--mask", "--layover-mask", "--layover-mask", NULL);
     extract_string_options(&argc, &argv, pts_file,
         "-points", "--points", "-p", NULL);
+    char bench_path[512];
+    int bench_specified = extract_string_options(&argc, &argv, bench_path,
+        "-benchmark-cache", "--benchmark-cache", NULL);
 
     pt_name[0] = "";
     int plat = extract_double_options(&argc, &argv, &pt_lat[0], "-plat", NULL);
@@ -300,6 +322,17 @@ main(int argc, char **argv)
     if (fileExists(embedded_tiff_lut_file)) remove(embedded_tiff_lut_file);
     if (fileExists(embedded_asf_colormap_file)) remove(embedded_asf_colormap_file);
 
+    // headless: time panning around the first image, then quit
+    if (bench_specified) {
+        curr = &image_info[0];
+        if (curr->filename[strlen(curr->filename)-1] == '.')
+            curr->filename[strlen(curr->filename)-1] = '\0';
+        read_file(curr->filename, band_specified ? band : NULL, FALSE, TRUE);
+        get_thumbnail_data(curr);
+        benchmark_cache(curr, bench_path);
+        exit(EXIT_SUCCESS);
+    }
+
     if (mask_specified) {
         curr = mask = &mask_info;
         mask->filename = STRDUP(mask_file_name);
@@ -250,7 +250,11 @@ int handle_seasat_h5_file(const char *filename, char *meta_name, char *data_name
 meta_parameters *read_seasat_h5_meta(const char *meta_name);
 int open_seasat_h5_data(const char *filename,
                         meta_parameters *meta, ClientInterface *client);
+/* bench_cache.c */
+void benchmark_cache(ImageInfo *ii, const char *path_file);
+
 /* big_image.c */
+void render_big_image(ImageInfo *ii, unsigned char *bdata, int biw, int bih);
 GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair);
 void fill_big(ImageInfo *ii);
 void update_zoom(void);
@@ -0,0 +1,137 @@
+#include "asf_view.h"
+#include <sys/time.h>
+
+// Headless benchmark of the image cache: replays a pan/zoom path over the
+// loaded image, rendering the big image for each step exactly as the GUI
+// would, and reports how long each frame took.
+//
+// The path is read from a file with one step per line:
+//     <center line> <center sample> <zoom> [<pause, in milliseconds>]
+// Blank lines and lines starting with '#' are skipped.  The pause is the
+// time the "user" spends looking at the frame before moving on, which is
+// when the cache gets to read ahead.  If the file name is "auto", a path
+// is made up: pan from the top of the image to the bottom at 1:1, then
+// zoom out and pan back up.
+
+#define FRAME_BUDGET_MS 33.3
+
+typedef struct {
+    double line, samp, zoom;
+    int pause_ms;
+} PathStep;
+
+static double wall_clock(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec*1.0e-6;
+}
+
+static PathStep *read_path(const char *file, int *n_steps)
+{
+    int n = 0, max = 256;
+    PathStep *steps = MALLOC(sizeof(PathStep)*max);
+    char buf[256];
+
+    FILE *fp = FOPEN(file, "r");
+    while (fgets(buf, sizeof(buf), fp)) {
+        PathStep step;
+        step.pause_ms = 0;
+        if (buf[0] == '#')
+            continue;
+        if (sscanf(buf, "%lf %lf %lf %d", &step.line, &step.samp,
+                   &step.zoom, &step.pause_ms) < 3)
+            continue;
+        if (n == max) {
+            max *= 2;
+            steps = realloc(steps, sizeof(PathStep)*max);
+        }
+        steps[n++] = step;
+    }
+    FCLOSE(fp);
+
+    *n_steps = n;
+    return steps;
+}
+
+static PathStep *make_path(ImageInfo *ii, int *n_steps)
+{
+    int bih = get_big_image_height_sub();
+    int n_down = ii->nl / (bih/4) + 1;
+    int n_up = n_down/4 + 1;
+    int i, n = 0;
+    PathStep *steps = MALLOC(sizeof(PathStep)*(n_down + n_up));
+
+    // down the middle at 1:1, a quarter screen at a time
+    for (i=0; i<n_down; ++i) {
+        steps[n].line = i*(bih/4);
+        steps[n].samp = ii->ns/2;
+        steps[n].zoom = 1;
+        steps[n].pause_ms = 30;
+        ++n;
+    }
+    // back up at 4:1
+    for (i=0; i<n_up; ++i) {
+        steps[n].line = ii->nl - 1 - i*bih;
+        steps[n].samp = ii->ns/2;
+        steps[n].zoom = 4;
+        steps[n].pause_ms = 30;
+        ++n;
+    }
+
+    *n_steps = n;
+    return steps;
+}
+
+void benchmark_cache(ImageInfo *ii, const char *path_file)
+{
+    int i, n_steps, n_slow = 0;
+    double total = 0, worst = 0;
+    PathStep *steps;
+
+    if (strcmp(path_file, "auto") == 0)
+        steps = make_path(ii, &n_steps);
+    else
+        steps = read_path(path_file, &n_steps);
+
+    int biw = get_big_image_width_sub();
+    int bih = get_big_image_height_sub();
+    unsigned char *bdata = MALLOC(sizeof(unsigned char)*biw*bih*3);
+
+    asfPrintStatus("\nReplaying %d steps over a %dx%d view of %s\n",
+                   n_steps, biw, bih, ii->filename);
+
+    for (i=0; i<n_steps; ++i) {
+        center_line = steps[i].line;
+        center_samp = steps[i].samp;
+        zoom = steps[i].zoom;
+
+        double start = wall_clock();
+        render_big_image(ii, bdata, biw, bih);
+        double ms = (wall_clock() - start)*1000.;
+
+        total += ms;
+        if (ms > worst)
+            worst = ms;
+        if (ms > FRAME_BUDGET_MS)
+            ++n_slow;
+
+        if (steps[i].pause_ms > 0)
+            g_usleep(steps[i].pause_ms*1000);
+    }
+
+    asfPrintStatus("\n   Frames:                %8d\n", n_steps);
+    asfPrintStatus("   Average frame:         %8.1f ms\n",
+                   n_steps > 0 ? total/n_steps : 0);
+    asfPrintStatus("   Slowest frame:         %8.1f ms\n", worst);
+    asfPrintStatus("   Frames over %.1f ms:   %8d\n",
+                   FRAME_BUDGET_MS, n_slow);
+    asfPrintStatus("   Tiles read on demand:  %8d\n", ii->data_ci->n_loads);
+    asfPrintStatus("   Tiles read ahead:      %8d\n",
+                   ii->data_ci->n_prefetched);
+    asfPrintStatus("   Tiles in memory:       %8d (budget: %d)\n\n",
+                   ii->data_ci->n_tiles, ii->data_ci->max_tiles);
+
+    FREE(bdata);
+    FREE(steps);
+}
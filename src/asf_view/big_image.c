@@ -744,16 +744,11 @@ static void add_north_arrow(GdkPixbuf *pb, ImageInfo *ii)
   put_line(pb, y0, x0, y1, x1, GREEN, ii);
 }
 
-GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
+// Fill in the RGB values of the big image (biw x bih pixels, at the
+// current zoom and center), without any of the overlays
+void render_big_image(ImageInfo *ii, unsigned char *bdata, int biw, int bih)
 {
-    assert(ii->data_ci);
-    assert(ii->meta);
-
-    int i, j, k, m, n;
-    int nchan = 3; // RGB for now, don't support RGBA yet
-    int biw = get_big_image_width_sub();
-    int bih = get_big_image_height_sub();
-    unsigned char *bdata = MALLOC(sizeof(unsigned char)*biw*bih*nchan);
+    int i, j, m, n;
     int background_red=0, background_blue=0, background_green=0;
 
     // kludge! When showing the startup image, change the background
@@ -767,6 +762,11 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
     }
 
     if (!mask) {
+        // when zoomed out, draw from the coarsest overview level that
+        // still has a pixel for every screen pixel, when there is one
+        int k;
+        CachedImage *ci = cached_image_for_zoom(ii->data_ci, zoom, &k);
+
         int mm = 0;
         for (i=0; i<bih; ++i) {
             for (j=0; j<biw; ++j) {
@@ -783,7 +783,12 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
                 else {
                     // here we have some averaging, that will make the
                     // images look a bit smoother when zoomed out
-                    if (zoom<2) {
+                    if (k>0) {
+                        // overview pixels are already averages
+                        cached_image_get_rgb(ci, (int)floor(l) >> k,
+                            (int)floor(s) >> k, &r, &g, &b);
+                    }
+                    else if (zoom<2) {
                         // one-to-one (or thereabouts) view -- no averaging
                         cached_image_get_rgb(ii->data_ci, (int)floor(l),
                             (int)floor(s), &r, &g, &b);
@@ -850,6 +855,7 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
         }
     }
     else { // mask applied
+        ii->data_ci->overview_level = 0;
         // this code is largely the same as above except we need to
         // check for ignored values before populating a pixel
         int mm = 0;
@@ -916,6 +922,31 @@ GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
             }
         }
     }
+
+    // now that what's on screen is loaded, let the cache read ahead
+    double l0, l1, samp;
+    img2ls(0, 0, &l0, &samp);
+    img2ls(0, bih-1, &l1, &samp);
+    cached_image_set_viewport(ii->data_ci, (int)floor(l0),
+                              (int)ceil(l1 + 2*zoom));
+    if (mask)
+        cached_image_set_viewport(mask->data_ci, (int)floor(l0),
+                                  (int)ceil(l1 + 2*zoom));
+}
+
+GdkPixbuf * make_big_image(ImageInfo *ii, int show_crosshair)
+{
+    assert(ii->data_ci);
+    assert(ii->meta);
+
+    int i, j, k;
+    int nchan = 3; // RGB for now, don't support RGBA yet
+    int biw = get_big_image_width_sub();
+    int bih = get_big_image_height_sub();
+    unsigned char *bdata = MALLOC(sizeof(unsigned char)*biw*bih*nchan);
+
+    render_big_image(ii, bdata, biw, bih);
+
     // Create the pixbuf
     GdkPixbuf *pb =
         gdk_pixbuf_new_from_data(bdata, GDK_COLORSPACE_RGB, FALSE, 
@@ -40,12 +40,30 @@ round (double arg)
 
 #include "asf_glib.h"
 
-// at 64MB tiles, this is ~1.5GB
-static const int MAX_TILES = 24;
+// Default memory budget for the cache: at 64MB tiles, this is 24 tiles
+static const int DEFAULT_CACHE_MB = 1536;
+
+// How many tiles past the edge of the screen to read ahead
+static const int PREFETCH_AHEAD = 2;
 
 // quit blathering?
 int quiet = FALSE;
 
+typedef struct {
+    int tile;
+    unsigned char *data;
+} TileRequest;
+
+struct CachePrefetcher {
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    GQueue *queue;          // TileRequests waiting to be read
+    TileRequest *busy;      // The one being read right now
+    GQueue *ready;          // Read, waiting for the GUI to pick them up
+    int quit;
+};
+
 static int data_size(CachedImage *self)
 {
     switch (self->data_type) {
@@ -63,139 +81,463 @@ static int data_size(CachedImage *self)
     }
 }
 
-static void print_cache_size(CachedImage *self)
+static size_t tile_bytes(CachedImage *self)
 {
-    int i;
-    int size=0;
-    int ds = data_size(self);
-    for (i=0; i<self->n_tiles; ++i)
-        size += ds*self->rows_per_tile*self->ns;
+    return (size_t)data_size(self)*self->ns*self->rows_per_tile;
+}
 
+static void print_cache_size(CachedImage *self)
+{
     asfPrintStatus("Cache size is %.1f megabytes.\n",
-        (float)size/1024./1024.);
+        (float)self->n_tiles*tile_bytes(self)/1024./1024.);
 }
 
-static unsigned char *get_pixel(CachedImage *self, int line, int samp)
+// Read rows straight from the file, bypassing the cache.  The client's
+// read functions aren't reentrant, so this is the only way any thread
+// should call them.
+void cached_image_read_rows(CachedImage *self, int row_start, int n_rows,
+                            unsigned char *dest)
 {
-    // check if outside the image
-    static unsigned char zero = 0;
-    if (line<0 || samp<0 || line >= self->nl || samp >= self->ns)
-        return &zero;
+    g_mutex_lock(&self->read_lock);
+    self->client->read_fn(row_start, n_rows, (void*)dest,
+        self->client->read_client_info, self->meta, self->client->data_type);
+    g_mutex_unlock(&self->read_lock);
+}
 
-    // size of each pixel
-    int ds = data_size(self);
+int cached_image_pixel_size(CachedImage *self)
+{
+    return data_size(self);
+}
 
-    int i;
-    for (i=0; i<self->n_tiles; ++i) {
-        int rs = self->rowstarts[i];
-        if (rs >= 0) {
-            if (line >= rs && line < rs+self->rows_per_tile) {
-                // found the right cache
-                assert(self->cache[i]);
-
-                // this probably won't ever happen, but here we go anyway
-                if (self->n_access > 1024*1024*1024) {
-                    asfPrintStatus("Resetting n_access.\n");
-                    for (i=0; i<self->n_tiles; ++i)
-                        self->access_counts[i] = 0;
-                    self->n_access = 1;
-                }
-
-                // mark this as the most recently accessed
-                self->access_counts[i] = self->n_access++;
-
-                // return pointer to the cached value
-                return &self->cache[i][((line-rs)*self->ns + samp)*ds];
+// Read an image tile from the file.  Called from both the GUI thread
+// and the prefetch thread.
+static void read_tile(CachedImage *self, int tile, unsigned char *data)
+{
+    int rs = tile * self->rows_per_tile;
+
+    // ensure we don't read past the end of the file
+    int rows_to_get = self->rows_per_tile;
+    if (rs + self->rows_per_tile > self->nl)
+        rows_to_get = self->nl - rs;
+
+    // clear out the tile -- we may not fill it up, if we are near the end
+    // of the file, and we don't want old data to appear
+    memset(data, 0, tile_bytes(self));
+
+    cached_image_read_rows(self, rs, rows_to_get, data);
+}
+
+//---------------------------------------------------------------------------
+// The tile table: tile_spot[] maps image tiles to spots, and the spots
+// are kept on a doubly linked list in order of use.
+
+static void lru_unlink(CachedImage *self, int spot)
+{
+    int p = self->lru_prev[spot], n = self->lru_next[spot];
+    if (p >= 0) self->lru_next[p] = n; else self->lru_head = n;
+    if (n >= 0) self->lru_prev[n] = p; else self->lru_tail = p;
+}
+
+static void lru_push_front(CachedImage *self, int spot)
+{
+    self->lru_prev[spot] = -1;
+    self->lru_next[spot] = self->lru_head;
+    if (self->lru_head >= 0)
+        self->lru_prev[self->lru_head] = spot;
+    else
+        self->lru_tail = spot;
+    self->lru_head = spot;
+}
+
+static void install_tile(CachedImage *self, int tile, unsigned char *data)
+{
+    int spot;
+    for (spot=0; spot<self->n_spots; ++spot)
+        if (!self->cache[spot])
+            break;
+    assert(spot < self->n_spots);
+    assert(self->tile_spot[tile] < 0);
+
+    self->cache[spot] = data;
+    self->rowstarts[spot] = tile * self->rows_per_tile;
+    self->tile_spot[tile] = spot;
+    lru_push_front(self, spot);
+}
+
+// Take the given spot's buffer out of the table
+static unsigned char *evict_spot(CachedImage *self, int spot)
+{
+    unsigned char *data = self->cache[spot];
+    self->tile_spot[self->rowstarts[spot] / self->rows_per_tile] = -1;
+    self->rowstarts[spot] = -1;
+    self->cache[spot] = NULL;
+    lru_unlink(self, spot);
+    return data;
+}
+
+// Get a buffer for a new tile without going over the memory budget,
+// giving up the least recently used tile if need be.  Tiles wanted on
+// screen always get a buffer.  Tiles that are only being read ahead don't
+// get the last one we're allowed to allocate, and don't push out the most
+// recently used tile or any that are on screen; NULL is returned instead.
+static unsigned char *get_buffer(CachedImage *self, int for_screen)
+{
+    int reserve = for_screen ? 0 : 1;
+
+    if (self->n_spare > 0)
+        return self->spare[--self->n_spare];
+
+    if (!self->reached_max_tiles && self->n_tiles + reserve < self->max_tiles)
+    {
+        unsigned char *data = malloc(tile_bytes(self));
+        if (data) {
+            ++self->n_tiles;
+            if (self->n_tiles == self->max_tiles) {
+                if (!quiet)
+                    asfPrintStatus("Fully loaded with %d tiles.\n",
+                                   self->n_tiles);
+                print_cache_size(self);
+                self->reached_max_tiles = TRUE;
             }
+            return data;
         }
+        // if this is the first tile -- abort, we are out of memory
+        if (self->n_tiles == 0)
+            asfPrintError("Failed to allocate cache of %ld bytes.\n"
+                          "Out of memory.\n", (long)tile_bytes(self));
+        // couldn't allocate the next tile -- must dump existing
+        if (!quiet)
+            asfPrintStatus("reached max # of tiles: %d\n", self->n_tiles);
+        print_cache_size(self);
+        self->max_tiles = self->n_tiles;
+        self->reached_max_tiles = TRUE;
     }
 
-    int spot = 0;
-    if (!self->reached_max_tiles) {
-        assert(self->cache[self->n_tiles] == NULL);
-        unsigned char *data = malloc(ds*self->ns*self->rows_per_tile);
-        if (!data) {
-            // if this is the first tile -- abort, we are out of memory
-            if (self->n_tiles == 0)
-                asfPrintError("Failed to allocate cache of %ld bytes.\n"
-                              "Out of memory.\n",
-                              ds*self->ns*self->rows_per_tile);
-            // couldn't allocate the next tile -- must dump existing
-            if (!quiet)
-                asfPrintStatus("reached max # of tiles: %d\n", self->n_tiles);
-            print_cache_size(self);
-            self->reached_max_tiles = TRUE;
-        } else {
-            spot = self->n_tiles;
-            self->cache[spot] = data;
-            ++self->n_tiles;
-        }
+    if (self->lru_tail >= 0) {
+        int spot = self->lru_tail;
+        int tile = self->rowstarts[spot] / self->rows_per_tile;
+        if (for_screen || (self->lru_head != spot &&
+            (tile < self->view_first_tile || tile > self->view_last_tile)))
+            return evict_spot(self, spot);
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// The prefetch thread.
+
+static gpointer prefetch_thread(gpointer user_data)
+{
+    CachedImage *self = (CachedImage*)user_data;
+    CachePrefetcher *pf = self->prefetcher;
+
+    g_mutex_lock(&pf->lock);
+    for (;;) {
+        while (!pf->quit && g_queue_is_empty(pf->queue))
+            g_cond_wait(&pf->cond, &pf->lock);
+        if (pf->quit)
+            break;
+
+        pf->busy = (TileRequest*)g_queue_pop_head(pf->queue);
+        g_mutex_unlock(&pf->lock);
+
+        read_tile(self, pf->busy->tile, pf->busy->data);
+
+        g_mutex_lock(&pf->lock);
+        g_queue_push_tail(pf->ready, pf->busy);
+        pf->busy = NULL;
+        g_cond_broadcast(&pf->cond);
     }
+    g_mutex_unlock(&pf->lock);
+
+    return NULL;
+}
+
+static void start_prefetcher(CachedImage *self)
+{
+    CachePrefetcher *pf = MALLOC(sizeof(CachePrefetcher));
+    g_mutex_init(&pf->lock);
+    g_cond_init(&pf->cond);
+    pf->queue = g_queue_new();
+    pf->ready = g_queue_new();
+    pf->busy = NULL;
+    pf->quit = FALSE;
+    self->prefetcher = pf;
+    pf->thread = g_thread_new("cache_prefetch", prefetch_thread, self);
+}
 
-    if (self->reached_max_tiles) {
-        // dump an existing cached tile
-        // not found in the cache -- find least used spot
-        int least_access_count = self->access_counts[0];
-        for (i=0; i<self->n_tiles; ++i) {
-            if (self->access_counts[i] < least_access_count) {
-                least_access_count = self->access_counts[i];
-                spot = i;
+// Move tiles the prefetcher has finished into the tile table.
+// Call with the prefetcher's lock held.
+static void adopt_ready_tiles(CachedImage *self)
+{
+    CachePrefetcher *pf = self->prefetcher;
+    TileRequest *req;
+    while ((req = (TileRequest*)g_queue_pop_head(pf->ready)) != NULL) {
+        install_tile(self, req->tile, req->data);
+        ++self->n_prefetched;
+        FREE(req);
+    }
+}
+
+// Is this tile on its way?  Call with the prefetcher's lock held.
+static int tile_requested(CachePrefetcher *pf, int tile)
+{
+    GList *l;
+    if (pf->busy && pf->busy->tile == tile)
+        return TRUE;
+    for (l = pf->queue->head; l; l = l->next)
+        if (((TileRequest*)l->data)->tile == tile)
+            return TRUE;
+    for (l = pf->ready->head; l; l = l->next)
+        if (((TileRequest*)l->data)->tile == tile)
+            return TRUE;
+    return FALSE;
+}
+
+// Take back the buffers of requests that haven't been started yet.
+// Call with the prefetcher's lock held.
+static void cancel_requests(CachedImage *self)
+{
+    CachePrefetcher *pf = self->prefetcher;
+    TileRequest *req;
+    while ((req = (TileRequest*)g_queue_pop_head(pf->queue)) != NULL) {
+        self->spare[self->n_spare++] = req->data;
+        FREE(req);
+    }
+}
+
+// The GUI needs this tile now.  If the prefetcher has it, or is reading
+// it, wait for it, and put it in the table along with anything else the
+// prefetcher has finished.
+static void collect_prefetched(CachedImage *self, int tile)
+{
+    CachePrefetcher *pf = self->prefetcher;
+    if (!pf)
+        return;
+
+    g_mutex_lock(&pf->lock);
+    if (tile_requested(pf, tile)) {
+        GList *l;
+        // move the request to the front, if it hasn't been started
+        for (l = pf->queue->head; l; l = l->next) {
+            if (((TileRequest*)l->data)->tile == tile) {
+                TileRequest *req = (TileRequest*)l->data;
+                g_queue_delete_link(pf->queue, l);
+                g_queue_push_head(pf->queue, req);
+                break;
             }
         }
+        g_cond_broadcast(&pf->cond);
+        while ((pf->busy && pf->busy->tile == tile) ||
+               (!g_queue_is_empty(pf->queue) &&
+                ((TileRequest*)g_queue_peek_head(pf->queue))->tile == tile))
+            g_cond_wait(&pf->cond, &pf->lock);
     }
+    adopt_ready_tiles(self);
+    g_mutex_unlock(&pf->lock);
+}
 
-    if (!self->reached_max_tiles && self->n_tiles == MAX_TILES) {
-        if (!quiet)
-            asfPrintStatus("Fully loaded with %d tiles.\n", self->n_tiles);
-        print_cache_size(self);
-        self->reached_max_tiles = TRUE;
+// We're out of memory, and all of it is with the prefetcher.  (This can
+// only happen if the memory budget had to be cut because malloc failed.)
+// Stop it, and take everything back.
+static void reclaim_buffers(CachedImage *self)
+{
+    CachePrefetcher *pf = self->prefetcher;
+    if (!pf)
+        return;
+
+    g_mutex_lock(&pf->lock);
+    cancel_requests(self);
+    while (pf->busy)
+        g_cond_wait(&pf->cond, &pf->lock);
+    adopt_ready_tiles(self);
+    g_mutex_unlock(&pf->lock);
+}
+
+// The tiles to read ahead, given what is on screen
+static int tiles_to_prefetch(CachedImage *self, int *tiles)
+{
+    int i, n=0;
+    for (i=1; i<=PREFETCH_AHEAD; ++i) {
+        int tile;
+        if (self->pan_direction > 0)
+            tile = self->view_last_tile + i;
+        else if (self->pan_direction < 0)
+            tile = self->view_first_tile - i;
+        else // don't know yet, so try both directions
+            tile = i%2 ? self->view_last_tile + (i+1)/2
+                       : self->view_first_tile - i/2;
+
+        if (tile >= 0 && tile < self->n_image_tiles &&
+            self->tile_spot[tile] < 0)
+            tiles[n++] = tile;
     }
+    return n;
+}
+
+void cached_image_set_viewport(CachedImage *self, int first_line,
+                               int last_line)
+{
+    int i, n, first_tile, last_tile;
+    int tiles[PREFETCH_AHEAD];
+
+    // if we're drawing from an overview, that's what needs reading ahead
+    if (self->overview_level > 0) {
+        int k = self->overview_level;
+        cached_image_set_viewport(overview_level(self->overview, k),
+            first_line >> k, last_line >> k);
+        return;
+    }
+
+    if (first_line < 0) first_line = 0;
+    if (last_line >= self->nl) last_line = self->nl - 1;
+    if (last_line < first_line)
+        return;
+    first_tile = first_line / self->rows_per_tile;
+    last_tile = last_line / self->rows_per_tile;
+
+    // which way are we going?
+    if (self->view_first_tile >= 0) {
+        int was = self->view_first_tile + self->view_last_tile;
+        if (first_tile + last_tile > was)
+            self->pan_direction = 1;
+        else if (first_tile + last_tile < was)
+            self->pan_direction = -1;
+    }
+    self->view_first_tile = first_tile;
+    self->view_last_tile = last_tile;
+
+    // the prefetcher needs at least a tile of its own, and one for the
+    // screen, and isn't needed at all if everything is already loaded
+    if (self->max_tiles < 3 || self->client->require_full_load)
+        return;
+    n = tiles_to_prefetch(self, tiles);
+    if (n == 0 && !self->prefetcher)
+        return;
+
+    if (!self->prefetcher)
+        start_prefetcher(self);
+    CachePrefetcher *pf = self->prefetcher;
+
+    g_mutex_lock(&pf->lock);
+
+    // forget about where we were going before
+    cancel_requests(self);
+    adopt_ready_tiles(self);
+
+    for (i=0; i<n; ++i) {
+        if (self->tile_spot[tiles[i]] >= 0 || tile_requested(pf, tiles[i]))
+            continue;
+
+        unsigned char *data = get_buffer(self, FALSE);
+        if (!data)
+            break;
+
+        TileRequest *req = MALLOC(sizeof(TileRequest));
+        req->tile = tiles[i];
+        req->data = data;
+        g_queue_push_tail(pf->queue, req);
+    }
+    g_cond_broadcast(&pf->cond);
+    g_mutex_unlock(&pf->lock);
+}
+
+static unsigned char *get_pixel(CachedImage *self, int line, int samp)
+{
+    // check if outside the image
+    // (big enough for any data type: see data_size())
+    static unsigned char zero[12];
+    if (line<0 || samp<0 || line >= self->nl || samp >= self->ns)
+        return zero;
 
-    // load info from file
-    assert(spot >= 0 && spot < self->n_tiles);
-    assert(self->cache[spot] != NULL);
+    // size of each pixel
+    int ds = data_size(self);
 
-    // clear out the cache -- we may not fill up the tile, if
-    // we are near the end of the file, and we don't want old data
-    // to appear
-    int ns = self->ns;
-    memset(self->cache[spot], 0, ds*ns*self->rows_per_tile);
+    int tile = line / self->rows_per_tile;
+    int spot = self->tile_spot[tile];
 
-    // update where this cache entry starts
-    int rs = (line / self->rows_per_tile) * self->rows_per_tile;
-    self->rowstarts[spot] = rs;
+    if (spot < 0) {
+        // not in memory -- maybe the prefetcher has it
+        collect_prefetched(self, tile);
+        spot = self->tile_spot[tile];
 
-    // mark this tile as the most recently accessed
-    self->access_counts[spot] = self->n_access++;
+        if (spot < 0) {
+            unsigned char *data = get_buffer(self, TRUE);
+            if (!data) {
+                reclaim_buffers(self);
+                data = get_buffer(self, TRUE);
+            }
+            assert(data);
 
-    //printf("Updated entry #%d:\n"
-    //    "     row start: %d\n"
-    //    "     row end: %d\n"
-    //    "     access count: %d\n", spot,
-    //    rs, rs+self->rows_per_tile-1, self->access_counts[spot]);
+            if (!quiet) {
+                int rs = tile * self->rows_per_tile;
+                int re = rs + self->rows_per_tile;
+                asfPrintStatus("Cache: loading rows %d-%d\n",
+                    rs, re > self->nl ? self->nl : re);
+            }
 
-    // ensure we don't read past the end of the file
-    int rows_to_get = self->rows_per_tile;
-    if (rs + self->rows_per_tile > self->nl)
-        rows_to_get = self->nl - rs;
+            read_tile(self, tile, data);
+            ++self->n_loads;
+            install_tile(self, tile, data);
+            spot = self->tile_spot[tile];
+        }
+    }
+    else if (spot != self->lru_head) {
+        // mark this as the most recently accessed
+        lru_unlink(self, spot);
+        lru_push_front(self, spot);
+    }
+
+    // return pointer to the cached value
+    return &self->cache[spot][((line-self->rowstarts[spot])*self->ns + samp)*ds];
+}
 
-    if (!quiet) {
-        asfPrintStatus("Cache: loading into spot #%d: rows %d-%d\n",
-            spot, rs, rs+rows_to_get);
-        //print_cache_size(self);
+CachedImage *cached_image_for_zoom(CachedImage *self, double zoom,
+                                   int *level)
+{
+    // overviews hold averaged data values, which mean nothing when a look
+    // up table is applied (e.g., to a classification)
+    int k = 0;
+    if (!have_lut()) {
+        int n_levels = overview_n_levels(self->overview);
+        while (k < n_levels && zoom >= (double)(2 << k))
+            ++k;
     }
 
-    self->client->read_fn(rs, rows_to_get, (void*)(self->cache[spot]),
-        self->client->read_client_info, self->meta, self->client->data_type);
+    CachedImage *ci = k > 0 ? overview_level(self->overview, k) : NULL;
+    if (!ci) {
+        ci = self;
+        k = 0;
+    }
 
-    assert((line-rs)*self->ns + samp <= self->ns*self->rows_per_tile);
-    return &self->cache[spot][((line-rs)*self->ns + samp)*ds];
+    self->overview_level = k;
+    *level = k;
+    return ci;
 }
 
 void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
                          void *dest_void)
 {
-    if (self->entire_image_fits || !self->client->thumb_fn) {
+    int sf = self->meta->general->line_count / thumb_size_y;
+    int level;
+    CachedImage *ci = cached_image_for_zoom(self, sf, &level);
+    self->overview_level = 0;
+
+    if (level > 0) {
+        // The overviews are already built -- sample the coarsest level
+        // that will do.
+        int ds = data_size(self);
+        unsigned char *dest = (unsigned char*)dest_void;
+        int i,j;
+        for (i=0; i<thumb_size_y; ++i) {
+            for (j=0; j<thumb_size_x; ++j) {
+                unsigned char *p =
+                    get_pixel(ci, (i*sf) >> level, (j*sf) >> level);
+                memcpy(dest+(i*thumb_size_x+j)*ds, p, ds);
+            }
+        }
+    }
+    else if (self->entire_image_fits || !self->client->thumb_fn) {
         // Either we don't have thumbnailing support from the client,
         // or the image will fit entirely in memory.  In both cases, we
         // can just call get_pixel() on the subset necessary to show
@@ -206,7 +548,6 @@ void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
         unsigned char *dest = (unsigned char*)dest_void;
 
         // this will fill the cache with the image data
-        int sf = self->meta->general->line_count / thumb_size_y;
         //assert(sf == self->meta->general->sample_count / thumb_size_x);
 
         // supress the "populating cache" msgs when loading the whole thing
@@ -224,21 +565,21 @@ void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
 
         quiet=FALSE;
     } else {
+        g_mutex_lock(&self->read_lock);
         self->client->thumb_fn(thumb_size_x, thumb_size_y,
             self->meta, self->client->read_client_info, dest_void,
             self->client->data_type);
+        g_mutex_unlock(&self->read_lock);
     }
 }
 
-CachedImage * cached_image_new_from_file(
-    const char *file, meta_parameters *meta, ClientInterface *client,
+CachedImage * cached_image_new_from_client(
+    meta_parameters *meta, ClientInterface *client,
     ImageStats *stats, ImageStatsRGB *stats_r, ImageStatsRGB *stats_g,
-    ImageStatsRGB *stats_b)
+    ImageStatsRGB *stats_b, double budget_mb, int verbose)
 {
     CachedImage *self = MALLOC(sizeof(CachedImage));
 
-    asfPrintStatus("Opening cache: %s\n", file);
-
     self->data_type = client->data_type;
     assert(self->data_type != UNDEFINED);
 
@@ -254,7 +595,8 @@ CachedImage * cached_image_new_from_file(
     // line line_count may have been fudges, if we are multilooking
     self->nl = meta->general->line_count;
     self->ns = meta->general->sample_count;
-    asfPrintStatus("Image is %dx%d LxS\n", self->nl, self->ns);
+    if (verbose)
+        asfPrintStatus("Image is %dx%d LxS\n", self->nl, self->ns);
 
     if (client->require_full_load) {
         // Use only 1 tile -- load entire image into it
@@ -270,11 +612,29 @@ CachedImage * cached_image_new_from_file(
         // test line -- uncomment this for very small tiles
         //self->rows_per_tile = 2*1024*1024 / (self->ns*data_size(self));
     }
+    if (self->rows_per_tile > self->nl)
+        self->rows_per_tile = self->nl > 0 ? self->nl : 1;
 
-    asfPrintStatus("Using %d rows per tile.\n", self->rows_per_tile);
+    if (verbose)
+        asfPrintStatus("Using %d rows per tile.\n", self->rows_per_tile);
 
     int n_tiles_required = (int)ceil((double)self->nl / self->rows_per_tile);
-    self->entire_image_fits = n_tiles_required <= MAX_TILES;
+    self->n_image_tiles = n_tiles_required;
+
+    // how many tiles can we have?
+    if (client->require_full_load) {
+        self->max_tiles = 1;
+    } else {
+        self->max_tiles = (int)(budget_mb*1024.*1024. / tile_bytes(self));
+        if (self->max_tiles < 1)
+            self->max_tiles = 1;
+        if (self->max_tiles > n_tiles_required)
+            self->max_tiles = n_tiles_required;
+        if (verbose)
+            asfPrintStatus("Cache memory budget: %.0f megabytes (%d tiles).\n",
+                budget_mb, self->max_tiles);
+    }
+    self->entire_image_fits = n_tiles_required <= self->max_tiles;
     // self->entire_image_fits = FALSE; // uncomment to test thumb_fn
 
     // at the beginning, we have no tiles
@@ -282,21 +642,60 @@ CachedImage * cached_image_new_from_file(
     self->reached_max_tiles = FALSE;
 
     int i;
-    self->rowstarts = MALLOC(sizeof(int)*MAX_TILES);
-    self->cache = MALLOC(sizeof(float*)*MAX_TILES);
-    self->access_counts = MALLOC(sizeof(int)*MAX_TILES);
-    for (i=0; i<MAX_TILES; ++i) {
+    self->n_spots = self->max_tiles;
+    self->rowstarts = MALLOC(sizeof(int)*self->n_spots);
+    self->cache = MALLOC(sizeof(unsigned char*)*self->n_spots);
+    self->lru_prev = MALLOC(sizeof(int)*self->n_spots);
+    self->lru_next = MALLOC(sizeof(int)*self->n_spots);
+    self->spare = MALLOC(sizeof(unsigned char*)*self->n_spots);
+    for (i=0; i<self->n_spots; ++i) {
         self->rowstarts[i] = -1;
         self->cache[i] = NULL;
-        self->access_counts[i] = 0;
+        self->lru_prev[i] = self->lru_next[i] = -1;
     }
+    self->lru_head = self->lru_tail = -1;
+    self->n_spare = 0;
+
+    self->tile_spot = MALLOC(sizeof(int)*n_tiles_required);
+    for (i=0; i<n_tiles_required; ++i)
+        self->tile_spot[i] = -1;
+
+    self->view_first_tile = self->view_last_tile = -1;
+    self->pan_direction = 0;
+    self->prefetcher = NULL;
+    g_mutex_init(&self->read_lock);
+    self->n_loads = self->n_prefetched = 0;
+    self->overview = NULL;
+    self->overview_level = 0;
+
+    if (verbose) {
+        asfPrintStatus("Number of tiles required for the entire image: %d\n",
+            n_tiles_required);
+        asfPrintStatus("Fits in memory: %s\n",
+            self->entire_image_fits ? "Yes" : "No");
+    }
+
+    return self;
+}
+
+CachedImage * cached_image_new_from_file(
+    const char *file, meta_parameters *meta, ClientInterface *client,
+    ImageStats *stats, ImageStatsRGB *stats_r, ImageStatsRGB *stats_g,
+    ImageStatsRGB *stats_b)
+{
+    asfPrintStatus("Opening cache: %s\n", file);
+
+    double budget_mb = DEFAULT_CACHE_MB;
+    const char *env = getenv("ASF_VIEW_CACHE_MB");
+    if (env && atof(env) > 0)
+        budget_mb = atof(env);
 
-    self->n_access = 0;
+    CachedImage *self = cached_image_new_from_client(meta, client,
+        stats, stats_r, stats_g, stats_b, budget_mb, TRUE);
 
-    asfPrintStatus("Number of tiles required for the entire image: %d\n",
-        n_tiles_required);
-    asfPrintStatus("Fits in memory: %s\n",
-        self->entire_image_fits ? "Yes" : "No");
+    // Zoomed out views come from the overview pyramid, if we need one
+    if (!self->entire_image_fits && !client->require_full_load)
+        self->overview = overview_open(self, budget_mb);
 
     return self;
 }
@@ -399,24 +798,65 @@ void cached_image_get_rgb_float(CachedImage *self, int line, int samp,
     }
 }
 
+static void stop_prefetcher(CachedImage *self)
+{
+    CachePrefetcher *pf = self->prefetcher;
+    TileRequest *req;
+
+    g_mutex_lock(&pf->lock);
+    pf->quit = TRUE;
+    g_cond_broadcast(&pf->cond);
+    g_mutex_unlock(&pf->lock);
+    g_thread_join(pf->thread);
+
+    // drop whatever was read ahead and never used
+    while ((req = (TileRequest*)g_queue_pop_head(pf->queue)) != NULL) {
+        free(req->data);
+        FREE(req);
+    }
+    while ((req = (TileRequest*)g_queue_pop_head(pf->ready)) != NULL) {
+        free(req->data);
+        FREE(req);
+    }
+    g_queue_free(pf->queue);
+    g_queue_free(pf->ready);
+    g_cond_clear(&pf->cond);
+    g_mutex_clear(&pf->lock);
+    FREE(pf);
+    self->prefetcher = NULL;
+}
+
 void cached_image_free (CachedImage *self)
 {
     int i;
-    for (i=0; i<self->n_tiles; ++i) {
+
+    // this may be busy reading from us
+    if (self->overview)
+        overview_free(self->overview);
+
+    if (self->prefetcher)
+        stop_prefetcher(self);
+
+    for (i=0; i<self->n_spots; ++i) {
         if (self->cache[i])
             free(self->cache[i]);
     }
+    for (i=0; i<self->n_spare; ++i)
+        free(self->spare[i]);
 
     if (self->client->free_fn)
       self->client->free_fn(self->client->read_client_info);
 
     free(self->rowstarts);
-    free(self->access_counts);
+    free(self->lru_prev);
+    free(self->lru_next);
+    free(self->tile_spot);
+    free(self->spare);
     free(self->cache);
     free(self->client);
+    g_mutex_clear(&self->read_lock);
 
     // we do not own the metadata -- don't free it!
 
     free(self);
 }
-
@@ -94,17 +94,48 @@ typedef struct {
 //---------------------------------------------------------------------------
 // Here is the ImageCache stuff.  The global ImageCache that holds the
 // loaded image is "data_ci".  This is all private data.
+//
+// The image is cached in tiles of rows_per_tile full-width rows.  At most
+// max_tiles of them are held in memory (the budget is ASF_VIEW_CACHE_MB
+// megabytes, default 1.5GB); when that is reached, the least recently used
+// tile is reused.  A background thread reads the tiles just past the
+// viewport, in the direction the user is panning, so that they are usually
+// already loaded when they scroll into view.  Only the GUI thread touches
+// the tile table itself -- the prefetcher reads into buffers it has been
+// handed, which are put in the table the next time the GUI looks for them.
+//
+// Zoomed out views of images that don't fit are drawn from an overview
+// pyramid (see overview.c), which is itself a set of CachedImages.
+
+typedef struct CachePrefetcher CachePrefetcher;
+typedef struct Overview Overview;
+
 typedef struct {
   int nl, ns;               // Image dimensions.
   ClientInterface *client;  // pointers to data read implementations
-  int n_tiles;              // Number of tiles in memory
+  int n_tiles;              // Number of tile buffers allocated
+  int max_tiles;            // Memory budget, in tiles
   int reached_max_tiles;    // Have we loaded as many tiles as we can?
   int rows_per_tile;        // Number of rows in each tile
   int entire_image_fits;    // TRUE if we can load the entire image
-  int *rowstarts;           // Row numbers starting each tile
+  int n_image_tiles;        // Number of tiles covering the entire image
+  int n_spots;              // Size of the arrays below
+  int *tile_spot;           // Spot holding each image tile, or -1
+  int *rowstarts;           // Row numbers starting each tile (-1 if empty)
   unsigned char **cache;    // Cached values (floats, unsigned chars ...)
-  int *access_counts;       // Updated when a tile is accessed
-  int n_access;             // used to find oldest tile
+  int *lru_prev, *lru_next; // Spots in order of use, most recent first
+  int lru_head, lru_tail;
+  int n_spare;              // Buffers allocated but not holding a tile
+  unsigned char **spare;
+  int view_first_tile;      // Tiles most recently shown on screen
+  int view_last_tile;
+  int pan_direction;        // +1 panning down, -1 up, 0 don't know yet
+  CachePrefetcher *prefetcher;  // NULL until first needed
+  GMutex read_lock;         // the client's read functions aren't reentrant
+  int n_loads;              // Tiles read while the GUI waited
+  int n_prefetched;         // Tiles that were read ahead of time
+  Overview *overview;       // Reduced resolution levels, NULL if none
+  int overview_level;       // Level last drawn from, 0 for this image
   ssv_data_type_t data_type;// type of data we have
   meta_parameters *meta;    // metadata -- don't own this pointer
   ImageStats *stats;        // not owned by us, not populated by us
@@ -118,6 +149,13 @@ CachedImage * cached_image_new_from_file(
     ImageStats *stats, ImageStatsRGB *stats_r, ImageStatsRGB *stats_g,
     ImageStatsRGB *stats_b);
 
+// Lower level constructor: no status messages, and the caller picks the
+// cache size.  No overviews are built.
+CachedImage * cached_image_new_from_client(
+    meta_parameters *meta, ClientInterface *client,
+    ImageStats *stats, ImageStatsRGB *stats_r, ImageStatsRGB *stats_g,
+    ImageStatsRGB *stats_b, double budget_mb, int verbose);
+
 float cached_image_get_pixel (CachedImage *self, int line, int samp);
 void cached_image_get_rgb(CachedImage *self, int line, int samp,
                           unsigned char *r, unsigned char *g,
@@ -125,9 +163,30 @@ void cached_image_get_rgb(CachedImage *self, int line, int samp,
 void cached_image_get_rgb_float(CachedImage *self, int line, int samp,
                                 float *r, float *g, float *b);
 
+// Tell the cache which lines are on screen, so it can read ahead
+void cached_image_set_viewport(CachedImage *self, int first_line,
+                               int last_line);
+
+// Image to draw from at the given zoom (screen pixels per image pixel),
+// and which overview level that is: line and sample in it are the full
+// resolution ones shifted right by *level.
+CachedImage *cached_image_for_zoom(CachedImage *self, double zoom,
+                                   int *level);
+
+// Raw access, for building overviews
+int cached_image_pixel_size(CachedImage *self);
+void cached_image_read_rows(CachedImage *self, int row_start, int n_rows,
+                            unsigned char *dest);
+
 void load_thumbnail_data(CachedImage *self, int thumb_size_x, int thumb_size_y,
                          void *dest);
 
 void cached_image_free (CachedImage *self);
 
+// overview.c
+Overview *overview_open(CachedImage *base, double budget_mb);
+int overview_n_levels(Overview *ov);
+CachedImage *overview_level(Overview *ov, int k);
+void overview_free(Overview *ov);
+
 #endif
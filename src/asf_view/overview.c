@@ -0,0 +1,570 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "asf.h"
+#include "asf_view.h"
+
+// Overview pyramid for large images.
+//
+// When an image doesn't fit in the cache, drawing it zoomed out means
+// sampling the full resolution image with a stride, which reads most of the
+// file again every time the zoom changes.  Instead, we build reduced
+// resolution copies of the image -- level k is 2^k times smaller in each
+// direction, each pixel the mean of a 2x2 block of the level below -- and
+// draw from the coarsest level that still has a pixel for every screen
+// pixel.
+//
+// The levels are written, once, to a file in the overview directory
+// (ASF_VIEW_OVERVIEW_DIR, or "asf_view" in the user's cache directory),
+// named after a signature of the image's contents, so the next time the
+// same image is opened they are ready right away.  Building happens in a
+// background thread; until it's done, the full resolution image is used.
+// The least recently used files are removed when the directory grows past
+// ASF_VIEW_OVERVIEW_MB megabytes (default 4GB).  Setting ASF_VIEW_OVERVIEWS
+// to 0 turns all of this off.
+
+#define OVERVIEW_MAGIC "ASFVOVR1"
+#define OVERVIEW_VERSION 1
+#define OVERVIEW_BYTE_ORDER 0x01020304
+
+// Stop adding levels once the image is this small, or there are this many
+static const int MIN_LEVEL_SIZE = 256;
+#define MAX_LEVELS 12
+
+// Default limit on the size of the overview directory
+static const int DEFAULT_OVERVIEW_MB = 4096;
+
+// How many rows of the image are sampled for the signature
+static const int SIGNATURE_ROWS = 16;
+
+// Rows are read from the image this many megabytes at a time, so the GUI
+// isn't kept waiting on the read lock for long
+static const int BUILD_CHUNK_MB = 8;
+
+typedef struct {
+    char magic[8];
+    gint32 version;
+    gint32 byte_order;
+    gint32 nl, ns, data_type, n_levels;
+    char sig[44];
+    gint32 level_nl[MAX_LEVELS], level_ns[MAX_LEVELS];
+    gint64 level_offset[MAX_LEVELS];
+} OverviewHeader;
+
+typedef struct {
+    FILE *fp;
+    gint64 offset;
+    int row_bytes;
+} LevelReader;
+
+struct Overview {
+    CachedImage *base;          // don't own this
+    char *file;                 // the file holding the levels
+    double budget_mb;           // cache budget for the levels' images
+    OverviewHeader hdr;
+    CachedImage *levels[MAX_LEVELS];     // level k is levels[k-1]
+    meta_parameters *metas[MAX_LEVELS];
+    GThread *builder;           // NULL if not building
+    volatile gint ready;
+    volatile gint cancel;
+};
+
+// Running state of the build: for each level, the first row of a pair
+// that is waiting for its second row
+typedef struct {
+    Overview *ov;
+    FILE *fp;
+    int nch;                    // channels per pixel
+    int ds;                     // bytes per pixel
+    int floats;                 // TRUE for float data, FALSE for bytes
+    int have_no_data;           // skip no_data values in the means?
+    float no_data;
+    float *pending[MAX_LEVELS+1];
+    int have_pending[MAX_LEVELS+1];
+    int rows_done[MAX_LEVELS+1];
+    float *scratch[MAX_LEVELS+1];
+    unsigned char *out;
+    int failed;
+} Builder;
+
+static int n_channels(ssv_data_type_t data_type)
+{
+    return data_type == RGB_BYTE || data_type == RGB_FLOAT ? 3 : 1;
+}
+
+static int is_float(ssv_data_type_t data_type)
+{
+    return data_type == GREYSCALE_FLOAT || data_type == RGB_FLOAT;
+}
+
+static char *overview_dir(void)
+{
+    const char *env = getenv("ASF_VIEW_OVERVIEW_DIR");
+    if (env && *env)
+        return g_strdup(env);
+    return g_build_filename(g_get_user_cache_dir(), "asf_view", NULL);
+}
+
+// Signature of the image contents: the size and type, plus a few rows
+// spread down the image.  Cheap enough to do every time an image is opened.
+static char *image_signature(CachedImage *base)
+{
+    GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA1);
+    int ds = cached_image_pixel_size(base);
+    unsigned char *row = MALLOC(sizeof(unsigned char)*base->ns*ds);
+    gint32 dims[3];
+    int i;
+
+    dims[0] = base->nl;
+    dims[1] = base->ns;
+    dims[2] = base->data_type;
+    g_checksum_update(sum, (guchar*)dims, sizeof(dims));
+
+    for (i=0; i<SIGNATURE_ROWS; ++i) {
+        int line = (int)((double)i*(base->nl-1)/(SIGNATURE_ROWS-1));
+        memset(row, 0, base->ns*ds);
+        cached_image_read_rows(base, line, 1, row);
+        g_checksum_update(sum, row, base->ns*ds);
+    }
+
+    char *sig = g_strdup(g_checksum_get_string(sum));
+    g_checksum_free(sum);
+    FREE(row);
+    return sig;
+}
+
+static void init_header(OverviewHeader *hdr, CachedImage *base,
+                        const char *sig)
+{
+    int k, nl = base->nl, ns = base->ns;
+    gint64 offset = sizeof(OverviewHeader);
+    int ds = cached_image_pixel_size(base);
+
+    memset(hdr, 0, sizeof(OverviewHeader));
+    memcpy(hdr->magic, OVERVIEW_MAGIC, 8);
+    hdr->version = OVERVIEW_VERSION;
+    hdr->byte_order = OVERVIEW_BYTE_ORDER;
+    hdr->nl = base->nl;
+    hdr->ns = base->ns;
+    hdr->data_type = base->data_type;
+    strncpy_safe(hdr->sig, sig, sizeof(hdr->sig));
+
+    for (k=0; k<MAX_LEVELS && (nl > MIN_LEVEL_SIZE || ns > MIN_LEVEL_SIZE);
+         ++k)
+    {
+        nl = (nl+1)/2;
+        ns = (ns+1)/2;
+        hdr->level_nl[k] = nl;
+        hdr->level_ns[k] = ns;
+        hdr->level_offset[k] = offset;
+        offset += (gint64)nl*ns*ds;
+    }
+    hdr->n_levels = k;
+}
+
+static gint64 overview_file_size(OverviewHeader *hdr, int ds)
+{
+    int k = hdr->n_levels - 1;
+    return hdr->level_offset[k] + (gint64)hdr->level_nl[k]*hdr->level_ns[k]*ds;
+}
+
+// Does the file hold a complete set of levels matching this header?
+static int overview_file_ok(const char *file, OverviewHeader *want, int ds)
+{
+    OverviewHeader hdr;
+    struct stat st;
+
+    if (g_stat(file, &st) != 0 ||
+        (gint64)st.st_size != overview_file_size(want, ds))
+        return FALSE;
+
+    FILE *fp = fopen(file, "rb");
+    if (!fp)
+        return FALSE;
+    int n = fread(&hdr, sizeof(OverviewHeader), 1, fp);
+    fclose(fp);
+
+    return n == 1 && memcmp(&hdr, want, sizeof(OverviewHeader)) == 0;
+}
+
+//---------------------------------------------------------------------------
+// Building
+
+// Load a row of pixels, as floats, from raw image data
+static void unpack_row(Builder *b, unsigned char *raw, int ns, float *row)
+{
+    int i, n = ns*b->nch;
+    if (b->floats)
+        memcpy(row, raw, sizeof(float)*n);
+    else
+        for (i=0; i<n; ++i)
+            row[i] = (float)raw[i];
+}
+
+static void pack_row(Builder *b, float *row, int ns, unsigned char *raw)
+{
+    int i, n = ns*b->nch;
+    if (b->floats)
+        memcpy(raw, row, sizeof(float)*n);
+    else
+        for (i=0; i<n; ++i)
+            raw[i] = (unsigned char)(row[i] + .5);
+}
+
+// Is this a value that shouldn't go into the mean?
+static int skip_value(Builder *b, float f)
+{
+    return b->floats && (isnan(f) || (b->have_no_data && f == b->no_data));
+}
+
+// Average two rows of a level (the second may be missing, at the bottom
+// of an odd-sized level) down to a row of the next level
+static void reduce_rows(Builder *b, float *r1, float *r2, int ns, float *out)
+{
+    int i, j, c, nch = b->nch;
+    int ns_out = (ns+1)/2;
+    float fill = b->have_no_data ? b->no_data : 0;
+
+    for (j=0; j<ns_out; ++j) {
+        for (c=0; c<nch; ++c) {
+            float sum = 0;
+            int n = 0;
+            for (i=0; i<2; ++i) {
+                float *r = i==0 ? r1 : r2;
+                int s;
+                if (!r)
+                    continue;
+                for (s=2*j; s<2*j+2 && s<ns; ++s) {
+                    float f = r[s*nch + c];
+                    if (!skip_value(b, f)) {
+                        sum += f;
+                        ++n;
+                    }
+                }
+            }
+            out[j*nch + c] = n > 0 ? sum/n : fill;
+        }
+    }
+}
+
+// Hand a finished row of level k to the builder: write it out (unless it's
+// the full resolution image), and pair it up to make the next level
+static void push_row(Builder *b, int k, float *row)
+{
+    OverviewHeader *hdr = &b->ov->hdr;
+    int ns = k == 0 ? hdr->ns : hdr->level_ns[k-1];
+
+    if (k > 0 && !b->failed) {
+        gint64 offset = hdr->level_offset[k-1] +
+            (gint64)b->rows_done[k]*ns*b->ds;
+        pack_row(b, row, ns, b->out);
+        if (FSEEK64(b->fp, offset, SEEK_SET) != 0 ||
+            fwrite(b->out, b->ds, ns, b->fp) != (size_t)ns)
+            b->failed = TRUE;
+    }
+    ++b->rows_done[k];
+
+    if (k == hdr->n_levels)
+        return;
+
+    if (b->have_pending[k]) {
+        reduce_rows(b, b->pending[k], row, ns, b->scratch[k+1]);
+        b->have_pending[k] = FALSE;
+        push_row(b, k+1, b->scratch[k+1]);
+    } else {
+        memcpy(b->pending[k], row, sizeof(float)*ns*b->nch);
+        b->have_pending[k] = TRUE;
+    }
+}
+
+// Finish off levels with an odd number of rows, from the bottom up
+static void flush_rows(Builder *b)
+{
+    OverviewHeader *hdr = &b->ov->hdr;
+    int k;
+
+    for (k=0; k<hdr->n_levels; ++k) {
+        if (b->have_pending[k]) {
+            int ns = k == 0 ? hdr->ns : hdr->level_ns[k-1];
+            reduce_rows(b, b->pending[k], NULL, ns, b->scratch[k+1]);
+            b->have_pending[k] = FALSE;
+            push_row(b, k+1, b->scratch[k+1]);
+        }
+    }
+}
+
+// Remove the oldest overview files until the directory is within its limit
+static void prune_overviews(const char *dir, const char *keep)
+{
+    double limit_mb = DEFAULT_OVERVIEW_MB;
+    const char *env = getenv("ASF_VIEW_OVERVIEW_MB");
+    if (env && atof(env) > 0)
+        limit_mb = atof(env);
+
+    GDir *d = g_dir_open(dir, 0, NULL);
+    if (!d)
+        return;
+
+    for (;;) {
+        const char *name;
+        char *oldest = NULL;
+        time_t oldest_time = 0;
+        gint64 total = 0;
+
+        g_dir_rewind(d);
+        while ((name = g_dir_read_name(d)) != NULL) {
+            struct stat st;
+            if (!g_str_has_suffix(name, ".ovr"))
+                continue;
+            char *path = g_build_filename(dir, name, NULL);
+            if (g_stat(path, &st) == 0) {
+                total += st.st_size;
+                if (strcmp(path, keep) != 0 &&
+                    (!oldest || st.st_mtime < oldest_time)) {
+                    g_free(oldest);
+                    oldest = g_strdup(path);
+                    oldest_time = st.st_mtime;
+                }
+            }
+            g_free(path);
+        }
+
+        if (total <= limit_mb*1024.*1024. || !oldest) {
+            g_free(oldest);
+            break;
+        }
+        g_unlink(oldest);
+        g_free(oldest);
+    }
+
+    g_dir_close(d);
+}
+
+static gpointer build_thread(gpointer user_data)
+{
+    Overview *ov = (Overview*)user_data;
+    CachedImage *base = ov->base;
+    OverviewHeader *hdr = &ov->hdr;
+    Builder b;
+    int k, line;
+
+    memset(&b, 0, sizeof(Builder));
+    b.ov = ov;
+    b.nch = n_channels(base->data_type);
+    b.ds = cached_image_pixel_size(base);
+    b.floats = is_float(base->data_type);
+    b.have_no_data = b.floats && meta_is_valid_double(base->meta->general->no_data);
+    b.no_data = b.have_no_data ? (float)base->meta->general->no_data : 0;
+
+    char *tmp = g_strdup_printf("%s.tmp", ov->file);
+    b.fp = fopen(tmp, "wb");
+    if (!b.fp) {
+        g_free(tmp);
+        return NULL;
+    }
+    b.failed = fwrite(hdr, sizeof(OverviewHeader), 1, b.fp) != 1;
+
+    for (k=0; k<=hdr->n_levels; ++k) {
+        int ns = k == 0 ? hdr->ns : hdr->level_ns[k-1];
+        b.pending[k] = MALLOC(sizeof(float)*ns*b.nch);
+        b.scratch[k] = MALLOC(sizeof(float)*ns*b.nch);
+        b.have_pending[k] = FALSE;
+        b.rows_done[k] = 0;
+    }
+    b.out = MALLOC(sizeof(unsigned char)*hdr->ns*b.ds);
+
+    int chunk_rows = BUILD_CHUNK_MB*1024*1024 / (base->ns*b.ds);
+    if (chunk_rows < 1)
+        chunk_rows = 1;
+    unsigned char *chunk = MALLOC(sizeof(unsigned char)*chunk_rows*base->ns*b.ds);
+
+    for (line=0; line<base->nl && !b.failed; line+=chunk_rows) {
+        int i, n = chunk_rows;
+        if (line + n > base->nl)
+            n = base->nl - line;
+
+        if (g_atomic_int_get(&ov->cancel))
+            break;
+
+        memset(chunk, 0, (size_t)n*base->ns*b.ds);
+        cached_image_read_rows(base, line, n, chunk);
+        for (i=0; i<n; ++i) {
+            unpack_row(&b, chunk + (size_t)i*base->ns*b.ds, base->ns,
+                       b.scratch[0]);
+            push_row(&b, 0, b.scratch[0]);
+        }
+    }
+    if (line >= base->nl)
+        flush_rows(&b);
+
+    int ok = line >= base->nl && !b.failed;
+    if (fclose(b.fp) != 0)
+        ok = FALSE;
+
+    if (ok && g_rename(tmp, ov->file) == 0) {
+        char *dir = g_path_get_dirname(ov->file);
+        prune_overviews(dir, ov->file);
+        g_free(dir);
+        g_atomic_int_set(&ov->ready, TRUE);
+    } else {
+        g_unlink(tmp);
+    }
+
+    for (k=0; k<=hdr->n_levels; ++k) {
+        FREE(b.pending[k]);
+        FREE(b.scratch[k]);
+    }
+    FREE(b.out);
+    FREE(chunk);
+    g_free(tmp);
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// Reading the levels back
+
+static int read_level(int row_start, int n_rows_to_get, void *dest,
+                      void *read_client_info, meta_parameters *meta,
+                      int data_type)
+{
+    LevelReader *r = (LevelReader*)read_client_info;
+    gint64 offset = r->offset + (gint64)row_start*r->row_bytes;
+
+    if (FSEEK64(r->fp, offset, SEEK_SET) != 0)
+        return FALSE;
+    return fread(dest, r->row_bytes, n_rows_to_get, r->fp) ==
+        (size_t)n_rows_to_get;
+}
+
+static void free_level_reader(void *read_client_info)
+{
+    LevelReader *r = (LevelReader*)read_client_info;
+    fclose(r->fp);
+    FREE(r);
+}
+
+// Set up a cached image that reads level k out of the overview file
+static CachedImage *open_level(Overview *ov, int k)
+{
+    CachedImage *base = ov->base;
+    OverviewHeader *hdr = &ov->hdr;
+
+    FILE *fp = fopen(ov->file, "rb");
+    if (!fp)
+        return NULL;
+
+    LevelReader *r = MALLOC(sizeof(LevelReader));
+    r->fp = fp;
+    r->offset = hdr->level_offset[k-1];
+    r->row_bytes = hdr->level_ns[k-1]*cached_image_pixel_size(base);
+
+    ClientInterface *client = MALLOC(sizeof(ClientInterface));
+    memset(client, 0, sizeof(ClientInterface));
+    client->read_fn = read_level;
+    client->thumb_fn = NULL;
+    client->free_fn = free_level_reader;
+    client->read_client_info = r;
+    client->data_type = base->data_type;
+    client->require_full_load = FALSE;
+
+    meta_parameters *meta = meta_copy(base->meta);
+    meta->general->line_count = hdr->level_nl[k-1];
+    meta->general->sample_count = hdr->level_ns[k-1];
+    ov->metas[k-1] = meta;
+
+    // the levels together are at most a third the size of the image, so
+    // a quarter of its budget keeps the coarse ones entirely in memory
+    return cached_image_new_from_client(meta, client, base->stats,
+        base->stats_r, base->stats_g, base->stats_b, ov->budget_mb/4, FALSE);
+}
+
+//---------------------------------------------------------------------------
+
+Overview *overview_open(CachedImage *base, double budget_mb)
+{
+    const char *env = getenv("ASF_VIEW_OVERVIEWS");
+    if (env && strcmp(env, "0") == 0)
+        return NULL;
+
+    char *sig = image_signature(base);
+    OverviewHeader hdr;
+    init_header(&hdr, base, sig);
+    if (hdr.n_levels == 0) {
+        g_free(sig);
+        return NULL;
+    }
+
+    char *dir = overview_dir();
+    if (g_mkdir_with_parents(dir, 0755) != 0) {
+        asfPrintWarning("Couldn't create overview directory %s\n", dir);
+        g_free(dir);
+        g_free(sig);
+        return NULL;
+    }
+
+    Overview *ov = MALLOC(sizeof(Overview));
+    memset(ov, 0, sizeof(Overview));
+    ov->base = base;
+    ov->budget_mb = budget_mb;
+    ov->hdr = hdr;
+
+    char *name = g_strdup_printf("%s.ovr", sig);
+    ov->file = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(dir);
+    g_free(sig);
+
+    if (overview_file_ok(ov->file, &hdr, cached_image_pixel_size(base))) {
+        asfPrintStatus("Using overviews from %s\n", ov->file);
+        g_utime(ov->file, NULL);    // for pruning: recently used
+        ov->ready = TRUE;
+    } else {
+        asfPrintStatus("Building %d overview levels in %s\n",
+                       hdr.n_levels, ov->file);
+        ov->builder = g_thread_new("overview_builder", build_thread, ov);
+    }
+
+    return ov;
+}
+
+int overview_n_levels(Overview *ov)
+{
+    if (!ov || !g_atomic_int_get(&ov->ready))
+        return 0;
+    return ov->hdr.n_levels;
+}
+
+CachedImage *overview_level(Overview *ov, int k)
+{
+    assert(k >= 1 && k <= overview_n_levels(ov));
+
+    if (!ov->levels[k-1])
+        ov->levels[k-1] = open_level(ov, k);
+    return ov->levels[k-1];
+}
+
+void overview_free(Overview *ov)
+{
+    int k;
+
+    if (ov->builder) {
+        g_atomic_int_set(&ov->cancel, TRUE);
+        g_thread_join(ov->builder);
+    }
+
+    for (k=0; k<MAX_LEVELS; ++k) {
+        if (ov->levels[k])
+            cached_image_free(ov->levels[k]);
+        if (ov->metas[k])
+            meta_free(ov->metas[k]);
+    }
+
+    g_free(ov->file);
+    FREE(ov);
+}
@@ -2761,6 +2761,8 @@ static int asf_convert_file(char *configFileName, int saveDEM)
   if (!check_config(configFileName, cfg))
     return 0;
 
+  asf_trace_begin("asf_convert");
+
   //---------------------------------------------------------------
   // Let's get to work
   if (strlen(cfg->general->out_name) == 0) {
@@ -2824,7 +2826,9 @@ static int asf_convert_file(char *configFileName, int saveDEM)
       strcpy(cfg->general->out_name, original_output_filename);
     } 
 
+    asf_trace_begin("processing");
     char *result = do_processing(cfg, imported_files[ii], saveDEM);
+    asf_trace_end();
     asfPrintStatus("Result: %s\n", result);
 
     // save the output (pre-export, so it is ASF internal) if it is the
@@ -3431,6 +3435,7 @@ static int asf_convert_file(char *configFileName, int saveDEM)
 
   FREE(first_pre_export);
 
+  asf_trace_end();
   return TRUE;
 }
 
@@ -3,6 +3,22 @@
 #include <asf_vector.h>
 
 
+// Rewrite GeoTIFFs written by export_band_image() as Cloud Optimized
+// GeoTIFFs, in place
+static void convert_to_cog(int nouts, char **outs)
+{
+  int i;
+  for (i=0; i<nouts; ++i) {
+    char *strip_name = MALLOC(sizeof(char)*(strlen(outs[i])+16));
+    sprintf(strip_name, "%s.strip.tmp", outs[i]);
+    if (rename(outs[i], strip_name) != 0)
+      asfPrintError("Could not rename %s to %s\n", outs[i], strip_name);
+    write_cog_tiff(strip_name, outs[i]);
+    remove(strip_name);
+    FREE(strip_name);
+  }
+}
+
 int asf_export(output_format_t format, scale_t sample_mapping,
                char *in_base_name, char *output_name)
 {
@@ -28,6 +44,7 @@ int asf_export_bands(output_format_t format, scale_t sample_mapping, int rgb,
   char *in_meta_name=NULL, *in_data_name=NULL, *out_name=NULL;
 
   asfPrintStatus("Exporting ...\n");
+  asf_trace_begin("asf_export");
 
   meta_parameters *md = NULL;
   int i, nouts = 0, is_polsarpro = 0, is_matrix = 0;
@@ -88,6 +105,18 @@ int asf_export_bands(output_format_t format, scale_t sample_mapping, int rgb,
                         &nouts, &outs);
       
   }
+  else if ( format == COG ) {
+      out_name = MALLOC(sizeof(char)*(strlen(output_name)+32));
+      strcpy(out_name, output_name);
+      if (!is_matrix)
+	append_ext_if_needed(out_name, ".tif", ".tiff");
+      export_band_image(in_meta_name, in_data_name, out_name,
+                        sample_mapping, band_name, rgb,
+                        true_color, false_color,
+                        look_up_table_name, GEOTIFF, use_pixel_is_point,
+                        &nouts, &outs);
+      convert_to_cog(nouts, outs);
+  }
   else if ( format == JPEG ) {
       //in_data_name = appendExt(in_base_name, ".img");
       //in_meta_name = appendExt(in_base_name, ".meta");
@@ -232,6 +261,7 @@ int asf_export_bands(output_format_t format, scale_t sample_mapping, int rgb,
     meta_free(md);
 
   asfPrintStatus("Export successful!\n\n");
+  asf_trace_end();
   return (EXIT_SUCCESS);
 }
 
@@ -265,7 +295,10 @@ write_insar_rgb(output_format_t format, char *in_meta_name, char *in_data_name,
     strcpy(band_name[0], "INTERFEROGRAM_PHASE");
     export_band_image(in_meta_name, in_data_name, out_name,
 		      MINMAX, band_name, FALSE, FALSE, FALSE,
-		      "interferogram.lut", format, 0, &nouts, &outs);
+		      "interferogram.lut", format == COG ? GEOTIFF : format,
+		      0, &nouts, &outs);
+    if (format == COG)
+      convert_to_cog(nouts, outs);
     FREE(band_name[0]);
     FREE(band_name);
     for (ii=0; ii<nouts; ii++)
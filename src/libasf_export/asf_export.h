@@ -50,6 +50,7 @@ typedef enum {
   POLSARPRO_HDR,                // PolsarPro with ENVI header
   HDF,                          // HDF5 - NASA Earth Observation standard
   NC,                           // netCDF - modeler oriented format
+  COG,                          // Cloud Optimized GeoTIFF
   UNKNOWN_OUTPUT_FORMAT
 } output_format_t;
 
@@ -212,6 +213,15 @@ void export_hdf(const char *in_base_name, char *output_file_name,
 // Prototypes from export_geotiff.c
 void export_geotiff(const char *input_file_list, const char *output_file_name);
 
+// Prototypes from cog.c
+#define COG_DEFAULT_TILE_SIZE 512
+typedef enum {
+  COG_DEFLATE,
+  COG_ZSTD
+} cog_compression_t;
+void set_cog_options(int tile_size, cog_compression_t compression);
+void write_cog_tiff(const char *in_file, const char *out_file);
+
 // Prototypes from export_polsarpro.c
 void initialize_polsarpro_file(const char *output_file_name,
 			       meta_parameters *meta, FILE **fpOut);
@@ -0,0 +1,630 @@
+/*
+  cog.c: Cloud Optimized GeoTIFF output.
+
+  export_band_image() writes (Geo)TIFFs one scanline at a time, with a
+  single row per strip and LZW compression.  To view such a file at any
+  zoom level a client has to read all of it.  write_cog_tiff() rewrites
+  one of those files as a Cloud Optimized GeoTIFF:
+
+    - the image is stored in square tiles (512x512 by default),
+    - tiles are DEFLATE (or ZSTD) compressed, with the horizontal
+      predictor for integer data and the floating point predictor for
+      float data,
+    - a pyramid of reduced-resolution overviews is added, each level
+      half the size of the previous one, until the whole image fits in
+      a single tile,
+    - all of the IFDs, and their tile offset/byte count arrays, are at
+      the start of the file, so a client learns the whole layout of the
+      file from its first few kilobytes.
+
+  The input is streamed one tile row at a time, and every overview level
+  is built from the level above it as rows arrive, so memory use is a
+  few tile rows per level regardless of the image size.  The full
+  resolution tiles are written as soon as their tile row is complete.
+  The (much smaller) overview tiles are parked in a temporary file and
+  copied into place after the full resolution data.
+
+  DEFLATE compression is done here, with zlib, by a set of worker
+  threads (see asf_parallel_for()), and the finished tiles are handed to
+  libtiff as raw tiles.  The predictors are applied exactly the way
+  libtiff applies them, so any TIFF reader can decode the result.  ZSTD
+  goes through libtiff's own codec, one tile at a time, since we do not
+  link against libzstd directly.
+
+  Needs libtiff 4.1 or later, for deferred strile array writing.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <asf.h>
+#include "asf_tiff.h"
+#include <asf_nan.h>
+#include <asf_export.h>
+
+#define COG_DEFLATE_LEVEL 6
+
+// Files whose (uncompressed) size approaches 4GB are written as BigTIFF
+#define COG_BIGTIFF_THRESHOLD (0xF0000000LL)
+
+static int cog_tile_size = COG_DEFAULT_TILE_SIZE;
+static cog_compression_t cog_compression = COG_DEFLATE;
+
+// Location of an overview tile in the temporary file
+typedef struct {
+  long long offset;
+  tsize_t size;
+} cog_spill_t;
+
+// One level of the pyramid.  Level 0 is the full resolution image.
+typedef struct {
+  int width, height;
+  int tiles_across, tiles_down;
+  unsigned char *rows;      // up to one tile row's worth of image lines
+  int nrows;                // number of lines currently in 'rows'
+  int tile_row;             // tile row that 'rows' belongs to
+  unsigned char *pending;   // even line waiting for its odd partner
+  int have_pending;
+  unsigned char *half;      // downsampled line, sent on to the next level
+  cog_spill_t *spill;       // where this level's tiles went (overviews)
+} cog_level_t;
+
+typedef struct {
+  TIFF *out;
+  int tile_size;
+  int nlevels;
+  cog_level_t *levels;
+  int spp, bps, sample_format;
+  int pixel_bytes;          // bytes in one pixel (all samples)
+  tsize_t tile_bytes;       // bytes in one uncompressed tile
+  int compression;          // TIFF compression tag value
+  int predictor;
+  int parallel;             // TRUE: we compress, in worker threads
+  int nearest;              // TRUE: subsample overviews, don't average
+  int have_nodata;
+  double nodata;
+  unsigned char *fill;      // one pixel of the no data value (or zero)
+  FILE *spill_fp;
+} cog_t;
+
+// Work shared by the threads compressing one tile row
+typedef struct {
+  cog_t *c;
+  cog_level_t *lvl;
+  unsigned char **data;
+  uLongf *size;
+} cog_tile_job_t;
+
+void set_cog_options(int tile_size, cog_compression_t compression)
+{
+  // The TIFF spec requires tile dimensions to be multiples of 16
+  if (tile_size < 16 || tile_size % 16 != 0)
+    asfPrintError("COG tile size must be a positive multiple of 16 "
+                  "(got %d)\n", tile_size);
+  cog_tile_size = tile_size;
+  cog_compression = compression;
+}
+
+static double get_sample(const cog_t *c, const unsigned char *p)
+{
+  if (c->sample_format == SAMPLEFORMAT_IEEEFP)
+    return c->bps == 64 ? *(const double *)p : *(const float *)p;
+  else if (c->sample_format == SAMPLEFORMAT_INT) {
+    switch (c->bps) {
+      case 8:  return *(const signed char *)p;
+      case 16: return *(const short *)p;
+      default: return *(const int *)p;
+    }
+  }
+  else {
+    switch (c->bps) {
+      case 8:  return *p;
+      case 16: return *(const unsigned short *)p;
+      default: return *(const unsigned int *)p;
+    }
+  }
+}
+
+static void put_sample(const cog_t *c, unsigned char *p, double v)
+{
+  if (c->sample_format == SAMPLEFORMAT_IEEEFP) {
+    if (c->bps == 64)
+      *(double *)p = v;
+    else
+      *(float *)p = (float)v;
+    return;
+  }
+
+  // Averages of integers are rounded, not truncated
+  v = floor(v + 0.5);
+  if (c->sample_format == SAMPLEFORMAT_INT) {
+    switch (c->bps) {
+      case 8:  *(signed char *)p = (signed char)v; break;
+      case 16: *(short *)p = (short)v; break;
+      default: *(int *)p = (int)v; break;
+    }
+  }
+  else {
+    switch (c->bps) {
+      case 8:  *p = (unsigned char)v; break;
+      case 16: *(unsigned short *)p = (unsigned short)v; break;
+      default: *(unsigned int *)p = (unsigned int)v; break;
+    }
+  }
+}
+
+static int is_valid(const cog_t *c, double v)
+{
+  return !ISNAN(v) && !(c->have_nodata && v == c->nodata);
+}
+
+// Reduce two adjacent lines of a level (width 'w') to one line of the
+// next level.  Each output pixel is the average of the valid pixels in
+// its 2x2 block, or no data if there are none.  Palette images are
+// subsampled instead, since averaging color indices is meaningless.
+static void downsample(const cog_t *c, int w, const unsigned char *a,
+                       const unsigned char *b, unsigned char *out)
+{
+  int pb = c->pixel_bytes, sb = c->bps / 8;
+  int half_w = (w + 1) / 2;
+  int x, s, k;
+
+  for (x = 0; x < half_w; ++x) {
+    int x0 = 2*x, x1 = 2*x + 1 < w ? 2*x + 1 : 2*x;
+    if (c->nearest) {
+      memcpy(out + x*pb, a + x0*pb, pb);
+      continue;
+    }
+    for (s = 0; s < c->spp; ++s) {
+      const unsigned char *src[4];
+      double sum = 0.0;
+      int n = 0;
+      src[0] = a + x0*pb + s*sb;
+      src[1] = a + x1*pb + s*sb;
+      src[2] = b + x0*pb + s*sb;
+      src[3] = b + x1*pb + s*sb;
+      for (k = 0; k < 4; ++k) {
+        double v = get_sample(c, src[k]);
+        if (is_valid(c, v)) {
+          sum += v;
+          ++n;
+        }
+      }
+      if (n > 0)
+        put_sample(c, out + x*pb + s*sb, sum / n);
+      else
+        memcpy(out + x*pb + s*sb, c->fill + s*sb, sb);
+    }
+  }
+}
+
+// Copy tile 'tx' of the current tile row out of the level's line buffer.
+// Parts of edge tiles that lie outside the image are set to no data.
+static void extract_tile(const cog_t *c, const cog_level_t *lvl, int tx,
+                         unsigned char *tile)
+{
+  int ts = c->tile_size, pb = c->pixel_bytes;
+  int x0 = tx * ts;
+  int w = lvl->width - x0 < ts ? lvl->width - x0 : ts;
+  int x, y;
+
+  for (y = 0; y < ts; ++y) {
+    unsigned char *dst = tile + (size_t)y * ts * pb;
+    int first_fill = 0;
+    if (y < lvl->nrows) {
+      memcpy(dst, lvl->rows + ((size_t)y * lvl->width + x0) * pb, w * pb);
+      first_fill = w;
+    }
+    for (x = first_fill; x < ts; ++x)
+      memcpy(dst + x*pb, c->fill, pb);
+  }
+}
+
+// Apply the TIFF predictor to each line of a tile, exactly as libtiff's
+// encoder would (horDiff8/16/32 and fpDiff in tif_predict.c).  'scratch'
+// must hold one tile line.
+static void apply_predictor(const cog_t *c, unsigned char *tile,
+                            unsigned char *scratch)
+{
+  int n = c->tile_size * c->spp;       // samples per tile line
+  int sb = c->bps / 8;
+  int stride = c->spp;
+  int i, b, y;
+
+  for (y = 0; y < c->tile_size; ++y) {
+    unsigned char *line = tile + (size_t)y * n * sb;
+
+    if (c->predictor == PREDICTOR_HORIZONTAL) {
+      if (sb == 1) {
+        for (i = n - 1; i >= stride; --i)
+          line[i] -= line[i - stride];
+      }
+      else if (sb == 2) {
+        unsigned short *p = (unsigned short *)line;
+        for (i = n - 1; i >= stride; --i)
+          p[i] -= p[i - stride];
+      }
+      else {
+        unsigned int *p = (unsigned int *)line;
+        for (i = n - 1; i >= stride; --i)
+          p[i] -= p[i - stride];
+      }
+    }
+    else if (c->predictor == PREDICTOR_FLOATINGPOINT) {
+      // Split the samples into byte planes, most significant byte first,
+      // then difference the bytes
+      memcpy(scratch, line, n * sb);
+      for (i = 0; i < n; ++i) {
+        for (b = 0; b < sb; ++b) {
+#if defined(ASF_BIG_ENDIAN)
+          line[b * n + i] = scratch[i * sb + b];
+#else
+          line[(sb - b - 1) * n + i] = scratch[i * sb + b];
+#endif
+        }
+      }
+      for (i = n * sb - 1; i >= stride; --i)
+        line[i] -= line[i - stride];
+    }
+  }
+}
+
+// asf_parallel_fn: compress tiles [start,end) of the current tile row
+static void compress_tiles(int start, int end, void *data)
+{
+  cog_tile_job_t *job = (cog_tile_job_t *)data;
+  cog_t *c = job->c;
+  unsigned char *tile = MALLOC(c->tile_bytes);
+  unsigned char *scratch = MALLOC(c->tile_size * c->pixel_bytes);
+  int tx;
+
+  for (tx = start; tx < end; ++tx) {
+    uLongf size = compressBound(c->tile_bytes);
+    extract_tile(c, job->lvl, tx, tile);
+    apply_predictor(c, tile, scratch);
+    job->data[tx] = MALLOC(size);
+    if (compress2(job->data[tx], &size, tile, c->tile_bytes,
+                  COG_DEFLATE_LEVEL) != Z_OK)
+      asfPrintError("Error compressing COG tile.\n");
+    job->size[tx] = size;
+  }
+
+  FREE(scratch);
+  FREE(tile);
+}
+
+// Write a finished tile of level 'l'.  Full resolution tiles go straight
+// into the output file, overview tiles into the temporary file.
+static void put_tile(cog_t *c, int l, int index, unsigned char *data,
+                     tsize_t size)
+{
+  if (l == 0) {
+    tsize_t ret = c->parallel ?
+      TIFFWriteRawTile(c->out, index, data, size) :
+      TIFFWriteEncodedTile(c->out, index, data, size);
+    if (ret < 0)
+      asfPrintError("Error writing COG tile %d.\n", index);
+  }
+  else {
+    cog_level_t *lvl = &c->levels[l];
+    lvl->spill[index].offset = FTELL64(c->spill_fp);
+    lvl->spill[index].size = size;
+    ASF_FWRITE(data, 1, size, c->spill_fp);
+  }
+}
+
+static void flush_tile_row(cog_t *c, int l)
+{
+  cog_level_t *lvl = &c->levels[l];
+  int nt = lvl->tiles_across;
+  int first = lvl->tile_row * nt;
+  int tx;
+
+  if (c->parallel) {
+    cog_tile_job_t job;
+    job.c = c;
+    job.lvl = lvl;
+    job.data = (unsigned char **) MALLOC(sizeof(unsigned char *) * nt);
+    job.size = (uLongf *) MALLOC(sizeof(uLongf) * nt);
+    asf_parallel_for(nt, 1, compress_tiles, &job);
+    for (tx = 0; tx < nt; ++tx) {
+      put_tile(c, l, first + tx, job.data[tx], job.size[tx]);
+      FREE(job.data[tx]);
+    }
+    FREE(job.data);
+    FREE(job.size);
+  }
+  else {
+    // libtiff compresses (and applies the predictor) when the tile is
+    // written to the output file
+    unsigned char *tile = MALLOC(c->tile_bytes);
+    for (tx = 0; tx < nt; ++tx) {
+      extract_tile(c, lvl, tx, tile);
+      put_tile(c, l, first + tx, tile, c->tile_bytes);
+    }
+    FREE(tile);
+  }
+
+  lvl->nrows = 0;
+  lvl->tile_row++;
+}
+
+// Add one image line to level 'l', and pass it on (downsampled, paired
+// with the line before it) to the next level.
+static void add_line(cog_t *c, int l, const unsigned char *line)
+{
+  cog_level_t *lvl = &c->levels[l];
+  size_t line_bytes = (size_t)lvl->width * c->pixel_bytes;
+
+  memcpy(lvl->rows + lvl->nrows * line_bytes, line, line_bytes);
+  lvl->nrows++;
+  if (lvl->nrows == c->tile_size ||
+      lvl->tile_row * c->tile_size + lvl->nrows == lvl->height)
+    flush_tile_row(c, l);
+
+  if (l + 1 < c->nlevels) {
+    if (!lvl->have_pending) {
+      memcpy(lvl->pending, line, line_bytes);
+      lvl->have_pending = TRUE;
+    }
+    else {
+      downsample(c, lvl->width, lvl->pending, line, lvl->half);
+      lvl->have_pending = FALSE;
+      add_line(c, l + 1, lvl->half);
+    }
+  }
+}
+
+// An odd line count leaves the last line of a level unpaired; it is
+// paired with itself.
+static void finish_levels(cog_t *c)
+{
+  int l;
+  for (l = 0; l < c->nlevels - 1; ++l) {
+    cog_level_t *lvl = &c->levels[l];
+    if (lvl->have_pending) {
+      downsample(c, lvl->width, lvl->pending, lvl->pending, lvl->half);
+      lvl->have_pending = FALSE;
+      add_line(c, l + 1, lvl->half);
+    }
+  }
+}
+
+static void copy_doubles_tag(TIFF *in, TIFF *out, ttag_t tag)
+{
+  uint16 count;
+  double *values;
+  if (TIFFGetField(in, tag, &count, &values))
+    TIFFSetField(out, tag, count, values);
+}
+
+static void set_level_tags(cog_t *c, TIFF *in, uint16 photometric, int l)
+{
+  TIFF *out = c->out;
+  cog_level_t *lvl = &c->levels[l];
+  uint16 *red, *green, *blue, count, *extra;
+  char *text;
+
+  TIFFSetField(out, TIFFTAG_SUBFILETYPE, l == 0 ? 0 : FILETYPE_REDUCEDIMAGE);
+  TIFFSetField(out, TIFFTAG_IMAGEWIDTH, lvl->width);
+  TIFFSetField(out, TIFFTAG_IMAGELENGTH, lvl->height);
+  TIFFSetField(out, TIFFTAG_TILEWIDTH, c->tile_size);
+  TIFFSetField(out, TIFFTAG_TILELENGTH, c->tile_size);
+  TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, c->bps);
+  TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, c->spp);
+  TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, c->sample_format);
+  TIFFSetField(out, TIFFTAG_PHOTOMETRIC, photometric);
+  TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(out, TIFFTAG_COMPRESSION, c->compression);
+  if (c->predictor != PREDICTOR_NONE)
+    TIFFSetField(out, TIFFTAG_PREDICTOR, c->predictor);
+
+  if (photometric == PHOTOMETRIC_PALETTE &&
+      TIFFGetField(in, TIFFTAG_COLORMAP, &red, &green, &blue))
+    TIFFSetField(out, TIFFTAG_COLORMAP, red, green, blue);
+  if (TIFFGetField(in, TIFFTAG_EXTRASAMPLES, &count, &extra))
+    TIFFSetField(out, TIFFTAG_EXTRASAMPLES, count, extra);
+  if (TIFFGetField(in, TIFFTAG_GDAL_NODATA, &text))
+    TIFFSetField(out, TIFFTAG_GDAL_NODATA, text);
+
+  // Georeferencing and ASF metadata only go with the full resolution
+  // image; readers derive the overviews' georeferencing from it
+  if (l == 0) {
+    uint16 *keys;
+
+    TIFFSetField(out, TIFFTAG_XRESOLUTION, 1.0);
+    TIFFSetField(out, TIFFTAG_YRESOLUTION, 1.0);
+    TIFFSetField(out, TIFFTAG_RESOLUTIONUNIT, RESUNIT_NONE);
+
+    if (TIFFGetField(in, TIFFTAG_GEOKEYDIRECTORY, &count, &keys))
+      TIFFSetField(out, TIFFTAG_GEOKEYDIRECTORY, count, keys);
+    copy_doubles_tag(in, out, TIFFTAG_GEODOUBLEPARAMS);
+    copy_doubles_tag(in, out, TIFFTAG_GEOPIXELSCALE);
+    copy_doubles_tag(in, out, TIFFTAG_GEOTIEPOINTS);
+    copy_doubles_tag(in, out, TIFFTAG_GEOTRANSMATRIX);
+    if (TIFFGetField(in, TIFFTAG_GEOASCIIPARAMS, &text))
+      TIFFSetField(out, TIFFTAG_GEOASCIIPARAMS, text);
+    if (TIFFGetField(in, TIFFTAG_ASF_INSAR_METADATA, &text))
+      TIFFSetField(out, TIFFTAG_ASF_INSAR_METADATA, text);
+  }
+}
+
+void write_cog_tiff(const char *in_file, const char *out_file)
+{
+  TIFF *in;
+  cog_t c;
+  uint32 width, height, y;
+  uint16 spp, bps, sample_format, photometric, planar;
+  long long total_bytes = 0;
+  unsigned char *line;
+  char *nodata_str, *spill_name = NULL;
+  int l, ts, w, h, s, i;
+
+  asfPrintStatus("Writing Cloud Optimized GeoTIFF: %s\n", out_file);
+
+  _XTIFFInitialize();
+  in = XTIFFOpen(in_file, "r");
+  if (!in)
+    asfPrintError("Error opening TIFF file %s\n", in_file);
+
+  TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &width);
+  TIFFGetField(in, TIFFTAG_IMAGELENGTH, &height);
+  TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &spp);
+  TIFFGetFieldDefaulted(in, TIFFTAG_BITSPERSAMPLE, &bps);
+  TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLEFORMAT, &sample_format);
+  TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &planar);
+  if (!TIFFGetField(in, TIFFTAG_PHOTOMETRIC, &photometric))
+    photometric = spp == 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK;
+
+  if (planar != PLANARCONFIG_CONTIG && spp > 1)
+    asfPrintError("COG output needs pixel-interleaved TIFF input.\n");
+  if (!(sample_format == SAMPLEFORMAT_IEEEFP && (bps == 32 || bps == 64)) &&
+      !(sample_format != SAMPLEFORMAT_IEEEFP &&
+        (bps == 8 || bps == 16 || bps == 32)))
+    asfPrintError("Unsupported data type for COG output (%d bits, "
+                  "sample format %d).\n", bps, sample_format);
+
+  memset(&c, 0, sizeof(c));
+  c.tile_size = ts = cog_tile_size;
+  c.spp = spp;
+  c.bps = bps;
+  c.sample_format = sample_format;
+  c.pixel_bytes = spp * bps / 8;
+  c.tile_bytes = (tsize_t)ts * ts * c.pixel_bytes;
+  c.nearest = photometric == PHOTOMETRIC_PALETTE;
+
+  if (c.nearest)
+    c.predictor = PREDICTOR_NONE;
+  else if (sample_format == SAMPLEFORMAT_IEEEFP)
+    c.predictor = PREDICTOR_FLOATINGPOINT;
+  else
+    c.predictor = PREDICTOR_HORIZONTAL;
+
+  c.compression = COMPRESSION_ADOBE_DEFLATE;
+  c.parallel = TRUE;
+  if (cog_compression == COG_ZSTD) {
+    if (TIFFIsCODECConfigured(COMPRESSION_ZSTD)) {
+      c.compression = COMPRESSION_ZSTD;
+      c.parallel = FALSE;
+    }
+    else
+      asfPrintWarning("This libtiff was built without ZSTD support.\n"
+                      "Using DEFLATE compression instead.\n");
+  }
+
+  c.have_nodata = TIFFGetField(in, TIFFTAG_GDAL_NODATA, &nodata_str);
+  c.nodata = c.have_nodata ? atof(nodata_str) : 0.0;
+  c.fill = MALLOC(c.pixel_bytes);
+  for (s = 0; s < spp; ++s)
+    put_sample(&c, c.fill + s * bps / 8, c.nodata);
+
+  // Pyramid: halve the size until the whole image fits in one tile
+  c.nlevels = 1;
+  for (w = width, h = height; w > ts || h > ts; w = (w+1)/2, h = (h+1)/2)
+    c.nlevels++;
+  c.levels = (cog_level_t *) CALLOC(c.nlevels, sizeof(cog_level_t));
+  for (l = 0, w = width, h = height; l < c.nlevels;
+       ++l, w = (w+1)/2, h = (h+1)/2)
+  {
+    cog_level_t *lvl = &c.levels[l];
+    lvl->width = w;
+    lvl->height = h;
+    lvl->tiles_across = (w + ts - 1) / ts;
+    lvl->tiles_down = (h + ts - 1) / ts;
+    lvl->rows = MALLOC((size_t)ts * w * c.pixel_bytes);
+    if (l + 1 < c.nlevels) {
+      lvl->pending = MALLOC((size_t)w * c.pixel_bytes);
+      lvl->half = MALLOC((size_t)((w + 1) / 2) * c.pixel_bytes);
+    }
+    if (l > 0)
+      lvl->spill = (cog_spill_t *)
+        MALLOC(sizeof(cog_spill_t) * lvl->tiles_across * lvl->tiles_down);
+    total_bytes += (long long)lvl->tiles_across * lvl->tiles_down *
+      c.tile_bytes;
+  }
+
+  // Write all of the directories first, with room for their tile
+  // offset and byte count arrays but no image data yet
+  c.out = XTIFFOpen(out_file,
+                    total_bytes > COG_BIGTIFF_THRESHOLD ? "w8" : "w");
+  if (!c.out)
+    asfPrintError("Error opening output TIFF file %s\n", out_file);
+  for (l = 0; l < c.nlevels; ++l) {
+    set_level_tags(&c, in, photometric, l);
+    TIFFDeferStrileArrayWriting(c.out);
+    TIFFWriteCheck(c.out, TRUE, "write_cog_tiff");
+    if (!TIFFWriteDirectory(c.out))
+      asfPrintError("Error writing COG directory %d.\n", l);
+  }
+  XTIFFClose(c.out);
+
+  // Reopen, and lay the (still empty) arrays down right after the
+  // directories.  Each array is updated in place by TIFFFlush() once
+  // the tiles of its directory have been written.
+  c.out = XTIFFOpen(out_file, "r+");
+  if (!c.out)
+    asfPrintError("Error reopening output TIFF file %s\n", out_file);
+  for (l = 0; l < c.nlevels; ++l) {
+    TIFFSetDirectory(c.out, l);
+    if (!TIFFForceStrileArrayWriting(c.out))
+      asfPrintError("Error writing COG tile arrays.\n");
+  }
+  TIFFSetDirectory(c.out, 0);
+
+  if (c.nlevels > 1) {
+    spill_name = MALLOC(sizeof(char) * (strlen(out_file) + 16));
+    sprintf(spill_name, "%s.ovr.tmp", out_file);
+    c.spill_fp = FOPEN(spill_name, "w+b");
+  }
+
+  // Stream the image through the pyramid
+  line = MALLOC((size_t)width * c.pixel_bytes);
+  for (y = 0; y < height; ++y) {
+    if (TIFFReadScanline(in, line, y, 0) < 0)
+      asfPrintError("Error reading line %d of %s\n", y, in_file);
+    add_line(&c, 0, line);
+    asfLineMeter(y, height);
+  }
+  finish_levels(&c);
+  FREE(line);
+  TIFFFlush(c.out);
+
+  // Copy the overview tiles into place, smallest level last
+  if (c.nlevels > 1) {
+    unsigned char *buf = MALLOC(c.parallel ?
+                                compressBound(c.tile_bytes) : c.tile_bytes);
+    for (l = 1; l < c.nlevels; ++l) {
+      cog_level_t *lvl = &c.levels[l];
+      TIFFSetDirectory(c.out, l);
+      for (i = 0; i < lvl->tiles_across * lvl->tiles_down; ++i) {
+        tsize_t ret;
+        FSEEK64(c.spill_fp, lvl->spill[i].offset, SEEK_SET);
+        ASF_FREAD(buf, 1, lvl->spill[i].size, c.spill_fp);
+        ret = c.parallel ?
+          TIFFWriteRawTile(c.out, i, buf, lvl->spill[i].size) :
+          TIFFWriteEncodedTile(c.out, i, buf, lvl->spill[i].size);
+        if (ret < 0)
+          asfPrintError("Error writing COG overview tile %d.\n", i);
+      }
+      TIFFFlush(c.out);
+    }
+    FREE(buf);
+    FCLOSE(c.spill_fp);
+    remove(spill_name);
+    FREE(spill_name);
+  }
+
+  XTIFFClose(c.out);
+  XTIFFClose(in);
+
+  for (l = 0; l < c.nlevels; ++l) {
+    FREE(c.levels[l].rows);
+    if (c.levels[l].pending) FREE(c.levels[l].pending);
+    if (c.levels[l].half) FREE(c.levels[l].half);
+    if (c.levels[l].spill) FREE(c.levels[l].spill);
+  }
+  FREE(c.levels);
+  FREE(c.fill);
+}
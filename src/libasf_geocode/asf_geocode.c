@@ -950,6 +950,8 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
   void (*report_func) (const char *format, ...);
   report_func = force_flag ? asfPrintWarning : asfPrintError;
 
+  asf_trace_begin("asf_geocode");
+
   // Assign output filename
   char *output_image = appendExt(out_base_name, "img");
   char *output_meta_data = appendExt(output_image, "meta");
@@ -2743,6 +2745,7 @@ int asf_mosaic(project_parameters_t *pp, projection_type_t projection_type,
   free(output_image);
 
   asfPrintStatus("Geocoding complete.\n\n");
+  asf_trace_end();
   return 0;
 }
 
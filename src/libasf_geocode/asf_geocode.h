@@ -149,6 +149,8 @@ int combine(char **infiles, int n_inputs, char *outfile);
 
 // Prototypes from geoid.c
 float get_geoid_height(double lat, double lon);
+void get_geoid_heights(int n, const double *lat, const double *lon,
+                       float *heights);
 
 // Prototypes from clip.c
 int clip(char *inFile, char *maskFile, char *outFile);
@@ -2,6 +2,7 @@
 #include "asf.h"
 
 #include <assert.h>
+#include <glib.h>
 #include <stdio.h>
 
 //#define geoid_height_at(x,y) *(geoid_heights + y*w + x)
@@ -25,27 +26,64 @@ float geoid_height_at(int x, int y)
     return *(geoid_heights + y*w + x);
 }
 
+// The grid is 2-byte big-endian signed integers, in centimeters.  It is
+// read with a single fread, and converted in memory.
 static int read_geoid(void)
 {
-    int x,y;
+    int i;
+    unsigned char *raw = MALLOC(2*w*h);
     FILE *f=fopen_share_file("WW15MGH.DAC","rb");
-    for (y=0;y<h;y++)
-	for (x=0;x<w;x++) {
-            signed char hi=fgetc(f);
-            unsigned char lo=fgetc(f);
-            float height=((hi<<8)+lo)*(1.0/100);
-            *(geoid_heights + y*w + x) = height;
-	}
+    if (!f)
+        asfPrintError("Could not open the geoid file WW15MGH.DAC\n");
+    FREAD_CHECKED(raw, 2, w*h, f, 0);
     fclose(f);
+
+    for (i=0; i<w*h; i++) {
+        signed char hi=raw[2*i];
+        unsigned char lo=raw[2*i+1];
+        geoid_heights[i]=((hi<<8)+lo)*(1.0/100);
+    }
+    FREE(raw);
     return 0;
 }
 
-float get_geoid_height(double lat, double lon)
+// Load the grid on first use.  Safe to call from several threads.
+static void load_geoid(void)
 {
-    if (!geoid_heights) {
+    static gsize init = 0;
+    if (g_once_init_enter(&init)) {
         geoid_heights = MALLOC(sizeof(float)*w*h);
         read_geoid();
+        g_once_init_leave(&init, 1);
     }
+}
+
+// Bilinear interpolation at grid position (x,y), 0<=x<w, 0<=y<h.  The
+// neighbours past the last column and row are clamped to the edge, as
+// geoid_height_at() does.
+static inline float interp_geoid(double x, double y)
+{
+    int x_0 = (int)x;
+    int x_1 = x_0 < w-1 ? x_0 + 1 : w-1;
+    double xf = x-x_0;
+
+    int y_0 = (int)y;
+    int y_1 = y_0 < h-1 ? y_0 + 1 : h-1;
+    double yf = y-y_0;
+
+    const float *r0 = geoid_heights + y_0*w;
+    const float *r1 = geoid_heights + y_1*w;
+
+    return
+         xf     * yf     * r1[x_1] +
+         (1-xf) * yf     * r1[x_0] +
+         xf     * (1-yf) * r0[x_1] +
+         (1-xf) * (1-yf) * r0[x_0];
+}
+
+float get_geoid_height(double lat, double lon)
+{
+    load_geoid();
 
     if (lon < 0) lon += 360;
 
@@ -54,28 +92,33 @@ float get_geoid_height(double lat, double lon)
         return 0;
     }
 
-    // Y: 721 records = 180*4+1, 
+    // Y: 721 records = 180*4+1,
     //    from 90 degrees North down to 90 degrees South every 0.25 degrees.
-    double y = (90.-lat)*4.;
-
-    // X: 1440 elements = 360*4, 
+    // X: 1440 elements = 360*4,
     //    from 0 degrees East to 359.75 degrees East every 0.25 degrees.
-    double x = lon*4.;
-
-    // bilinear interp
-    int y_0 = (int)y;
-    int y_1 = y_0 + 1;
-    double yf = y-y_0;
+    return interp_geoid(lon*4., (90.-lat)*4.);
+}
 
-    int x_0 = (int)x;
-    int x_1 = x_0 + 1;
-    double xf = x-x_0;
+// Geoid heights at n points, same as calling get_geoid_height() on each.
+// Meant for whole DEM lines: the grid check is done once, and the loop
+// has no calls in it.
+void get_geoid_heights(int n, const double *lat, const double *lon,
+                       float *heights)
+{
+    int i;
+    load_geoid();
 
-    return
-         xf     * yf     * geoid_height_at(x_1,y_1) +
-         (1-xf) * yf     * geoid_height_at(x_0,y_1) +
-         xf     * (1-yf) * geoid_height_at(x_1,y_0) +
-         (1-xf) * (1-yf) * geoid_height_at(x_0,y_0);
+    for (i=0; i<n; i++) {
+        double la = lat[i];
+        double lo = lon[i] < 0 ? lon[i] + 360 : lon[i];
+        if (la > 90 || la < -90 || lo < 0 || lo >= 360) {
+            printf("Illegal lat, lon passed to get_geoid_heights: %f,%f\n",
+                   la, lon[i]);
+            heights[i] = 0;
+        }
+        else
+            heights[i] = interp_geoid(lo*4., (90.-la)*4.);
+    }
 }
 
 // These are for the test code -- do not use!
@@ -85,4 +128,3 @@ float *geoid_get_height_array(void);
 int geoid_get_width(void) { return w; }
 int geoid_get_height(void) { return h; }
 float *geoid_get_height_array(void) { return geoid_heights; }
-
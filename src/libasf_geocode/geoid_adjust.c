@@ -128,7 +128,9 @@ int geoid_adjust(const char *input_filename, const char *output_filename)
 
   FILE *fpIn = FOPEN(input_img, "rb");
   FILE *fpOut = FOPEN(output_img, "wb");
-  float *buf;
+  float *buf, *hts;
+  double *pt_lat, *pt_lon;
+  int *idx;
 
   // Two ways we can do this:
   //   1) call meta_get_latLon at every point
@@ -148,19 +150,25 @@ int geoid_adjust(const char *input_filename, const char *output_filename)
   if (latlon_image) {
     asfPrintStatus("Lat/Lon image, not using mapping interpolation.\n");
     buf = MALLOC(sizeof(float)*ns);
+    idx = MALLOC(sizeof(int)*ns);
+    pt_lat = MALLOC(sizeof(double)*ns);
+    pt_lon = MALLOC(sizeof(double)*ns);
+    hts = MALLOC(sizeof(float)*ns);
     for (ii=0; ii<nl; ++ii) {
       get_float_line(fpIn, meta, ii, buf);
+      int n = 0;
       for (jj=0; jj<ns; ++jj) {
-        double lat, lon;
-        meta_get_latLon(meta, ii, jj, 0, &lat, &lon);
-        if (buf[jj] > -900 && buf[jj] != meta->general->no_data)
-        {
-          float ht = get_geoid_height(lat,lon);
-          buf[jj] += ht;
-          avg += ht;
-          ++num;
+        if (buf[jj] > -900 && buf[jj] != meta->general->no_data) {
+          meta_get_latLon(meta, ii, jj, 0, &pt_lat[n], &pt_lon[n]);
+          idx[n++] = jj;
         }
       }
+      get_geoid_heights(n, pt_lat, pt_lon, hts);
+      for (jj=0; jj<n; ++jj) {
+        buf[idx[jj]] += hts[jj];
+        avg += hts[jj];
+      }
+      num += n;
       put_float_line(fpOut, meta, ii, buf);
       asfLineMeter(ii,nl);
     }
@@ -172,6 +180,10 @@ int geoid_adjust(const char *input_filename, const char *output_filename)
 
     int test_mode = 1;
     buf = MALLOC(sizeof(float)*ns*size);
+    idx = MALLOC(sizeof(int)*ns*size);
+    pt_lat = MALLOC(sizeof(double)*ns*size);
+    pt_lon = MALLOC(sizeof(double)*ns*size);
+    hts = MALLOC(sizeof(float)*ns*size);
 
     // these are for tracking the quality of the bilinear interp
     // not used if test_mode is false
@@ -190,6 +202,9 @@ int geoid_adjust(const char *input_filename, const char *output_filename)
 
       get_float_lines(fpIn, meta, ii, size, buf);
 
+      // valid points of this block of lines, corrected all at once below
+      int n = 0;
+
       for (jj=0; jj<ns; jj += size) {
         double lats[4], lons[4];
 
@@ -233,14 +248,21 @@ int geoid_adjust(const char *input_filename, const char *output_filename)
 
             if (buf[kkk] > -900 && buf[kkk] != meta->general->no_data)
             {
-              float ht = get_geoid_height(lat,lon);
-              buf[kkk] += ht;
-              avg += ht;
-              ++num;
+              pt_lat[n] = lat;
+              pt_lon[n] = lon;
+              idx[n++] = kkk;
             }
           }  
         }
       }
+
+      get_geoid_heights(n, pt_lat, pt_lon, hts);
+      for (jj=0; jj<n; ++jj) {
+        buf[idx[jj]] += hts[jj];
+        avg += hts[jj];
+      }
+      num += n;
+
       put_float_lines(fpOut, meta, ii, size, buf);
       asfPrintStatus("Completed %.1f%%  \r", 100.*ii/(double)nl);
     }
@@ -257,6 +279,10 @@ int geoid_adjust(const char *input_filename, const char *output_filename)
   FCLOSE(fpOut);
 
   FREE(buf);
+  FREE(idx);
+  FREE(pt_lat);
+  FREE(pt_lon);
+  FREE(hts);
   FREE(input_img);
   FREE(input_meta);
   FREE(output_img);
@@ -90,6 +90,7 @@ int asf_import(radiometry_t radiometry, int db_flag, int complex_flag,
   char outDataName[256], outMetaName[256];
 
   asfPrintStatus("   Importing: %s\n", inBaseName);
+  asf_trace_begin("asf_import");
 
   /*
   printf("\nradiometry: %d\n", radiometry);
@@ -121,6 +122,7 @@ int asf_import(radiometry_t radiometry, int db_flag, int complex_flag,
 
   if (metaonly) {
     create_xml_meta(inBaseName, outBaseName, format_type);
+    asf_trace_end();
     return 0;
   }
 
@@ -380,6 +382,7 @@ int asf_import(radiometry_t radiometry, int db_flag, int complex_flag,
   }
 
   asfPrintStatus("Import complete.\n\n");
+  asf_trace_end();
   return 0;
 }
 
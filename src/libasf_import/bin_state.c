@@ -66,6 +66,9 @@ bin_state *new_bin_state(void)
   s->bytesPerFrame=0;
   s->bytesInFile=0;
   s->missing=NULL;
+  s->frameBlock=NULL;
+  s->blockFrames=0;
+  s->blockPos=0;
 
   s->nValid=0;
   s->estDop=0.0;
@@ -113,6 +116,8 @@ void delete_bin_state(bin_state *s)
       FREE(s->firstFrame[i]);
   if (s->missing!=NULL)
     freeMissing(s);
+  if (s->frameBlock!=NULL)
+    FREE(s->frameBlock);
   FREE(s);
 }
 
@@ -46,6 +46,9 @@ typedef struct {
 	long long bytesInFile;		/* Number of bytes in entire file*/
 	void *missing;			/* "Missing" data pointer (see missing.c)*/
 	int readStatus;			/* Status of current data: 0 - bad, 1 - good */
+	unsigned char *frameBlock;	/* Block of frames read ahead from binary (see frame.c)*/
+	int blockFrames;		/* Number of whole frames currently in frameBlock*/
+	int blockPos;			/* Index of the next unread frame in frameBlock*/
 
 /*Fields filled out/used by lz/ceos2raw during processing*/
 	int nValid;			/* Number of valid output samples (nSamp-replica length)*/
@@ -134,6 +137,15 @@ iqType *RSAT_unpackBytes(signalType *in,int nIn,iqType *out);
 iqType *JERS_unpackBytes(signalType *in,int nIn,iqType *out);
 iqType *ERS_unpackBytes(signalType *in,int nIn,iqType *out);
 
+/*Asynchronous, double-buffered writer for decoded echo lines
+(see pulse_writer.c).  Lines handed to pulse_writer_put are copied into
+a block, and full blocks are written by a background thread while the
+decoder works on the next block.*/
+typedef struct pulse_writer pulse_writer;
+pulse_writer *new_pulse_writer(FILE *fpOut,int lineBytes);
+void pulse_writer_put(pulse_writer *w,const iqType *line);
+void delete_pulse_writer(pulse_writer *w);
+
 
 
 
@@ -26,6 +26,10 @@ JRS frames are 4660 bytes, 7.5 sync bytes, and 6144*2*3 bits of payload.
 RSAT frames are 323 bytes, 4 sync bytes, and 311 bytes of payload.
     There are a variable number of frames per echo line.
     The first frame in a line contains 50 bytes of auxiliary data.
+
+Frames are not read from the file one at a time: nextFrameBytes pulls
+a block of several thousand frames with one read, and the readers
+below copy single frames out of that block.
 */
 
 #include "asf.h"
@@ -46,9 +50,42 @@ void openBinary(bin_state *s,const char *fName)
 /*Seek to the given (0-based) frame number in the given file*/
 void seekFrame(bin_state *s,int frameNo)
 {
-    long long seekLoc=s->bytesPerFrame*frameNo;
+    long long seekLoc=(long long)s->bytesPerFrame*frameNo;
     FSEEK64(s->binary,seekLoc,0);
     s->curFrame=frameNo;
+
+    /*Anything left in the read-ahead block is for the old position*/
+    s->blockFrames=0;
+    s->blockPos=0;
+}
+
+/*Number of bytes to read from the binary file in one go*/
+#define FRAME_BLOCK_BYTES (4*1024*1024)
+
+/***************************************************
+nextFrameBytes:
+Returns a pointer to the next s->bytesPerFrame bytes of the
+binary file, refilling s->frameBlock with one large read when
+it runs dry.  Returns NULL if there isn't a whole frame left
+(a trailing partial frame is treated as end of file, just like
+a short read of a single frame would be).
+*/
+static unsigned char *nextFrameBytes(bin_state *s)
+{
+    if (s->blockPos >= s->blockFrames) {
+        int capacity = FRAME_BLOCK_BYTES/s->bytesPerFrame;
+        if (capacity < 1)
+            capacity = 1;
+        if (s->frameBlock == NULL)
+            s->frameBlock = (unsigned char *)
+                MALLOC(sizeof(unsigned char)*capacity*s->bytesPerFrame);
+        s->blockFrames = FREAD_CHECKED(s->frameBlock, s->bytesPerFrame,
+                                       capacity, s->binary, 1);
+        s->blockPos = 0;
+        if (s->blockFrames == 0)
+            return NULL;
+    }
+    return &s->frameBlock[(long long)s->bytesPerFrame*(s->blockPos++)];
 }
 
 /***************************************************
@@ -60,44 +97,39 @@ Modifies and returns the pointed-to frame.
 ERS_frame * ERS_readNextFrame(bin_state *s, ERS_frame *f)
 {
     // Read next frame in file
-    if (feof(s->binary)) {
-        s->readStatus = 0;
-    }
-    else {
-        size_t nitems = 1;
-        size_t ret = FREAD_CHECKED(f, ERS_bytesPerFrame, nitems, s->binary, 1);
-        f->is_aux = f->is_zero = f->is_echo = 0;
-
-        if (ret == nitems) {
-            s->curFrame++;
-
-            // Determine frame type
-            if (f->type == 128) // Check auxiliary data bit
-                f->is_aux = 1;
-            else if (f->type & 64) // Check zero bit
-                f->is_zero = 1;
-            else if ((f->type > 128) && (f->type <= 156))
-                f->is_echo = 1;
-            else {
-                f->is_echo = 1;
-                asfForcePrintStatus(
-                        "\n\n** Error at frame %i - Unknown frame type (%i); assumed to be bit error.\n\n",
-                        s->curFrame, f->type);
-            }
+    unsigned char *frame = nextFrameBytes(s);
+    f->is_aux = f->is_zero = f->is_echo = 0;
+
+    if (frame) {
+        memcpy(f, frame, ERS_bytesPerFrame);
+        s->curFrame++;
+
+        // Determine frame type
+        if (f->type == 128) // Check auxiliary data bit
+            f->is_aux = 1;
+        else if (f->type & 64) // Check zero bit
+            f->is_zero = 1;
+        else if ((f->type > 128) && (f->type <= 156))
+            f->is_echo = 1;
+        else {
+            f->is_echo = 1;
+            asfForcePrintStatus(
+                    "\n\n** Error at frame %i - Unknown frame type (%i); assumed to be bit error.\n\n",
+                    s->curFrame, f->type);
+        }
 
-            // Extract & decode auxiliary data
-            if (f->is_aux) {
-                int ii;
-                for (ii=0; (ii < ERS_datPerAux) && (ii < ERS_datPerFrame); ii++) {
-                    f->raw[ii] = f->data[ii];
-                }
-                ERS_decodeAux(f->raw, &f->aux);
+        // Extract & decode auxiliary data
+        if (f->is_aux) {
+            int ii;
+            for (ii=0; (ii < ERS_datPerAux) && (ii < ERS_datPerFrame); ii++) {
+                f->raw[ii] = f->data[ii];
             }
-        }
-        else {
-            s->readStatus = 0;
+            ERS_decodeAux(f->raw, &f->aux);
         }
     }
+    else {
+        s->readStatus = 0;
+    }
 
     return f;
 }
@@ -111,7 +143,11 @@ Modifies and returns the pointed-to frame.
 JRS_frame * JRS_readNextFrame(bin_state *s,JRS_frame *f)
 {
 /*Read next frame in file.*/
-    ASF_FREAD(f->data,1,JRS_bytesPerFrame,s->binary);
+    unsigned char *frame = nextFrameBytes(s);
+    if (frame == NULL)
+        asfPrintError("Read past end of JERS binary file at frame %d\n",
+                      s->curFrame);
+    memcpy(f->data,frame,JRS_bytesPerFrame);
     s->curFrame++;
 
 /*Extract & decode auxiliary data*/
@@ -130,44 +166,39 @@ Modifies and returns the pointed-to frame.
 RSAT_frame * RSAT_readNextFrame(bin_state *s,RSAT_frame *f)
 {
     // Read next frame in file
-    if (feof(s->binary)) {
-        s->readStatus = 0;
-    }
-    else {
-        size_t nitems = 1;
-        size_t ret = FREAD_CHECKED(f,RSAT_bytesPerFrame,nitems,s->binary, 1);
-        f->is_aux=f->is_zero=f->is_echo=0;
-        f->hasReplica=0;
-        f->beam=-1;
-
-        if (ret == nitems) {
-            s->curFrame++;
-
-            // Determine frame type
-            if ((f->status[1]&1)==0)  // Check zero bit
-                f->is_zero=1;
-            else if ((f->id[1]&6)==0) // Check auxiliary data bit
-                f->is_aux=1;
-            else if ((f->id[1]&6)==2) // Check echo data bit
-                f->is_echo=1;
+    unsigned char *frame = nextFrameBytes(s);
+    f->is_aux=f->is_zero=f->is_echo=0;
+    f->hasReplica=0;
+    f->beam=-1;
+
+    if (frame) {
+        memcpy(f, frame, RSAT_bytesPerFrame);
+        s->curFrame++;
+
+        // Determine frame type
+        if ((f->status[1]&1)==0)  // Check zero bit
+            f->is_zero=1;
+        else if ((f->id[1]&6)==0) // Check auxiliary data bit
+            f->is_aux=1;
+        else if ((f->id[1]&6)==2) // Check echo data bit
+            f->is_echo=1;
         /*  else
             asfPrintError("Unknown RSAT frame type '%d'\n",(int)f->id[1]);
         */
 
-            if (f->is_aux)
-            {
-                int ii;
-                for (ii=0; (ii<RSAT_datPerAux) && (ii<RSAT_datPerFrame); ii++) {
-                    f->raw[ii] = f->data[ii];
-                }
-                RSAT_decodeAux(f->raw,&f->aux);
-                f->beam = RSAT_auxGetBeam(&f->aux);
-                f->hasReplica = RSAT_auxHasReplica(&f->aux);
+        if (f->is_aux)
+        {
+            int ii;
+            for (ii=0; (ii<RSAT_datPerAux) && (ii<RSAT_datPerFrame); ii++) {
+                f->raw[ii] = f->data[ii];
             }
+            RSAT_decodeAux(f->raw,&f->aux);
+            f->beam = RSAT_auxGetBeam(&f->aux);
+            f->hasReplica = RSAT_auxHasReplica(&f->aux);
         }
-        else {
-            s->readStatus = 0;
-        }
+    }
+    else {
+        s->readStatus = 0;
     }
 
     return f;
@@ -1,6 +1,7 @@
 #include "airsar.h"
 #include "asf_meta.h"
 #include <ctype.h>
+#include <glib.h>
 
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_math.h>
@@ -674,17 +675,96 @@ int ingest_insar_data(const char *inBaseName, const char *outBaseName,
   return ret;
 }
 
+// The total power of a compressed Stokes matrix record is
+// (byte[1]/254 + 1.5) * 2^byte[0].  Both factors only take 256 values, so
+// they are looked up rather than computed with pow() for every pixel.
+static double stokes_mantissa[256], stokes_exponent[256];
+
+// Build the tables on first use.  Safe to call from several threads.
+static void init_stokes_tables(void)
+{
+  static gsize init = 0;
+  if (g_once_init_enter(&init)) {
+    int i;
+    for (i=0; i<256; i++) {
+      char b = (char) i;
+      stokes_mantissa[i] = (float)b/254.0 + 1.5;
+      stokes_exponent[i] = pow(2, b);
+    }
+    g_once_init_leave(&init, 1);
+  }
+}
+
+// Total power of sample_count consecutive compressed Stokes matrix records.
+void airsar_stokes_total_power(const char *rec, int sample_count,
+			       double *total_power)
+{
+  const unsigned char *b = (const unsigned char *) rec;
+  int kk;
+
+  init_stokes_tables();
+  for (kk=0; kk<sample_count; kk++, b+=AIRSAR_STOKES_BYTES)
+    total_power[kk] = stokes_mantissa[b[1]] * stokes_exponent[b[0]];
+}
+
+typedef struct {
+  int sample_count;
+  radiometry_t radiometry;
+  const char *rec;          // block of compressed Stokes matrix records
+  float *band[9];           // block of lines of each output band
+} stokes_job;
+
+/* asf_parallel_fn: expand lines [start,end) of the block into total power,
+   and amplitude and phase of HH, HV, VH and VV. */
+static void stokes_lines(int start, int end, void *data)
+{
+  stokes_job *job = (stokes_job *) data;
+  int ns = job->sample_count;
+  double *total = (double *) MALLOC(sizeof(double)*ns);
+  float *ysca = (float *) MALLOC(sizeof(float)*ns);
+  int ii, kk, pol;
+
+  for (ii=start; ii<end; ii++) {
+    const char *rec = job->rec + (long)ii*ns*AIRSAR_STOKES_BYTES;
+    long line = (long)ii*ns;
+    float *power = job->band[0] + line;
+
+    // Scale is always 1.0 according to Bruce Chapman
+    airsar_stokes_total_power(rec, ns, total);
+    for (kk=0; kk<ns; kk++) {
+      float total_power = total[kk];
+      ysca[kk] = 2.0 * sqrt(total_power);
+      power[kk] = sqrt(total_power);
+    }
+
+    // The scattering matrix elements are in bytes 2-9, real and imaginary
+    // part of HH, HV, VH and VV in turn.
+    for (pol=0; pol<4; pol++) {
+      const char *b = rec + 2 + 2*pol;
+      float *amp = job->band[1+2*pol] + line;
+      float *phase = job->band[2+2*pol] + line;
+      for (kk=0; kk<ns; kk++, b+=AIRSAR_STOKES_BYTES) {
+	float re = (float)b[0] * ysca[kk] / 127.0;
+	float im = (float)b[1] * ysca[kk] / 127.0;
+	amp[kk] = sqrt(re*re + im*im);
+	phase[kk] = atan2(im, re);
+      }
+      if (job->radiometry == r_SIGMA)
+	for (kk=0; kk<ns; kk++)
+	  amp[kk] = amp[kk]*amp[kk];
+    }
+  }
+
+  FREE(total);
+  FREE(ysca);
+}
+
 int ingest_polsar_data(const char *inBaseName, const char *outBaseName,
 		       radiometry_t radiometry, char band)
 {
   FILE *fpIn, *fpOut;
   char *inFile, *outFile;
   int ii, kk, ret;
-  char *byteBuf;
-  float *power, *shh_amp, *shh_phase, *shv_amp, *shv_phase, *svh_amp;
-  float *svh_phase, *svv_amp, *svv_phase;
-  float total_power, ysca, amp, phase;
-  complexFloat cpx;
 
   // Allocate memory
   inFile = (char *) MALLOC(sizeof(char)*255);
@@ -717,16 +797,17 @@ int ingest_polsar_data(const char *inBaseName, const char *outBaseName,
 	     "AMP,SIGMA_DB-AMP-HH,SIGMA_DB-PHASE-HH,SIGMA_DB-AMP-HV,"\
 	     "SIGMA_DB-PHASE-HV,SIGMA_DB-AMP-VH,SIGMA_DB-PHASE-VH,"\
 	     "SIGMA_DB-AMP-VV,SIGMA_DB-PHASE-VV");
-    power = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    shh_amp = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    shh_phase = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    shv_amp = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    shv_phase = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    svh_amp = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    svh_phase = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    svv_amp = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    svv_phase = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-    byteBuf = (char *) MALLOC(sizeof(char)*10);
+    int line_count = meta->general->line_count;
+    int sample_count = meta->general->sample_count;
+    int block = AIRSAR_STOKES_BLOCK_LINES;
+    char *rec = (char *) MALLOC(sizeof(char)*AIRSAR_STOKES_BYTES*
+				sample_count*block);
+    stokes_job job;
+    job.sample_count = sample_count;
+    job.radiometry = radiometry;
+    job.rec = rec;
+    for (kk=0; kk<9; kk++)
+      job.band[kk] = (float *) MALLOC(sizeof(float)*sample_count*block);
     airsar_header *header = read_airsar_header(inFile);
 //    airsar_param_header *params = read_airsar_params(inFile);
     long offset = header->first_data_offset;
@@ -734,9 +815,12 @@ int ingest_polsar_data(const char *inBaseName, const char *outBaseName,
     fpIn = FOPEN(inFile, "rb");
     fpOut = FOPEN(outFile, "wb");
     FSEEK(fpIn, offset, SEEK_SET);
-    for (ii=0; ii<meta->general->line_count; ii++) {
-      for (kk=0; kk<meta->general->sample_count; kk++) {
-	ASF_FREAD(byteBuf, sizeof(char), 10, fpIn);
+    // Read a block of lines at once, expand its lines in parallel, then
+    // write them out in order.
+    for (ii=0; ii<line_count; ii+=block) {
+      int n = ii + block > line_count ? line_count - ii : block;
+      ASF_FREAD(rec, sizeof(char), (long)AIRSAR_STOKES_BYTES*sample_count*n,
+		fpIn);
 /*
         float m11, m12, m13, m14, m22, m23, m24, m33, m34, m44;
 	m11 = ((float)byteBuf[1]/254.0 + 1.5) * pow(2, byteBuf[0]);
@@ -750,105 +834,21 @@ int ingest_polsar_data(const char *inBaseName, const char *outBaseName,
 	m44 = (float)byteBuf[9] * m11 / 127.0;
 	m22 = 1 - m33 -m44;
 */
-
-	// Scale is always 1.0 according to Bruce Chapman
-	total_power =
-	  ((float)byteBuf[1]/254.0 + 1.5) * pow(2, byteBuf[0]);
-	ysca = 2.0 * sqrt(total_power);
-	power[kk] = sqrt(total_power);
-	cpx.real = (float)byteBuf[2] * ysca / 127.0;
-	cpx.imag = (float)byteBuf[3] * ysca / 127.0;
-	amp = sqrt(cpx.real*cpx.real + cpx.imag*cpx.imag);
-	phase = atan2(cpx.imag, cpx.real);
-	if (radiometry == r_AMP) {
-	  shh_amp[kk] = amp;
-	  shh_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA) {
-	  shh_amp[kk] = amp*amp;
-	  shh_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA_DB) {
-	  shh_amp[kk] = amp;
-	  shh_phase[kk] = phase;
-	}
-	cpx.real = (float)byteBuf[4] * ysca / 127.0;
-	cpx.imag = (float)byteBuf[5] * ysca / 127.0;
-	amp = sqrt(cpx.real*cpx.real + cpx.imag*cpx.imag);
-	phase = atan2(cpx.imag, cpx.real);
-	if (radiometry == r_AMP) {
-	  shv_amp[kk] = amp;
-	  shv_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA) {
-	  shv_amp[kk] = amp*amp;
-	  shv_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA_DB) {
-	  shv_amp[kk] = amp;
-	  shv_phase[kk] = phase;
-	}
-	cpx.real = (float)byteBuf[6] * ysca / 127.0;
-	cpx.imag = (float)byteBuf[7] * ysca / 127.0;
-	amp = sqrt(cpx.real*cpx.real + cpx.imag*cpx.imag);
-	phase = atan2(cpx.imag, cpx.real);
-	if (radiometry == r_AMP) {
-	  svh_amp[kk] = amp;
-	  svh_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA) {
-	  svh_amp[kk] = amp*amp;
-	  svh_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA_DB) {
-	  svh_amp[kk] = amp;
-	  svh_phase[kk] = phase;
-	}
-	cpx.real = (float)byteBuf[8] * ysca / 127.0;
-	cpx.imag = (float)byteBuf[9] * ysca / 127.0;
-	amp = sqrt(cpx.real*cpx.real + cpx.imag*cpx.imag);
-	phase = atan2(cpx.imag, cpx.real);
-	if (radiometry == r_AMP) {
-	  svv_amp[kk] = amp;
-	  svv_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA) {
-	  svv_amp[kk] = amp*amp;
-	  svv_phase[kk] = phase;
-	}
-	else if (radiometry == r_SIGMA_DB) {
-	  svv_amp[kk] = amp;
-	  svv_phase[kk] = phase;
-	}
-      }
-      put_band_float_line(fpOut, meta, 0, ii, power);
-      put_band_float_line(fpOut, meta, 1, ii, shh_amp);
-      put_band_float_line(fpOut, meta, 2, ii, shh_phase);
-      put_band_float_line(fpOut, meta, 3, ii, shv_amp);
-      put_band_float_line(fpOut, meta, 4, ii, shv_phase);
-      put_band_float_line(fpOut, meta, 5, ii, svh_amp);
-      put_band_float_line(fpOut, meta, 6, ii, svh_phase);
-      put_band_float_line(fpOut, meta, 7, ii, svv_amp);
-      put_band_float_line(fpOut, meta, 8, ii, svv_phase);
-      asfLineMeter(ii, meta->general->line_count);
+      asf_parallel_for(n, 8, stokes_lines, &job);
+      for (kk=0; kk<9; kk++)
+	put_band_float_lines(fpOut, meta, kk, ii, n, job.band[kk]);
+      asfLineMeter(ii + n - 1, line_count);
     }
     FCLOSE(fpIn);
     FCLOSE(fpOut);
     meta_write(meta, outFile);
 
     // Clean up
-    FREE(power);
-    FREE(shh_amp);
-    FREE(shh_phase);
-    FREE(shv_amp);
-    FREE(shv_phase);
-    FREE(svh_amp);
-    FREE(svh_phase);
-    FREE(svv_amp);
-    FREE(svv_phase);
+    for (kk=0; kk<9; kk++)
+      FREE(job.band[kk]);
+    FREE(rec);
     FREE(inFile);
     FREE(outFile);
-    FREE(byteBuf);
 
     ret = TRUE;
   }
@@ -513,6 +513,7 @@ void import_ceos_raw(char *inDataName, char *inMetaName, char *outDataName,
   readPulseFunc readNextPulse; /* Pointer to function that reads the next line
           of CEOS Data */
   iqType *iqBuf;           /* Buffer containing the complex i & q channels */
+  pulse_writer *writer;    /* Writes decoded lines in the background */
   meta_parameters *meta;
 
   /* Create metadata */
@@ -541,14 +542,16 @@ void import_ceos_raw(char *inDataName, char *inMetaName, char *outDataName,
   asfRequire (s->nBeams==1,"Unable to import level 0 ScanSAR data.\n");
   iqBuf = (iqType*)MALLOC(sizeof(iqType)*2*(s->nSamp));
   fpOut = FOPEN(outDataName, "wb");
+  writer = new_pulse_writer(fpOut, s->nSamp*2);
   getNextCeosLine(s->binary, s, inMetaName, outDataName); /* Skip CEOS header. */
   s->nLines = 0;
   for (ii=0; ii<nl; ii++) {
     readNextPulse(s, iqBuf, inDataName, outDataName);
-    ASF_FWRITE(iqBuf, s->nSamp*2, 1, fpOut);
+    pulse_writer_put(writer, iqBuf);
     asfLineMeter(ii,nl);
     s->nLines++;
   }
+  delete_pulse_writer(writer);
   strcpy(meta->general->basename, inDataName);
   meta->general->band_count = import_single_band ? 1 : meta->general->band_count;
   struct dataset_sum_rec dssr;
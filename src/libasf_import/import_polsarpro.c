@@ -105,8 +105,8 @@ static void ingest_airsar_polsar_amp(char *inFile, char *outFile,
   meta_parameters *meta = NULL;
   int ii, kk, do_resample = FALSE;
   float *power = NULL;
-  double azimuth_scale, range_scale;
-  char *byteBuf = NULL, *inBaseName = NULL, unscaleBaseName[1024];
+  double *total_power = NULL, azimuth_scale, range_scale;
+  char *rec = NULL, *inBaseName = NULL, unscaleBaseName[1024];
 
   fpIn = FOPEN(inFile, "rb");
   if (p_azimuth_scale && p_range_scale) {
@@ -126,8 +126,12 @@ static void ingest_airsar_polsar_amp(char *inFile, char *outFile,
   strcpy(meta->general->bands, "AMP");
   //meta->general->image_data_type = IMAGE_LAYER_STACK;
 
-  power = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-  byteBuf = (char *) MALLOC(sizeof(char)*10);
+  int line_count = meta->general->line_count;
+  int sample_count = meta->general->sample_count;
+  int block = AIRSAR_STOKES_BLOCK_LINES;
+  power = (float *) MALLOC(sizeof(float)*sample_count*block);
+  total_power = (double *) MALLOC(sizeof(double)*sample_count);
+  rec = (char *) MALLOC(sizeof(char)*AIRSAR_STOKES_BYTES*sample_count*block);
   airsar_header *header = read_airsar_header(inFile);
   long offset = header->first_data_offset;
   if (do_resample)
@@ -135,13 +139,20 @@ static void ingest_airsar_polsar_amp(char *inFile, char *outFile,
   else
     fpOut = FOPEN(outFile, "wb");
   FSEEK(fpIn, offset, SEEK_SET);
-  for (ii=0; ii<meta->general->line_count; ii++) {
-    for (kk=0; kk<meta->general->sample_count; kk++) {
-      ASF_FREAD(byteBuf, sizeof(char), 10, fpIn);
-      power[kk] = sqrt(((float)byteBuf[1]/254.0 + 1.5) * pow(2, byteBuf[0]));
-    }
-    put_float_line(fpOut, meta, ii, power);
-    asfLineMeter(ii, meta->general->line_count);
+  for (ii=0; ii<line_count; ii+=block) {
+    int n = ii + block > line_count ? line_count - ii : block;
+    long pixels = (long)sample_count*n;
+    ASF_FREAD(rec, sizeof(char), AIRSAR_STOKES_BYTES*pixels, fpIn);
+    for (kk=0; kk<n; kk++) {
+      float *p = power + (long)kk*sample_count;
+      int jj;
+      airsar_stokes_total_power(rec + (long)kk*sample_count*AIRSAR_STOKES_BYTES,
+				sample_count, total_power);
+      for (jj=0; jj<sample_count; jj++)
+	p[jj] = sqrt(total_power[jj]);
+    }
+    put_float_lines(fpOut, meta, ii, n, power);
+    asfLineMeter(ii + n - 1, line_count);
   }
   FCLOSE(fpIn);
   FCLOSE(fpOut);
@@ -151,8 +162,10 @@ static void ingest_airsar_polsar_amp(char *inFile, char *outFile,
     meta_write(meta, outFile);
   if (power)
     FREE(power);
-  if (byteBuf)
-    FREE(byteBuf);
+  if (total_power)
+    FREE(total_power);
+  if (rec)
+    FREE(rec);
   if (meta)
     meta_free(meta);
 
@@ -9,71 +9,75 @@
 #include "dateUtil.h"
 #include "xml_util.h"
 #include <ctype.h>
+#include <glib.h>
 #include "asf_tiff.h"
 #include "geotiff_support.h"
 
-static float *get_cal_lut_lines(sentinel_lut_line *cal, radiometry_t radiometry,
-  int band, int lut_line_count, int start, int end, char *outFile)
+// Number of lines imported together.  Rounded up to a whole number of
+// strips, so that every strip is decoded once.
+#define SENTINEL_BLOCK_LINES 256
+
+// Interpolate every LUT vector along range, once, to the full sample_count.
+// Each vector is interpolated on its own pixel grid; beyond the first and
+// last pixel the end values are held.
+static float *lut_range_rows(sentinel_lut_line *lut, int lut_line_count,
+  int sample_count)
 {
-  meta_parameters *meta = meta_read(outFile);
-  int sample_count = meta->general->sample_count;
-  int oldLine = cal[start].line;
-  int newLine = cal[end].line;
-  int deltaLine = newLine - oldLine;
-  if (oldLine == newLine)
-    newLine++;
-  int ii, kk, kkLut, oldPixel, newPixel, deltaPixel, idx;
-  float cal00, cal01, cal10, cal11;
-  float a00, a10, a01, a11, slopeLine, slopePixel;
-  float *amp = (float *) MALLOC(sizeof(float)*sample_count*deltaLine);
-  
-  // Determine actual calibration value
-  for (ii=oldLine; ii<newLine; ii++) {
+  float *rows = (float *) MALLOC(sizeof(float)*lut_line_count*sample_count);
+  int ii, kk, kkLut;
+
+  for (ii=0; ii<lut_line_count; ii++) {
+    int *pixel = lut[ii].pixel;
+    float *value = lut[ii].value;
+    float *row = rows + (long)ii*sample_count;
     kkLut = 0;
-    oldPixel = cal[start].pixel[0];
-    newPixel = cal[start].pixel[1];
-    deltaPixel = newPixel - oldPixel;
-    cal00 = cal[start].value[0];
-    cal10 = cal[start].value[1];
-    cal01 = cal[end].value[0];
-    cal11 = cal[end].value[1];
-    a00 = cal00;
-    a10 = cal10 - cal00;
-    a01 = cal01 - cal00;
-    a11 = cal00 - cal01 - cal10 + cal11;
     for (kk=0; kk<sample_count; kk++) {
-      idx = (ii - oldLine)*sample_count + kk;
-      if (kk == newPixel) {
+      while (kkLut < lut[ii].count-1 && kk >= pixel[kkLut+1])
         kkLut++;
-        oldPixel = newPixel;
-        if (kkLut+1 < cal[start].count)
-          newPixel = cal[start].pixel[kkLut+1];
-        else
-          newPixel = cal[start].pixel[kkLut];
-        deltaPixel = newPixel - oldPixel;
-        cal00 = cal[start].value[kkLut];
-        if (kkLut+1 < cal[start].count)
-          cal10 = cal[start].value[kkLut+1];
-        else
-          cal10 = cal[start].value[kkLut];
-        cal01 = cal[end].value[kkLut];
-        if (kkLut+1 < cal[end].count)
-          cal11 = cal[end].value[kkLut+1];
-        else
-          cal11 = cal[end].value[kkLut];
-        a00 = cal00;
-        a10 = cal10 - cal00;
-        a01 = cal01 - cal00;
-        a11 = cal00 - cal01 - cal10 + cal11;
-      }
-      slopeLine = (float)(ii - oldLine)/(float)deltaLine;
-      slopePixel = (float)(kk - oldPixel)/(float)deltaPixel;
-      idx = (ii - oldLine)*meta->general->sample_count + kk;
-      amp[idx] = a00 + a10 * slopePixel + a01 * slopeLine 
-        + a11 * slopePixel * slopeLine;
+      if (kk <= pixel[0])
+        row[kk] = value[0];
+      else if (kkLut == lut[ii].count-1)
+        row[kk] = value[kkLut];
+      else
+        row[kk] = value[kkLut] + (value[kkLut+1] - value[kkLut])*
+          (float)(kk - pixel[kkLut])/(float)(pixel[kkLut+1] - pixel[kkLut]);
+    }
+  }
+
+  return rows;
+}
+
+// Interpolate the range-interpolated LUT rows along azimuth to one image
+// line.
+static void lut_azimuth_line(const float *rows, sentinel_lut_line *lut,
+  int lut_line_count, int line, int sample_count, float *out)
+{
+  int lo = 0, hi = lut_line_count-1, kk;
+
+  if (line <= lut[lo].line || lut_line_count == 1)
+    hi = lo;
+  else if (line >= lut[hi].line)
+    lo = hi;
+  else {
+    while (hi - lo > 1) {
+      int mid = (lo + hi)/2;
+      if (lut[mid].line <= line)
+        lo = mid;
+      else
+        hi = mid;
     }
   }
-  return amp;
+
+  const float *r0 = rows + (long)lo*sample_count;
+  const float *r1 = rows + (long)hi*sample_count;
+  if (lo == hi)
+    memcpy(out, r0, sizeof(float)*sample_count);
+  else {
+    float slopeLine = (float)(line - lut[lo].line)/
+      (float)(lut[hi].line - lut[lo].line);
+    for (kk=0; kk<sample_count; kk++)
+      out[kk] = r0[kk] + slopeLine*(r1[kk] - r0[kk]);
+  }
 }
 
 static void write_cal_lut(sentinel_lut_line *cal, radiometry_t radiometry, 
@@ -157,69 +161,6 @@ static void write_cal_lut(sentinel_lut_line *cal, radiometry_t radiometry,
   meta_free(meta);
 }
 
-static float *get_noise_lut_lines(sentinel_lut_line *lut, radiometry_t radiometry, 
-  int band, int lut_line_count, int start, int end, char *outFile)
-{
-  meta_parameters *meta = meta_read(outFile);
-  int sample_count = meta->general->sample_count;
-  int oldLine = lut[start].line;
-  int newLine = lut[end].line;
-  int deltaLine = newLine - oldLine;
-  if (oldLine == newLine)
-    newLine++;
-  int ii, kk, kkLut, oldPixel, newPixel, deltaPixel, idx;
-  float noise00, noise01, noise10, noise11;
-  float a00, a10, a01, a11, slopeLine, slopePixel;
-  float *noise = (float *) MALLOC(sizeof(float)*sample_count*deltaLine);
-  
-  // Determine actual value
-  for (ii=oldLine; ii<newLine; ii++) {
-    kkLut = 0;
-    oldPixel = lut[start].pixel[0];
-    newPixel = lut[start].pixel[1];
-    deltaPixel = newPixel - oldPixel;
-    noise00 = lut[start].value[0];
-    noise10 = lut[start].value[1];
-    noise01 = lut[end].value[0];
-    noise11 = lut[end].value[1];
-    a00 = noise00;
-    a10 = noise10 - noise00;
-    a01 = noise01 - noise00;
-    a11 = noise00 - noise01 - noise10 + noise11;
-    for (kk=0; kk<meta->general->sample_count; kk++) {
-      idx = (ii - oldLine)*sample_count + kk;
-      if (kk == newPixel) {
-        kkLut++;
-        oldPixel = newPixel;
-        if (kkLut+1 < lut[start].count)
-          newPixel = lut[start].pixel[kkLut+1];
-        else
-          newPixel = lut[start].pixel[kkLut];
-        deltaPixel = newPixel - oldPixel;
-        noise00 = lut[start].value[kkLut];
-        if (kkLut+1 < lut[start].count)        
-          noise10 = lut[start].value[kkLut+1];
-        else
-          noise10 = lut[start].value[kkLut];
-        noise01 = lut[end].value[kkLut];
-        if (kkLut+1 < lut[end].count)
-          noise11 = lut[end].value[kkLut+1];
-        else
-          noise11 = lut[end].value[kkLut];
-        a00 = noise00;
-        a10 = noise10 - noise00;
-        a01 = noise01 - noise00;
-        a11 = noise00 - noise01 - noise10 + noise11;
-      }
-      slopeLine = (float)(ii - oldLine)/(float)deltaLine;
-      slopePixel = (float)(kk - oldPixel)/(float)deltaPixel;
-      noise[idx] = a00 + a10 * slopePixel + a01 * slopeLine 
-        + a11 * slopePixel * slopeLine;
-    }
-  }
-  return noise;
-}
-
 static void write_noise_lut(sentinel_lut_line *lut, radiometry_t radiometry, 
   int band, int lut_line_count, char *outFile)
 {
@@ -531,6 +472,192 @@ static sentinel_lut_line *read_sentinel_noise(char *xmlFile, char *mode,
   return lut;
 }
 
+// A TIFF handle of its own for one worker thread, with the strip it
+// decoded last and the LUT values for the line it is calibrating.
+typedef struct {
+  TIFF *tiff;
+  tdata_t strip_buf;
+  tstrip_t strip;
+  tdata_t line_buf;
+  float *cal, *noise;
+} sentinel_reader;
+
+// One band of a measurement file, imported a block of lines at a time.
+typedef struct {
+  const char *inDataName;
+  tiff_type_t tiffInfo;
+  int detected;
+  radiometry_t radiometry;
+  int sample_count;
+  sentinel_lut_line *cal, *lut;
+  int calLutLines, noiseLutLines;
+  const float *calRows, *noiseRows;
+  float mask;
+
+  int first_line;                 // of the current block
+  float *amp, *phase;             // sample_count per line of the block
+  double *noise_sum;              // noise floor sum and count per line,
+  long *noise_count;              // NULL when not needed
+
+  GMutex pool_lock;
+  sentinel_reader **pool;
+  int n_free, n_readers;
+} sentinel_band_job;
+
+static sentinel_reader *take_reader(sentinel_band_job *job)
+{
+  sentinel_reader *r = NULL;
+  g_mutex_lock(&job->pool_lock);
+  if (job->n_free > 0)
+    r = job->pool[--job->n_free];
+  g_mutex_unlock(&job->pool_lock);
+
+  if (!r) {
+    r = (sentinel_reader *) MALLOC(sizeof(sentinel_reader));
+    r->tiff = XTIFFOpen(job->inDataName, "r");
+    if (!r->tiff)
+      asfPrintError("Could not open data file (%s)\n", job->inDataName);
+    r->strip_buf = NULL;
+    if (job->tiffInfo.format == STRIP_TIFF) {
+      r->strip_buf = _TIFFmalloc(TIFFStripSize(r->tiff));
+      if (!r->strip_buf)
+        asfPrintError("Can't allocate buffer for reading TIFF strips!\n");
+    }
+    r->strip = (tstrip_t) -1;
+    r->line_buf = _TIFFmalloc(TIFFScanlineSize(r->tiff));
+    if (!r->line_buf)
+      asfPrintError("Can't allocate buffer for reading TIFF lines!\n");
+    r->cal = (float *) MALLOC(sizeof(float)*job->sample_count);
+    r->noise = (float *) MALLOC(sizeof(float)*job->sample_count);
+    g_mutex_lock(&job->pool_lock);
+    job->n_readers++;
+    g_mutex_unlock(&job->pool_lock);
+  }
+  return r;
+}
+
+static void give_reader(sentinel_band_job *job, sentinel_reader *r)
+{
+  g_mutex_lock(&job->pool_lock);
+  job->pool[job->n_free++] = r;
+  g_mutex_unlock(&job->pool_lock);
+}
+
+static void free_readers(sentinel_band_job *job)
+{
+  int ii;
+  for (ii=0; ii<job->n_free; ii++) {
+    sentinel_reader *r = job->pool[ii];
+    if (r->strip_buf)
+      _TIFFfree(r->strip_buf);
+    _TIFFfree(r->line_buf);
+    FREE(r->cal);
+    FREE(r->noise);
+    XTIFFClose(r->tiff);
+    FREE(r);
+  }
+  job->n_free = job->n_readers = 0;
+}
+
+// Raw data of one line.  A strip is only decoded the first time one of
+// its lines is asked for.
+static void *read_sentinel_line(sentinel_band_job *job, sentinel_reader *r,
+  uint32 row)
+{
+  switch (job->tiffInfo.format)
+  {
+    case SCANLINE_TIFF:
+      TIFFReadScanline(r->tiff, r->line_buf, row, 0);
+      return r->line_buf;
+    case STRIP_TIFF:
+      {
+        tstrip_t strip = TIFFComputeStrip(r->tiff, row, 0);
+        if (strip != r->strip) {
+          if (TIFFReadEncodedStrip(r->tiff, strip, r->strip_buf, 
+                                   (tsize_t) -1) < 0)
+            asfPrintError("Could not read strip %d of %s\n", 
+                          (int) strip, job->inDataName);
+          r->strip = strip;
+        }
+        return (char *) r->strip_buf + 
+          (row - strip*job->tiffInfo.rowsPerStrip)*job->tiffInfo.scanlineSize;
+      }
+    case TILED_TIFF:
+      ReadScanline_from_TIFF_TileRow(r->tiff, r->line_buf, row, 0);
+      return r->line_buf;
+    default:
+      asfPrintError("Can't read this TIFF format!\n");
+      break;
+  }
+  return NULL;
+}
+
+// asf_parallel_fn: decode lines [start,end) of the block, and apply the
+// calibration and noise removal to them.
+static void import_sentinel_lines(int start, int end, void *data)
+{
+  sentinel_band_job *job = (sentinel_band_job *) data;
+  sentinel_reader *r = take_reader(job);
+  int sample_count = job->sample_count;
+  int dB = job->radiometry == r_SIGMA_DB || job->radiometry == r_BETA_DB ||
+    job->radiometry == r_GAMMA_DB;
+  int ii, sample;
+
+  for (ii=start; ii<end; ii++) {
+    int line = job->first_line + ii;
+    float *amp = job->amp + (long)ii*sample_count;
+    void *buf = read_sentinel_line(job, r, (uint32) line);
+
+    if (!job->detected) {
+      // complex 16 bit integers: interleaved real and imaginary parts
+      int16 *intValue = (int16 *) buf;
+      float *phase = job->phase + (long)ii*sample_count;
+      for (sample=0; sample<sample_count; sample++) {
+        float re = (float) intValue[2*sample];
+        float im = (float) intValue[2*sample+1];
+        amp[sample] = sqrt(re*re + im*im);
+        phase[sample] = atan2(im, re);
+      }
+      continue;
+    }
+
+    lut_azimuth_line(job->calRows, job->cal, job->calLutLines, line, 
+      sample_count, r->cal);
+    lut_azimuth_line(job->noiseRows, job->lut, job->noiseLutLines, line,
+      sample_count, r->noise);
+
+    uint16 *intValue = (uint16 *) buf;
+    float *calValue = r->cal;
+    float *lutNoise = r->noise;
+    for (sample=0; sample<sample_count; sample++) {
+      float re = (float) intValue[sample];
+      float cal2 = calValue[sample]*calValue[sample];
+      amp[sample] = (re*re - lutNoise[sample])/cal2;
+    }
+    if (dB) {
+      for (sample=0; sample<sample_count; sample++)
+        amp[sample] = amp[sample] < 0 ? -40.0 : 10.0 * log10(amp[sample]);
+    }
+
+    if (job->noise_sum) {
+      double sum = 0.0;
+      long count = 0;
+      for (sample=0; sample<sample_count; sample++) {
+        float noise = fabs(lutNoise[sample])/
+          (calValue[sample]*calValue[sample]);
+        if (ISNAN(job->mask) || !FLOAT_EQUIVALENT(noise, job->mask)) {
+          sum += noise;
+          count++;
+        }
+      }
+      job->noise_sum[ii] = sum;
+      job->noise_count[ii] = count;
+    }
+  }
+
+  give_reader(job, r);
+}
+
 void import_sentinel(const char *inBaseName, radiometry_t radiometry,
   const char *lutFile, const char *outBaseName)
 {
@@ -539,12 +666,11 @@ void import_sentinel(const char *inBaseName, radiometry_t radiometry,
   char inDataName[1024], *outDataName=NULL;
   char mission[25], beamMode[10], productType[10];
   char mode[25], modeStr[25];
-  float *amp = NULL, *phase = NULL, *calValue = NULL, *lutNoise = NULL;
-  float noise, re, im, scaledPower;
+  float *calRows = NULL, *noiseRows = NULL;
   double noise_mean = 0.0;
   long pixelCount = 0; 
   float mask = MAGIC_UNSET_DOUBLE;
-  int ii, file_count, band, line, sample, detected=TRUE, band_count=0;
+  int ii, file_count, band, line, detected=TRUE, band_count=0;
 
   check_sentinel_meta(inBaseName, mission, beamMode, productType);
   asfPrintStatus("   Mission: %s, beam mode: %s, product type: %s\n",
@@ -677,127 +803,81 @@ void import_sentinel(const char *inBaseName, radiometry_t radiometry,
   
         asfPrintStatus("\n   Importing %s ...\n", sentinel->data[band]);
   
-        uint32 scanlineSize = TIFFScanlineSize(tiff);
-        tdata_t *tiff_buf = _TIFFmalloc(scanlineSize);
-        if (!tiff_buf)
-          asfPrintError("Can't allocate buffer for reading TIFF lines!\n");
-  
-        amp = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-        phase = (float *) MALLOC(sizeof(float)*meta->general->sample_count);
-  
-        // Loop through the LUTs
-        uint32 row;
-        uint16 *intValue;
-        int kkCal = 0, kkNoise = 0;
-        int calIndex, calStart, calEnd, calLimit = 0;
-        int noiseIndex, noiseStart, noiseEnd, noiseLimit = 0;
-        for (line=0; line<meta->general->line_count; line++) {
-        
-          // Check LUT information
-          if (line == calLimit) {
-            if (calValue)
-              FREE(calValue);
-            if (kkCal < calLutLines - 1) {
-              calStart = kkCal;
-              calEnd = kkCal + 1;
-            }
-            else {
-              calStart = calEnd = kkCal;
-            }
-            calLimit = cal[calEnd].line;
-            calValue = get_cal_lut_lines(cal, radiometry, band, calLutLines, 
-              calStart, calEnd, outDataName);
-            kkCal++; 
-          }
-          if (line == noiseLimit) {
-            if (lutNoise)
-              FREE(lutNoise);
-            if (kkNoise < noiseLutLines - 1) {
-              noiseStart = kkNoise;
-              noiseEnd = kkNoise + 1;
-            }
-            else {
-              noiseStart = noiseEnd = kkNoise;
-            }
-            noiseLimit = lut[noiseEnd].line;
-            lutNoise = get_noise_lut_lines(lut, radiometry, band, noiseLutLines, 
-              noiseStart, noiseEnd, outDataName);
-            kkNoise++;
-          }
+        // Import the band a block of lines at a time: the lines of a block
+        // are decoded and calibrated in parallel, then written in order.
+        int line_count = meta->general->line_count;
+        int block = SENTINEL_BLOCK_LINES;
+        int chunk = 16;
+        if (tiffInfo.format == STRIP_TIFF && tiffInfo.rowsPerStrip > 0 &&
+            tiffInfo.rowsPerStrip <= SENTINEL_BLOCK_LINES) {
+          chunk = tiffInfo.rowsPerStrip;
+          block = (block + chunk - 1)/chunk*chunk;
+        }
 
-          // Apply values while going through data
-          row = (uint32)line;
-          switch (tiffInfo.format) 
-          {
-            case SCANLINE_TIFF:
-              TIFFReadScanline(tiff, tiff_buf, row, 0);
-              break;
-            case STRIP_TIFF:
-              ReadScanline_from_TIFF_Strip(tiff, tiff_buf, row, 0);
-              break;
-            case TILED_TIFF:
-              ReadScanline_from_TIFF_TileRow(tiff, tiff_buf, row, 0);
-              break;
-            default:
-              asfPrintError("Can't read this TIFF format!\n");
-              break;
-          }
-          for (sample=0; sample<sample_count; sample++) {
-            calIndex = (line - cal[calStart].line)*sample_count + sample;
-            noiseIndex = (line - lut[noiseStart].line)*sample_count + sample;
-            switch (sample_format)
-            {
-              case SAMPLEFORMAT_UINT:
-                re = (float)(((uint16*)tiff_buf)[sample]);
-                break;
-              case SAMPLEFORMAT_COMPLEXINT:
-                intValue = &((uint16*)tiff_buf)[sample];
-                re = (float) intValue[0];
-                im = (float) intValue[1];
-                break;
-            }
-            if (detected) {
-              noise = fabs(lutNoise[noiseIndex])/
-                (calValue[calIndex]*calValue[calIndex]);
-              if (noiseCount == 0) {
-                if (ISNAN(mask) || !FLOAT_EQUIVALENT(noise, mask)) {
-                  noise_mean += noise;
-                  pixelCount++;
-                }
-              }
-              scaledPower = (re*re - lutNoise[noiseIndex])/
-                (calValue[calIndex]*calValue[calIndex]);
-              if (radiometry == r_SIGMA_DB || radiometry == r_BETA_DB || 
-                radiometry == r_GAMMA_DB)
-                if (scaledPower < 0)
-                  amp[sample] = -40.0;
-                else
-                  amp[sample] = 10.0 * log10(scaledPower);
-              else
-                amp[sample] = scaledPower;
-            }
-            else {
-              amp[sample] = sqrt(re*re + im*im);
-              phase[sample] = atan2(im, re);
-            }
+        sentinel_band_job job;
+        job.inDataName = inDataName;
+        job.tiffInfo = tiffInfo;
+        job.detected = detected;
+        job.radiometry = radiometry;
+        job.sample_count = sample_count;
+        job.cal = cal;
+        job.lut = lut;
+        job.calLutLines = calLutLines;
+        job.noiseLutLines = noiseLutLines;
+        job.calRows = job.noiseRows = NULL;
+        job.mask = mask;
+        job.amp = (float *) MALLOC(sizeof(float)*sample_count*block);
+        job.phase = detected ? NULL :
+          (float *) MALLOC(sizeof(float)*sample_count*block);
+        job.noise_sum = NULL;
+        job.noise_count = NULL;
+        if (detected) {
+          calRows = lut_range_rows(cal, calLutLines, sample_count);
+          noiseRows = lut_range_rows(lut, noiseLutLines, sample_count);
+          job.calRows = calRows;
+          job.noiseRows = noiseRows;
+          if (noiseCount == 0) {
+            job.noise_sum = (double *) MALLOC(sizeof(double)*block);
+            job.noise_count = (long *) MALLOC(sizeof(long)*block);
           }
+        }
+        g_mutex_init(&job.pool_lock);
+        job.pool = (sentinel_reader **) 
+          MALLOC(sizeof(sentinel_reader *)*asf_get_thread_count());
+        job.n_free = job.n_readers = 0;
+
+        for (line=0; line<line_count; line+=block) {
+          int n = line + block > line_count ? line_count - line : block;
+          job.first_line = line;
+          asf_parallel_for(n, chunk, import_sentinel_lines, &job);
+
           if (detected)
-            put_band_float_line(fpOut, meta, band, line, amp);
+            put_band_float_lines(fpOut, meta, band, line, n, job.amp);
           else {
-            put_band_float_line(fpOut, meta, band*2, line, amp);
-            put_band_float_line(fpOut, meta, band*2+1, line, phase);
+            put_band_float_lines(fpOut, meta, band*2, line, n, job.amp);
+            put_band_float_lines(fpOut, meta, band*2+1, line, n, job.phase);
+          }
+          if (job.noise_sum) {
+            for (ii=0; ii<n; ii++) {
+              noise_mean += job.noise_sum[ii];
+              pixelCount += job.noise_count[ii];
+            }
           }
-          asfLineMeter(line, meta->general->line_count);
+          asfLineMeter(line + n - 1, line_count);
         }
           
         noiseCount++;
-        FREE(amp);
-        FREE(phase);
-        FREE(calValue);
-        calValue = NULL;
-        FREE(lutNoise);
-        lutNoise = NULL;
-        _TIFFfree(tiff_buf);
+        free_readers(&job);
+        FREE(job.pool);
+        g_mutex_clear(&job.pool_lock);
+        FREE(job.amp);
+        FREE(job.phase);
+        FREE(job.noise_sum);
+        FREE(job.noise_count);
+        FREE(calRows);
+        calRows = NULL;
+        FREE(noiseRows);
+        noiseRows = NULL;
         GTIFFree(gtif);
         XTIFFClose(tiff);
       }
@@ -31,6 +31,7 @@ void import_stf(char *inBaseName, char *outBaseName, radiometry_t radiometry,
   long imgStart=0, imgEnd=0;       /* Used to handle missing lines correctly */
   float fd, fdd, fddd;                               /* Doppler coefficients */
   FILE *fpOut=NULL;                           /* Data file to be written out */
+  pulse_writer *writer;          /* Writes decoded lines in the background */
   bin_state *s;    /* Structure with info about the satellite & its raw data */
   iqType *iqBuf;             /* Buffer containing the complex i & q channels */
   readPulseFunc readNextPulse; /* Pointer to function that reads the next line of CEOS Data */
@@ -136,6 +137,7 @@ void import_stf(char *inBaseName, char *outBaseName, radiometry_t radiometry,
 
   /* Now we just loop over the output lines, writing as we go. */
   fpOut=FOPEN(outDataName,"wb");
+  writer=new_pulse_writer(fpOut,sizeof(iqType)*s->nSamp*2);
   s->nLines=0;
   s->readStatus=1;
 
@@ -154,7 +156,7 @@ void import_stf(char *inBaseName, char *outBaseName, radiometry_t radiometry,
         if (((outLine >= imgStart) && (outLine <= imgEnd+4096)) ||  /* descending */
             ((outLine >= imgEnd) && (outLine <= imgStart+4096)))    /* ascending */
         {
-            ASF_FWRITE(iqBuf,sizeof(iqType),s->nSamp*2,fpOut);
+            pulse_writer_put(writer,iqBuf);
             s->nLines++;
         }
       }
@@ -162,6 +164,7 @@ void import_stf(char *inBaseName, char *outBaseName, radiometry_t radiometry,
       asfLineMeter(outLine, nTotal);
   }
   asfLineMeter(nTotal, nTotal);
+  delete_pulse_writer(writer);
 
   if (lat_constrained) {
     s->nLines -= 4096; /* reduce the line number from extra padding */
@@ -0,0 +1,134 @@
+/*************************
+pulse_writer.c: asynchronous output of decoded echo lines.
+
+The level-zero importers decode one echo line at a time and used to
+write each line straight to the output file.  Here the lines are
+collected into large blocks instead, and a background thread writes
+one block while the decoder fills the other.  Decoding and disk output
+therefore overlap, and the file sees a few large writes instead of one
+small write per echo.
+
+The data written, and its order, is exactly what the line-at-a-time
+loop would have written.
+*/
+
+#include <glib.h>
+
+#include "asf.h"
+#include "decoder.h"
+
+/*Number of bytes collected in a block before it is handed off*/
+#define PULSE_BLOCK_BYTES (4*1024*1024)
+
+struct pulse_writer {
+    FILE *fpOut;                /* Output file (owned by the caller)*/
+    int lineBytes;              /* Bytes in one echo line*/
+    int linesPerBlock;          /* Lines that fit in each block*/
+    unsigned char *block[2];    /* The two blocks we alternate between*/
+    int nLines[2];              /* Number of lines in each block*/
+    int pending[2];             /* Block is full and waiting to be written*/
+    int cur;                    /* Block the decoder is currently filling*/
+    int done;                   /* No more blocks are coming*/
+    GMutex lock;
+    GCond cond;
+    GThread *thread;
+};
+
+/*Writer thread: writes blocks in the order they were handed off, until
+told there are no more.*/
+static gpointer pulse_writer_thread(gpointer data)
+{
+    pulse_writer *w = (pulse_writer *)data;
+    int b = 0;
+
+    for (;;) {
+        g_mutex_lock(&w->lock);
+        while (!w->pending[b] && !w->done)
+            g_cond_wait(&w->cond, &w->lock);
+        if (!w->pending[b]) {
+            g_mutex_unlock(&w->lock);
+            break;
+        }
+        g_mutex_unlock(&w->lock);
+
+        ASF_FWRITE(w->block[b], w->lineBytes, w->nLines[b], w->fpOut);
+
+        g_mutex_lock(&w->lock);
+        w->pending[b] = 0;
+        g_cond_broadcast(&w->cond);
+        g_mutex_unlock(&w->lock);
+
+        b = !b;
+    }
+    return NULL;
+}
+
+/*Hand the current block to the writer thread, and wait until the other
+block has been written so the decoder can start filling it.*/
+static void pulse_writer_submit(pulse_writer *w)
+{
+    g_mutex_lock(&w->lock);
+    w->pending[w->cur] = 1;
+    g_cond_broadcast(&w->cond);
+    w->cur = !w->cur;
+    while (w->pending[w->cur])
+        g_cond_wait(&w->cond, &w->lock);
+    g_mutex_unlock(&w->lock);
+    w->nLines[w->cur] = 0;
+}
+
+pulse_writer *new_pulse_writer(FILE *fpOut,int lineBytes)
+{
+    pulse_writer *w = (pulse_writer *)MALLOC(sizeof(pulse_writer));
+    int i;
+
+    w->fpOut = fpOut;
+    w->lineBytes = lineBytes;
+    w->linesPerBlock = PULSE_BLOCK_BYTES/lineBytes;
+    if (w->linesPerBlock < 1)
+        w->linesPerBlock = 1;
+    for (i=0; i<2; i++) {
+        w->block[i] = (unsigned char *)
+            MALLOC(sizeof(unsigned char)*w->linesPerBlock*lineBytes);
+        w->nLines[i] = 0;
+        w->pending[i] = 0;
+    }
+    w->cur = 0;
+    w->done = 0;
+    g_mutex_init(&w->lock);
+    g_cond_init(&w->cond);
+    w->thread = g_thread_new("pulse_writer", pulse_writer_thread, w);
+
+    return w;
+}
+
+/*Queue one echo line (lineBytes bytes) for output.*/
+void pulse_writer_put(pulse_writer *w,const iqType *line)
+{
+    memcpy(&w->block[w->cur][w->nLines[w->cur]*w->lineBytes],
+           line, w->lineBytes);
+    if (++w->nLines[w->cur] == w->linesPerBlock)
+        pulse_writer_submit(w);
+}
+
+/*Write out whatever is still queued, and stop the writer thread.  The
+output file is left open.*/
+void delete_pulse_writer(pulse_writer *w)
+{
+    int i;
+
+    if (w->nLines[w->cur] > 0)
+        pulse_writer_submit(w);
+
+    g_mutex_lock(&w->lock);
+    w->done = 1;
+    g_cond_broadcast(&w->cond);
+    g_mutex_unlock(&w->lock);
+    g_thread_join(w->thread);
+
+    g_cond_clear(&w->cond);
+    g_mutex_clear(&w->lock);
+    for (i=0; i<2; i++)
+        FREE(w->block[i]);
+    FREE(w);
+}
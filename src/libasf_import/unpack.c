@@ -22,15 +22,17 @@ Called only by ERS_unpackBytes.
 */
 void ERS_convertSignalBytes(signalType *in,iqType *out)
 {
-	long b=(in[0]<<24)|(in[1]<<16)|(in[2]<<8)|(in[3]);
-	out[0]=0x001f&(b >> 27);
-	out[1]=0x001f&(b >> 22);
-	out[2]=0x001f&(b >> 17);
-	out[3]=0x001f&(b >> 12);
-	out[4]=0x001f&(b >> 7);
-	out[5]=0x001f&(b >> 2);
-	out[6]=0x001f&((b<<3)+(in[4]>>5));
-	out[7]=0x001f&(in[4]);
+	/*All 40 bits as one word, so each sample is a single shift & mask.*/
+	unsigned long long b=((unsigned long long)in[0]<<32)|
+		((unsigned long long)in[1]<<24)|(in[2]<<16)|(in[3]<<8)|(in[4]);
+	out[0]=0x001f&(b >> 35);
+	out[1]=0x001f&(b >> 30);
+	out[2]=0x001f&(b >> 25);
+	out[3]=0x001f&(b >> 20);
+	out[4]=0x001f&(b >> 15);
+	out[5]=0x001f&(b >> 10);
+	out[6]=0x001f&(b >> 5);
+	out[7]=0x001f&(b);
 }
 
 /*Unpack nIn input bytes to nIn/nSig*nIQ*2 of output bytes.
@@ -41,9 +43,9 @@ iqType *ERS_unpackBytes(signalType *in,int nIn,iqType *out)
 	if (len*EnSig!=nIn)
 		asfPrintError("Asked to convert %d bytes, which is not divisble by %d!\n",
 		              nIn,EnSig);
-	for (i=0;i<len;i++)
-		ERS_convertSignalBytes(&in[i*EnSig],&out[i*EnIQ*2]);
-	return &out[len*EnIQ*2];
+	for (i=0;i<len;i++,in+=EnSig,out+=EnIQ*2)
+		ERS_convertSignalBytes(in,out);
+	return out;
 }
 
 
@@ -55,35 +57,57 @@ various horrible bitwise combinations of the data.
 */
 #define JnSig 3 /*Number of bytes of signal data converted.*/
 #define JnIQ 4 /*Number of I/Q samples converted.*/
+/*
+JERS_iq:
+The I and Q samples for each 6-bit sample pair, de-interleaved and
+offset by 125.  Entry s is {125+i,125+q}, where i is bits 5,3,1 of s
+and q is bits 4,2,0.
+*/
+static const iqType JERS_iq[64][2]={
+	{125,125}, {125,126}, {126,125}, {126,126},
+	{125,127}, {125,128}, {126,127}, {126,128},
+	{127,125}, {127,126}, {128,125}, {128,126},
+	{127,127}, {127,128}, {128,127}, {128,128},
+	{125,129}, {125,130}, {126,129}, {126,130},
+	{125,131}, {125,132}, {126,131}, {126,132},
+	{127,129}, {127,130}, {128,129}, {128,130},
+	{127,131}, {127,132}, {128,131}, {128,132},
+	{129,125}, {129,126}, {130,125}, {130,126},
+	{129,127}, {129,128}, {130,127}, {130,128},
+	{131,125}, {131,126}, {132,125}, {132,126},
+	{131,127}, {131,128}, {132,127}, {132,128},
+	{129,129}, {129,130}, {130,129}, {130,130},
+	{129,131}, {129,132}, {130,131}, {130,132},
+	{131,129}, {131,130}, {132,129}, {132,130},
+	{131,131}, {131,132}, {132,131}, {132,132}
+};
+
 /*
 JERS_convertSignalBytes:
-Trade JnSig signal bytes for JnIQ iq pairs (2*JnIQ bytes).
+Trade JnSig signal bytes for JnIQ iq pairs (2*JnIQ bytes), looking
+each 6-bit sample pair up in JERS_iq.
 Called only by JERS_unpackBytes.
 */
 void JERS_convertSignalBytes(signalType *in,iqType *out)
 {
-/*Extract I or Q channel, de-interleaving bits.*/
-#define ext_i(s) ((0x4&(s>>3))|(0x2&(s>>2))|(0x1&(s>>1)))
-#define ext_q(s) ((0x4&(s>>2))|(0x2&(s>>1))|(0x1&(s>>0)))
-
 	int b=(in[0]<<16)|(in[1]<<8)|(in[2]);/*3 bytes as an int.*/
-	int s;/*6 bits, forming one sample.*/
+	const iqType *iq;
 
-	s=0x03F&(b >> 18);/*1st sample pair*/
-	out[0]=125+ext_i(s);
-	out[1]=125+ext_q(s);
+	iq=JERS_iq[0x03F&(b >> 18)];/*1st sample pair*/
+	out[0]=iq[0];
+	out[1]=iq[1];
 
-	s=0x03F&(b >> 12);/*2nd sample pair*/
-	out[2]=125+ext_i(s);
-	out[3]=125+ext_q(s);
+	iq=JERS_iq[0x03F&(b >> 12)];/*2nd sample pair*/
+	out[2]=iq[0];
+	out[3]=iq[1];
 
-	s=0x03F&(b >> 6);/*3rd sample pair*/
-	out[4]=125+ext_i(s);
-	out[5]=125+ext_q(s);
+	iq=JERS_iq[0x03F&(b >> 6)];/*3rd sample pair*/
+	out[4]=iq[0];
+	out[5]=iq[1];
 
-	s=0x03F&(b);/*4th sample pair*/
-	out[6]=125+ext_i(s);
-	out[7]=125+ext_q(s);
+	iq=JERS_iq[0x03F&(b)];/*4th sample pair*/
+	out[6]=iq[0];
+	out[7]=iq[1];
 }
 
 /*Unpack nIn input bytes to nIn/nSig*nIQ*2 of output bytes.
@@ -94,9 +118,9 @@ iqType *JERS_unpackBytes(signalType *in,int nIn,iqType *out)
 	if (len*JnSig!=nIn)
 		asfPrintError("Asked to convert %d bytes, which is not divisble by %d!\n",
 		              nIn,JnSig);
-	for (i=0;i<len;i++)
-		JERS_convertSignalBytes(&in[i*JnSig],&out[i*JnIQ*2]);
-	return &out[len*JnIQ*2];
+	for (i=0;i<len;i++,in+=JnSig,out+=JnIQ*2)
+		JERS_convertSignalBytes(in,out);
+	return out;
 }
 
 
@@ -115,10 +139,14 @@ Called only by RSAT_unpackBytes.
 static int  RSAT_cvrt[16]={ 8, 9,10,11,12,13,14,15,
 			    0, 1, 2, 3, 4, 5, 6, 7};
 
+/*RSAT_cvrt[n] is just n with its sign bit flipped, so a whole byte
+can be converted at once with n^0x88.  Written this way (no table
+lookup) the loop in RSAT_unpackBytes vectorizes.*/
 void RSAT_convertSignalBytes(signalType in,iqType *out)
 {
-	out[0]=RSAT_cvrt[ 0x00f&(in >> 4) ];
-	out[1]=RSAT_cvrt[ 0x00f&(in) ];
+	signalType flipped=in^0x88;
+	out[0]=flipped >> 4;
+	out[1]=flipped & 0x00f;
 }
 
 /*Unpack nIn input bytes to nIn output bytes.
@@ -3,8 +3,227 @@
 #include "asf_insar.h"
 #include "asf_raster.h"
 
-#define AMP(cpx) sqrt((cpx).real*(cpx).real + (cpx).imag*(cpx).imag)
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#define MAX(a,b) (((a) > (b)) ? (a) : (b))
+
+/* Interferogram formation, multilooking and coherence are done in a single
+   pass over blocks of multilooked lines.  The master and slave lines a
+   block needs are read once, and the interferogram and the master and
+   slave powers are formed for all of them (igram_lines).  The multilooked
+   lines are then done in parallel (igram_ml_lines): each worker slides the
+   coherence window down its lines, adding the lines coming in and
+   subtracting the ones going out, and takes the window sums across from
+   prefix sums of the column sums.  A coherence value costs the same
+   whatever the window size. */
+
+typedef struct {
+  int ns, nl;
+  int lookLine, lookSample, stepLine, stepSample;
+  int out_ns;              /* multilooked samples */
+  float ampScale;
+  int first;               /* first line of the block */
+  int n_single;            /* single-look lines written from the block */
+  int ml_first;            /* first multilooked line of the block */
+  complexFloat *master, *slave;
+  float *re, *im;          /* interferogram */
+  float *pa, *pb;          /* master and slave power */
+  float *amp, *phase;      /* single-look amplitude and phase */
+  float *ml_amp, *ml_phase, *coh;
+} igram_job;
+
+/* Sums over the lines of the coherence window, per column.  The number of
+   non-zero powers is kept too, so that a window with no master or no
+   slave data is recognized exactly, whatever rounding the running sums
+   have picked up. */
+typedef struct {
+  double *re, *im, *a, *b;
+  int *na, *nb;
+} igram_sums;
+
+static void igram_sums_init(igram_sums *s, int n)
+{
+  s->re = (double *) MALLOC(sizeof(double)*n);
+  s->im = (double *) MALLOC(sizeof(double)*n);
+  s->a = (double *) MALLOC(sizeof(double)*n);
+  s->b = (double *) MALLOC(sizeof(double)*n);
+  s->na = (int *) MALLOC(sizeof(int)*n);
+  s->nb = (int *) MALLOC(sizeof(int)*n);
+}
+
+static void igram_sums_free(igram_sums *s)
+{
+  FREE(s->re);
+  FREE(s->im);
+  FREE(s->a);
+  FREE(s->b);
+  FREE(s->na);
+  FREE(s->nb);
+}
+
+static void igram_sums_clear(igram_sums *s, int n)
+{
+  int x;
+  for (x=0; x<n; x++) {
+    s->re[x] = s->im[x] = s->a[x] = s->b[x] = 0.0;
+    s->na[x] = s->nb[x] = 0;
+  }
+}
+
+// Add (sign 1) or take out (sign -1) lines [from,to) of the block.
+static void igram_sums_add(igram_sums *s, const igram_job *job,
+                           int from, int to, int sign)
+{
+  int ns = job->ns, row, x;
+  for (row=from; row<to; row++) {
+    long off = (long)row*ns;
+    const float *re = job->re + off, *im = job->im + off;
+    const float *pa = job->pa + off, *pb = job->pb + off;
+    for (x=0; x<ns; x++) {
+      s->re[x] += sign*(double)re[x];
+      s->im[x] += sign*(double)im[x];
+      s->a[x] += sign*(double)pa[x];
+      s->b[x] += sign*(double)pb[x];
+      s->na[x] += sign*(pa[x] != 0.0);
+      s->nb[x] += sign*(pb[x] != 0.0);
+    }
+  }
+}
+
+// Prefix sums over the columns: p[x] is the sum of columns [0,x).
+static void igram_sums_prefix(igram_sums *p, const igram_sums *s, int n)
+{
+  int x;
+  p->re[0] = p->im[0] = p->a[0] = p->b[0] = 0.0;
+  p->na[0] = p->nb[0] = 0;
+  for (x=0; x<n; x++) {
+    p->re[x+1] = p->re[x] + s->re[x];
+    p->im[x+1] = p->im[x] + s->im[x];
+    p->a[x+1] = p->a[x] + s->a[x];
+    p->b[x+1] = p->b[x] + s->b[x];
+    p->na[x+1] = p->na[x] + s->na[x];
+    p->nb[x+1] = p->nb[x] + s->nb[x];
+  }
+}
+
+/* asf_parallel_fn: form the interferogram and powers for lines
+   [start,end) of the block, and the single-look amplitude and phase for
+   the ones that are written out.  The loops are kept free of branches
+   and calls, apart from the sqrt and atan2 loops, so that the compiler
+   can vectorize them. */
+static void igram_lines(int start, int end, void *data)
+{
+  igram_job *job = (igram_job *) data;
+  int ns = job->ns, ii, x;
+
+  for (ii=start; ii<end; ii++) {
+    long off = (long)ii*ns;
+    const complexFloat *m = job->master + off, *s = job->slave + off;
+    float *re = job->re + off, *im = job->im + off;
+    float *pa = job->pa + off, *pb = job->pb + off;
+
+    // Complex multiplication for interferogram generation
+    for (x=0; x<ns; x++) {
+      re[x] = m[x].real*s[x].real + m[x].imag*s[x].imag;
+      im[x] = m[x].imag*s[x].real - m[x].real*s[x].imag;
+      pa[x] = m[x].real*m[x].real + m[x].imag*m[x].imag;
+      pb[x] = s[x].real*s[x].real + s[x].imag*s[x].imag;
+    }
+
+    if (ii >= job->n_single)
+      continue;
+
+    float *amp = job->amp + off, *phase = job->phase + off;
+    for (x=0; x<ns; x++)
+      amp[x] = sqrt((double)re[x]*re[x] + (double)im[x]*im[x]);
+    for (x=0; x<ns; x++)
+      phase[x] = (FLOAT_EQUIVALENT(re[x], 0.0) ||
+                  FLOAT_EQUIVALENT(im[x], 0.0)) ?
+        0.0 : atan2(im[x], re[x]);
+  }
+}
+
+/* asf_parallel_fn: multilooked amplitude and phase, and coherence, for
+   multilooked lines [start,end) of the block. */
+static void igram_ml_lines(int start, int end, void *data)
+{
+  igram_job *job = (igram_job *) data;
+  int ns = job->ns, out_ns = job->out_ns;
+  int sl = job->stepLine, ss = job->stepSample;
+  int ii, jj, row, x, lo = 0, hi = 0;
+  igram_sums sum, prefix;
+  double *ml_re = (double *) MALLOC(sizeof(double)*ns);
+  double *ml_im = (double *) MALLOC(sizeof(double)*ns);
+
+  igram_sums_init(&sum, ns);
+  igram_sums_init(&prefix, ns+1);
+
+  for (ii=start; ii<end; ii++) {
+    // Coherence window: lines [new_lo,new_hi) of the block
+    int new_lo = (job->ml_first + ii)*sl - job->first;
+    int new_hi = MIN(new_lo + job->lookLine, job->nl - job->first);
+    if (ii == start || new_lo >= hi) {
+      igram_sums_clear(&sum, ns);
+      igram_sums_add(&sum, job, new_lo, new_hi, 1);
+    }
+    else {
+      igram_sums_add(&sum, job, lo, new_lo, -1);
+      igram_sums_add(&sum, job, hi, new_hi, 1);
+    }
+    lo = new_lo;
+    hi = new_hi;
+    igram_sums_prefix(&prefix, &sum, ns);
+
+    float *pCoh = job->coh + (long)ii*out_ns;
+    for (jj=0; jj<out_ns; jj++) {
+      int c0 = jj*ss, c1 = MIN(c0 + job->lookSample, ns);
+      if (prefix.na[c1] == prefix.na[c0] || prefix.nb[c1] == prefix.nb[c0]) {
+        pCoh[jj] = 0.0;
+        continue;
+      }
+      double igram_real = prefix.re[c1] - prefix.re[c0];
+      double igram_imag = prefix.im[c1] - prefix.im[c0];
+      double sum_ab = (prefix.a[c1] - prefix.a[c0])*(prefix.b[c1] - prefix.b[c0]);
+      if (FLOAT_EQUIVALENT(sum_ab, 0.0))
+        pCoh[jj] = 0.0;
+      else
+        pCoh[jj] = (float) sqrt(igram_real*igram_real + igram_imag*igram_imag) /
+          sqrt(sum_ab);
+    }
+
+    // Multilook over the first stepLine lines of the window
+    int ml_hi = MIN(lo + sl, hi);
+    for (x=0; x<ns; x++)
+      ml_re[x] = ml_im[x] = 0.0;
+    for (row=lo; row<ml_hi; row++) {
+      const float *re = job->re + (long)row*ns, *im = job->im + (long)row*ns;
+      for (x=0; x<ns; x++) {
+        ml_re[x] += re[x];
+        ml_im[x] += im[x];
+      }
+    }
+    float *ml_amp = job->ml_amp + (long)ii*out_ns;
+    float *ml_phase = job->ml_phase + (long)ii*out_ns;
+    for (jj=0; jj<out_ns; jj++) {
+      double igram_real = 0.0, igram_imag = 0.0;
+      for (x=jj*ss; x<(jj+1)*ss; x++) {
+        igram_real += ml_re[x];
+        igram_imag += ml_im[x];
+      }
+      ml_amp[jj] = sqrt(igram_real*igram_real + igram_imag*igram_imag)*
+        job->ampScale;
+      if (FLOAT_EQUIVALENT(igram_real, 0.0) ||
+          FLOAT_EQUIVALENT(igram_imag, 0.0))
+        ml_phase[jj] = 0.0;
+      else
+        ml_phase[jj] = atan2(igram_imag, igram_real);
+    }
+  }
+
+  igram_sums_free(&sum);
+  igram_sums_free(&prefix);
+  FREE(ml_re);
+  FREE(ml_im);
+}
 
 int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 		  char *masterFile, char *slaveFile, char *outBase,
@@ -14,13 +233,10 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
   char cohFile[512], ml_ampFile[255], ml_phaseFile[255]; //, ml_igramFile[512];
   FILE *fpMaster, *fpSlave, *fpAmp, *fpPhase, *fpCoh, *fpAmp_ml, *fpPhase_ml;
   int line, sample_count, line_count, count;
-  float	bin_high, bin_low, max=0.0, sum_a, sum_b, ampScale;
+  float	bin_high, bin_low, max=0.0, ampScale;
   double hist_sum=0.0, percent, percent_sum;
   long long hist_val[HIST_SIZE], hist_cnt=0;
   meta_parameters *inMeta,*outMeta, *ml_outMeta;
-  complexFloat *master, *slave, *sum_igram, *sum_ml_igram;
-  float *amp, *phase, *sum_cpx_a, *sum_cpx_b, *coh, *pCoh;
-  float *ml_amp, *ml_phase;
 
   // FIXME: Processing flow with two-banded interferogram needed - backed out
   //        for now
@@ -94,18 +310,37 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
   meta_write(ml_outMeta, ml_igramFile);
   */
 
+  // Blocks of multilooked lines, small enough that the input lines and
+  // everything formed from them stay around 64 MB.
+  int out_nl = line_count/stepLine;
+  int out_ns = sample_count/stepSample;
+  int block = (1 << 21) / ((long)stepLine*sample_count);
+  if (block > 256) block = 256;
+  if (block < 1) block = 1;
+  int max_lines = block*stepLine + MAX(lookLine, stepLine);
+  long n = (long)sample_count*max_lines;
+
   // Allocate memory
-  master = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count*lookLine);
-  slave = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count*lookLine);
-  amp = (float *) MALLOC(sizeof(float)*sample_count*lookLine);
-  phase = (float *) MALLOC(sizeof(float)*sample_count*lookLine);
-  ml_amp = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  ml_phase = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  coh = (float *) MALLOC(sizeof(float)*sample_count/stepSample);
-  sum_cpx_a = (float *) MALLOC(sizeof(float)*sample_count);
-  sum_cpx_b = (float *) MALLOC(sizeof(float)*sample_count);
-  sum_igram = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count);
-  sum_ml_igram = (complexFloat *) MALLOC(sizeof(complexFloat)*sample_count);
+  igram_job job;
+  job.ns = sample_count;
+  job.nl = line_count;
+  job.lookLine = lookLine;
+  job.lookSample = lookSample;
+  job.stepLine = stepLine;
+  job.stepSample = stepSample;
+  job.out_ns = out_ns;
+  job.ampScale = ampScale;
+  job.master = (complexFloat *) MALLOC(sizeof(complexFloat)*n);
+  job.slave = (complexFloat *) MALLOC(sizeof(complexFloat)*n);
+  job.re = (float *) MALLOC(sizeof(float)*n);
+  job.im = (float *) MALLOC(sizeof(float)*n);
+  job.pa = (float *) MALLOC(sizeof(float)*n);
+  job.pb = (float *) MALLOC(sizeof(float)*n);
+  job.amp = (float *) MALLOC(sizeof(float)*n);
+  job.phase = (float *) MALLOC(sizeof(float)*n);
+  job.ml_amp = (float *) MALLOC(sizeof(float)*out_ns*block);
+  job.ml_phase = (float *) MALLOC(sizeof(float)*out_ns*block);
+  job.coh = (float *) MALLOC(sizeof(float)*out_ns*block);
 
   // Open files
   fpMaster = FOPEN(masterFile,"rb");
@@ -123,126 +358,60 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 
   asfPrintStatus("   Calculating interferogram and coherence ...\n\n");
 
-  for (line=0; line<line_count; line+=stepLine)
+  for (line=0; line*stepLine<line_count; line+=block)
   {
-    register int offset, row, column, limitLine;
-    double igram_real, igram_imag;
-    int inCol;
-    limitLine=MIN(lookLine, line_count-line);
-
-    printf("Percent completed %3.0f\r",(float)line/line_count*100.0);
-
-    pCoh = coh;
-
-    // Read in the next lines of data
-    get_complexFloat_lines(fpMaster, inMeta, line, limitLine, master);
-    get_complexFloat_lines(fpSlave, inMeta, line, limitLine, slave);
-
-    // Add the remaining rows into sum vectors
-    offset = sample_count;
-    for (column=0; column<sample_count; column++)
-    {
-      offset = column;
-      sum_cpx_a[column] = 0.0;
-      sum_cpx_b[column] = 0.0;
-      sum_igram[column].real = 0.0;
-      sum_igram[column].imag = 0.0;
-      sum_ml_igram[column].real = 0.0;
-      sum_ml_igram[column].imag = 0.0;
-      igram_real = 0.0;
-      igram_imag = 0.0;
-
-      for (row=0; row<limitLine; row++)
-      {
-	// Complex multiplication for interferogram generation
-	igram_real = master[offset].real*slave[offset].real + 
-	  master[offset].imag*slave[offset].imag;
-        igram_imag = master[offset].imag*slave[offset].real - 
-	  master[offset].real*slave[offset].imag;
-        amp[offset] = sqrt(igram_real*igram_real + igram_imag*igram_imag);
-        if (FLOAT_EQUIVALENT(igram_real, 0.0) || 
-	    FLOAT_EQUIVALENT(igram_imag, 0.0))
-	  phase[offset]=0.0;
-        else
-	  phase[offset] = atan2(igram_imag, igram_real);
-
-       	sum_cpx_a[column] += AMP(master[offset])*AMP(master[offset]);
-      	sum_cpx_b[column] += AMP(slave[offset])*AMP(slave[offset]);
-       	sum_igram[column].real += igram_real;
-	sum_igram[column].imag += igram_imag;
-	if (line % stepLine == 0 && row < stepLine) {
-	  sum_ml_igram[column].real += igram_real;
-	  sum_ml_igram[column].imag += igram_imag;
-	}
-
-	offset += sample_count;
-      }
-
-      ml_amp[column] = 
-	sqrt(sum_ml_igram[column].real*sum_ml_igram[column].real + 
-	     sum_ml_igram[column].imag*sum_ml_igram[column].imag)*ampScale;
-      if (FLOAT_EQUIVALENT(sum_ml_igram[column].real, 0.0) || 
-	  FLOAT_EQUIVALENT(sum_ml_igram[column].imag, 0.0))
-	ml_phase[column] = 0.0;
-      else
-	ml_phase[column] = atan2(sum_ml_igram[column].imag, 
-				 sum_ml_igram[column].real);
+    // Multilooked lines [line,line+n_ml) and single-look lines
+    // [first,single_end).  The last block takes any lines left over
+    // below the last multilooked line.
+    int first = line*stepLine;
+    int n_ml = MIN(block, out_nl - line);
+    int single_end = line + n_ml == out_nl ? line_count : first + n_ml*stepLine;
+    int read_end = single_end;
+    if (n_ml > 0)
+      read_end = MAX(read_end,
+                     MIN(line_count, (line + n_ml - 1)*stepLine + lookLine));
+
+    printf("Percent completed %3.0f\r",(float)first/line_count*100.0);
+
+    // Read in the lines of data for the whole block
+    get_complexFloat_lines(fpMaster, inMeta, first, read_end - first,
+                           job.master);
+    get_complexFloat_lines(fpSlave, inMeta, first, read_end - first,
+                           job.slave);
+
+    job.first = first;
+    job.n_single = single_end - first;
+    job.ml_first = line;
+    asf_parallel_for(read_end - first, 8, igram_lines, &job);
+    if (n_ml > 0)
+      asf_parallel_for(n_ml, 4, igram_ml_lines, &job);
+
+    // Write single-look and multilooked amplitude and phase, and coherence
+    put_float_lines(fpAmp, outMeta, first, job.n_single, job.amp);
+    put_float_lines(fpPhase, outMeta, first, job.n_single, job.phase);
+    if (n_ml > 0) {
+      put_float_lines(fpAmp_ml, ml_outMeta, line, n_ml, job.ml_amp);
+      put_float_lines(fpPhase_ml, ml_outMeta, line, n_ml, job.ml_phase);
+      put_float_lines(fpCoh, ml_outMeta, line, n_ml, job.coh);
     }
-
-    // Write single-look and multilooked amplitude and phase
-    put_float_lines(fpAmp, outMeta, line, stepLine, amp);
-    put_float_lines(fpPhase, outMeta, line, stepLine, phase);
-    put_float_line(fpAmp_ml, ml_outMeta, line/stepLine, ml_amp);
-    put_float_line(fpPhase_ml, ml_outMeta, line/stepLine, ml_phase);
-    //put_band_float_lines(fpIgram, outMeta, 0, line, stepLine, amp);
-    //put_band_float_lines(fpIgram, outMeta, 1, line, stepLine, phase);
-    //put_band_float_line(fpIgram_ml, ml_outMeta, 0, line/stepLine, ml_amp);
-    //put_band_float_line(fpIgram_ml, ml_outMeta, 1, line/stepLine, ml_phase);
-
-    // Calculate the coherence by adding from sum vectors
-    for (inCol=0; inCol<sample_count; inCol+=stepSample)
-    {
-      register int limitSample = MIN(lookSample,sample_count-inCol);
-      sum_a = 0.0;
-      sum_b = 0.0;
-      igram_real = 0.0;
-      igram_imag = 0.0;
-
-      // Step over multilook area and sum output columns
-      for (column=0; column<limitSample; column++)
-      {
-	igram_real += sum_igram[inCol+column].real;
-	igram_imag += sum_igram[inCol+column].imag;				
-	sum_a += sum_cpx_a[inCol+column];
-	sum_b += sum_cpx_b[inCol+column];
-      }
-
-      if (FLOAT_EQUIVALENT((sum_a*sum_b), 0.0))
-	*pCoh = 0.0;
-      else 
-      {
-	*pCoh = (float) sqrt(igram_real*igram_real + igram_imag*igram_imag) /
-	  sqrt(sum_a * sum_b);
-	if (*pCoh>1.0001)
-	{ 
-	  printf("   coh = %f -- setting to 1.0\n",*pCoh);
-	  printf("   You shouldn't have seen this!\n");
-	  printf("   Exiting.\n");
-          exit(EXIT_FAILURE);
-	  *pCoh=1.0;
-	}
-      }
-     pCoh++;
-    } 
-
-    // Write out values for coherence
-    put_float_line(fpCoh, ml_outMeta, line/stepLine, coh);
+    //put_band_float_lines(fpIgram, outMeta, 0, first, job.n_single, job.amp);
+    //put_band_float_lines(fpIgram, outMeta, 1, first, job.n_single, job.phase);
+    //put_band_float_lines(fpIgram_ml, ml_outMeta, 0, line, n_ml, job.ml_amp);
+    //put_band_float_lines(fpIgram_ml, ml_outMeta, 1, line, n_ml, job.ml_phase);
 
     // Keep filling coherence histogram
-    for (count=0; count<sample_count/stepSample; count++)
+    for (count=0; count<n_ml*out_ns; count++)
     {
       register int tmp;
-      tmp = (int) (coh[count]*HIST_SIZE); /* Figure out which bin this value is in */
+      float coh = job.coh[count];
+      if (coh>1.0001)
+      {
+        printf("   coh = %f -- setting to 1.0\n",coh);
+        printf("   You shouldn't have seen this!\n");
+        printf("   Exiting.\n");
+        exit(EXIT_FAILURE);
+      }
+      tmp = (int) (coh*HIST_SIZE); /* Figure out which bin this value is in */
       /* This shouldn't happen */
       if(tmp >= HIST_SIZE)
 	tmp = HIST_SIZE-1;
@@ -250,14 +419,14 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 	tmp = 0;
       
       hist_val[tmp]++;        // Increment that bin for the histogram
-      hist_sum += coh[count];   // Add up the values for the sum
+      hist_sum += coh;        // Add up the values for the sum
       hist_cnt++;             // Keep track of the total number of values
-      if (coh[count]>max) 
-	max = coh[count];  // Calculate maximum coherence
+      if (coh>max) 
+	max = coh;            // Calculate maximum coherence
     }
   } // End for line
 
-  printf("Percent completed %3.0f\n",(float)line/line_count*100.0);
+  printf("Percent completed %3.0f\n",100.0);
 
   // Sum and print the statistics
   percent_sum = 0.0;
@@ -278,13 +447,17 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 		 *average,hist_sum, hist_cnt, percent_sum);
 
   // Free and exit
-  FREE(master); 
-  FREE(slave);
-  FREE(amp); 
-  FREE(phase);
-  FREE(ml_amp); 
-  FREE(ml_phase); 
-  FREE(coh); 
+  FREE(job.master);
+  FREE(job.slave);
+  FREE(job.re);
+  FREE(job.im);
+  FREE(job.pa);
+  FREE(job.pb);
+  FREE(job.amp);
+  FREE(job.phase);
+  FREE(job.ml_amp);
+  FREE(job.ml_phase);
+  FREE(job.coh);
   FCLOSE(fpMaster); 
   FCLOSE(fpSlave);
   FCLOSE(fpAmp); 
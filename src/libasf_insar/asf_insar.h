@@ -54,6 +54,11 @@ int asf_igram_coh(int lookLine, int lookSample, int stepLine, int stepSample,
 		  float *average);
 
 // Prototypes from asf_phase_unwrap.c
+typedef struct dem_phase_params dem_phase_params;
+dem_phase_params *dem_phase_init(meta_parameters *meta, char *baseFile);
+void dem_phase_lines(dem_phase_params *p, int y, int n, const float *dem,
+		     float *phase);
+void dem_phase_free(dem_phase_params *p);
 int dem2phase(char *demFile, char *baseFile, char *phaseFile);
 int asf_phase_unwrap(char *algorithm, char *interferogram, char *metaFile, 
 		     char *demFile, char *baseline, double filter_strength, 
@@ -73,20 +78,31 @@ int asf_baseline(char *baseName, char *interferogram, char *seeds,
 		 int max_iterations, int *iterations);
 
 // Prototypes from deramp.c
+typedef struct deramp_params deramp_params;
+deramp_params *deramp_init(meta_parameters *meta, char *baseFile, int back);
+void deramp_lines(deramp_params *p, int y, int n, float *phase);
+void deramp_free(deramp_params *p);
 int deramp(char *inFile, char *baseFile, char *outFile, int back);
 
 // Prototypes from phase_filter.c
 int phase_filter(char *inFile, double strength, char *outFile);
+void phase_filter_image(FILE *in, meta_parameters *meta,
+			FILE *out, double strength);
 int zeroify(char *inFile, char *testFile, char *outFile);
 
 // Prototypes from escher.c
+#define ESCHER_DEFAULT_TILE_SIZE 1024
 int escher(char *inFile, char *outFile);
+int escher_tiled(char *inFile, char *outFile, int tileSize);
 
 // Prototypes from refine_baseline.c
 int refine_baseline(char *phaseFile, char *seeds, char *oldBase, 
 		    char *newBase);
 
 // Prototypes from multilook.c
+void multilook_phase_line(const float *amp, const float *phase, int ns,
+			  int look_line, const float *scale,
+			  float *ml_amp, float *ml_phase, float *rgb);
 int asf_insar_multilook(char *inFile, char *outFile, char *metaFile, char *overlay);
 
 #endif
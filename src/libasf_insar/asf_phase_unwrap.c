@@ -5,169 +5,316 @@
 #include "asf_insar.h"
 #include "asf_raster.h"
 
+struct dem_phase_params {
+  meta_parameters *meta;
+  baseline base;
+  int sample_count, start_line;
+  double yScale;
+  double *phase2elevBase, *sinFlat, *cosFlat;
+};
+
+// Set up simulating phase from a slant range DEM described by meta (which
+// must stay around until dem_phase_free), with the baseline in baseFile.
+dem_phase_params *dem_phase_init(meta_parameters *meta, char *baseFile)
+{
+  dem_phase_params *p = (dem_phase_params *) MALLOC(sizeof(dem_phase_params));
+  int x, start_sample;
+  double k, xScale;
+
+  p->meta = meta;
+  p->sample_count = meta->general->sample_count;
+  p->start_line = meta->general->start_line;
+  p->yScale = meta->sar->line_increment;
+  start_sample = meta->general->start_sample;
+  xScale = meta->sar->sample_increment;
+
+  // Get wavenumber
+  k = meta_get_k(meta);
+
+  // Read in baseline values
+  p->base = read_baseline(baseFile);
+
+  /* calculate the sine of the incidence angle across cols*/
+  p->sinFlat = (double *)MALLOC(sizeof(double)*p->sample_count);
+  p->cosFlat = (double *)MALLOC(sizeof(double)*p->sample_count);
+  p->phase2elevBase = (double *)MALLOC(sizeof(double)*p->sample_count);
+  for (x=0; x<p->sample_count; x++) {
+    int img_x = x*xScale + start_sample;
+    double incid = meta_incid(meta, 0.0, (float)img_x);
+    double flat = meta_flat(meta, 0.0, (float)img_x);
+    p->sinFlat[x] = sin(flat);
+    p->cosFlat[x] = cos(flat);
+    p->phase2elevBase[x] =
+      meta_get_slant(meta, 0.0, (float)img_x) * sin(incid)/(2.0*k);
+  }
+
+  return p;
+}
+
+// Simulated phase for n lines of heights, the first of which is DEM line y.
+void dem_phase_lines(dem_phase_params *p, int y, int n, const float *dem,
+		     float *phase)
+{
+  int ii, x, ns = p->sample_count;
+
+  for (ii=0; ii<n; ii++) {
+    double Bn_y, Bp_y;
+    const float *d = dem + (long)ii*ns;
+    float *ph = phase + (long)ii*ns;
+
+    // Calculate baseline for this row
+    meta_interp_baseline(p->meta, p->base, (y+ii)*(int)p->yScale+p->start_line,
+			 &Bn_y, &Bp_y);
+
+    // Step through each pixel in row
+    for (x=0; x<ns; x++)
+      ph[x] = d[x]/p->phase2elevBase[x]*(-Bp_y*p->sinFlat[x]-Bn_y*p->cosFlat[x]);
+  }
+}
+
+void dem_phase_free(dem_phase_params *p)
+{
+  FREE(p->phase2elevBase);
+  FREE(p->sinFlat);
+  FREE(p->cosFlat);
+  FREE(p);
+}
+
 int dem2phase(char *demFile, char *baseFile, char *phaseFile)
 {
-  int x, y, start_sample, start_line, line_count, sample_count;
-  double k, *phase2elevBase, *sinFlat, *cosFlat, xScale, yScale;
-  baseline base;
+  int y, line_count, sample_count;
+  dem_phase_params *params;
   meta_parameters *meta;
   FILE *fpDem, *fpPhase;
   float *phase,*dem;
-  
+
   meta = meta_read(demFile);
-  start_sample = meta->general->start_sample;
-  start_line = meta->general->start_line;
-  xScale = meta->sar->sample_increment;
-  yScale = meta->sar->line_increment;
   line_count = meta->general->line_count;
   sample_count = meta->general->sample_count;
-  
+
   meta_write(meta, phaseFile);
-  
+
   // Allocate some memory
   phase = (float *)MALLOC(sizeof(float)*sample_count);
   dem =(float *)MALLOC(sizeof(float)*sample_count);
- 
-  // Get wavenumber
-  k = meta_get_k(meta);
-  
-  // Read in baseline values
-  base = read_baseline(baseFile);
 
-  // Open files  
+  params = dem_phase_init(meta, baseFile);
+
+  // Open files
   fpDem = fopenImage(demFile, "rb");
   fpPhase = fopenImage(phaseFile,"wb");
-  
-  /* calculate the sine of the incidence angle across cols*/
-  sinFlat = (double *)MALLOC(sizeof(double)*sample_count);
-  cosFlat = (double *)MALLOC(sizeof(double)*sample_count);
-  phase2elevBase = (double *)MALLOC(sizeof(double)*sample_count);
-  for (x=0; x<sample_count; x++) {
-    int img_x = x*xScale + start_sample;
-    double incid = meta_incid(meta, 0.0, (float)img_x);
-    double flat = meta_flat(meta, 0.0, (float)img_x);
-    sinFlat[x] = sin(flat);
-    cosFlat[x] = cos(flat);
-    phase2elevBase[x] = 
-      meta_get_slant(meta, 0.0, (float)img_x) * sin(incid)/(2.0*k);
-  }
-  
-  
+
   // Loop through each row and calculate height
   for (y=0;y<line_count;y++) {
-    double Bn_y, Bp_y;
-    
-    // Read in data 
     get_float_line(fpDem, meta, y, dem);
-    
-    // Calculate baseline for this row
-    meta_interp_baseline(meta, base, y*(int)yScale+start_line, &Bn_y, &Bp_y);
-    
-    // Step through each pixel in row
-    for (x=0; x<sample_count; x++)
-      phase[x] = dem[x]/phase2elevBase[x]*(-Bp_y*sinFlat[x]-Bn_y*cosFlat[x]);
+    dem_phase_lines(params, y, 1, dem, phase);
     put_float_line(fpPhase, meta, y, phase);
     asfLineMeter(y, line_count);
   }
   asfPrintStatus("Wrote %d lines of simulated phase data.\n\n", line_count);
-  
+
   // Clean up
   FREE(phase);
   FREE(dem);
   FCLOSE(fpPhase);
   FCLOSE(fpDem);
+  dem_phase_free(params);
+  meta_free(meta);
 
   return(0);
 }
 
-int asf_phase_unwrap(char *algorithm, char *interferogram, char *metaFile, 
-		     char *demFile, char *baseline, double filter_strength, 
-		     int flattening, char *mask, char *unwrapped_phase)
+// 'escher_tiled' unwraps tile by tile, for images too large for escher
+static int unwrap_escher(char *algorithm, char *inFile, char *outFile)
 {
-  int ii;
-  char tmp[255];
-  char **inFiles = (char **) MALLOC(sizeof(char *)*2);
-  for (ii=0; ii<2; ii++)
-    inFiles[ii] = (char *) MALLOC(sizeof(char)*50);
-
-  // Simulated phase image from DEM
-  asfPrintStatus("\n   Simulating a phase image from DEM ...\n\n");
-  check_return(dem2phase(demFile, baseline, "dem_phase.img"),
-	       "creating simulated phase (dem2phase)");
-
-  // Deramping and multilooking interferogram
-  asfPrintStatus("   Deramping interferogram ...\n\n");
-  check_return(deramp(interferogram, baseline, "igramd", 0),
-	       "deramping interferogram (deramp)");
-  asfPrintStatus("\n   Multilooking the interferogram ...\n\n");
-  check_return(asf_insar_multilook("igramd", "ml", "a_cpx.meta", NULL),
-	       "multilooking interferogram (multilook)");
-
-  // Remove known topographic phase
-  asfPrintStatus("\n   Removing known topographic phase ...\n");
-  if (flattening == 1) {
-    sprintf(inFiles[0], "ml_phase.img");
-    sprintf(inFiles[1], "dem_phase.img");
-    check_return(raster_calc("ml_dem_phase.img", 
-			     "\'(a-b)%6.2831853-3.14159265\' ", 2, inFiles),
-		 "subtracting terrain induced phase (raster_calc)");
-  }
-  
-  // Get rolling on the phase unwrapping
-  if (strncmp(algorithm, "escher", 6)==0) {
-    if (flattening == 1) 
-      sprintf(tmp, "ml_dem_phase.img");
-    else sprintf(tmp, "ml_phase.img");
-    if (filter_strength < 0.0 || filter_strength > 3.0) {
-      asfPrintWarning("phase filter value out of range - set to value "
-		      "of 1.6\n");
-      filter_strength = 1.6;
-    }
-    if (filter_strength > 0.0) {
-      asfPrintStatus("\n   Filtering the phase ...\n\n");
-      check_return(phase_filter(tmp, filter_strength, "filtered_phase"),
-		   "phase filtering (phase_filter)");
-      sprintf(tmp, "filtered_phase");
+  if (strcmp(algorithm, "escher_tiled")==0)
+    return escher_tiled(inFile, outFile, ESCHER_DEFAULT_TILE_SIZE);
+  else
+    return escher(inFile, outFile);
+}
+
+/* The unwrapping chain used to be a series of whole image steps, each
+   writing its result to the current directory for the next one to read.
+   Now the multilooking, the removal of the topographic phase and the
+   zeroing of pixels without data are done together, a block of lines
+   at a time, as are adding the topographic phase back and reramping.
+   Only what the phase filter and escher need as files is written, into
+   a scratch directory of its own for every run. */
+
+// Arithmetic of raster_calc, for the expressions the chain used:
+// '(a-b)%6.2831853-3.14159265' and '(a+b)*(a/a)*(b/b)'.
+static inline double calc_div(double a, double b)
+{
+  return b == 0 ? a : a/b;
+}
+
+static inline float flatten_phase(double a, double b)
+{
+  double mod = fmod(a-b, 6.2831853);
+  if (mod < 0)
+    mod += 6.2831853;
+  return mod - 3.14159265;
+}
+
+static inline float unflatten_phase(double a, double b)
+{
+  return (a+b)*calc_div(a,a)*calc_div(b,b);
+}
+
+typedef struct {
+  int ns, look_line;        // interferogram line length, lines per look
+  int out_ns, out_nl;       // size of the wrapped phase for escher
+  int first_line;           // first multilooked line of the block
+  int zero;                 // zero the pixels without data right away
+  dem_phase_params *dem;    // NULL without flattening
+  float *amp, *phase;       // block of interferogram lines
+  float *dem_lines;         // block of DEM lines
+  float *rgb;               // block of colorized multilooked phase
+  float *out;               // block of wrapped phase
+  unsigned char *mask;      // whole image: no data in the multilooked phase
+} unwrap_prep_job;
+
+/* asf_parallel_fn: multilook lines [start,end) of the current block and
+   take the topographic phase out. */
+static void prep_lines(int start, int end, void *data)
+{
+  unwrap_prep_job *job = (unwrap_prep_job *) data;
+  int ns = job->ns, out_ns = job->out_ns;
+  float *ml_phase = (float *) MALLOC(sizeof(float)*ns);
+  float *dem_phase = job->dem ?
+    (float *) MALLOC(sizeof(float)*job->dem->sample_count) : NULL;
+  int ii, x;
+
+  for (ii=start; ii<end; ii++) {
+    int y = job->first_line + ii;
+    long in = (long)ii*job->look_line*ns;
+    multilook_phase_line(job->amp + in, job->phase + in, ns, job->look_line,
+			 NULL, NULL, ml_phase, job->rgb + (long)ii*ns);
+    if (y >= job->out_nl)
+      continue;
+
+    float *out = job->out + (long)ii*out_ns;
+    unsigned char *mask = job->mask + (long)y*out_ns;
+    if (job->dem) {
+      dem_phase_lines(job->dem, y, 1,
+		      job->dem_lines + (long)ii*job->dem->sample_count,
+		      dem_phase);
+      for (x=0; x<out_ns; x++)
+	out[x] = flatten_phase(ml_phase[x], dem_phase[x]);
     }
-    if (strcmp(tmp, "ml_phase.img") != 0) {
-      asfPrintStatus("\n   Cleaning up filtering result ...\n");
-      check_return(zeroify(tmp, "ml_phase.img", "escher_in_phase.img"),
-		   "phase value cosmetics (zeroify)");
-      sprintf(tmp, "escher_in_phase.img");
+    else
+      memcpy(out, ml_phase, sizeof(float)*out_ns);
+    for (x=0; x<out_ns; x++) {
+      mask[x] = ml_phase[x] == 0;
+      if (job->zero && mask[x])
+	out[x] = 0;
     }
-    if (flattening == 1) {
-      asfPrintStatus("   Performing phase unwrapping ...\n");
-      check_return(escher(tmp,"unwrap_dem"), "phase unwrapping (escher)");
-      asfPrintStatus("   Adding known topographic phase again ...\n");
-      sprintf(inFiles[0], "unwrap_dem.img");
-      sprintf(inFiles[1], "dem_phase.img");
-      check_return(raster_calc("unwrap_phase.img", "\'(a+b)*(a/a)*(b/b)\' ",
-			       2, inFiles),
-		   "adding terrain induced phase back (raster_calc)");
+  }
+
+  FREE(ml_phase);
+  FREE(dem_phase);
+}
+
+typedef struct {
+  int ns;
+  int first_line;
+  dem_phase_params *dem;    // NULL without flattening
+  deramp_params *deramp;
+  float *dem_lines;         // block of DEM lines
+  float *phase;             // block of unwrapped phase
+  float *nod;               // block of reramped unwrapped phase
+} unwrap_finish_job;
+
+/* asf_parallel_fn: add the topographic phase back to lines [start,end)
+   of the current block, and reramp them. */
+static void finish_lines(int start, int end, void *data)
+{
+  unwrap_finish_job *job = (unwrap_finish_job *) data;
+  int ns = job->ns;
+  float *dem_phase = job->dem ?
+    (float *) MALLOC(sizeof(float)*job->dem->sample_count) : NULL;
+  int ii, x;
+
+  for (ii=start; ii<end; ii++) {
+    int y = job->first_line + ii;
+    float *phase = job->phase + (long)ii*ns;
+    float *nod = job->nod + (long)ii*ns;
+    if (job->dem) {
+      dem_phase_lines(job->dem, y, 1,
+		      job->dem_lines + (long)ii*job->dem->sample_count,
+		      dem_phase);
+      for (x=0; x<ns; x++)
+	phase[x] = unflatten_phase(phase[x], dem_phase[x]);
     }
-    else
-      check_return(escher(tmp,"unwrap"), "phase unwrapping (escher)");
+    memcpy(nod, phase, sizeof(float)*ns);
+    deramp_lines(job->deramp, y, 1, nod);
+  }
 
-    asfPrintStatus("   Reramping unwrapped phase ...\n");
-    check_return(deramp("unwrap", baseline, "unwrap_nod", 1),
-		 "reramping unwrapped phase (deramp)");
+  FREE(dem_phase);
+}
 
-    meta_parameters *m2 = meta_read("unwrap_phase.meta");
-    m2->general->data_type = ASF_BYTE;
-    meta_write(m2, "unwrap_dem_mask.meta");
-    meta_free(m2);
+// Lines per block, so that a block of n_images images of ns samples, each
+// line standing for lines_per_line lines read, stays around 16 MB.
+static int block_lines(long ns, int lines_per_line, int n_images)
+{
+  long block = (1 << 22) / (ns*lines_per_line*n_images);
+  if (block > 256) block = 256;
+  if (block < 1) block = 1;
+  return (int) block;
+}
 
-    /*
-    char inFile[256]; char outFile[256];
-    strcpy(inFile, "unwrap_dem_mask");
-    strcpy(outFile, "unwrap_mask");
-    asfPrintStatus("Writing unwrapping mask to file ...\n");
-    check_return(asf_export_with_lut(TIF, TRUNCATE, "unwrapping_mask.lut", 
-				     inFile, outFile),
-		 "colorized phase unwrapping mask (asf_export)");
-    */
+// Zero the pixels of a phase image that are set in mask.
+static void zero_masked(char *file, meta_parameters *meta,
+			const unsigned char *mask)
+{
+  int ns = meta->general->sample_count;
+  int nl = meta->general->line_count;
+  float *buf = (float *) MALLOC(sizeof(float)*ns);
+  FILE *fp = fopenImage(file, "r+b");
+  int x, y;
+
+  for (y=0; y<nl; y++) {
+    const unsigned char *m = mask + (long)y*ns;
+    get_float_line(fp, meta, y, buf);
+    for (x=0; x<ns; x++)
+      if (m[x])
+	buf[x] = 0;
+    put_float_line(fp, meta, y, buf);
   }
-  else if (strncmp(algorithm, "snaphu", 6)==0) {
+
+  FCLOSE(fp);
+  FREE(buf);
+}
+
+static void workspace_name(char *out, const char *workspace, const char *file)
+{
+  sprintf(out, "%s%c%s", workspace, DIR_SEPARATOR, file);
+}
+
+// check_return() for steps run once the workspace exists: the workspace
+// is removed before bailing out.
+static void check_workspace_return(int ret, const char *workspace, char *msg)
+{
+  if (ret != 0) {
+    remove_dir(workspace);
+    asfPrintError("%s\n", msg);
+  }
+}
+
+int asf_phase_unwrap(char *algorithm, char *interferogram, char *metaFile,
+		     char *demFile, char *baseline, double filter_strength,
+		     int flattening, char *mask, char *unwrapped_phase)
+{
+  meta_parameters *igramMeta, *mlMeta, *wrapMeta, *unwMeta, *outMeta;
+  meta_parameters *demMeta=NULL;
+  dem_phase_params *demParams=NULL;
+  FILE *fpAmp, *fpPhase, *fpDem=NULL, *fpRGB, *fpWrap, *fpUnw, *fpOut, *fpNod;
+  char inAmp[1024], inPhase[1024], wrapFile[1024], filterFile[1024];
+  char rgbFile[1024], unwFile[1024], unwMask[1024], outFile[1024];
+  char *workspace, *stamp, *escherIn;
+  int line, block, look_line, ml_ns, ml_nl, out_ns, out_nl;
+
+  if (strncmp(algorithm, "snaphu", 6)==0) {
 
     asfPrintError("function still needs to be connected again\n");
     /*
@@ -198,10 +345,222 @@ int asf_phase_unwrap(char *algorithm, char *interferogram, char *metaFile,
     link("ml_phase.meta", "unwrap_phase.meta");
     */
   }
+  else if (strncmp(algorithm, "escher", 6)!=0)
+    asfPrintError("Unknown phase unwrapping algorithm '%s'\n", algorithm);
+
+  if (filter_strength < 0.0 || filter_strength > 3.0) {
+    asfPrintWarning("phase filter value out of range - set to value "
+		    "of 1.6\n");
+    filter_strength = 1.6;
+  }
+  // The filter strength used to be handed to the phase_filter tool with
+  // one decimal place, and read back as a float.
+  char str[32];
+  float strength;
+  sprintf(str, "%.1f", filter_strength);
+  sscanf(str, "%f", &strength);
+  filter_strength = strength;
+
+  // Intermediate files go into a scratch directory of their own
+  workspace = (char *) MALLOC(sizeof(char)*(strlen(unwrapped_phase)+32));
+  stamp = time_stamp_dir();
+  sprintf(workspace, "%s-%s", unwrapped_phase, stamp);
+  FREE(stamp);
+  create_clean_dir(workspace);
+  workspace_name(wrapFile, workspace, "wrapped_phase.img");
+  workspace_name(filterFile, workspace, "filtered_phase.img");
+  workspace_name(rgbFile, workspace, "ml_phase_rgb");
+  workspace_name(unwFile, workspace, "unwrap_dem.img");
+  workspace_name(unwMask, workspace, "unwrap_dem_mask.img");
+
+  // The interferogram is multilooked as it is read, into lines of look_line
+  // lines each.  With flattening, the wrapped phase only covers the part
+  // that the DEM covers as well.
+  create_name(inAmp, interferogram, "_amp.img");
+  create_name(inPhase, interferogram, "_phase.img");
+  igramMeta = meta_read(inPhase);
+  mlMeta = meta_read(inPhase);
+  look_line = mlMeta->sar->azimuth_look_count;
+  if (look_line < 1)
+    asfPrintError("Invalid azimuth look count (%d) in %s\n",
+                  look_line, inPhase);
+  ml_ns = mlMeta->general->sample_count;
+  mlMeta->general->line_count /= look_line;
+  ml_nl = mlMeta->general->line_count;
+  mlMeta->sar->multilook = 1;
+  mlMeta->sar->line_increment = 1;
+  mlMeta->sar->sample_increment = 1;
+  mlMeta->sar->azimuth_time_per_pixel *= look_line;
+  mlMeta->general->y_pixel_size *= look_line;
+  meta_write(mlMeta, rgbFile);
+
+  out_ns = ml_ns;
+  out_nl = ml_nl;
+  if (flattening == 1) {
+    demMeta = meta_read(demFile);
+    if (demMeta->general->sample_count < out_ns)
+      out_ns = demMeta->general->sample_count;
+    if (demMeta->general->line_count < out_nl)
+      out_nl = demMeta->general->line_count;
+    demParams = dem_phase_init(demMeta, baseline);
+    fpDem = fopenImage(demFile, "rb");
+  }
+  wrapMeta = meta_copy(mlMeta);
+  wrapMeta->general->sample_count = out_ns;
+  wrapMeta->general->line_count = out_nl;
+  meta_write(wrapMeta, wrapFile);
+
+  asfPrintStatus("\n   Multilooking the interferogram ...\n");
+  if (flattening == 1)
+    asfPrintStatus("   Removing known topographic phase ...\n");
+  asfPrintStatus("\nInput is %d lines by %d samples\n",
+		 igramMeta->general->line_count, ml_ns);
+  asfPrintStatus("Ouput is %d lines by %d samples\n\n", ml_nl, ml_ns);
+
+  unwrap_prep_job prep;
+  block = block_lines(ml_ns, look_line, 2);
+  prep.ns = ml_ns;
+  prep.look_line = look_line;
+  prep.out_ns = out_ns;
+  prep.out_nl = out_nl;
+  prep.zero = filter_strength == 0.0;
+  prep.dem = demParams;
+  prep.amp = (float *) MALLOC(sizeof(float)*ml_ns*look_line*block);
+  prep.phase = (float *) MALLOC(sizeof(float)*ml_ns*look_line*block);
+  prep.dem_lines = demParams ?
+    (float *) MALLOC(sizeof(float)*demParams->sample_count*block) : NULL;
+  prep.rgb = (float *) MALLOC(sizeof(float)*ml_ns*block);
+  prep.out = (float *) MALLOC(sizeof(float)*out_ns*block);
+  prep.mask = (unsigned char *) MALLOC(sizeof(unsigned char)*out_ns*out_nl);
+
+  fpAmp = fopenImage(inAmp, "rb");
+  fpPhase = fopenImage(inPhase, "rb");
+  fpRGB = fopenImage(rgbFile, "wb");
+  fpWrap = fopenImage(wrapFile, "wb");
+  for (line=0; line<ml_nl; line+=block) {
+    int n = line + block > ml_nl ? ml_nl - line : block;
+    int n_out = line + n > out_nl ? out_nl - line : n;
+
+    get_float_lines(fpAmp, igramMeta, line*look_line, n*look_line, prep.amp);
+    get_float_lines(fpPhase, igramMeta, line*look_line, n*look_line,
+		    prep.phase);
+    if (demParams && n_out > 0)
+      get_float_lines(fpDem, demMeta, line, n_out, prep.dem_lines);
+
+    prep.first_line = line;
+    asf_parallel_for(n, 4, prep_lines, &prep);
+
+    put_float_lines(fpRGB, mlMeta, line, n, prep.rgb);
+    if (n_out > 0)
+      put_float_lines(fpWrap, wrapMeta, line, n_out, prep.out);
+    asfLineMeter(line + n - 1, ml_nl);
+  }
+  FCLOSE(fpAmp);
+  FCLOSE(fpPhase);
+  FCLOSE(fpRGB);
+  FCLOSE(fpWrap);
+  FREE(prep.amp);
+  FREE(prep.phase);
+  FREE(prep.rgb);
+  FREE(prep.out);
+  FREE(prep.dem_lines);
+
+  // Export a color version of the interferogram to JPEG
+  create_name(outFile, unwrapped_phase, "_ml_phase_rgb");
+  check_workspace_return(asf_export_with_lut(JPEG, SIGMA, "interferogram.lut",
+					     rgbFile, outFile), workspace,
+			 "colorized interferogram (asf_export)");
+
+  // Get rolling on the phase unwrapping
+  escherIn = wrapFile;
+  if (filter_strength > 0.0) {
+    asfPrintStatus("\n   Filtering the phase ...\n\n");
+    check_workspace_return(phase_filter(wrapFile, filter_strength,
+					filterFile), workspace,
+			   "phase filtering (phase_filter)");
+    asfPrintStatus("\n   Cleaning up filtering result ...\n");
+    zero_masked(filterFile, wrapMeta, prep.mask);
+    escherIn = filterFile;
+  }
+  FREE(prep.mask);
+
+  asfPrintStatus("   Performing phase unwrapping ...\n");
+  check_workspace_return(unwrap_escher(algorithm, escherIn, unwFile),
+			 workspace, "phase unwrapping (escher)");
+
+  // The topographic phase is added back again, and the result reramped,
+  // a block of lines at a time.
+  if (flattening == 1)
+    asfPrintStatus("   Adding known topographic phase again ...\n");
+  asfPrintStatus("   Reramping unwrapped phase ...\n");
+  // escher keeps the size of the wrapped phase, which already is no
+  // larger than the DEM.
+  unwMeta = meta_read(unwFile);
+  outMeta = meta_copy(unwMeta);
+  create_name(outFile, unwrapped_phase, "_phase.img");
+  meta_write(outMeta, outFile);
+  meta_free(outMeta);
+  outMeta = meta_read(outFile);
+  fpOut = fopenImage(outFile, "wb");
+  create_name(outFile, unwrapped_phase, "_nod_phase.img");
+  meta_write(outMeta, outFile);
+  fpNod = fopenImage(outFile, "wb");
+
+  unwrap_finish_job finish;
+  int ns = outMeta->general->sample_count;
+  int nl = outMeta->general->line_count;
+  block = block_lines(ns, 1, 3);
+  finish.ns = ns;
+  finish.dem = demParams;
+  finish.deramp = deramp_init(outMeta, baseline, 1);
+  finish.dem_lines = demParams ?
+    (float *) MALLOC(sizeof(float)*demParams->sample_count*block) : NULL;
+  finish.phase = (float *) MALLOC(sizeof(float)*ns*block);
+  finish.nod = (float *) MALLOC(sizeof(float)*ns*block);
 
-  for (ii=0; ii<2; ii++)
-    FREE(inFiles[ii]);
-  FREE(inFiles);
+  fpUnw = fopenImage(unwFile, "rb");
+  for (line=0; line<nl; line+=block) {
+    int n = line + block > nl ? nl - line : block;
+
+    get_float_lines(fpUnw, unwMeta, line, n, finish.phase);
+    if (demParams)
+      get_float_lines(fpDem, demMeta, line, n, finish.dem_lines);
+
+    finish.first_line = line;
+    asf_parallel_for(n, 4, finish_lines, &finish);
+
+    put_float_lines(fpOut, outMeta, line, n, finish.phase);
+    put_float_lines(fpNod, outMeta, line, n, finish.nod);
+    asfLineMeter(line + n - 1, nl);
+  }
+  FCLOSE(fpUnw);
+  FCLOSE(fpOut);
+  FCLOSE(fpNod);
+  FREE(finish.phase);
+  FREE(finish.nod);
+  FREE(finish.dem_lines);
+  deramp_free(finish.deramp);
+
+  // Keep the unwrapping mask
+  create_name(outFile, unwrapped_phase, "_dem_mask.img");
+  if (rename(unwMask, outFile) != 0)
+    asfPrintError("Could not move %s to %s\n", unwMask, outFile);
+  outMeta->general->data_type = ASF_BYTE;
+  meta_write(outMeta, outFile);
+
+  // Clean up
+  if (demParams) {
+    FCLOSE(fpDem);
+    dem_phase_free(demParams);
+    meta_free(demMeta);
+  }
+  meta_free(igramMeta);
+  meta_free(mlMeta);
+  meta_free(wrapMeta);
+  meta_free(unwMeta);
+  meta_free(outMeta);
+  remove_dir(workspace);
+  FREE(workspace);
 
   return(0);
 }
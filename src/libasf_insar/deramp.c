@@ -6,16 +6,84 @@
 /* local constants */
 #define VERSION 2.5
 
+struct deramp_params {
+  meta_parameters *meta;
+  baseline base;
+  int samples, sl;
+  double yScale, twok;
+  double *sflat, *cflat;
+};
+
+// Set up deramping of images described by meta (which must stay around
+// until deramp_free), with the baseline in baseFile.  With back=0 the
+// flat-earth phase is left alone.
+deramp_params *deramp_init(meta_parameters *meta, char *baseFile, int back)
+{
+  deramp_params *p = (deramp_params *) MALLOC(sizeof(deramp_params));
+  int x, ss;
+  double xScale;
+
+  p->meta = meta;
+  p->samples = meta->general->sample_count;
+  ss = meta->general->start_sample - 1;
+  p->sl = meta->general->start_line - 1;
+  xScale = meta->sar->sample_increment;
+  p->yScale = meta->sar->line_increment;
+  p->twok = back*2.0*meta_get_k(meta);
+
+  // read in CEOS parameters & convert to meters
+  p->base = read_baseline(baseFile);
+
+  // calculate slant ranges and look angles - Ian's thesis eqn 3.10 
+  p->sflat = (double *)MALLOC(sizeof(double)*p->samples);
+  p->cflat = (double *)MALLOC(sizeof(double)*p->samples);
+  for (x = 0; x < p->samples; x++) {
+    double flat=meta_flat(meta,0.0,x*xScale+ss);
+    p->sflat[x]=sin(flat);
+    p->cflat[x]=cos(flat);
+  }
+
+  return p;
+}
+
+// Deramp n lines of phase in place, the first of which is image line y.
+void deramp_lines(deramp_params *p, int y, int n, float *phase)
+{
+  int ii, x;
+
+  for (ii = 0; ii < n; ii++) {
+    double Bn_y,Bp_y;
+    float *line = phase + (long)ii*p->samples;
+    meta_interp_baseline(p->meta,p->base,(y+ii)*(int)p->yScale+p->sl,
+			 &Bn_y,&Bp_y);
+
+    // calculate flat-earth range phase term & remove it 
+    for (x = 0; x < p->samples; x++)
+      {
+	double d=line[x];
+	if (d!=0.0) /*Ignore points which didn't phase unwrap.*/
+	  d -= p->twok*(Bp_y*p->cflat[x]-Bn_y*p->sflat[x]);
+	// Was: d-=ceos_flat_phase(ceos,base,x,y);
+	line[x]=d;
+      }
+  }
+}
+
+void deramp_free(deramp_params *p)
+{
+  FREE(p->sflat);
+  FREE(p->cflat);
+  FREE(p);
+}
+
 int deramp(char *inFile, char *baseFile, char *outFile, int back)
 {
   FILE  *fpAmpIn, *fpPhaseIn, *fpAmpOut, *fpPhaseOut;
   meta_parameters *meta;
-  baseline base;
-  int samples, lines, ss, sl, x, y;
-  double xScale, yScale;
-    char  szInPhase[255], szInAmp[255], szOutPhase[255], szOutAmp[255];
+  deramp_params *params;
+  int samples, lines, y;
+  char  szInPhase[255], szInAmp[255], szOutPhase[255], szOutAmp[255];
   float *amp, *phase;
-  double *sflat, *cflat;
   
   create_name(szInAmp, inFile, "_amp.img");
   create_name(szInPhase, inFile, "_phase.img");
@@ -27,22 +95,10 @@ int deramp(char *inFile, char *baseFile, char *outFile, int back)
   
   samples = meta->general->sample_count;
   lines = meta->general->line_count;
-  ss = meta->general->start_sample - 1;
-  sl = meta->general->start_line - 1;
-  xScale = meta->sar->sample_increment;
-  yScale = meta->sar->line_increment;
   
   meta_write(meta, szOutPhase);
   
-  /*
-  //Link over ".amp" file, if it exists.
-  if (fileExists(szInAmp)&&!fileExists(szOutAmp))
-    {
-      char command[1024];
-      sprintf(command,"ln -s %s %s\n", szInAmp, szOutAmp);
-      system(command);
-    }
-  */  
+  // The amplitude, if there is one, is copied over unchanged.
   int ampFlag = 0;
   if (fileExists(szInAmp)) {
     ampFlag = 1;
@@ -52,52 +108,25 @@ int deramp(char *inFile, char *baseFile, char *outFile, int back)
   // buffer mallocs, read data file
   amp = (float *)MALLOC(sizeof(float)*samples);
   phase = (float *)MALLOC(sizeof(float)*samples);
-  sflat = (double *)MALLOC(sizeof(double)*samples);
-  cflat = (double *)MALLOC(sizeof(double)*samples);
   if (ampFlag) {
     fpAmpIn = fopenImage(szInAmp,"rb");
     fpAmpOut = fopenImage(szOutAmp,"wb");
   }
   fpPhaseIn = fopenImage(szInPhase,"rb");
   fpPhaseOut = fopenImage(szOutPhase,"wb");
-  //fpIn = fopenImage(inFile,"rb");
-  //fout = fopenImage(outFile,"wb");
   
-  // read in CEOS parameters & convert to meters
-  base = read_baseline(baseFile);
-  
-  // calculate slant ranges and look angles - Ian's thesis eqn 3.10 
-  for (x = 0; x < samples; x++) {
-    double flat=meta_flat(meta,0.0,x*xScale+ss);
-    sflat[x]=sin(flat);
-    cflat[x]=cos(flat);
-  }
+  params = deramp_init(meta, baseFile, back);
 
   for (y = 0; y < lines; y++) {
-    double Bn_y,Bp_y;
-    double twok = back*2.0*meta_get_k(meta);
-    meta_interp_baseline(meta,base,y*(int)yScale+sl,&Bn_y,&Bp_y);
     if (ampFlag)
       get_float_line(fpAmpIn, meta, y, amp);
     get_float_line(fpPhaseIn, meta, y, phase);
-    //get_band_float_line(fin, meta, 0, y, amp);
-    //get_band_float_line(fin, meta, 1, y, phase);
     
-    // calculate flat-earth range phase term & remove it 
-    for (x = 0; x < samples; x++)
-      {
-	double d=phase[x];
-	if (d!=0.0) /*Ignore points which didn't phase unwrap.*/
-	  d -= twok*(Bp_y*cflat[x]-Bn_y*sflat[x]);
-	// Was: d-=ceos_flat_phase(ceos,base,x,y);
-	phase[x]=d;
-      }
+    deramp_lines(params, y, 1, phase);
 
     if (ampFlag)
       put_float_line(fpAmpOut, meta, y, amp);
     put_float_line(fpPhaseOut, meta, y, phase);
-    //put_band_float_line(fout, meta, 0, y, amp);
-    //put_band_float_line(fout, meta, 1, y, phase);
     asfLineMeter(y, lines);
   }
   meta_write(meta, outFile);
@@ -111,8 +140,8 @@ int deramp(char *inFile, char *baseFile, char *outFile, int back)
   }
   FREE(amp);
   FREE(phase);
-  FREE(sflat);
-  FREE(cflat);
+  deramp_free(params);
+  meta_free(meta);
   
   return 0;
 }
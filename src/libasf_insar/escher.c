@@ -70,78 +70,140 @@ typedef struct _Point {
   int j;
 } Point;
 
+/*
+ * The point list of the branch cut tree currently being grown.  It starts
+ *   small and is doubled as needed, up to MAX_PLIST points.
+ */
 #define MAX_PLIST 1048576
 typedef struct _PList {
   int n;
-  Point p[1048576];
-  int c[1048576];
+  int max;
+  Point *p;
+  int *c;
 } PList;
 
-// Globals
-PList list;
-Uchar *mask;     /* phase-state mask  */
-Uchar *im;       /* integration mask  */
-float *phase;   /* input phase       */
-float *coh;     /* coherence 'rho'   */
-int wid;
-int len;
-int size;
+/*
+ * Everything one unwrapping run works on.  The whole image is one context;
+ *   in tiled mode every tile gets its own, which is why none of this is
+ *   global any more.  (x0, y0) is where the arrays start in the full image.
+ */
+typedef struct {
+  PList list;
+  Uchar *mask;     /* phase-state mask  */
+  Uchar *im;       /* integration mask  */
+  float *phase;    /* input phase       */
+  int wid;
+  int len;
+  int size;
+  int x0, y0;
+  int verbose;     /* print progress and statistics */
+} EscherCtx;
 
 // Function declarations
-void loadWrappedPhase(char *phaseName);
-void groundBorder(void);
-void makeMask(void);
-void verifyCuts(void);
-Uchar chargeCalc(float ul, float ll, float lr, float ur);
-float phaseRemap(float in);
-void installCordon(char *cordonName);
-void cutMask(void);
-void generateCut(int x, int y);
-void makeBranchCut(int x1, int y1, int x2, int y2, Uchar orBy);
-void saveMask(Uchar *mask, char *maskName);
-void readMask(Uchar *mask, char *maskName);
-void finishUwp(void);
-void checkSeed(int *new_seedX, int *new_seedY);
-void integratePhase(int x, int y);
-void saveUwp(char *uwpName);
-void doStats();
-
-void loadWrappedPhase(char *f)
+static void loadWrappedPhase(EscherCtx *e, char *phaseName);
+static void groundBorder(EscherCtx *e);
+static void makeMask(EscherCtx *e);
+#if DO_DEBUG_CHECKS
+static void verifyCuts(EscherCtx *e);
+#endif
+static Uchar chargeCalc(float ul, float ll, float lr, float ur);
+static float phaseRemap(float in);
+static Point *readCordon(char *cordonName, int *nPoints);
+static void installCordon(EscherCtx *e, Point *cordon, int nPoints);
+static void cutMask(EscherCtx *e);
+static void generateCut(EscherCtx *e, int x, int y);
+static void makeBranchCut(EscherCtx *e, int x1, int y1, int x2, int y2,
+			  Uchar orBy);
+static void saveMask(EscherCtx *e, char *maskName);
+static void finishUwp(EscherCtx *e);
+static void checkSeed(EscherCtx *e, int *new_seedX, int *new_seedY);
+static int integratePhase(EscherCtx *e, int x, int y);
+static void saveUwp(EscherCtx *e, char *uwpName);
+static void doStats(EscherCtx *e);
+
+static void initCtx(EscherCtx *e, int wid, int len, int x0, int y0)
+{
+  e->wid = wid;
+  e->len = len;
+  e->size = wid*len;
+  e->x0 = x0;
+  e->y0 = y0;
+  e->verbose = TRUE;
+  e->mask = (Uchar *)CALLOC(e->size, sizeof(Uchar));
+  e->im = (Uchar *)CALLOC(e->size, sizeof(Uchar));
+  e->phase = (float *)MALLOC(sizeof(float)*e->size);
+  e->list.n = 0;
+  e->list.max = 4096;
+  e->list.p = (Point *)MALLOC(sizeof(Point)*e->list.max);
+  e->list.c = (int *)MALLOC(sizeof(int)*e->list.max);
+}
+
+static void freeCtx(EscherCtx *e)
+{
+  if (e->list.p) FREE(e->list.p);
+  if (e->list.c) FREE(e->list.c);
+  if (e->mask) FREE(e->mask);
+  if (e->im) FREE(e->im);
+  if (e->phase) FREE(e->phase);
+}
+
+/* append (k, l) to the current tree, connected to list point 'point' */
+static void addPoint(EscherCtx *e, int k, int l, int point)
+{
+  PList *list = &e->list;
+
+  if (list->n == list->max) {
+    if (list->max >= MAX_PLIST)
+      asfPrintError("list exceeded %d points", MAX_PLIST);
+    list->max *= 2;
+    list->p = (Point *)realloc(list->p, sizeof(Point)*list->max);
+    list->c = (int *)realloc(list->c, sizeof(int)*list->max);
+    if (!list->p || !list->c)
+      asfPrintError("   escher:  out of memory growing the branch cut list");
+  }
+  list->p[list->n].i = k;
+  list->p[list->n].j = l;
+  list->c[list->n]   = point;
+  list->n++;
+}
+
+static void loadWrappedPhase(EscherCtx *e, char *f)
 {
   FILE * fd;
   meta_parameters *meta;
 
   fd = FOPEN(f, "rb");
   meta = meta_read(f);
-  get_float_lines(fd, meta, 0, len, phase);
+  get_float_lines(fd, meta, 0, e->len, e->phase);
   FCLOSE(fd);
+  meta_free(meta);
 
   return;
 }
 
-void groundBorder()
+static void groundBorder(EscherCtx *e)
 {
   int i, j;
 
   /* ground the left edge once and ground the right edge twice */
-  for (j = 0; j < len; j++) {
-    mask[j*wid+0]     |= GROUNDED;
-    mask[j*wid+wid-2] |= GROUNDED;
-    mask[j*wid+wid-1] |= GROUNDED;
+  for (j = 0; j < e->len; j++) {
+    e->mask[j*e->wid+0]     |= GROUNDED;
+    e->mask[j*e->wid+e->wid-2] |= GROUNDED;
+    e->mask[j*e->wid+e->wid-1] |= GROUNDED;
   }
 
   /* ground the top edge once and ground the bottom edge twice */
-  for (i = 0; i < wid; i++) {
-    mask[(0)*wid+i]     |= GROUNDED;
-    mask[(len-2)*wid+i] |= GROUNDED;
-    mask[(len-1)*wid+i] |= GROUNDED;
+  for (i = 0; i < e->wid; i++) {
+    e->mask[(0)*e->wid+i]     |= GROUNDED;
+    e->mask[(e->len-2)*e->wid+i] |= GROUNDED;
+    e->mask[(e->len-1)*e->wid+i] |= GROUNDED;
   }
 
   return;
 }
 
 
-float phaseRemap(float p)
+static float phaseRemap(float p)
 {
   p = (double)fmod((double)p,(double)TWOPI);
   if (p>PI) p-=TWOPI;
@@ -150,59 +212,81 @@ float phaseRemap(float p)
 }
 
 
-int isGoodSeed(int x,int y)
+static int isGoodSeed(EscherCtx *e, int x,int y)
 {
 #define check_span 10 /*Make sure no cuts occur within this many pixels of seed*/
   int dx,dy;
-  if ((x<check_span)||(x>=wid-check_span)||
-      (y<check_span)||(y>=len-check_span))
+  if ((x<check_span)||(x>=e->wid-check_span)||
+      (y<check_span)||(y>=e->len-check_span))
     return 0;/*out-of-bounds*/
   dy=0;
   for (dx=-check_span;dx<=check_span;dx++)
-    if (mask[(y+dy)*wid+(x+dx)]!=0)
+    if (e->mask[(y+dy)*e->wid+(x+dx)]!=0)
       return 0;/*Some cut is near this point*/
   dx=0;
   for (dy=-check_span;dy<=check_span;dy++)
-    if (mask[(y+dy)*wid+(x+dx)]!=0)
+    if (e->mask[(y+dy)*e->wid+(x+dx)]!=0)
       return 0;/*Some cut is near this point*/
   return 1;/*If no cut is nearby, this is a good point*/
 }
 
-void checkSeed(int *x, int *y)
+static void checkSeed(EscherCtx *e, int *x, int *y)
 {
   /* adjust seed point to reside on a usable (mask == ZERO) pixel */
-  while (!isGoodSeed(*x,*y))
+  while (!isGoodSeed(e,*x,*y))
   {
     asfPrintStatus("\n   seed point (%d, %d) is not ZERO.\n", *x, *y);
     /*Pick a new, random seed point.*/
-    *x=(rand()&0x7fff)*wid/0x7fff;
-    *y=(rand()&0x7fff)*len/0x7fff;
+    *x=(rand()&0x7fff)*e->wid/0x7fff;
+    *y=(rand()&0x7fff)*e->len/0x7fff;
     asfPrintStatus("\n   auto-adjusted seed point to (%d, %d).\n", *x, *y);
   }
   asfPrintStatus("\n   checkSeed() finished\n\n");
   return;
 }
 
+/*
+ * Tiles cannot use checkSeed(): a tile may not have a good seed at all,
+ *   and rand() is neither reentrant nor reproducible.  Instead search square
+ *   rings outwards from (x, y) and take the first good point.
+ *   Returns FALSE if the tile has no good seed.
+ */
+static int findSeed(EscherCtx *e, int *x, int *y)
+{
+  int r, dx, dy, maxR = max(e->wid, e->len);
+
+  for (r = 0; r < maxR; r++)
+    for (dy = -r; dy <= r; dy++)
+      for (dx = -r; dx <= r; dx += (dy == -r || dy == r) ? 1 : 2*r)
+        if (isGoodSeed(e, *x+dx, *y+dy)) {
+          *x += dx;
+          *y += dy;
+          return TRUE;
+        }
+  return FALSE;
+}
+
 /*
  * This function is a cursory test to check for 'residual' residues.
  *   If 'escher' is working properly it should give a null result.
  */
-void verifyCuts(void)
+#if DO_DEBUG_CHECKS
+static void verifyCuts(EscherCtx *e)
 {
   int i, j, nSites = 0, nResidues = 0;
   float p0, p1, p2, p3;
 
   asfPrintStatus("\nStarting the verification ...\n\n");
 
-  for (j = 1; j < len - 2; j++) {
-    for (i = 1; i < wid - 2; i++) {
+  for (j = 1; j < e->len - 2; j++) {
+    for (i = 1; i < e->wid - 2; i++) {
       /* check only mask points which have 0-valued local loops */
-      if (!mask[j*wid+i] && !mask[j*wid+i+1] &&
-          !mask[(j+1)*wid+i+1] && !mask[(j+1)*wid+i]) {
-        p0 = phase[wid*(j  )+i  ];
-        p1 = phase[wid*(j+1)+i  ];
-        p2 = phase[wid*(j+1)+i+1];
-        p3 = phase[wid*(j  )+i+1];
+      if (!e->mask[j*e->wid+i] && !e->mask[j*e->wid+i+1] &&
+          !e->mask[(j+1)*e->wid+i+1] && !e->mask[(j+1)*e->wid+i]) {
+        p0 = e->phase[e->wid*(j  )+i  ];
+        p1 = e->phase[e->wid*(j+1)+i  ];
+        p2 = e->phase[e->wid*(j+1)+i+1];
+        p3 = e->phase[e->wid*(j  )+i+1];
         nSites++;
 
         /*
@@ -219,28 +303,29 @@ void verifyCuts(void)
     nResidues, nSites, 100.0*(float)(nResidues)/(float)(nSites));
   return;
 }
+#endif
 
-void makeMask()
+static void makeMask(EscherCtx *e)
 {
   int i, j;
   float p0, p1, p2, p3;
 
-  for (j = 1; j < len - 2; j++) {
-    for (i = 1; i < wid - 2; i++) {
-      if (0.0==phase[wid*(j  )+i])
+  for (j = 1; j < e->len - 2; j++) {
+    for (i = 1; i < e->wid - 2; i++) {
+      if (0.0==e->phase[e->wid*(j  )+i])
         /*Ground out zero-phases (e.g., layover regions)*/
-	mask[j*wid+i] |= GROUNDED;
-      p0 = phase[wid*(j  )+i  ];
-      p1 = phase[wid*(j+1)+i  ];
-      p2 = phase[wid*(j+1)+i+1];
-      p3 = phase[wid*(j  )+i+1];
-      mask[j*wid+i] |= chargeCalc(p0,p1,p2,p3);
+	e->mask[j*e->wid+i] |= GROUNDED;
+      p0 = e->phase[e->wid*(j  )+i  ];
+      p1 = e->phase[e->wid*(j+1)+i  ];
+      p2 = e->phase[e->wid*(j+1)+i+1];
+      p3 = e->phase[e->wid*(j  )+i+1];
+      e->mask[j*e->wid+i] |= chargeCalc(p0,p1,p2,p3);
     }
   }
   return;
 }
 
-Uchar chargeCalc(float p0, float p1, float p2, float p3)
+static Uchar chargeCalc(float p0, float p1, float p2, float p3)
 {
   register float d0, d1, d2, d3, od0, od1, od2, od3, sum;
 
@@ -292,52 +377,71 @@ Uchar chargeCalc(float p0, float p1, float p2, float p3)
 #endif
 }
 
-void installCordon(char *cordonFnm)
+/*
+ * Read the optional 'cordon' file of extra points (in full image
+ *   coordinates) to ground out.  Returns NULL if there is no such file.
+ */
+static Point *readCordon(char *cordonFnm, int *nPoints)
 {
-  int i, n, x, y;
+  int n = 0, max = 1024;
+  Point *cordon;
   FILE *fp;
 
-  if (fileExist(cordonFnm)) {
-    n = fileNumLines(cordonFnm);
-    fp = FOPEN(cordonFnm,"r");
-    for (i = 0; i < n; i++) {
-      fscanf(fp,"%d", &x);
-      fscanf(fp,"%d", &y);
-      mask[ y*wid + x] |= GROUNDED;
-    }
-    fclose(fp);
-    //printf("\ngrounded out %d points from cordon file '%s'\n\n",
-    //  n, cordonFnm);
-    doStats();
-  }
-  else {
+  *nPoints = 0;
+  if (!fileExists(cordonFnm)) {
     /*The "cordon" file almost never exists; so this shouldn't be an error!
     fprintf(stderr,
             " ** cordon file '%s' does not exist; skipped installation **\n",
             cordonFnm);*/
+    return NULL;
   }
 
-  return;
+  cordon = (Point *)MALLOC(sizeof(Point)*max);
+  fp = FOPEN(cordonFnm,"r");
+  while (fscanf(fp,"%d %d", &cordon[n].i, &cordon[n].j) == 2) {
+    if (++n == max) {
+      max *= 2;
+      cordon = (Point *)realloc(cordon, sizeof(Point)*max);
+      if (!cordon)
+        asfPrintError("   escher:  out of memory reading '%s'\n", cordonFnm);
+    }
+  }
+  FCLOSE(fp);
+  *nPoints = n;
+
+  return cordon;
 }
 
-void saveMask(unsigned char *m, char *f)
+static void installCordon(EscherCtx *e, Point *cordon, int n)
 {
-  char fnm[256];
+  int i, x, y;
+
+  for (i = 0; i < n; i++) {
+    x = cordon[i].i - e->x0;
+    y = cordon[i].j - e->y0;
+    if (x >= 0 && x < e->wid && y >= 0 && y < e->len)
+      e->mask[ y*e->wid + x] |= GROUNDED;
+  }
+  if (n && e->verbose)
+    doStats(e);
 
-  create_name(fnm,f,"_mask.img");
-  writeVector(m, fnm, CHAR, size);
   return;
 }
 
-void readMask(unsigned char *m, char *fnm)
+static void saveMask(EscherCtx *e, char *f)
 {
-  if (!size)
-    Exit("   escher:  readMask():  zero mask size");
-  readVector(m, fnm, CHAR, size);
+  char fnm[256];
+
+  FILE *fp;
+
+  create_name(fnm,f,"_mask.img");
+  fp = FOPEN(fnm, "wb");
+  ASF_FWRITE(e->mask, sizeof(Uchar), e->size, fp);
+  FCLOSE(fp);
   return;
 }
 
-void cutMask(void)
+static void cutMask(EscherCtx *e)
 {
   int i, j;
 
@@ -350,63 +454,63 @@ void cutMask(void)
    */
 
 #if 0
-  for (j = 1; j < len-2; j++) {
+  for (j = 1; j < e->len-2; j++) {
 
-    if (!(j%(len/6))) 
-      asfPrintStatus ("    ...binary clobber at %d of %d\n", j, len);
+    if (!(j%(e->len/6))) 
+      asfPrintStatus ("    ...binary clobber at %d of %d\n", j, e->len);
 
-    for (i = 1; i < wid-2; i++) {
+    for (i = 1; i < e->wid-2; i++) {
 
-      if (mask[j*wid+i) & POSITIVE_CHARGE) {
-        if      (mask[(j-1)*wid+i-1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i-1] |= IN_CUT; 
+      if (e->mask[j*e->wid+i) & POSITIVE_CHARGE) {
+        if      (e->mask[(j-1)*e->wid+i-1] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j-1)*e->wid+i-1] |= IN_CUT; 
 	}
-        else if (mask[(j-1)*wid+i  ] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i  ] |= IN_CUT; 
+        else if (e->mask[(j-1)*e->wid+i  ] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j-1)*e->wid+i  ] |= IN_CUT; 
 	}
-        else if (mask[(j-1)*wid+i+1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i+1] |= IN_CUT; 
+        else if (e->mask[(j-1)*e->wid+i+1] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j-1)*e->wid+i+1] |= IN_CUT; 
 	}
-        else if (mask[(j  )*wid+i-1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i-1] |= IN_CUT; 
+        else if (e->mask[(j  )*e->wid+i-1] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j  )*e->wid+i-1] |= IN_CUT; 
 	}
-        else if (mask[(j  )*wid+i+1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i+1] |= IN_CUT; 
+        else if (e->mask[(j  )*e->wid+i+1] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j  )*e->wid+i+1] |= IN_CUT; 
 	}
-        else if (mask[(j+1)*wid+i-1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i-1] |= IN_CUT; 
+        else if (e->mask[(j+1)*e->wid+i-1] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j+1)*e->wid+i-1] |= IN_CUT; 
 	}
-        else if (mask[(j+1)*wid+i  ] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i  ] |= IN_CUT; 
+        else if (e->mask[(j+1)*e->wid+i  ] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j+1)*e->wid+i  ] |= IN_CUT; 
 	}
-        else if (mask[(j+1)*wid+i+1] & NEGATIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i+1] |= IN_CUT; 
+        else if (e->mask[(j+1)*e->wid+i+1] & NEGATIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j+1)*e->wid+i+1] |= IN_CUT; 
 	}
       }
-      else if (mask[j*wid+i) & NEGATIVE_CHARGE) {
-        if      (mask[(j-1)*wid+i-1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i-1] |= IN_CUT; 
+      else if (e->mask[j*e->wid+i) & NEGATIVE_CHARGE) {
+        if      (e->mask[(j-1)*e->wid+i-1] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j-1)*e->wid+i-1] |= IN_CUT; 
 	}
-        else if (mask[(j-1)*wid+i  ] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i  ] |= IN_CUT; 
+        else if (e->mask[(j-1)*e->wid+i  ] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j-1)*e->wid+i  ] |= IN_CUT; 
 	}
-        else if (mask[(j-1)*wid+i+1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j-1)*wid+i+1] |= IN_CUT; 
+        else if (e->mask[(j-1)*e->wid+i+1] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j-1)*e->wid+i+1] |= IN_CUT; 
 	}
-        else if (mask[(j  )*wid+i-1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i-1] |= IN_CUT; 
+        else if (e->mask[(j  )*e->wid+i-1] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j  )*e->wid+i-1] |= IN_CUT; 
 	}
-        else if (mask[(j  )*wid+i+1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j  )*wid+i+1] |= IN_CUT; 
+        else if (e->mask[(j  )*e->wid+i+1] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j  )*e->wid+i+1] |= IN_CUT; 
 	}
-        else if (mask[(j+1)*wid+i-1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i-1] |= IN_CUT; 
+        else if (e->mask[(j+1)*e->wid+i-1] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j+1)*e->wid+i-1] |= IN_CUT; 
 	}
-        else if (mask[(j+1)*wid+i  ] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i  ] |= IN_CUT; 
+        else if (e->mask[(j+1)*e->wid+i  ] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j+1)*e->wid+i  ] |= IN_CUT; 
 	}
-        else if (mask[(j+1)*wid+i+1] & POSITIVE_CHARGE) { 
-	  mask[j*wid+i] |= IN_CUT; mask[(j+1)*wid+i+1] |= IN_CUT; 
+        else if (e->mask[(j+1)*e->wid+i+1] & POSITIVE_CHARGE) { 
+	  e->mask[j*e->wid+i] |= IN_CUT; e->mask[(j+1)*e->wid+i+1] |= IN_CUT; 
 	}
       }
 
@@ -415,20 +519,20 @@ void cutMask(void)
 #endif
 
   /* initialize the number of points in 'list' to zero */
-  list.n = 0;
+  e->list.n = 0;
 
   /* loop over (wid-3)x(len-3) residue sites */
-  for (j = 1; j < len-2; j++) {
-    register Uchar *maskLineStart=mask+wid*j;
-    if (!(j%(len/8)))  
-      asfPrintStatus("     ...at %d of %d\n", j, len);
-    for (i = 1; i < wid-2; i++) {
+  for (j = 1; j < e->len-2; j++) {
+    register Uchar *maskLineStart=e->mask+e->wid*j;
+    if (e->verbose && !(j%(e->len/8)))
+      asfPrintStatus("     ...at %d of %d\n", j, e->len);
+    for (i = 1; i < e->wid-2; i++) {
       /*
        * this will be a point to cut if it has some charge
        * and is not already in a cut
        */
       if (*(maskLineStart+i) & SOME_CHARGE && !(*(maskLineStart+i) & IN_CUT)) {
-        generateCut(i, j);
+        generateCut(e, i, j);
       }
     }
   }
@@ -443,7 +547,7 @@ void cutMask(void)
  * and which has a total charge of zero. Furthermore, we want the
  * number of points involved in the branch cut to be minimized.
  */
-void generateCut(int i, int j)
+static void generateCut(EscherCtx *e, int i, int j)
 {
   Uchar tV;                        /* test value */
   int point, point_i, point_j;
@@ -457,26 +561,26 @@ void generateCut(int i, int j)
   int scram;
 
   /* calculate the total charge of the tree */
-  if (mask[ j*wid + i] & POSITIVE_CHARGE)
+  if (e->mask[ j*e->wid + i] & POSITIVE_CHARGE)
     tC = +1;
-  else if (mask[ j*wid + i] & NEGATIVE_CHARGE)
+  else if (e->mask[ j*e->wid + i] & NEGATIVE_CHARGE)
     tC = -1;
   else
-    Exit("   generateCut() called with no charge at (%d,%d)",i,j);
+    asfPrintError("   generateCut() called with no charge at (%d,%d)",i,j);
 
   /* calculate the maximum possible radius box around this point */
   maxR = min(i + 1, j + 1);
-  maxR = min(maxR, wid - i);
-  maxR = min(maxR, len - j);
+  maxR = min(maxR, e->wid - i);
+  maxR = min(maxR, e->len - j);
 
   /* set the number of points in the list to 1, and point 0 to (i, j) */
-  list.n      = 1;
-  list.p[0].i = i;
-  list.p[0].j = j;
-  list.c[0]   = 0;   /* point 0 connects to itself */
+  e->list.n      = 1;
+  e->list.p[0].i = i;
+  e->list.p[0].j = j;
+  e->list.c[0]   = 0;   /* point 0 connects to itself */
 
   /* set this point in the mask to IN_TREE */
-  mask[ j*wid + i] |= IN_TREE;
+  e->mask[ j*e->wid + i] |= IN_TREE;
 
   /* set initial radius r = 2 and also set rmo = r - 1, a utility variable */
   r   = 2;
@@ -490,10 +594,10 @@ void generateCut(int i, int j)
 
     /* loop over the charge points in the current tree      */
     /*   (These may include cut charges from earlier trees) */
-    for (point = 0; point < list.n; point++) {
+    for (point = 0; point < e->list.n; point++) {
 
-      point_i = list.p[point].i;
-      point_j = list.p[point].j;
+      point_i = e->list.p[point].i;
+      point_j = e->list.p[point].j;
 
       /* loop over ALL the pixels in the box of radius r around this point */
       /* do this by starting with a box of radius 2 and working out */
@@ -526,15 +630,15 @@ void generateCut(int i, int j)
           }
 
           /* make sure (k, l) is within the image boundary */
-          if (k >= 0 && k < wid && l >= 0 && l < len) {
+          if (k >= 0 && k < e->wid && l >= 0 && l < e->len) {
 
             /* establish a test value 'tV', the value of the mask at (k, l) */
-            tV = mask[l*wid+k];
+            tV = e->mask[l*e->wid+k];
 
             /* test to see if the test value is grounded */
             if (tV & GROUNDED) {
               /* logical error check */
-              if (tV & IN_TREE) Exit("tV is both GROUNDED && IN_TREE");
+              if (tV & IN_TREE) asfPrintError("tV is both GROUNDED && IN_TREE");
               /* new total charge is zero automatically */
               tC    =    0;
               /*
@@ -543,14 +647,8 @@ void generateCut(int i, int j)
                */
               scram = TRUE;
 
-              /* increment number of points in the list, set last location */
-              list.n++;
-              if (list.n > 1000000)
-                 Exit("list exceeded 1 million points");
-              list.p[(list.n)-1].i = k;
-              list.p[(list.n)-1].j = l;
-              /* connect this guy to point number 'point' */
-              list.c[(list.n)-1]   = point;
+              /* add (k, l) to the list, connected to point number 'point' */
+              addPoint(e, k, l, point);
 
               /*
                * connect all points with GROUNDED lines
@@ -558,15 +656,15 @@ void generateCut(int i, int j)
                */
               /* start at the second point on the list */
               /* loop to the last point on the list    */
-              for (p = 1; p <= (list.n)-1; p++) {
+              for (p = 1; p <= (e->list.n)-1; p++) {
                 /* set (p_i, p_j) to 'p-th' point in the list */
-                p_i  = list.p[p].i;
-                p_j  = list.p[p].j;
+                p_i  = e->list.p[p].i;
+                p_j  = e->list.p[p].j;
                 /* connection index is carried in c[] array   */
-                cIdx = list.c[p];
-                p_ii = list.p[cIdx].i;
-                p_jj = list.p[cIdx].j;
-                makeBranchCut(p_i, p_j, p_ii, p_jj, (IN_CUT | GROUNDED));
+                cIdx = e->list.c[p];
+                p_ii = e->list.p[cIdx].i;
+                p_jj = e->list.p[cIdx].j;
+                makeBranchCut(e, p_i, p_j, p_ii, p_jj, (IN_CUT | GROUNDED));
               }
 
             }  /* end if test value tV is GROUNDED */
@@ -582,17 +680,12 @@ void generateCut(int i, int j)
                * is not already part of a cut */
               if (!(tV & IN_CUT)) { tC += 3 - 2*((int)(tV & SOME_CHARGE)); }
               /* label all points from (point_i, _j) to (k, l) as IN_CUT */
-              makeBranchCut(point_i, point_j, k, l, IN_CUT);
-              /* increment number of points in the list, set last location */
-              list.n++;
-              if (list.n > 1000000) Exit("list exceeded 1 million points");
-              list.p[(list.n)-1].i = k;
-              list.p[(list.n)-1].j = l;
-              /* connect this guy to point number 'point' */
-              list.c[(list.n)-1]   = point;
+              makeBranchCut(e, point_i, point_j, k, l, IN_CUT);
+              /* add (k, l) to the list, connected to point number 'point' */
+              addPoint(e, k, l, point);
 
               /* mark this point as being on the current tree */
-              mask[ l*wid + k] |= IN_TREE;
+              e->mask[ l*e->wid + k] |= IN_TREE;
 
               /* scram if this cut has neutralized the tree */
               if (!tC) { scram = TRUE; }
@@ -636,7 +729,7 @@ void generateCut(int i, int j)
   /* I think we can just about take this out pretty soon */
   if (!scram) {
     asfPrintStatus("(%d, %d), maxR = %d, r = %d, rmo = %d, list.n = %d\n",
-      i, j, maxR, r, rmo, list.n);
+      i, j, maxR, r, rmo, e->list.n);
     asfPrintError("Error in generateCut()");
   }
 #endif
@@ -647,42 +740,42 @@ void generateCut(int i, int j)
    * there is a list of points on the current
    * tree which should be marked 'NOT_IN_TREE'.
    */
-  for (point = 0; point < list.n; point++) {
-    point_i = list.p[point].i;
-    point_j = list.p[point].j;
-    mask[ point_j*wid + point_i] &= NOT_IN_TREE;
+  for (point = 0; point < e->list.n; point++) {
+    point_i = e->list.p[point].i;
+    point_j = e->list.p[point].j;
+    e->mask[ point_j*e->wid + point_i] &= NOT_IN_TREE;
   }
 
 #if DEBUG_TEST
   /* debug test... */
   /* I think we can just about take this out pretty soon */
   count = 0;
-  for (point = 0; point < list.n; point++) {
-    point_i = list.p[point].i;
-    point_j = list.p[point].j;
-    if (!(mask[ point_j*wid + point_i] & IN_CUT)) { count++; }
+  for (point = 0; point < e->list.n; point++) {
+    point_i = e->list.p[point].i;
+    point_j = e->list.p[point].j;
+    if (!(e->mask[ point_j*e->wid + point_i] & IN_CUT)) { count++; }
   }
   if (count) {
     asfPrintStatus("   at point (%d, %d), the debug test for IN_CUT returned:"
 		   "\n",i,j);
-    asfPrintStatus("   \t%d bad of %d in the list\n", count, list.n);
-    for (point = 0; point < list.n; point++) {
-      point_i = list.p[point].i;
-      point_j = list.p[point].j;
-      if (!(mask[ point_j*wid + point_i] & IN_CUT)) { count++; }
+    asfPrintStatus("   \t%d bad of %d in the list\n", count, e->list.n);
+    for (point = 0; point < e->list.n; point++) {
+      point_i = e->list.p[point].i;
+      point_j = e->list.p[point].j;
+      if (!(e->mask[ point_j*e->wid + point_i] & IN_CUT)) { count++; }
       asfPrintStatus("   %d: (%d, %d)\n\tmask %d\n\tmask & IN_CUT %d\n",
-        point, point_i, point_j, (int)(mask[point_j*wid+point_i)),
-        (int)(mask[point_j*wid+point_i] & IN_CUT));
+        point, point_i, point_j, (int)(e->mask[point_j*e->wid+point_i)),
+        (int)(e->mask[point_j*e->wid+point_i] & IN_CUT));
       asfPrintStatus("   \tmask & GROUNDED %d\n\tmask & SOME_CHARGE %d\n",
-        (int)(mask[point_j*wid+point_i] & GROUNDED),
-        (int)(mask[point_j*wid+point_i] & SOME_CHARGE));
+        (int)(e->mask[point_j*e->wid+point_i] & GROUNDED),
+        (int)(e->mask[point_j*e->wid+point_i] & SOME_CHARGE));
     }
-    Exit("   generateCut() failed logical test");
+    asfPrintError("   generateCut() failed logical test");
   }
 #endif
 
   /* reset number of points on list to zero */
-  list.n = 0;
+  e->list.n = 0;
 
   return;
 }
@@ -692,7 +785,8 @@ void generateCut(int i, int j)
  * The purpose of this function is to do a logical or of 'orVal' with every
  *   pixel in the mask array from (i, j) to (ii, jj) inclusive.
  */
-void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
+static void makeBranchCut(EscherCtx *e, int i, int j, int ii, int jj,
+			  Uchar orVal)
 {
   int   dx, dy;        /* differences in coord values               */
   int   adx, ady;      /* absolute values of diffs                  */
@@ -718,7 +812,7 @@ void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
     lcd   = dx;
     if      (dx < 0) dc1 =  1;
     else if (dx > 0) dc1 = -1;
-    else             Exit("makeBranchCut():  logic error 1");
+    else             asfPrintError("makeBranchCut():  logic error 1");
     slope = (float)(dy)/(float)(dx);
   }
   else           {
@@ -728,7 +822,7 @@ void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
     lcd   = dy;
     if      (dy < 0) dc1 =  1;
     else if (dy > 0) dc1 = -1;
-    else             Exit("makeBranchCut():  logic error 2");
+    else             asfPrintError("makeBranchCut():  logic error 2");
     slope = (float)(dx)/(float)(dy);
   }
 
@@ -736,50 +830,51 @@ void makeBranchCut(int i, int j, int ii, int jj, Uchar orVal)
   if (order) {
     for (c1 = lc; c1 != lc - lcd + dc1; c1 += dc1) {
       c2 = sc + (int)(slope*(float)(c1 - lc));
-      mask[c2*wid+c1] |= orVal;
+      e->mask[c2*e->wid+c1] |= orVal;
     }
   }
   else {
     for (c1 = lc; c1 != lc - lcd + dc1; c1 += dc1) {
       c2 = sc + (int)(slope*(float)(c1 - lc));
-      mask[c1*wid+c2] |= orVal;
+      e->mask[c1*e->wid+c2] |= orVal;
     }
   }
 
   /* also label the last point as IN_CUT */
-  mask[ jj*wid + ii] |= orVal;
+  e->mask[ jj*e->wid + ii] |= orVal;
 
   return;
 }
 
-void finishUwp(void)
+static void finishUwp(EscherCtx *e)
 {
   int i, j;
 
-  for (j = 0; j < len; j++) {
-    register float *lineStart=&phase[wid*j];
-    for (i = 0; i < wid; i++)
-      if (!(mask[j*wid+i]&INTEGRATED))
+  for (j = 0; j < e->len; j++) {
+    register float *lineStart=&e->phase[e->wid*j];
+    for (i = 0; i < e->wid; i++)
+      if (!(e->mask[j*e->wid+i]&INTEGRATED))
        *(lineStart+i) = 0.0;/*Set non-integrated phases to zero*/
   }
 
   return;
 }
 
-void saveUwp(char *f)
+static void saveUwp(EscherCtx *e, char *f)
 {
   meta_parameters *meta;
 
   FILE *fd = FOPEN(f, "wb");
   meta = meta_read(f);
-  put_float_lines(fd, meta, 0, len, phase);
+  put_float_lines(fd, meta, 0, e->len, e->phase);
   FCLOSE(fd);
+  meta_free(meta);
 
   return;
 }
 
 
-void integratePhase(int i, int j)
+static int integratePhase(EscherCtx *e, int i, int j)
 {
   int    u, v;      /* starting point coordinates                         */
   Uchar  s;         /* temp status value                                  */
@@ -788,13 +883,13 @@ void integratePhase(int i, int j)
 
   /* initialize things */
   /* set 'source' bits for seed point in 'im' to 0; no source! */
-  im[j*wid+i]   &= 0x0f;
+  e->im[j*e->wid+i]   &= 0x0f;
 
   /* set unwrapped phase to seed value p0                      */
   /*  *(uwp+j*wid+i)   = p0; <--IMPLICIT*/
 
   /* label seed point as integrated                            */
-  mask[j*wid+i] |= INTEGRATED;
+  e->mask[j*e->wid+i] |= INTEGRATED;
 
   /* increment integration counter                             */
   t++;
@@ -807,56 +902,60 @@ void integratePhase(int i, int j)
    */
 
   /* try 1:  go up one pixel to (i, j-1) */
-  if (!(mask[(j-1)*wid+i] & IICG)){
+  if (!(e->mask[(j-1)*e->wid+i] & IICG)){
     v--; t++;
-    im[ j*wid + i] |= TRIED_U;
-    im[ v*wid + u] |= SOURCE_B;
-    mask[ v*wid + u] |= INTEGRATED;
-    phase[v*wid + u]  = phase[j*wid+i] +
-                           phaseRemap((phase[v*wid+u]) -
-                           (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going up...");
+    e->im[ j*e->wid + i] |= TRIED_U;
+    e->im[ v*e->wid + u] |= SOURCE_B;
+    e->mask[ v*e->wid + u] |= INTEGRATED;
+    e->phase[v*e->wid + u]  = e->phase[j*e->wid+i] +
+                           phaseRemap((e->phase[v*e->wid+u]) -
+                           (e->phase[j*e->wid+i]));
+    if (e->verbose)
+      asfPrintStatus("   from seed point, started out by going up...");
   }
 
   /* try 2:  go right one pixel to (i + 1, j) */
-  else if (!(mask[j*wid+(i+1)] & IICG)){
+  else if (!(e->mask[j*e->wid+(i+1)] & IICG)){
     u++; t++;
-    im[ j*wid + i] |= TRIED_UR;
-    im[ v*wid + u] |= SOURCE_L;
-    mask[ v*wid + u] |= INTEGRATED;
-    phase[ v*wid + u]  = phase[j*wid+i] +
-                           phaseRemap((phase[v*wid+u]) -
-                           (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going right...\n");
+    e->im[ j*e->wid + i] |= TRIED_UR;
+    e->im[ v*e->wid + u] |= SOURCE_L;
+    e->mask[ v*e->wid + u] |= INTEGRATED;
+    e->phase[ v*e->wid + u]  = e->phase[j*e->wid+i] +
+                           phaseRemap((e->phase[v*e->wid+u]) -
+                           (e->phase[j*e->wid+i]));
+    if (e->verbose)
+      asfPrintStatus("   from seed point, started out by going right...\n");
   }
 
   /* try 3:  go down one pixel to (i, j + 1) */
-  else if (!(mask[(j+1)*wid+i] & IICG)){
+  else if (!(e->mask[(j+1)*e->wid+i] & IICG)){
     v++; t++;
-    im[ j*wid + i] |= TRIED_URD;
-    im[ v*wid + u] |= SOURCE_A;
-    mask[ v*wid + u] |= INTEGRATED;
-    phase[ v*wid + u]  = phase[j*wid+i] +
-                           phaseRemap((phase[v*wid+u]) -
-                           (phase[j*wid+i]));
-    asfPrintStatus("   from seed point, started out by going down...\n");
+    e->im[ j*e->wid + i] |= TRIED_URD;
+    e->im[ v*e->wid + u] |= SOURCE_A;
+    e->mask[ v*e->wid + u] |= INTEGRATED;
+    e->phase[ v*e->wid + u]  = e->phase[j*e->wid+i] +
+                           phaseRemap((e->phase[v*e->wid+u]) -
+                           (e->phase[j*e->wid+i]));
+    if (e->verbose)
+      asfPrintStatus("   from seed point, started out by going down...\n");
   }
 
   /* try 4:  go left one pixel to (i - 1, j) */
-  else if (!(mask[j*wid+(i-1)] & IICG)){
+  else if (!(e->mask[j*e->wid+(i-1)] & IICG)){
     u--; t++;
-    im[ j*wid + i] |= TRIED_URDL;
-    im[ v*wid + u] |= SOURCE_R;
-    mask[ v*wid + u] |= INTEGRATED;
-    phase[ v*wid + u]  = phase[j*wid+i] +
-                           phaseRemap((phase[v*wid+u]) -
-                           (phase[j*wid+i]));
-    asfPrintStatus("\n   from seed point, started out by going left...\n");
+    e->im[ j*e->wid + i] |= TRIED_URDL;
+    e->im[ v*e->wid + u] |= SOURCE_R;
+    e->mask[ v*e->wid + u] |= INTEGRATED;
+    e->phase[ v*e->wid + u]  = e->phase[j*e->wid+i] +
+                           phaseRemap((e->phase[v*e->wid+u]) -
+                           (e->phase[j*e->wid+i]));
+    if (e->verbose)
+      asfPrintStatus("\n   from seed point, started out by going left...\n");
   }
 
   /* fall through:  No good 4-nbrs found */
   else {
-    im[ j*wid + i] |= TRIED_URDL;
+    e->im[ j*e->wid + i] |= TRIED_URDL;
   }
 
   /*
@@ -868,12 +967,13 @@ void integratePhase(int i, int j)
    *  This way we only fall out when we get back to (i, j) and all search
    *    directions are exhausted.
    */
-  while (u != i || v != j || !(im[j*wid+i] & TRIED_L)){
+  while (u != i || v != j || !(e->im[j*e->wid+i] & TRIED_L)){
 
-    if (!(t%100000)) asfPrintStatus ("\r   total integrated = %d", t);
+    if (e->verbose && !(t%100000))
+      asfPrintStatus ("\r   total integrated = %d", t);
 
     /* s = temp value of 'im' at pixel (u, v) */
-    s        = im[v*wid + u];
+    s        = e->im[v*e->wid + u];
     madeJump = FALSE;
 
     /*
@@ -889,16 +989,16 @@ void integratePhase(int i, int j)
     if (!(s & TRIED_URDL)) {
 
       /* if this is the case, then set TRIED_U since we're about to try 'up' */
-      im[ v*wid + u] |= TRIED_U;
+      e->im[ v*e->wid + u] |= TRIED_U;
 
-      if (!(mask[(v-1)*wid+u] & IICG)) {
+      if (!(e->mask[(v-1)*e->wid+u] & IICG)) {
         v--; t++;
         madeJump = TRUE;
-        im[ v*wid + u] |= SOURCE_B;
-        mask[ v*wid + u] |= INTEGRATED;
-        phase[ v*wid + u]  = phase[(v+1)*wid + u] +
-                               phaseRemap(phase[v*wid+u] -
-                               phase[(v+1)*wid+u]);
+        e->im[ v*e->wid + u] |= SOURCE_B;
+        e->mask[ v*e->wid + u] |= INTEGRATED;
+        e->phase[ v*e->wid + u]  = e->phase[(v+1)*e->wid + u] +
+                               phaseRemap(e->phase[v*e->wid+u] -
+                               e->phase[(v+1)*e->wid+u]);
       }
 
     }
@@ -908,18 +1008,18 @@ void integratePhase(int i, int j)
 
       /* if this is the case,
          then set TRIED_R since we're about to try 'right' */
-      im[ v*wid + u] |= TRIED_R;
+      e->im[ v*e->wid + u] |= TRIED_R;
 
       /* check if potential destination is not integrated,
          not cut, and not grounded */
-      if (!(mask[v*wid+(u+1)] & IICG)) {
+      if (!(e->mask[v*e->wid+(u+1)] & IICG)) {
         u++; t++;
         madeJump = TRUE;
-        im[ v*wid + u] |= SOURCE_L;
-        mask[ v*wid + u] |= INTEGRATED;
-        phase[ v*wid + u]  = phase[ v*wid + (u-1)] +
-                               phaseRemap(phase[v*wid+u] -
-                                 phase[v*wid+(u-1)]);
+        e->im[ v*e->wid + u] |= SOURCE_L;
+        e->mask[ v*e->wid + u] |= INTEGRATED;
+        e->phase[ v*e->wid + u]  = e->phase[ v*e->wid + (u-1)] +
+                               phaseRemap(e->phase[v*e->wid+u] -
+                                 e->phase[v*e->wid+(u-1)]);
       }
 
     }
@@ -929,18 +1029,18 @@ void integratePhase(int i, int j)
 
       /* if this is the case, then set TRIED_D since
          we're about to try 'down' */
-      im[ v*wid + u] |= TRIED_D;
+      e->im[ v*e->wid + u] |= TRIED_D;
 
       /* check if potential destination is
          not integrated, not cut, and not grounded */
-      if (!(mask[(v+1)*wid+u] & IICG)) {
+      if (!(e->mask[(v+1)*e->wid+u] & IICG)) {
         v++; t++;
         madeJump = TRUE;
-        im[ v*wid + u] |= SOURCE_A;
-        mask[ v*wid + u] |= INTEGRATED;
-        phase[ v*wid + u]  = phase[ (v-1)*wid + u] +
-                               phaseRemap(phase[v*wid+u] -
-                                 phase[(v-1)*wid+u]);
+        e->im[ v*e->wid + u] |= SOURCE_A;
+        e->mask[ v*e->wid + u] |= INTEGRATED;
+        e->phase[ v*e->wid + u]  = e->phase[ (v-1)*e->wid + u] +
+                               phaseRemap(e->phase[v*e->wid+u] -
+                                 e->phase[(v-1)*e->wid+u]);
       }
 
     }
@@ -950,18 +1050,18 @@ void integratePhase(int i, int j)
 
       /* if this is the case,
          then set TRIED_L since we're about to try 'left' */
-      im[ v*wid + u] |= TRIED_L;
+      e->im[ v*e->wid + u] |= TRIED_L;
 
       /* check if potential destination is
          not integrated, not cut, and not grounded */
-      if (!(mask[v*wid+(u-1)] & IICG)) {
+      if (!(e->mask[v*e->wid+(u-1)] & IICG)) {
         u--; t++;
         madeJump = TRUE;
-        im[ v*wid + u] |= SOURCE_R;
-        mask[ v*wid + u] |= INTEGRATED;
-        phase[ v*wid + u]  = phase[v*wid + (u+1)] +
-                               phaseRemap(phase[v*wid+u] -
-                                 phase[v*wid+(u+1)]);
+        e->im[ v*e->wid + u] |= SOURCE_R;
+        e->mask[ v*e->wid + u] |= INTEGRATED;
+        e->phase[ v*e->wid + u]  = e->phase[v*e->wid + (u+1)] +
+                               phaseRemap(e->phase[v*e->wid+u] -
+                                 e->phase[v*e->wid+(u+1)]);
       }
 
     }
@@ -984,12 +1084,13 @@ void integratePhase(int i, int j)
 
   }  /* end of the big 'while-not-done' loop */
 
-  asfPrintStatus("\nUnwrapped %d pixels...\n", t);
-  return;
+  if (e->verbose)
+    asfPrintStatus("\nUnwrapped %d pixels...\n", t);
+  return t;
 }
 
 
-void doStats()
+static void doStats(EscherCtx *e)
 {
   int    i, j, k;
   int    nZero     = 0;
@@ -999,11 +1100,11 @@ void doStats()
   int    nCut      = 0;
   int    nInteg    = 0;
   int    nInTree   = 0;
-  float total     = (float)(len*wid);
+  float total     = (float)(e->len*e->wid);
 
-  for (j = 0; j < len; j++) {
-    register Uchar *lineStart=mask+wid*j;
-    for (i = 0; i < wid; i++) {
+  for (j = 0; j < e->len; j++) {
+    register Uchar *lineStart=e->mask+e->wid*j;
+    for (i = 0; i < e->wid; i++) {
 
       k = (int)(*(lineStart+i));
 
@@ -1049,56 +1150,427 @@ int escher(char *inFile, char *outFile)
   int seedX=-1,seedY=-1; 
   char szWrap[MAXNAME], szUnwrap[MAXNAME];
   meta_parameters *meta;
+  EscherCtx ctx, *e = &ctx;
+  Point *cordon;
+  int nCordon;
 
   create_name(szWrap, inFile, ".img");
   create_name(szUnwrap, outFile, ".img");
 
   meta = meta_read(szWrap);
-  wid = meta->general->sample_count;
-  len = meta->general->line_count;
+  initCtx(e, meta->general->sample_count, meta->general->line_count, 0, 0);
   if ((seedX == -1)&&(seedY == -1))
   {
-    seedX = wid/2;
-    seedY = len/2;
+    seedX = e->wid/2;
+    seedY = e->len/2;
   }
   
   meta_write(meta, szUnwrap);
-
-  size = wid*len;
-  mask = (Uchar *)calloc(size, sizeof(Uchar));
-  im = (Uchar *)calloc(size, sizeof(Uchar));
-  phase = (float *)MALLOC(sizeof(float)*size);
+  meta_free(meta);
 
   /* perform steps*/
   asfPrintStatus("\nGenerating phase unwrapping mask ...\n\n");
-  loadWrappedPhase(szWrap);
-  groundBorder();
-  makeMask();
-  doStats();
+  loadWrappedPhase(e, szWrap);
+  groundBorder(e);
+  makeMask(e);
+  doStats(e);
   asfPrintStatus("\n\nGrounding remaining residues ...\n\n");
-  installCordon("cordon");
+  cordon = readCordon("cordon", &nCordon);
+  installCordon(e, cordon, nCordon);
   asfPrintStatus("\n\nDefining branch cuts ...\n\n");
-  cutMask();
-  doStats();
+  cutMask(e);
+  doStats(e);
 
 #if DO_DEBUG_CHECKS
-  saveMask((char *)mask, "test");
+  saveMask(e, "test");
 
-  verifyCuts();                                           
+  verifyCuts(e);
 #endif
 
   asfPrintStatus("\n\nIntegrating the phase ...\n\n");
-  checkSeed(&seedX, &seedY);
-  integratePhase(seedX, seedY);
-  doStats();
-  finishUwp();
-  saveMask(mask, szUnwrap);
-  saveUwp(szUnwrap);
+  checkSeed(e, &seedX, &seedY);
+  integratePhase(e, seedX, seedY);
+  doStats(e);
+  finishUwp(e);
+  saveMask(e, szUnwrap);
+  saveUwp(e, szUnwrap);
   
   // Clean up
-  FREE(mask);
-  FREE(im);
-  FREE(phase);
+  if (cordon) FREE(cordon);
+  freeCtx(e);
+
+  return(0);
+}
+
+/*
+ * Tiled unwrapping
+ *
+ * escher() needs the whole phase image, its mask and its integration mask
+ *   in memory at once, which large interferograms do not fit into.
+ *   escher_tiled() cuts the image into square tiles instead, and unwraps
+ *   each tile, extended by ESCHER_TILE_OVERLAP lines and samples on every
+ *   side, as if it were an image of its own: residues, branch cuts and the
+ *   flood fill integration are all done per tile, and the tiles of one tile
+ *   row are unwrapped in parallel.  Only the core of each tile (the part
+ *   without the overlap) goes into the output.
+ *
+ * Each tile comes out unwrapped up to its own whole number of cycles.  Where
+ *   two neighbouring tiles overlap, the difference between their unwrapped
+ *   phases should be the same multiple of 2 pi at every pixel both have
+ *   integrated; the most common multiple is taken as the offset across that
+ *   seam, and the number of pixels agreeing with it as its weight.  Starting
+ *   from the tile with the most unwrapped pixels, tiles are then tied
+ *   together along the heaviest seams first (a maximum spanning tree), so a
+ *   poor seam is only used when there is no better way to reach a tile.
+ *   Tiles that cannot be reached at all are left out, just as escher()
+ *   leaves out regions its flood fill cannot reach.
+ *
+ * Only one tile row of input, and the overlapping strip of the row above,
+ *   is held in memory at a time.  The tile offsets are applied in a second
+ *   pass over the output.
+ */
+#define ESCHER_TILE_OVERLAP 64
+#define ESCHER_MIN_TILE     (4*ESCHER_TILE_OVERLAP)
+#define ESCHER_MIN_SEAM     32   /* pixels a seam needs before we trust it */
+#define ESCHER_MAX_JUMP     64   /* largest seam offset considered, cycles */
+
+typedef struct {
+  int a, b;        /* tile numbers                                   */
+  int k;           /* tile b is this many cycles above tile a        */
+  int weight;      /* number of pixels that agree on k               */
+} Seam;
+
+typedef struct {
+  int wid, len;              /* image size                           */
+  int tileSize, ntx, nty;
+  int ty;                    /* tile row being unwrapped             */
+  float *band;               /* input lines of the tile row ...      */
+  int bandY0;                /*   ... starting at this line          */
+  EscherCtx *row;            /* one context per tile in the row      */
+  Point *cordon;
+  int nCordon;
+  int *nResidues;            /* residues found in each tile          */
+} TiledRun;
+
+/* core area [cx0,cx1) x [cy0,cy1) of tile (tx, ty), and its extended area */
+static void tileArea(TiledRun *run, int tx, int ty, int *cx0, int *cx1,
+		     int *cy0, int *cy1, int *ex0, int *ex1, int *ey0, int *ey1)
+{
+  int T = run->tileSize, O = ESCHER_TILE_OVERLAP;
+
+  *cx0 = tx*T;
+  *cx1 = (tx+1)*T < run->wid ? (tx+1)*T : run->wid;
+  *cy0 = ty*T;
+  *cy1 = (ty+1)*T < run->len ? (ty+1)*T : run->len;
+  *ex0 = *cx0 - O > 0 ? *cx0 - O : 0;
+  *ex1 = *cx1 + O < run->wid ? *cx1 + O : run->wid;
+  *ey0 = *cy0 - O > 0 ? *cy0 - O : 0;
+  *ey1 = *cy1 + O < run->len ? *cy1 + O : run->len;
+}
+
+static void unwrapTiles(int start, int end, void *data)
+{
+  TiledRun *run = (TiledRun *)data;
+  int tx, y, k, seedX, seedY;
+  int cx0, cx1, cy0, cy1, ex0, ex1, ey0, ey1;
+
+  for (tx = start; tx < end; tx++) {
+    EscherCtx *e = &run->row[tx];
+    int nRes = 0;
+
+    tileArea(run, tx, run->ty, &cx0, &cx1, &cy0, &cy1,
+	     &ex0, &ex1, &ey0, &ey1);
+    initCtx(e, ex1-ex0, ey1-ey0, ex0, ey0);
+    e->verbose = FALSE;
+    for (y = ey0; y < ey1; y++)
+      memcpy(e->phase + (y-ey0)*e->wid,
+	     run->band + (long)(y-run->bandY0)*run->wid + ex0,
+	     sizeof(float)*e->wid);
+
+    groundBorder(e);
+    makeMask(e);
+    installCordon(e, run->cordon, run->nCordon);
+    for (y = cy0; y < cy1; y++)
+      for (k = (y-ey0)*e->wid + cx0-ex0; k < (y-ey0)*e->wid + cx1-ex0; k++)
+        if (e->mask[k] & SOME_CHARGE) nRes++;
+    run->nResidues[run->ty*run->ntx + tx] = nRes;
+    cutMask(e);
+
+    seedX = (cx0+cx1)/2 - ex0;
+    seedY = (cy0+cy1)/2 - ey0;
+    if (findSeed(e, &seedX, &seedY))
+      integratePhase(e, seedX, seedY);
+    finishUwp(e);
+
+    /* only the phase and the mask are needed from here on */
+    FREE(e->im);
+    e->im = NULL;
+  }
+}
+
+/* Keep only the lines from image line y0 on of a finished tile: that is
+   all of it the next tile row overlaps. */
+static void trimTile(EscherCtx *e, int y0)
+{
+  int skip = y0 - e->y0, len;
+  float *phase;
+  Uchar *mask;
+
+  if (skip <= 0)
+    return;
+  len = skip < e->len ? e->len - skip : 0;
+  phase = (float *)MALLOC(sizeof(float)*(len*e->wid + 1));
+  mask = (Uchar *)MALLOC(sizeof(Uchar)*(len*e->wid + 1));
+  memcpy(phase, e->phase + skip*e->wid, sizeof(float)*len*e->wid);
+  memcpy(mask, e->mask + skip*e->wid, sizeof(Uchar)*len*e->wid);
+  FREE(e->phase);
+  FREE(e->mask);
+  e->phase = phase;
+  e->mask = mask;
+  e->len = len;
+  e->size = len*e->wid;
+  e->y0 = y0;
+}
+
+/* Work out the offset, in cycles, across the overlap of tiles a and b. */
+static void measureSeam(EscherCtx *a, EscherCtx *b, int na, int nb,
+			Seam *seam)
+{
+  int hist[2*ESCHER_MAX_JUMP+1];
+  int x, y, k, best;
+  int x0 = a->x0 > b->x0 ? a->x0 : b->x0;
+  int y0 = a->y0 > b->y0 ? a->y0 : b->y0;
+  int x1 = a->x0+a->wid < b->x0+b->wid ? a->x0+a->wid : b->x0+b->wid;
+  int y1 = a->y0+a->len < b->y0+b->len ? a->y0+a->len : b->y0+b->len;
+
+  memset(hist, 0, sizeof(hist));
+  for (y = y0; y < y1; y++) {
+    int ia = (y-a->y0)*a->wid - a->x0;
+    int ib = (y-b->y0)*b->wid - b->x0;
+    for (x = x0; x < x1; x++) {
+      if ((a->mask[ia+x] & INTEGRATED) && (b->mask[ib+x] & INTEGRATED)) {
+        k = (int)floor((b->phase[ib+x] - a->phase[ia+x])/TWOPI + 0.5);
+        if (k >= -ESCHER_MAX_JUMP && k <= ESCHER_MAX_JUMP)
+          hist[k+ESCHER_MAX_JUMP]++;
+      }
+    }
+  }
+
+  best = ESCHER_MAX_JUMP;
+  for (k = 0; k < 2*ESCHER_MAX_JUMP+1; k++)
+    if (hist[k] > hist[best]) best = k;
+
+  seam->a = na;
+  seam->b = nb;
+  seam->k = best - ESCHER_MAX_JUMP;
+  seam->weight = hist[best];
+}
+
+/*
+ * Tie the tiles together, heaviest seams first, starting from tile 'ref'.
+ *   offset[t] is the number of cycles to add to tile t; linked[t] is FALSE
+ *   for tiles no usable seam leads to.  Returns the number of seams used.
+ */
+static int solveOffsets(Seam *seams, int nSeams, int nTiles, int ref,
+			int *offset, int *linked)
+{
+  int s, best, nUsed = 0;
+
+  for (s = 0; s < nTiles; s++) {
+    offset[s] = 0;
+    linked[s] = FALSE;
+  }
+  linked[ref] = TRUE;
+
+  for (;;) {
+    best = -1;
+    for (s = 0; s < nSeams; s++)
+      if (seams[s].weight >= ESCHER_MIN_SEAM &&
+          linked[seams[s].a] != linked[seams[s].b] &&
+          (best < 0 || seams[s].weight > seams[best].weight))
+        best = s;
+    if (best < 0)
+      break;
+    if (linked[seams[best].a]) {
+      offset[seams[best].b] = offset[seams[best].a] - seams[best].k;
+      linked[seams[best].b] = TRUE;
+    }
+    else {
+      offset[seams[best].a] = offset[seams[best].b] + seams[best].k;
+      linked[seams[best].a] = TRUE;
+    }
+    nUsed++;
+  }
+
+  return nUsed;
+}
+
+int escher_tiled(char *inFile, char *outFile, int tileSize)
+{
+  char szWrap[MAXNAME], szUnwrap[MAXNAME], szMask[MAXNAME];
+  meta_parameters *meta;
+  TiledRun run;
+  EscherCtx *above;
+  Seam *seams;
+  FILE *fpIn, *fpOut, *fpMask;
+  float *outLines;
+  Uchar *outMask;
+  int *nInteg, *offset, *linked;
+  int wid, len, T, nTiles, nSeams = 0, nUsed, ref, adjust;
+  int tx, ty, t, x, y;
+  int cx0, cx1, cy0, cy1, ex0, ex1, ey0, ey1;
+  long long totInteg = 0, totResidues = 0, totLinked = 0;
+
+  create_name(szWrap, inFile, ".img");
+  create_name(szUnwrap, outFile, ".img");
+  create_name(szMask, szUnwrap, "_mask.img");
+
+  meta = meta_read(szWrap);
+  wid = meta->general->sample_count;
+  len = meta->general->line_count;
+  meta_write(meta, szUnwrap);
+
+  T = tileSize < ESCHER_MIN_TILE ? ESCHER_MIN_TILE : tileSize;
+  run.wid = wid;
+  run.len = len;
+  run.tileSize = T;
+  run.ntx = (wid + T - 1)/T;
+  run.nty = (len + T - 1)/T;
+  nTiles = run.ntx*run.nty;
+  run.band = (float *)MALLOC(sizeof(float)*(T + 2*ESCHER_TILE_OVERLAP)*wid);
+  run.row = (EscherCtx *)CALLOC(run.ntx, sizeof(EscherCtx));
+  run.cordon = readCordon("cordon", &run.nCordon);
+  run.nResidues = (int *)CALLOC(nTiles, sizeof(int));
+  above = (EscherCtx *)CALLOC(run.ntx, sizeof(EscherCtx));
+  seams = (Seam *)MALLOC(sizeof(Seam)*2*nTiles);
+  nInteg = (int *)CALLOC(nTiles, sizeof(int));
+  offset = (int *)MALLOC(sizeof(int)*nTiles);
+  linked = (int *)MALLOC(sizeof(int)*nTiles);
+  outLines = (float *)MALLOC(sizeof(float)*T*wid);
+  outMask = (Uchar *)MALLOC(sizeof(Uchar)*T*wid);
+
+  asfPrintStatus("\nUnwrapping %d x %d tiles of %d pixels "
+		 "(%d pixels overlap) ...\n\n",
+		 run.ntx, run.nty, T, ESCHER_TILE_OVERLAP);
+
+  fpIn = FOPEN(szWrap, "rb");
+  fpOut = FOPEN(szUnwrap, "wb");
+  fpMask = FOPEN(szMask, "wb");
+  for (ty = 0; ty < run.nty; ty++) {
+    tileArea(&run, 0, ty, &cx0, &cx1, &cy0, &cy1, &ex0, &ex1, &ey0, &ey1);
+    get_float_lines(fpIn, meta, ey0, ey1-ey0, run.band);
+    run.bandY0 = ey0;
+    run.ty = ty;
+
+    asf_parallel_for(run.ntx, 1, unwrapTiles, &run);
+
+    for (tx = 0; tx < run.ntx; tx++) {
+      EscherCtx *e = &run.row[tx];
+      t = ty*run.ntx + tx;
+
+      /* seams with the tile to the left and the tile above */
+      if (tx > 0)
+        measureSeam(&run.row[tx-1], e, t-1, t, &seams[nSeams++]);
+      if (ty > 0)
+        measureSeam(&above[tx], e, t-run.ntx, t, &seams[nSeams++]);
+
+      /* the core of the tile goes into the output */
+      tileArea(&run, tx, ty, &cx0, &cx1, &cy0, &cy1,
+	       &ex0, &ex1, &ey0, &ey1);
+      for (y = cy0; y < cy1; y++) {
+        int in = (y-ey0)*e->wid + (cx0-ex0), out = (y-cy0)*wid + cx0;
+        memcpy(outLines + out, e->phase + in, sizeof(float)*(cx1-cx0));
+        memcpy(outMask + out, e->mask + in, sizeof(Uchar)*(cx1-cx0));
+        for (x = 0; x < cx1-cx0; x++)
+          if (outMask[out+x] & INTEGRATED) nInteg[t]++;
+      }
+    }
+    put_float_lines(fpOut, meta, cy0, cy1-cy0, outLines);
+    ASF_FWRITE(outMask, sizeof(Uchar), (cy1-cy0)*wid, fpMask);
+
+    /* this tile row is now the row above */
+    for (tx = 0; tx < run.ntx; tx++) {
+      freeCtx(&above[tx]);
+      above[tx] = run.row[tx];
+      trimTile(&above[tx], cy1 - ESCHER_TILE_OVERLAP);
+    }
+    asfLineMeter(cy1-1, len);
+  }
+  for (tx = 0; tx < run.ntx; tx++)
+    freeCtx(&above[tx]);
+  FCLOSE(fpIn);
+  FCLOSE(fpOut);
+  FCLOSE(fpMask);
+
+  /* tie the tiles together */
+  ref = 0;
+  for (t = 0; t < nTiles; t++)
+    if (nInteg[t] > nInteg[ref]) ref = t;
+  nUsed = solveOffsets(seams, nSeams, nTiles, ref, offset, linked);
+
+  adjust = FALSE;
+  for (t = 0; t < nTiles; t++) {
+    totResidues += run.nResidues[t];
+    if (linked[t]) {
+      totInteg += nInteg[t];
+      totLinked++;
+    }
+    if (!linked[t] || offset[t])
+      adjust = TRUE;
+  }
+
+  /* second pass: shift each tile by its offset, and drop unlinked tiles */
+  if (adjust) {
+    fpOut = FOPEN(szUnwrap, "r+b");
+    fpMask = FOPEN(szMask, "r+b");
+    for (ty = 0; ty < run.nty; ty++) {
+      tileArea(&run, 0, ty, &cx0, &cx1, &cy0, &cy1,
+	       &ex0, &ex1, &ey0, &ey1);
+      get_float_lines(fpOut, meta, cy0, cy1-cy0, outLines);
+      FSEEK64(fpMask, (long long)cy0*wid, SEEK_SET);
+      ASF_FREAD(outMask, sizeof(Uchar), (cy1-cy0)*wid, fpMask);
+      for (y = 0; y < cy1-cy0; y++) {
+        for (x = 0; x < wid; x++) {
+          int k = y*wid + x;
+          t = ty*run.ntx + x/T;
+          if (!(outMask[k] & INTEGRATED))
+            continue;
+          if (!linked[t]) {
+            outLines[k] = 0.0;
+            outMask[k] &= NOT_INTEGRATED;
+          }
+          else
+            outLines[k] += TWOPI*offset[t];
+        }
+      }
+      put_float_lines(fpOut, meta, cy0, cy1-cy0, outLines);
+      FSEEK64(fpMask, (long long)cy0*wid, SEEK_SET);
+      ASF_FWRITE(outMask, sizeof(Uchar), (cy1-cy0)*wid, fpMask);
+    }
+    FCLOSE(fpOut);
+    FCLOSE(fpMask);
+  }
+
+  asfPrintStatus("\n   %9lld residues   %7.3f %%\n", totResidues,
+		 100.0*(double)totResidues/((double)wid*len));
+  asfPrintStatus("   %9lld unwrapped  %7.3f %%\n", totInteg,
+		 100.0*(double)totInteg/((double)wid*len));
+  asfPrintStatus("   %lld of %d tiles tied together along %d of %d seams\n\n",
+		 totLinked, nTiles, nUsed, nSeams);
+
+  // Clean up
+  if (run.cordon) FREE(run.cordon);
+  FREE(run.band);
+  FREE(run.row);
+  FREE(run.nResidues);
+  FREE(above);
+  FREE(seams);
+  FREE(nInteg);
+  FREE(offset);
+  FREE(linked);
+  FREE(outLines);
+  FREE(outMask);
+  meta_free(meta);
 
   return(0);
 }
@@ -1018,10 +1018,11 @@ int write_config(char *configFile, dem_config *cfg)
     fprintf(fConfig, "[Phase unwrapping]\n");
     if (!shortFlag)
       fprintf(fConfig, "\n# Name of the phase unwrapping algorithm used.\n"
-	      "# Currently two phase unwrapping algorithms are supported. 'escher' is an\n"
-	      "# implementation of Goldstein's branch cut algorithm. 'snaphu' has been\n"
-	      "# developed and is distributed by Stanford University. It uses a minimum\n"
-	      "# cost flow network.\n\n");
+	      "# Currently three phase unwrapping algorithms are supported. 'escher' is an\n"
+	      "# implementation of Goldstein's branch cut algorithm. 'escher_tiled'\n"
+	      "# runs the same algorithm tile by tile, for images too large to unwrap\n"
+	      "# in one piece. 'snaphu' has been developed and is distributed by\n"
+	      "# Stanford University. It uses a minimum cost flow network.\n\n");
     fprintf(fConfig, "algorithm = %s\n", cfg->unwrap->algorithm);
     if (!shortFlag)
       fprintf(fConfig, "\n# This parameters defines whether a topographic phase based on\n"
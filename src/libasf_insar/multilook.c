@@ -1,31 +1,89 @@
+#include <pthread.h>
+
 #include "asf.h"
 #include "asf_meta.h"
 #include "asf_export.h"
+#include "asf_insar.h"
 #include "ifm.h"
 
 /* local constants */
 #define VERSION 4.0
 
+static float Sin[256], Cos[256];
+
+static void build_tables(void)
+{
+  int i;
+  for (i=0;i<256;i++) {
+    float phas=((float)i)/256.0*(2*3.14159265358979);
+    Sin[i]=sin(phas);
+    Cos[i]=cos(phas);
+  }
+}
+
+// Build the sine and cosine tables on first use.  Safe to call from
+// several threads.
+static void init_tables(void)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, build_tables);
+}
+
+// Multilook look_line consecutive lines of amplitude and phase (ns samples
+// each) into one line of ns samples.  rgb gets the phase folded into
+// [0,pi), times scale (if not NULL) -- the values colorized for the
+// interferogram browse image.  ml_amp and rgb may be NULL.
+void multilook_phase_line(const float *amp, const float *phase, int ns,
+                          int look_line, const float *scale,
+                          float *ml_amp, float *ml_phase, float *rgb)
+{
+  const float convers=256.0/(2*3.14159265358979);
+  float ampScale = 1.0/look_line;
+  int sample, row;
+  complexFloat z;
+
+  init_tables();
+
+  for (sample=0; sample<ns; sample++) {
+    float zReal=0.0, zImag=0.0;
+    int offset=sample;
+    // Add up looking area
+    for (row=0; row<look_line; row++) {
+      float ampI = amp[offset];
+      int index = 0xFF&((int)(phase[offset]*convers));
+      zReal += ampI * Cos[index];
+      zImag += ampI * Sin[index];
+      offset += ns;
+    }
+
+    // Get phase from complex values
+    z.real = zReal;
+    z.imag = zImag;
+    if (ml_amp)
+      ml_amp[sample] = Cabs(z)*ampScale;
+    ml_phase[sample] = Cphase(z);
+    if (rgb) {
+      float s = scale ? scale[sample] : 1.0;
+      if (ml_phase[sample] < 0.0)
+        rgb[sample] = (ml_phase[sample] + M_PI) * s;
+      else
+        rgb[sample] = ml_phase[sample] * s;
+    }
+  }
+}
+
 int asf_insar_multilook(char *inFile, char *outFile, char *metaFile, char *overlay)
 {
   meta_parameters *metaIn, *metaOut;
   char inAmp[255], inPhase[255], outAmp[255], outPhase[255], outRGB[255];
   FILE *fpAmpIn, *fpPhaseIn, *fpAmpOut, *fpPhaseOut, *fpRGB, *fpOverlay;
-  int look_line, look_sample, step_line, step_sample, i,line, sample, row, col;
-  long long nitems, newitems, in_sample_count, in_line_count, out_sample_count;
-  long long out_line_count, ds;
-  register float *ampIn, *phaseIn, ampScale;
-  float *ampOut, *phaseOut, *rgb, *scaleIn, Sin[256],Cos[256], scale;
-  complexFloat z;
-  register float tmp,zImag,zReal,ampI;
-  register int index,offset;
-  const float convers=256.0/(2*3.14159265358979);
+  int look_line, step_line, line;
+  long long in_sample_count, in_line_count, out_sample_count, out_line_count;
+  float *ampIn, *phaseIn, *ampOut, *phaseOut, *rgb, *scaleIn=NULL;
   
   // Create filenames and open files for reading
   create_name(inAmp, inFile, "_amp.img");
   create_name(inPhase, inFile, "_phase.img");
-  metaIn = meta_read(inPhase);
-  metaOut = meta_read(inPhase);
   // FIXME: Should write out two-banded file. Too much to fix in the rest of
   //        the unwrapping code. Leaving that for clean up after the course.
   create_name(outAmp, outFile, "_amp.img");
@@ -35,11 +93,12 @@ int asf_insar_multilook(char *inFile, char *outFile, char *metaFile, char *overl
   metaOut = meta_read(inFile);
 
   // Create new metadata file for the amplitude and phase.
-  look_sample = step_sample = 1;
-  look_line = step_line = metaOut->sar->look_count;  
+  look_line = step_line = metaOut->sar->azimuth_look_count;  
+  if (look_line < 1)
+    asfPrintError("Invalid azimuth look count (%d) in %s\n",
+                  look_line, inFile);
   in_sample_count = metaIn->general->sample_count;
   in_line_count = metaIn->general->line_count;
-  metaOut->general->sample_count /= step_sample;
   metaOut->general->line_count /= step_line;
   out_sample_count = metaOut->general->sample_count;
   out_line_count = metaOut->general->line_count;
@@ -47,11 +106,9 @@ int asf_insar_multilook(char *inFile, char *outFile, char *metaFile, char *overl
   metaOut->sar->line_increment = 1;
   metaOut->sar->sample_increment = 1;
   metaOut->sar->azimuth_time_per_pixel *= step_line;
-  metaOut->general->x_pixel_size *= step_sample;
   metaOut->general->y_pixel_size *= step_line;
   meta_write(metaOut, outAmp);
   meta_write(metaOut, outPhase);
-  //meta_write(metaOut, outFile);
   meta_write(metaOut, outRGB);
   
   // Open the files
@@ -59,31 +116,18 @@ int asf_insar_multilook(char *inFile, char *outFile, char *metaFile, char *overl
   fpPhaseIn = fopenImage(inPhase, "rb");
   fpAmpOut = fopenImage(outAmp, "wb");
   fpPhaseOut = fopenImage(outPhase, "wb");
-  //FILE *fpIn = fopenImage(inFile, "rb");
-  //FILE *fpOut = fopenImage(outFile, "wb");
   fpRGB = fopenImage(outRGB, "wb");
   if (overlay)
     fpOverlay = fopenImage(overlay, "rb");
   
-  for (i=0;i<256;i++) {
-    float phas=((float)i)/256.0*(2*3.14159265358979);
-    Sin[i]=sin(phas);
-    Cos[i]=cos(phas);
-  }
-  
   // Set data variables
-  ampScale = 1.0/(look_line*look_sample);
-  nitems   = (look_line-step_line)*in_sample_count;
-  newitems = step_line*in_sample_count;
-  
-  ds       = sizeof(float);
-  ampIn    = (float *)MALLOC(ds*(newitems+nitems+look_sample));
-  phaseIn  = (float *)MALLOC(ds*(newitems+nitems+look_sample));
+  ampIn    = (float *)MALLOC(sizeof(float)*look_line*in_sample_count);
+  phaseIn  = (float *)MALLOC(sizeof(float)*look_line*in_sample_count);
   if (overlay)
-    scaleIn  = (float *)MALLOC(ds*(newitems+nitems+look_sample));
-  ampOut   = (float *)MALLOC(ds*out_sample_count);
-  rgb      = (float *)MALLOC(ds*out_sample_count);
-  phaseOut = (float *)MALLOC(ds*out_sample_count);
+    scaleIn  = (float *)MALLOC(sizeof(float)*out_sample_count);
+  ampOut   = (float *)MALLOC(sizeof(float)*out_sample_count);
+  rgb      = (float *)MALLOC(sizeof(float)*out_sample_count);
+  phaseOut = (float *)MALLOC(sizeof(float)*out_sample_count);
   
   // Let the user know what's happening  
   asfPrintStatus("Input is %lld lines by %lld samples\n",
@@ -96,58 +140,18 @@ int asf_insar_multilook(char *inFile, char *outFile, char *metaFile, char *overl
     
     get_float_lines(fpAmpIn, metaIn, line*step_line, look_line, ampIn);
     get_float_lines(fpPhaseIn, metaIn, line*step_line, look_line, phaseIn);
-    //get_band_float_lines(fpIn, metaIn, 0, line*step_line, look_line, ampIn);
-    //get_band_float_lines(fpIn, metaIn, 1, line*step_line, look_line, 
-    //			 phaseIn);
     if (overlay)
       get_float_lines(fpOverlay, metaOut, line, 1, scaleIn);
     
-    // Begin adding data
-    for (sample=0; sample<out_sample_count; sample++) { 
-      tmp = 0.0, zReal=0.0, zImag=0.0;
-      // Add up looking area
-      for (col=0; col<look_sample; col++) {
-	offset=sample*step_sample+col;
-	for (row=0; row<look_line; row++) {
-	  ampI = ampIn[offset];
-	  index = 0xFF&((int)(phaseIn[offset]*convers));
-	  tmp += ampI * ampI;
-	  zReal += ampI * Cos[index];
-	  zImag += ampI * Sin[index];
-	  offset += in_sample_count;
-	}
-      }
-      
-      // Get phase from complex values
-      z.real = zReal;
-      z.imag = zImag;
-
-      ampOut[sample] = Cabs(z)*ampScale; 
-      phaseOut[sample] = Cphase(z);
-      if (overlay)
-	scale = scaleIn[sample];
-      else
-	scale = 1.0;
-      if (phaseOut[sample] < 0.0)
-	rgb[sample] = (phaseOut[sample] + M_PI) * scale;
-      else
-	rgb[sample] = phaseOut[sample] * scale;
-    }
+    multilook_phase_line(ampIn, phaseIn, in_sample_count, look_line, scaleIn,
+			 ampOut, phaseOut, rgb);
     
     // Write out data to file
-    //put_band_float_line(fpOut, metaOut, 0, line, ampOut);
-    //put_band_float_line(fpOut, metaOut, 1, line, phaseOut);
     put_float_line(fpAmpOut, metaOut, line, ampOut);
     put_float_line(fpPhaseOut, metaOut, line, phaseOut);
     put_float_line(fpRGB, metaOut, line, rgb);
     
     asfLineMeter(line, out_line_count);
-        
-    // Reposition data for next read
-    for (i=0;i<nitems;i++) {
-      ampIn[i] = ampIn[i + newitems];
-      phaseIn[i] = phaseIn[i + newitems];
-    }
   }
   
   // Clean up
@@ -164,8 +168,6 @@ int asf_insar_multilook(char *inFile, char *outFile, char *metaFile, char *overl
   FCLOSE(fpPhaseIn);
   FCLOSE(fpAmpOut);
   FCLOSE(fpPhaseOut);
-  //FCLOSE(fpIn);
-  //FCLOSE(fpOut);
   FCLOSE(fpRGB);
   
   meta_free(metaIn);
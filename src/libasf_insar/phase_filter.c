@@ -1,5 +1,8 @@
+#include <pthread.h>
+
 #include "asf.h"
 #include "asf_meta.h"
+#include "asf_insar.h"
 #include "fft.h"
 #include "fft2d.h"
 
@@ -33,7 +36,8 @@ Filter sizes:
 void blendData(complex **chunks,complex **last_chunks,
         float *weight,float *outBuf);
 
-int nl,ns;
+/*Output number of lines and samples, rounded up to whole output chunks.*/
+static int nl,ns;
 
 /***********************************************
 blendHoriz, blendVert:
@@ -190,10 +194,6 @@ void blendData(complex **chunks,complex **last_chunks,
   }
 }
 
-void image_filter(FILE *in, meta_parameters *meta,
-		  FILE *out, double strength);
-
-/* FIXME: result comes in short - calling the command line tool for the moment
 int phase_filter(char *inFile, double strength, char *outFile)
 {
   FILE *fpIn, *fpOut;
@@ -204,21 +204,19 @@ int phase_filter(char *inFile, double strength, char *outFile)
   fpOut = fopenImage(outFile, "wb");
   meta = meta_read(inFile);
   
-  // Round up to find image size which is an even number of output chunks..
-  ns = (meta->general->sample_count+ox-1)/ox*ox;
-  nl = (meta->general->line_count+oy-1)/oy*oy;
-  asfPrintStatus("Output Size: %d samples by %d lines\n\n", ns, nl);
-  
   // Set up output file
   meta_write(meta, outFile);
   
   // Perform the filtering, write out
-  fft2dInit(dMy, dMx);
-  image_filter(fpIn, meta, fpOut, strength);
+  phase_filter_image(fpIn, meta, fpOut, strength);
+
+  // The output is only complete once it is closed
+  FCLOSE(fpIn);
+  FCLOSE(fpOut);
+  meta_free(meta);
   
   return (0);
 }
-*/
 
 /**************************************************
  read_image: reads the image file given by in & ddr
@@ -233,6 +231,8 @@ void read_image(FILE *in,meta_parameters *meta, float *dest,
   int stopY=delY, stopX=delX;
   if ((stopY+startY) > meta->general->line_count)
     stopY = meta->general->line_count - startY;
+  if (stopY < 0)
+    stopY = 0;
   if ((stopX+startX) > meta->general->sample_count)
     stopX = meta->general->sample_count - startX;
   /*Read portion of input image into topleft of dest array.*/
@@ -262,9 +262,12 @@ between 1.2 and 1.7.  Larger strengths filter noise
 better, but eliminate more good information, too.
 Huge scalings, like 2.0 or 3.0, result in very geometric-
 looking phase.
+
+work is FFT2D_WORK_SIZE(dMy) floats of scratch space for the FFTs, so
+that several chunks can be filtered at once by different threads.
 */
 
-void phase_filter_func(complex *buf,float strength)
+void phase_filter_func(complex *buf,float strength,float *work)
 {
   register int x,y;
   
@@ -279,7 +282,7 @@ void phase_filter_func(complex *buf,float strength)
   float adjStrength=(strength-1)/2;
   
   /*fft buf*/
-  fft2d((float *)buf,dMy,dMx);	
+  fft2d_work((float *)buf, dMy, dMx, work);
   
   /*Manipulate power spectrum.*/
   for (y=0; y<dy; y++) {
@@ -293,11 +296,115 @@ void phase_filter_func(complex *buf,float strength)
   }
 	
   /*ifft buf*/
-  ifft2d((float *)buf, dMy, dMx);
+  ifft2d_work((float *)buf, dMy, dMx, work);
+}
+
+/************************************************************
+strip_reader:
+	Reads the input image one strip (dy lines) at a time in a
+background thread, so the next strip is being read while the
+current one is filtered.  Consecutive strips overlap by oy lines;
+the overlapping half is copied over from the previous strip rather
+than read from the file again.
+*/
+typedef struct {
+  FILE *in;
+  meta_parameters *meta;
+  int nStrips;
+  float *strip[2];       /* Strip k lives in strip[k%2]*/
+  int produced;          /* Number of strips read so far*/
+  int consumed;          /* Number of strips the filter is done with*/
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+} strip_reader;
+
+static void *strip_reader_thread(void *data)
+{
+  strip_reader *r = (strip_reader *)data;
+  int k;
+
+  for (k=0; k<r->nStrips; k++) {
+    float *dest = r->strip[k%2];
+
+    /*Wait until the filter is done with the strip in this slot.*/
+    pthread_mutex_lock(&r->lock);
+    while (k - r->consumed >= 2)
+      pthread_cond_wait(&r->cond, &r->lock);
+    pthread_mutex_unlock(&r->lock);
+
+    if (k == 0)
+      read_image(r->in, r->meta, dest, 0, 0, ns, dy);
+    else {
+      memcpy(dest, &r->strip[(k-1)%2][oy*ns], sizeof(float)*ns*oy);
+      read_image(r->in, r->meta, &dest[oy*ns], 0, k*oy+oy, ns, dy-oy);
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->produced = k+1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+  }
+  return NULL;
+}
+
+/*Wait for strip k to be read, and return it.*/
+static float *strip_reader_get(strip_reader *r, int k)
+{
+  pthread_mutex_lock(&r->lock);
+  while (r->produced <= k)
+    pthread_cond_wait(&r->cond, &r->lock);
+  pthread_mutex_unlock(&r->lock);
+  return r->strip[k%2];
+}
+
+/*The filter is done with the oldest strip; its slot may be reused.*/
+static void strip_reader_release(strip_reader *r)
+{
+  pthread_mutex_lock(&r->lock);
+  r->consumed++;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/*Work for the threads filtering the chunks of one strip.*/
+typedef struct {
+  float *inBuf;
+  complex **chunks;
+  complex *p2c;
+  float strength;
+} filter_job;
+
+#define NUM_PHASE 512
+
+/*asf_parallel_fn: convert chunks [start,end) of the strip to complex,
+and filter them.*/
+static void filter_chunks(int start, int end, void *data)
+{
+  filter_job *job = (filter_job *)data;
+  float work[FFT2D_WORK_SIZE(dMy)];
+  float polarCvrt = NUM_PHASE/(2*PI);
+  complex *p2c = job->p2c;
+  int chunkX,x,y;
+
+#define phase2cpx(ph) p2c[(int)((ph)*polarCvrt)&(NUM_PHASE-1)]
+  for (chunkX=start; chunkX<end; chunkX++) {
+    /*Convert polar image to complex chunk.*/
+    for (y=0; y<dy; y++) {
+      register float *in = &job->inBuf[y*ns+chunkX*ox];
+      register complex *out = &job->chunks[chunkX][y*dx];
+      for (x=0; x<dx; x++)
+        *out++=phase2cpx(*in++);
+    }
+
+    /*Filter the chunk.*/
+    phase_filter_func(job->chunks[chunkX], job->strength, work);
+  }
+#undef phase2cpx
 }
 
 /************************************************************
-image_filter: 
+phase_filter_image: 
 	Applies the goldstein phase filter across an entire
 image, and writes the result to another image.
 
@@ -306,21 +413,33 @@ to little pieces of the image.  But processing the image as
 a bunch of little pieces results in a segmented phase image.
 Hence we do a bilinear weighting of 4 overlapping filters 
 to "feather" the edges.
+
+	The chunks of each strip are independent of each other,
+so they are filtered in parallel (see asf_parallel_for), while
+a reader thread fetches the next strip.  Blending is unchanged,
+so the output does not depend on the number of threads.
 */
 
-void image_filter(FILE *in, meta_parameters *meta,
-		  FILE *out, double strength)
+void phase_filter_image(FILE *in, meta_parameters *meta,
+			FILE *out, double strength)
 {
   int chunkX,chunkY,nChunkX,nChunkY;
   int i,x,y;
-  float *inBuf, *outBuf, *weight;
+  float *outBuf, *weight;
   complex **chunks, **last_chunks=NULL;
+  complex *p2c;
+  strip_reader reader;
+  filter_job job;
   
+  /*Round up to find image size which is an even number of output chunks.*/
+  ns = (meta->general->sample_count+ox-1)/ox*ox;
+  nl = (meta->general->line_count+oy-1)/oy*oy;
+  asfPrintStatus("   Output Size: %d samples by %d lines\n\n", ns, nl);
+
+  /*Build the (shared, read-only) FFT tables before any threads start.*/
+  fft2dInit(dMy, dMx);
+
   /*Allocate polar to complex conversion array*/
-#define NUM_PHASE 512
-#define phase2cpx(ph) p2c[(int)((ph)*polarCvrt)&(NUM_PHASE-1)]
-  complex *p2c;
-  float polarCvrt = NUM_PHASE/(2*PI);
   p2c = (complex *) MALLOC(sizeof(complex)*NUM_PHASE);
   for (i=0; i<NUM_PHASE; i++) {
       float phase = i*2*PI/NUM_PHASE;
@@ -337,37 +456,37 @@ void image_filter(FILE *in, meta_parameters *meta,
   /*Allocate storage arrays.*/
   nChunkX = ns/ox-1;
   nChunkY = nl/oy-1;
-  outBuf = inBuf = (float *)MALLOC(sizeof(float)*ns*dy);
+  outBuf = (float *)MALLOC(sizeof(float)*ns*oy);
 #define newChunkArray(name) name=(complex **)MALLOC(sizeof(complex **)*nChunkX); \
 			for (chunkX=0;chunkX<nChunkX;chunkX++) \
 				name[chunkX]=(complex *)MALLOC(sizeof(complex)*dx*dy);
   newChunkArray(chunks);
+
+  /*Start reading strips.*/
+  reader.in = in;
+  reader.meta = meta;
+  reader.nStrips = nChunkY;
+  reader.strip[0] = (float *)MALLOC(sizeof(float)*ns*dy);
+  reader.strip[1] = (float *)MALLOC(sizeof(float)*ns*dy);
+  reader.produced = reader.consumed = 0;
+  pthread_mutex_init(&reader.lock, NULL);
+  pthread_cond_init(&reader.cond, NULL);
+  if (pthread_create(&reader.thread, NULL, strip_reader_thread, &reader) != 0)
+    asfPrintError("Could not start the phase filter's reader thread.\n");
+
+  job.p2c = p2c;
+  job.strength = strength;
   
-  /*Loop across each chunk in file.
-    printf("Filtering phase in %d x %d blocks...\n",dx,dy);
-    printf("Output phase in %d x %d blocks...\n",ox,oy);*/
+  /*Loop across each strip of chunks in file.*/
   for (chunkY=0; chunkY<nChunkY; chunkY++) {
 
     asfLineMeter(chunkY, nChunkY);
     
-    /*Read next chunk of input.*/
-    read_image(in, meta, inBuf, 0, chunkY*ox, ns, dy);
-    
-    /*Convert polar image to complex chunk.*/
-    for (chunkX=0; chunkX<nChunkX; chunkX++) {
-	register float *in;
-	register complex *out;
-	for (y=0; y<dy; y++) {
-	  in = &inBuf[y*ns+chunkX*ox];
-	  out = &chunks[chunkX][y*dx];
-	  for (x=0;x<dx;x++)
-	    *out++=phase2cpx(*in++);
-	}
-    }
-    
-    /*Filter each newly-read chunk.*/
-    for (chunkX=0; chunkX<nChunkX; chunkX++)
-      phase_filter_func(chunks[chunkX], strength);
+    /*Convert and filter each chunk of the next strip.*/
+    job.inBuf = strip_reader_get(&reader, chunkY);
+    job.chunks = chunks;
+    asf_parallel_for(nChunkX, 4, filter_chunks, &job);
+    strip_reader_release(&reader);
 	
     /*Blend and write out filtered data.*/
     blendData(chunks, last_chunks, weight, outBuf);
@@ -386,11 +505,25 @@ void image_filter(FILE *in, meta_parameters *meta,
   for (y=0; y<oy; y++)
     if (chunkY*oy+y < meta->general->line_count)
       put_float_line(out, meta, chunkY*oy+y, &outBuf[y*ns]);
-  
+
+  pthread_join(reader.thread, NULL);
+  pthread_cond_destroy(&reader.cond);
+  pthread_mutex_destroy(&reader.lock);
+  FREE(reader.strip[0]);
+  FREE(reader.strip[1]);
+  for (chunkX=0; chunkX<nChunkX; chunkX++) {
+    FREE(chunks[chunkX]);
+    if (last_chunks)
+      FREE(last_chunks[chunkX]);
+  }
+  FREE(chunks);
+  if (last_chunks)
+    FREE(last_chunks);
+  FREE(outBuf);
+  FREE(weight);
+  FREE(p2c);
 }
 
-/* FIXME: does not perform properly - call command line and clean up after
-          course.
 int zeroify(char *inFile, char *testFile, char *outFile)
 {
   float *buf, *testbuf;
@@ -425,6 +558,13 @@ int zeroify(char *inFile, char *testFile, char *outFile)
     put_float_line(fpOut, metaIn, y ,buf);
   }
 
+  FCLOSE(fpIn);
+  FCLOSE(fpTest);
+  FCLOSE(fpOut);
+  FREE(buf);
+  FREE(testbuf);
+  meta_free(metaIn);
+  meta_free(metaTest);
+
   return 0;
 }
-*/
@@ -204,6 +204,30 @@ int resample_to_square_pixsiz(const char *infile, const char *outfile,
 int resample_to_pixsiz_nn(const char *infile, const char *outfile,
                           double xpixsiz, double ypixsiz);
 
+/* Prototypes from box_filter.c **********************************************/
+typedef void box_read_fn(int line, float *buf, void *data);
+typedef struct {
+  int ns;                 /* samples per line */
+  int max_lines;          /* size of the ring buffer */
+  float *lines;           /* ring buffer of max_lines lines */
+  int head;               /* slot of the first line */
+  int first, count;       /* lines [first,first+count) are in the window */
+  int pushes;             /* lines read since the last reset */
+  double *sum;            /* per column: sum of the finite non-zero values */
+  int *valid;             /*   number of non-zero values */
+  int *bad;               /*   number of non-finite values */
+  double *psum;           /* prefix sums of the above, ns+1 each */
+  int *pvalid, *pbad;
+} box_window;
+box_window *box_window_new(int ns, int max_lines);
+void box_window_free(box_window *w);
+void box_window_reset(box_window *w, int first);
+float *box_window_line(box_window *w, int line);
+void box_window_move(box_window *w, int start, int end,
+                     box_read_fn *read_line, void *data);
+void box_window_prefix(box_window *w);
+float box_window_mean(box_window *w, int lo, int hi);
+
 /* Prototypes from smooth.c **************************************************/
 int smooth(const char *infile, const char *outfile, int kernel_size,
            edge_strategy_t edge_strategy);
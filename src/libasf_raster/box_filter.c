@@ -0,0 +1,171 @@
+/*******************************************************************
+   Running-sum box filtering, shared by resample() and smooth().
+
+   A box_window holds the lines [first, first+count) of an image in a
+   ring buffer, together with the sum and number of the non-zero values
+   in each column of the window (zero is "no data" and is left out of
+   the mean).  Moving the window down only adds the lines coming in and
+   subtracts the lines going out, and box_window_prefix() turns the
+   column sums into prefix sums, so that the mean over any range of
+   columns costs the same whatever the kernel size.
+
+   Non-finite values would never leave a running sum, so they are
+   counted separately, and a mean over a range that contains any is
+   computed directly from the lines in the window.
+*******************************************************************/
+#include <math.h>
+
+#include "asf.h"
+#include "asf_raster.h"
+
+box_window *box_window_new(int ns, int max_lines)
+{
+  box_window *w = (box_window *) MALLOC(sizeof(box_window));
+  w->ns = ns;
+  w->max_lines = max_lines;
+  w->lines = (float *) MALLOC(sizeof(float)*ns*max_lines);
+  w->sum = (double *) MALLOC(sizeof(double)*ns);
+  w->valid = (int *) MALLOC(sizeof(int)*ns);
+  w->bad = (int *) MALLOC(sizeof(int)*ns);
+  w->psum = (double *) MALLOC(sizeof(double)*(ns+1));
+  w->pvalid = (int *) MALLOC(sizeof(int)*(ns+1));
+  w->pbad = (int *) MALLOC(sizeof(int)*(ns+1));
+  box_window_reset(w, 0);
+  return w;
+}
+
+void box_window_free(box_window *w)
+{
+  FREE(w->lines);
+  FREE(w->sum);
+  FREE(w->valid);
+  FREE(w->bad);
+  FREE(w->psum);
+  FREE(w->pvalid);
+  FREE(w->pbad);
+  FREE(w);
+}
+
+// Empty the window, positioning it at the given line.
+void box_window_reset(box_window *w, int first)
+{
+  int x;
+  w->first = first;
+  w->count = 0;
+  w->head = 0;
+  w->pushes = 0;
+  for (x=0; x<w->ns; x++) {
+    w->sum[x] = 0.0;
+    w->valid[x] = w->bad[x] = 0;
+  }
+}
+
+// Line of the image in the window (first <= line < first+count).
+float *box_window_line(box_window *w, int line)
+{
+  int slot = (w->head + line - w->first) % w->max_lines;
+  return w->lines + (long)slot*w->ns;
+}
+
+static void add_line(box_window *w, const float *line, int sign)
+{
+  int x;
+  for (x=0; x<w->ns; x++) {
+    float v = line[x];
+    if (v != 0) {
+      if (!isfinite(v))
+        w->bad[x] += sign;
+      else
+        w->sum[x] += sign*v;
+      w->valid[x] += sign;
+    }
+  }
+}
+
+// Recompute the column sums from scratch, so that rounding errors in the
+// running sums cannot build up over a whole image.
+static void resum(box_window *w)
+{
+  int ii, x;
+  for (x=0; x<w->ns; x++) {
+    w->sum[x] = 0.0;
+    w->valid[x] = w->bad[x] = 0;
+  }
+  for (ii=0; ii<w->count; ii++)
+    add_line(w, box_window_line(w, w->first + ii), 1);
+}
+
+// Move the window to lines [start,end).  Lines coming into the window
+// are read with read_line(line, buf, data).
+void box_window_move(box_window *w, int start, int end,
+                     box_read_fn *read_line, void *data)
+{
+  if (end - start > w->max_lines)
+    asfPrintError("box_window_move: %d lines do not fit in a window of %d\n",
+                  end - start, w->max_lines);
+
+  // Nothing in common with the current window: start over
+  if (w->count == 0 || start >= w->first + w->count || start < w->first)
+    box_window_reset(w, start);
+
+  while (w->first < start) {
+    add_line(w, box_window_line(w, w->first), -1);
+    w->head = (w->head + 1) % w->max_lines;
+    w->first++;
+    w->count--;
+  }
+
+  while (w->first + w->count < end) {
+    int line = w->first + w->count;
+    float *buf = w->lines +
+      (long)((w->head + w->count) % w->max_lines)*w->ns;
+    read_line(line, buf, data);
+    w->count++;
+    add_line(w, buf, 1);
+    if (++w->pushes % w->max_lines == 0)
+      resum(w);
+  }
+}
+
+// Prefix sums over the columns, for box_window_mean().
+void box_window_prefix(box_window *w)
+{
+  int x;
+  w->psum[0] = 0.0;
+  w->pvalid[0] = w->pbad[0] = 0;
+  for (x=0; x<w->ns; x++) {
+    w->psum[x+1] = w->psum[x] + w->sum[x];
+    w->pvalid[x+1] = w->pvalid[x] + w->valid[x];
+    w->pbad[x+1] = w->pbad[x] + w->bad[x];
+  }
+}
+
+// Mean of the non-zero values in columns [lo,hi] (clipped to the image)
+// of all the lines in the window; zero if there are none.
+float box_window_mean(box_window *w, int lo, int hi)
+{
+  if (lo < 0) lo = 0;
+  if (hi > w->ns-1) hi = w->ns-1;
+  if (hi < lo)
+    return 0.0;
+
+  if (w->pbad[hi+1] - w->pbad[lo] > 0) {
+    float kersum = 0.0;
+    int total = 0, ii, x;
+    for (ii=0; ii<w->count; ii++) {
+      float *line = box_window_line(w, w->first + ii);
+      for (x=lo; x<=hi; x++) {
+        if (line[x] != 0) {
+          kersum += line[x];
+          total++;
+        }
+      }
+    }
+    return total ? kersum/(float)total : kersum;
+  }
+
+  int total = w->pvalid[hi+1] - w->pvalid[lo];
+  if (total == 0)
+    return 0.0;
+  return (float)((w->psum[hi+1] - w->psum[lo]) / total);
+}
@@ -4,6 +4,15 @@
 #define _EXPRESSION_H_
 
 char *expression2cookie(const char *expr,int nvars);
+
+/* Evaluate a cookie from expression2cookie for one pixel.  variables[] is
+   indexed by letter: variables[0] is a (input [1]), ..., variables[22] is
+   w (input [23]), and variables['x'-'a'] and variables['y'-'a'] are the
+   pixel's position.  Inputs past w, which can only be written [24],
+   [25], ..., come after the 26 letters: input [N] is variables[N+2].  So
+   for nvars inputs, variables[] must hold 26 values, plus nvars-23 if
+   nvars > 23. */
+#define EXPR_LETTER_VARS 26
 double evaluate(char *cookie,const double *variables);
 
 /* Internal Variables.*/
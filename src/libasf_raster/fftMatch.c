@@ -1,6 +1,7 @@
 #include "asf.h"
 #include "asf_meta.h"
 #include <math.h>
+#include <pthread.h>
 #include "fft.h"
 #include "fft2d.h"
 #include "asf_raster.h"
@@ -242,41 +243,6 @@ static int mini(int a, int b)
   return a<b ? a : b;
 }
 
-static int fftMatchBF(char *file1, char *file2, float *dx, float *dy, float *cert, double tol)
-{
-  int qf_saved = quietflag;
-  quietflag = TRUE;
-  int ok = FALSE;
-
-  float dx1=0, dx2=0, dy1=0, dy2=0, cert1=0, cert2=0;
-  fftMatch(file1, file2, NULL, &dx1, &dy1, &cert1);
-  if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<tol) {
-    *dx = *dy = *cert = 0;
-  }
-  else {
-    fftMatch(file2, file1, NULL, &dx2, &dy2, &cert2);
-    if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<tol) {
-      *dx = *dy = *cert = 0;
-    }
-    else if (fabs(dx1 + dx2) > .25 || fabs(dy1 + dy2) > .25) {
-      *dx = *dy = *cert = 0;
-    }
-    else {
-      *dx = (dx1 - dx2) * 0.5;
-      *dy = (dy1 - dy2) * 0.5;
-      *cert = cert1 < cert2 ? cert1 : cert2; 
-      ok = TRUE;
-    }
-  }
-
-  quietflag = qf_saved;
-  //asfPrintStatus("Result %s:\n"
-  //               "dx1=%8.2f dy1=%8.2f cert=%f\n"
-  //               "dx2=%8.2f dy2=%8.2f cert=%f\n", ok?"Yes":"No", dx1, dy1, cert1, dx2, dy2, cert2);
-
-  return ok; 
-}
-
 typedef struct offset_point {
   int x_pos;
   int y_pos;
@@ -415,6 +381,197 @@ static void print_matches(offset_point_t *matches, int num_x, int num_y, FILE *f
   fprintf(fp, "Total Average Offset: %8.3f\n", avg);
 }
 
+/* In-memory tile matching for fftMatch_gridded.
+
+   fftMatch_gridded used to trim() each pair of tiles out to disk and run
+   fftMatchBF() on the chips.  Now a strip of tile rows is read from both
+   images at once, and the tiles of the strip are matched concurrently
+   (see asf_parallel_for) straight from memory.  The correlation is the
+   same one fftMatch() computes for a size x size chip.  Each worker takes
+   a tile_matcher (FFT work array and correlation buffers) from a small
+   pool, so the buffers are allocated once per thread, not once per tile. */
+
+typedef struct {
+  float *in1, *in2;   /* nl x ns correlation buffers */
+  float *work;        /* FFT2D_WORK_SIZE(mY) column storage */
+} tile_matcher;
+
+typedef struct {
+  int size;                     /* tile size */
+  int ns, nl, mX, mY;           /* FFT size, as in fftMatch() */
+  int chipX, chipY, chipDX, chipDY, searchX, searchY;
+  double tol;
+
+  /* current strip of tile_y..tile_y+size-1 lines from each image */
+  float *strip1, *strip2;
+  int ns1, ns2;                 /* line widths of the strips */
+  int tile_y;
+  int size_x, overlap_x;        /* tile_x spacing and limit */
+  int img_ns;
+  offset_point_t *row;          /* results for the tiles of this strip */
+
+  pthread_mutex_t pool_lock;
+  tile_matcher **pool;
+  int n_free;
+} grid_job;
+
+static tile_matcher *take_matcher(grid_job *job)
+{
+  tile_matcher *m = NULL;
+  pthread_mutex_lock(&job->pool_lock);
+  if (job->n_free > 0)
+    m = job->pool[--job->n_free];
+  pthread_mutex_unlock(&job->pool_lock);
+
+  if (!m) {
+    m = MALLOC(sizeof(tile_matcher));
+    m->in1 = MALLOC(sizeof(float)*job->ns*job->nl);
+    m->in2 = MALLOC(sizeof(float)*job->ns*job->nl);
+    m->work = MALLOC(sizeof(float)*FFT2D_WORK_SIZE(job->mY));
+  }
+  return m;
+}
+
+static void give_matcher(grid_job *job, tile_matcher *m)
+{
+  pthread_mutex_lock(&job->pool_lock);
+  job->pool[job->n_free++] = m;
+  pthread_mutex_unlock(&job->pool_lock);
+}
+
+/* Memory counterpart of readImage: src is a chip with line stride
+   src_ns.  Unusable pixels (NaN or huge) are taken as zero, so they come
+   out as add and are left out of the sum; the padding is zero. */
+static void readChip(const float *src, int src_ns,
+                     int startX, int startY, int delX, int delY,
+                     float add, float *sum, float *dest, int nl, int ns)
+{
+  const double maxval = ((double)MAXFLOAT) / ((double)ns*nl);
+  double tempSum=0;
+  int x,y;
+
+  for (y=0;y<delY;y++) {
+    const float *in = src + (long)src_ns*(startY+y) + startX;
+    float *out = dest + (long)ns*y;
+    for (x=0;x<delX;x++) {
+      if (fabs(in[x]) < maxval && meta_is_valid_double(in[x])) {
+        tempSum+=in[x];
+        out[x]=in[x]+add;
+      }
+      else
+        out[x]=add;
+    }
+    for (x=delX;x<ns;x++)
+      out[x]=0.0;
+  }
+  for (y=delY;y<nl;y++)
+    memset(dest + (long)ns*y, 0, sizeof(float)*ns);
+  if (sum)
+    *sum=(float)tempSum;
+}
+
+/* fftMatch() of two size x size chips held in memory. */
+static void matchChips(grid_job *job, tile_matcher *m,
+                       const float *master, int master_ns,
+                       const float *slave, int slave_ns,
+                       float *dx, float *dy, float *cert)
+{
+  int ns=job->ns, nl=job->nl;
+  float scaleFact=1.0/(job->chipDX*job->chipDY);
+  float *in1=m->in1, *in2=m->in2;
+  float aveChip, doubt;
+  int x,y,l;
+
+  /* Same steps as fftProd, but with the caller's buffers */
+  readChip(slave,slave_ns,job->chipX,job->chipY,job->chipDX,job->chipDY,
+           0.0,&aveChip,in2,nl,ns);
+  aveChip/=-(float)job->chipDY*job->chipDX;
+  for (y=0;y<job->chipDY;y++) {
+    l=ns*y;
+    for (x=0;x<job->chipDX;x++)
+      in2[l+x]=(in2[l+x]+aveChip)*scaleFact;
+  }
+  rfft2d_work(in2,job->mY,job->mX,m->work);
+
+  readChip(master,master_ns,0,0,MINI(job->size,ns),MINI(job->size,nl),
+           aveChip,NULL,in1,nl,ns);
+  rfft2d_work(in1,job->mY,job->mX,m->work);
+
+  for (y=0;y<nl;y++) {
+    l=ns*y;
+    for (x=(y<2)?1:0;x<ns/2;x++)
+      in2[l+2*x+1]*=-1.0;
+  }
+  rspect2dprod(in1,in2,in2,nl,ns);
+  for (y=0;y<4;y++) {
+    l=ns*y;
+    for (x=0;x<8;x++) in2[l+x]=0;
+    l=ns*(nl-1-y);
+    for (x=0;x<8;x++) in2[l+x]=0;
+  }
+  rifft2d_work(in2,job->mY,job->mX,m->work);
+
+  findPeak(in2,dx,dy,&doubt,nl,ns,
+           job->chipX,job->chipY,job->searchX,job->searchY);
+  *cert = 1-doubt;
+}
+
+/* fftMatchBF() of two chips held in memory. */
+static int matchChipsBF(grid_job *job, tile_matcher *m,
+                        const float *chip1, int ns1,
+                        const float *chip2, int ns2,
+                        float *dx, float *dy, float *cert)
+{
+  float dx1=0, dx2=0, dy1=0, dy2=0, cert1=0, cert2=0;
+  double tol = job->tol;
+
+  matchChips(job, m, chip1, ns1, chip2, ns2, &dx1, &dy1, &cert1);
+  if (!meta_is_valid_double(dx1) || !meta_is_valid_double(dy1) || cert1<tol) {
+    *dx = *dy = *cert = 0;
+    return FALSE;
+  }
+  matchChips(job, m, chip2, ns2, chip1, ns1, &dx2, &dy2, &cert2);
+  if (!meta_is_valid_double(dx2) || !meta_is_valid_double(dy2) || cert2<tol) {
+    *dx = *dy = *cert = 0;
+    return FALSE;
+  }
+  if (fabs(dx1 + dx2) > .25 || fabs(dy1 + dy2) > .25) {
+    *dx = *dy = *cert = 0;
+    return FALSE;
+  }
+  *dx = (dx1 - dx2) * 0.5;
+  *dy = (dy1 - dy2) * 0.5;
+  *cert = cert1 < cert2 ? cert1 : cert2;
+  return TRUE;
+}
+
+/* asf_parallel_fn: match tiles [start,end) of the current strip. */
+static void match_tiles(int start, int end, void *data)
+{
+  grid_job *job = (grid_job *)data;
+  tile_matcher *m = take_matcher(job);
+  int jj;
+
+  for (jj=start; jj<end; ++jj) {
+    int tile_x = jj*(job->size - job->overlap_x);
+    if (tile_x + job->size > job->img_ns)
+      tile_x = job->img_ns - job->size;
+
+    float dx, dy, cert;
+    int ok = matchChipsBF(job, m, job->strip1 + tile_x, job->ns1,
+                          job->strip2 + tile_x, job->ns2, &dx, &dy, &cert);
+    offset_point_t *p = &job->row[jj];
+    p->x_pos = tile_x;
+    p->y_pos = job->tile_y;
+    p->cert = cert;
+    p->x_offset = dx;
+    p->y_offset = dy;
+    p->valid = ok && cert>job->tol;
+  }
+
+  give_matcher(job, m);
+}
+
 int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
                      float *avgLocX, float *avgLocY, float *certainty,
                      int size, double tol, int overlap)
@@ -433,8 +590,6 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
   asfPrintStatus("Tile overlap is %d pixels\n", overlap);
   asfPrintStatus("Match tolerance is %.2f\n", tol);
 
-  long long lsz = (long long)size;
-
   int num_x = (ns - size) / (size - overlap);
   int num_y = (nl - size) / (size - overlap);
   int len = num_x*num_y;
@@ -443,6 +598,42 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
 
   offset_point_t *matches = MALLOC(sizeof(offset_point_t)*len); 
 
+  if (ns < size || nl < size)
+    asfPrintError("Images (%dx%d) are smaller than one tile (%dx%d)\n",
+                  nl, ns, size, size);
+
+  /* Chip geometry and FFT size, as fftMatch() would pick for a chip */
+  grid_job job;
+  job.size = size;
+  job.tol = tol;
+  job.mX = (int)(log((float)size)/log(2.0)+0.5);
+  job.mY = job.mX;
+  if (job.mX > 13) job.mX = 13;
+  if (job.mY > 15) job.mY = 15;
+  job.ns = 1<<job.mX;
+  job.nl = 1<<job.mY;
+  job.chipDX = MINI(size,job.ns)*3/4;
+  job.chipDY = MINI(size,job.nl)*3/4;
+  job.chipX = MINI(size,job.ns)/8;
+  job.chipY = MINI(size,job.nl)/8;
+  job.searchX = MINI(size,job.ns)*3/8;
+  job.searchY = MINI(size,job.nl)*3/8;
+  job.overlap_x = overlap;
+  job.img_ns = ns;
+  job.ns1 = meta1->general->sample_count;
+  job.ns2 = meta2->general->sample_count;
+  job.strip1 = MALLOC(sizeof(float)*job.ns1*size);
+  job.strip2 = MALLOC(sizeof(float)*job.ns2*size);
+  pthread_mutex_init(&job.pool_lock, NULL);
+  job.pool = MALLOC(sizeof(tile_matcher *)*asf_get_thread_count());
+  job.n_free = 0;
+
+  /* Build the (shared, read-only) FFT tables before any threads start */
+  fft2dInit(job.mY, job.mX);
+
+  FILE *fp1 = fopenImage(inFile1, "rb");
+  FILE *fp2 = fopenImage(inFile2, "rb");
+
   int ii, jj, kk=0, nvalid=0;
   for (ii=0; ii<num_y; ++ii) {
     int tile_y = ii*(size - overlap);
@@ -453,45 +644,39 @@ int fftMatch_gridded(char *inFile1, char *inFile2, char *gridFile,
     }
     for (jj=0; jj<num_x; ++jj) {
       int tile_x = jj*(size - overlap);
-      if (tile_x + size > ns) {
-        if (jj != num_x - 1)
-          asfPrintError("Bad tile_x: %d %d %d %d %d\n", jj, num_x, tile_x, size, ns);
-        tile_x = ns - size;
-      }
-      //asfPrintStatus("Matching tile starting at (L,S) (%d,%d)\n", tile_y, tile_x);
-      char trim_append[64];
-      sprintf(trim_append, "_chip_%05d_%05d", tile_y, tile_x);
-      char *trim_chip1 = appendToBasename(inFile1, trim_append);
-      char *trim_chip2 = appendToBasename(inFile2, trim_append);
-      trim(inFile1, trim_chip1, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      trim(inFile2, trim_chip2, (long long)tile_x, (long long)tile_y, lsz, lsz);
-      //char smooth_append[64];
-      //sprintf(smooth_append, "_smooth_chip_%05d_%05d", tile_x, tile_y);
-      //char *smooth_chip1 = appendToBasename(inFile1, smooth_append);
-      //smooth(trim_chip1, smooth_chip1, 3, EDGE_TRUNCATE);
-      float dx, dy, cert;
-      int ok = fftMatchBF(trim_chip1, trim_chip2, &dx, &dy, &cert, tol);
-      matches[kk].x_pos = tile_x;
-      matches[kk].y_pos = tile_y;
-      matches[kk].cert = cert;
-      matches[kk].x_offset = dx;
-      matches[kk].y_offset = dy;
-      matches[kk].valid = ok && cert>tol;
+      if (tile_x + size > ns && jj != num_x - 1)
+        asfPrintError("Bad tile_x: %d %d %d %d %d\n", jj, num_x, tile_x, size, ns);
+    }
+
+    get_float_lines(fp1, meta1, tile_y, size, job.strip1);
+    get_float_lines(fp2, meta2, tile_y, size, job.strip2);
+    job.tile_y = tile_y;
+    job.row = &matches[kk];
+    asf_parallel_for(num_x, 1, match_tiles, &job);
+
+    for (jj=0; jj<num_x; ++jj) {
       asfPrintStatus("%s: %5d %5d dx=%7.3f, dy=%7.3f, cert=%5.3f\n",
-                     matches[kk].valid?"GOOD":"BAD ", tile_y, tile_x, dx, dy, cert);
+                     matches[kk].valid?"GOOD":"BAD ", tile_y,
+                     matches[kk].x_pos, matches[kk].x_offset,
+                     matches[kk].y_offset, matches[kk].cert);
       if (matches[kk].valid) ++nvalid;
       ++kk;
-      //printf("%4.1f ", dx);
-      removeImgAndMeta(trim_chip1);
-      FREE(trim_chip1);
-      removeImgAndMeta(trim_chip2);
-      FREE(trim_chip2);
-      //unlink(smooth_chip1);
-      //FREE(smooth_chip1);
     }
-    //printf("\n");
   }
 
+  FCLOSE(fp1);
+  FCLOSE(fp2);
+  for (ii=0; ii<job.n_free; ++ii) {
+    FREE(job.pool[ii]->in1);
+    FREE(job.pool[ii]->in2);
+    FREE(job.pool[ii]->work);
+    FREE(job.pool[ii]);
+  }
+  FREE(job.pool);
+  pthread_mutex_destroy(&job.pool_lock);
+  FREE(job.strip1);
+  FREE(job.strip2);
+
   //print_matches(matches, num_x, num_y, stdout);
 
   asfPrintStatus("Removing grid offset outliers.\n");
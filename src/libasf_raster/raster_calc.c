@@ -5,7 +5,6 @@
 #include <ctype.h>
 
 #define VERSION 2.0
-#define MAXIMGS 20
 
 char *expression2cookie(const char *expr, int nvars)
 {
@@ -92,27 +91,47 @@ int expressionMalformed(const char *expr, int nvars)
     printf("Your parenthesis do not match.\n");
     return 1;
   }
-  // Check to make sure all our variables are the right ones.
-  for (i=0; i<strln; i++)
+  // Check to make sure all our variables are the right ones.  Inputs past
+  // 'w' can only be referred to by number: [24] is the 24th input.
+  for (i=0; i<strln; i++) {
     if (isalpha(expr[i]))
-      if (tolower(expr[i])-'a' >= nvars &&
+      if ((tolower(expr[i])-'a' >= nvars || tolower(expr[i]) > 'w') &&
 	  tolower(expr[i]) != 'x' &&
 	  tolower(expr[i]) != 'y') {
 	printf("The variable '%c' is undefined.\n",expr[i]);
 	return 1;
       }
+    if (expr[i] == '[') {
+      int n = 0, start = i+1;
+      while (++i < strln && isdigit(expr[i]))
+	n = n*10 + expr[i]-'0';
+      if (i == start || i == strln || expr[i] != ']') {
+	printf("Inputs are numbered like this: [1], [2], ...\n");
+	return 1;
+      }
+      if (n < 1 || n > nvars) {
+	printf("The input [%d] is undefined.\n",n);
+	return 1;
+      }
+    }
+    else if (expr[i] == ']') {
+      printf("The brackets do not match.\n");
+      return 1;
+    }
+  }
   // Check to make sure we never have two operators in a row.
   for (i=1; i<strln; i++)
     if (ispunct(expr[i-1]) && ispunct(expr[i]) &&
-	expr[i-1] != '(' && expr[i-1] != ')' &&
-	expr[i] != '(' && expr[i] != ')') {
+	!strchr("()[]", expr[i-1]) && !strchr("()[]", expr[i])) {
       printf("The characters %c and %c don't look right together.\n",
 	     expr[i-1], expr[i]);
       return 1;
     }
   // Check to make sure we never have two operands in a row.
   for (i=1; i<strln; i++)
-    if (isalpha(expr[i-1]) && isalpha(expr[i])) {
+    if ((isalpha(expr[i-1]) && isalpha(expr[i])) ||
+	((isalnum(expr[i-1]) || expr[i-1] == ']') && expr[i] == '[') ||
+	(expr[i-1] == ']' && isalnum(expr[i]))) {
       printf("The characters %c and %c don't look right together.\n",
 	     expr[i-1], expr[i]);
       return 1;
@@ -146,6 +165,11 @@ EVALFUNC(varOp)
 {
   return vars[((token *)tok)->index];
 }
+/* Inputs [24], [25], ... live after the letters (see expression.h) */
+EVALFUNC(extraInputOp)
+{
+  return vars[((token *)tok)->index - ('w'-'a'+1) + EXPR_LETTER_VARS];
+}
 
 // Tokenizer Interface: Hacks up a string into
 // parts I call tokens-- these can be operators,
@@ -222,6 +246,16 @@ token *nextToken(void)
 	t->eval = varOp;
 	t->index = tolower(c)-'a';
       } 
+      else if (c == '[') { // An input by number, counting from 1.
+	t->type = tokVariable;
+	t->eval = varOp;
+	t->index = atoi(&currExpression[index]) - 1;
+	if (t->index > 'w'-'a')
+	  t->eval = extraInputOp;
+	while (currExpression[index] != ']')
+	  index++;
+	index++;
+      }
       else {
 	printf("Unrecognized symbol '%c'\n", c);
 	free(t);
@@ -232,15 +266,251 @@ token *nextToken(void)
   return t;
 }
 
-int raster_calc(char *outFile, char *expression, int input_count, 
+/* Compiled expressions.
+
+   evaluate() walks the token list once per pixel.  For whole images, the
+   token list is instead compiled once into a list of operations, each of
+   which runs over a full line: its operands are lines of intermediate
+   results ("slots"), input lines, or scalars (constants, and y).  The
+   arithmetic is the same, in double precision and in the same order, as
+   evaluate()'s, so the results are identical. */
+
+typedef enum {
+  calcSlot,      /* intermediate result line */
+  calcInput,     /* input image line */
+  calcConst,     /* constant */
+  calcX,         /* sample number */
+  calcY          /* line number */
+} calcOperandType;
+
+typedef struct {
+  calcOperandType type;
+  int index;     /* slot or input number */
+  double val;    /* constant value */
+} calc_operand;
+
+typedef struct {
+  char op;
+  calc_operand a, b;
+  int dest;      /* slot */
+} calc_instr;
+
+typedef struct {
+  calc_instr *instrs;
+  int n_instrs;
+  int n_slots;
+  calc_operand result;
+} calc_program;
+
+static calc_program *compile_cookie(char *cookie, int nvars)
+{
+  token **tokens = (token **) cookie;
+  int ii, n_tokens = 0;
+  while (tokens[n_tokens])
+    n_tokens++;
+
+  calc_program *prog = (calc_program *) MALLOC(sizeof(calc_program));
+  prog->instrs = (calc_instr *) MALLOC(sizeof(calc_instr)*(n_tokens+1));
+  prog->n_instrs = 0;
+  prog->n_slots = 0;
+
+  // Simulate evaluate()'s stack, including the two zeros it starts with
+  // (that is what makes "-a" work).
+  calc_operand *stack =
+    (calc_operand *) MALLOC(sizeof(calc_operand)*(n_tokens+2));
+  int sp = 2;
+  stack[0].type = stack[1].type = calcConst;
+  stack[0].val = stack[1].val = 0.0;
+
+  for (ii=0; ii<n_tokens; ii++) {
+    token *t = tokens[ii];
+    calc_operand *top = &stack[sp];
+    if (t->type == tokConstant) {
+      top->type = calcConst;
+      top->val = t->val;
+      sp++;
+    }
+    else if (t->type == tokVariable) {
+      if (tolower(t->op) == 'x')
+        top->type = calcX;
+      else if (tolower(t->op) == 'y')
+        top->type = calcY;
+      else {
+        top->type = calcInput;
+        top->index = t->index;
+        if (t->index < 0 || t->index >= nvars)
+          asfPrintError("Input %d is undefined\n", t->index+1);
+      }
+      sp++;
+    }
+    else {
+      if (sp < 2)
+        asfPrintError("Malformed expression\n");
+      calc_operand a = stack[sp-2], b = stack[sp-1];
+      calc_operand *res = &stack[sp-2];
+      if (a.type == calcConst && b.type == calcConst) {
+        res->type = calcConst;
+        res->val = t->eval(t, NULL, a.val, b.val);
+      }
+      else {
+        calc_instr *in = &prog->instrs[prog->n_instrs++];
+        in->op = t->op;
+        in->a = a;
+        in->b = b;
+        in->dest = sp-2;
+        if (sp-1 > prog->n_slots)
+          prog->n_slots = sp-1;
+        res->type = calcSlot;
+        res->index = sp-2;
+      }
+      sp--;
+    }
+  }
+  prog->result = stack[sp-1];
+  FREE(stack);
+
+  return prog;
+}
+
+static void free_program(calc_program *prog)
+{
+  FREE(prog->instrs);
+  FREE(prog);
+}
+
+/* An operand resolved for one line: a line of doubles, a line of floats,
+   or a scalar. */
+typedef struct {
+  const double *d;
+  const float *f;
+  double s;
+} calc_arg;
+
+#define CALC_LOOP(EXPR, A, B) \
+  for (i=0; i<n; i++) { double a = A, b = B; out[i] = EXPR; }
+
+#define CALC_KERNEL(name, EXPR) \
+static void name(int n, const calc_arg *x, const calc_arg *y, double *out) \
+{ \
+  int i; \
+  const double *ad = x->d, *bd = y->d; \
+  const float *af = x->f, *bf = y->f; \
+  double as = x->s, bs = y->s; \
+  if (ad && bd)      { CALC_LOOP(EXPR, ad[i], bd[i]) } \
+  else if (ad && bf) { CALC_LOOP(EXPR, ad[i], bf[i]) } \
+  else if (ad)       { CALC_LOOP(EXPR, ad[i], bs) } \
+  else if (af && bd) { CALC_LOOP(EXPR, af[i], bd[i]) } \
+  else if (af && bf) { CALC_LOOP(EXPR, af[i], bf[i]) } \
+  else if (af)       { CALC_LOOP(EXPR, af[i], bs) } \
+  else if (bd)       { CALC_LOOP(EXPR, as, bd[i]) } \
+  else if (bf)       { CALC_LOOP(EXPR, as, bf[i]) } \
+  else               { CALC_LOOP(EXPR, as, bs) } \
+}
+
+static double calc_mod(double a, double b)
+{
+  double mod = fmod(a,b);
+  if (mod < 0)
+    mod += b;
+  return mod;
+}
+
+CALC_KERNEL(add_line, a+b)
+CALC_KERNEL(sub_line, a-b)
+CALC_KERNEL(mul_line, a*b)
+CALC_KERNEL(div_line, b == 0 ? a : a/b)
+CALC_KERNEL(mod_line, b == 0 ? a : calc_mod(a,b))
+CALC_KERNEL(pow_line, pow(a,b))
+
+typedef struct {
+  calc_program *prog;
+  int ns;
+  int first_line;
+  float **in;          /* block of lines from each input */
+  int *in_ns;          /* line length of each input */
+  const double *xs;    /* 0, 1, ..., ns-1 */
+  float *out;          /* block of output lines */
+} calc_job;
+
+static void resolve_arg(calc_job *job, const calc_operand *o, int line,
+                        int yy, double *slots, calc_arg *arg)
+{
+  arg->d = NULL;
+  arg->f = NULL;
+  arg->s = 0.0;
+  switch (o->type) {
+  case calcSlot:
+    arg->d = slots + (long)o->index*job->ns;
+    break;
+  case calcInput:
+    arg->f = job->in[o->index] + (long)line*job->in_ns[o->index];
+    break;
+  case calcConst:
+    arg->s = o->val;
+    break;
+  case calcX:
+    arg->d = job->xs;
+    break;
+  case calcY:
+    arg->s = yy;
+    break;
+  }
+}
+
+/* asf_parallel_fn: evaluate the expression for lines [start,end) of the
+   current block. */
+static void calc_lines(int start, int end, void *data)
+{
+  calc_job *job = (calc_job *) data;
+  calc_program *prog = job->prog;
+  int ns = job->ns;
+  double *slots = prog->n_slots > 0 ?
+    (double *) MALLOC(sizeof(double)*prog->n_slots*ns) : NULL;
+  int ii, kk, xx;
+
+  for (ii=start; ii<end; ii++) {
+    int yy = job->first_line + ii;
+    calc_arg a, b;
+
+    for (kk=0; kk<prog->n_instrs; kk++) {
+      calc_instr *in = &prog->instrs[kk];
+      double *dest = slots + (long)in->dest*ns;
+      resolve_arg(job, &in->a, ii, yy, slots, &a);
+      resolve_arg(job, &in->b, ii, yy, slots, &b);
+      switch (in->op) {
+      case '+': add_line(ns, &a, &b, dest); break;
+      case '-': sub_line(ns, &a, &b, dest); break;
+      case '*': mul_line(ns, &a, &b, dest); break;
+      case '/': div_line(ns, &a, &b, dest); break;
+      case '%': mod_line(ns, &a, &b, dest); break;
+      case '^': pow_line(ns, &a, &b, dest); break;
+      }
+    }
+
+    float *out = job->out + (long)ii*ns;
+    resolve_arg(job, &prog->result, ii, yy, slots, &a);
+    if (a.d)
+      for (xx=0; xx<ns; xx++) out[xx] = a.d[xx];
+    else if (a.f)
+      for (xx=0; xx<ns; xx++) out[xx] = a.f[xx];
+    else
+      for (xx=0; xx<ns; xx++) out[xx] = a.s;
+  }
+
+  FREE(slots);
+}
+
+int raster_calc(char *outFile, char *expression, int input_count,
 		char **inFiles)
 {
   int ii, xx, yy;
   meta_parameters *inMeta, *outMeta;
-  meta_parameters *metas[MAXIMGS];
+  meta_parameters **metas;
   char *cookie;
-  float *inBuf[MAXIMGS], *outBuf;
-  FILE *fpIn[MAXIMGS], *fpOut;
+  FILE **fpIn, *fpOut;
+
+  metas = (meta_parameters **) MALLOC(sizeof(meta_parameters *)*input_count);
+  fpIn = (FILE **) MALLOC(sizeof(FILE *)*input_count);
 
   inMeta = meta_read(inFiles[0]);
   int ns = inMeta->general->sample_count;
@@ -248,14 +518,11 @@ int raster_calc(char *outFile, char *expression, int input_count,
   for (ii=0; ii<input_count; ii++) {
     meta_parameters *tmpMeta = meta_read(inFiles[ii]);
     fpIn[ii] = fopenImage(inFiles[ii], "rb");
-    // Make sure each image is at least as big as the first image.
-    if (ii != 0) {
-      if (tmpMeta->general->line_count < inMeta->general->line_count)
-        nl = tmpMeta->general->line_count;
-      if (tmpMeta->general->sample_count < inMeta->general->sample_count)
-        ns = tmpMeta->general->sample_count;
-    }
-    inBuf[ii] = (float*) MALLOC( sizeof(float)*tmpMeta->general->sample_count);
+    // The output is as big as the smallest image.
+    if (tmpMeta->general->line_count < nl)
+      nl = tmpMeta->general->line_count;
+    if (tmpMeta->general->sample_count < ns)
+      ns = tmpMeta->general->sample_count;
     metas[ii] = tmpMeta;
   }
   fpOut = fopenImage(outFile, "wb");
@@ -263,36 +530,67 @@ int raster_calc(char *outFile, char *expression, int input_count,
   outMeta->general->line_count = nl;
   outMeta->general->sample_count = ns;
   meta_write(outMeta, outFile);
+  meta_free(inMeta);
 
-  outBuf = (float *) MALLOC(sizeof(float)*outMeta->general->sample_count);
   cookie = expression2cookie(expression, input_count);
   if (NULL == cookie)
     exit(EXIT_FAILURE);
-  for (yy=0; yy<outMeta->general->line_count; yy++) {
-    double variables[26];
+  calc_program *prog = compile_cookie(cookie, input_count);
+  token **tok;
+  for (tok = (token **) cookie; *tok; tok++)
+    FREE(*tok);
+  FREE(cookie);
 
-    variables['y'-'a'] = yy;
+  // Lines are done a block at a time, small enough that the blocks of
+  // all the inputs stay around 64 MB.
+  long block_samples = 0;
+  for (ii=0; ii<input_count; ii++)
+    block_samples += metas[ii]->general->sample_count;
+  int block = (1 << 24) / (block_samples + ns);
+  if (block > 256) block = 256;
+  if (block < 1) block = 1;
+
+  calc_job job;
+  job.prog = prog;
+  job.ns = ns;
+  job.in = (float **) MALLOC(sizeof(float *)*input_count);
+  job.in_ns = (int *) MALLOC(sizeof(int)*input_count);
+  for (ii=0; ii<input_count; ii++) {
+    job.in_ns[ii] = metas[ii]->general->sample_count;
+    job.in[ii] = (float *) MALLOC(sizeof(float)*job.in_ns[ii]*block);
+  }
+  double *xs = (double *) MALLOC(sizeof(double)*ns);
+  for (xx=0; xx<ns; xx++)
+    xs[xx] = xx;
+  job.xs = xs;
+  job.out = (float *) MALLOC(sizeof(float)*ns*block);
+
+  for (yy=0; yy<nl; yy+=block) {
+    int n = yy + block > nl ? nl - yy : block;
 
     for (ii=0; ii<input_count; ii++)
-      get_float_line(fpIn[ii], metas[ii], yy, inBuf[ii]);
+      get_float_lines(fpIn[ii], metas[ii], yy, n, job.in[ii]);
 
-    for (xx=0; xx<outMeta->general->sample_count; xx++) {
-      variables['x'-'a'] = xx;
-      for (ii=0; ii<input_count; ii++)
-        variables[ii] = inBuf[ii][xx];
-      outBuf[xx] = evaluate(cookie,variables);
-    }
-    put_float_line(fpOut, outMeta, yy, outBuf);
-    asfLineMeter(yy, outMeta->general->line_count);
+    job.first_line = yy;
+    asf_parallel_for(n, 8, calc_lines, &job);
+
+    put_float_lines(fpOut, outMeta, yy, n, job.out);
+    asfLineMeter(yy + n - 1, nl);
   }
 
-  for (ii=0; ii<input_count; ++ii) { 
-    FREE(inBuf[ii]);
-    meta_free(metas[ii]); 
+  for (ii=0; ii<input_count; ++ii) {
+    FREE(job.in[ii]);
+    meta_free(metas[ii]);
     FCLOSE(fpIn[ii]);
   }
+  FREE(job.in);
+  FREE(job.in_ns);
+  FREE(job.out);
+  FREE(xs);
+  FREE(metas);
+  FREE(fpIn);
+  free_program(prog);
 
-  FREE(outBuf);
   meta_free(outMeta);
   FCLOSE(fpOut);
   return (0);
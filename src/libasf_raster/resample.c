@@ -45,60 +45,83 @@ ALGORITHM DESCRIPTION:
 #include "asf_endian.h"
 #include <asf_raster.h>
 
+typedef struct {
+    FILE *fp;
+    meta_parameters *meta;
+    int band_offset;        /* first line of the band in the file  */
+    int db;                 /* true if the input is in decibels    */
+} resample_reader;
+
+/* box_read_fn: read a line of the current band, as power values. */
+static void read_resample_line(int line, float *buf, void *data)
+{
+    resample_reader *r = (resample_reader *) data;
+    int l, np = r->meta->general->sample_count;
+
+    get_float_line(r->fp, r->meta, line + r->band_offset, buf);
+    if (r->db)
+        for (l=0; l<np; l++)
+            buf[l] = pow(10.0, buf[l]/10.0);
+}
+
+/* For nn_flag 2, bit_count holds, for every column, how many lines of the
+   window have each of the 32 bits set, and col_or the OR of the column.
+   Adding (sign 1) or dropping (sign -1) a line updates both, so the OR
+   follows the window as it moves instead of being rebuilt from all of
+   its lines. */
+static void or_line(const float *line, int np, int sign,
+                    int *bit_count, int *col_or)
+{
+    int j, b;
+
+    for (j = 0; j < np; j++) {
+        unsigned int v;
+        int *count;
+        if (line[j] == 0)
+            continue;
+        v = (unsigned int) (int) line[j];
+        count = bit_count + 32*(long)j;
+        for (b = 0; v; b++, v >>= 1) {
+            if (!(v & 1))
+                continue;
+            count[b] += sign;
+            if (count[b] == 0)
+                col_or[j] &= ~(1u << b);
+            else
+                col_or[j] |= 1u << b;
+        }
+    }
+}
+
+/* Value of the output pixel centered on input sample x, from the lines
+   currently in the window. */
 static float filter(      /****************************************/
-    float *inbuf,         /* input image buffer                   */
-    int    nl,            /* number of lines for inbuf            */
-    int    ns,            /* number of samples per line for inbuf */
+    box_window *w,        /* lines of the kernel                  */
     int    x,             /* sample in desired line               */
     int    nsk,           /* number of samples in kernel          */
-    int    nn_flag)       /* true if we should just use nearest   */
+    int    nn_flag,       /* true if we should just use nearest   */
                           /* instead of interpolating b/w points  */
+    int   *col_or)        /* per column OR of the window (nn 2)   */
 {                         /****************************************/
-    float  kersum =0.0;                    /* sum of kernel       */
     int    half   =(nsk-1)/2,              /* half size kernel    */
-           base   =(x-half),               /* index into inbuf    */
-           total  =0,                      /* valid kernel values */
-           i, j;                           /* loop counters       */
-                                           /***********************/
-
+           lo     =x-half,                 /* first sample        */
+           hi     =x+half,                 /* last sample         */
+           result =0,
+           j;
 
     if (nn_flag == 1) {  /* Use nearest neighbor value */
-      	if (base>=0 && base<nl*ns) 
-          return inbuf[base];
-	else if (base<0) 
-          return inbuf[0];
-      	else if (base>=nl*ns) 
-          return inbuf[ns*nl-1];
-      	asfPrintError("Not reached.\n");
+        if (lo < 0) lo = 0;
+        if (lo > w->ns-1) lo = w->ns-1;
+        return box_window_line(w, w->first)[lo];
     } else if (nn_flag == 2) { /* Use logical OR of values */
-      	for (i = 0; i < nl; i++) {
-      	  for (j = x-half; j <= x+half; j++) {
-      	    if (base>=0 && base<nl*ns && inbuf[base] != 0 && j < ns) { kersum = (int) ((int) kersum | (int) inbuf[base]); }
-      	    base++;
-      	  }
-      	  base += ns;
-      	  base -= nsk;
-      	}
-       	return (kersum);
-    } else {
-        for (i = 0; i < nl; i++) {
-          for (j = x-half; j <= x+half; j++) {
-            if (base>=0 && base<nl*ns && inbuf[base] != 0 && j < ns) {
-              kersum += inbuf[base];
-              total++;
-            }
-            base++;
-          }
-          base += ns;
-          base -= nsk;
-        }
-        if (total != 0)
-          kersum /= (float) total;
-        return (kersum);
+        if (lo < 0) lo = 0;
+        if (hi > w->ns-1) hi = w->ns-1;
+        for (j = lo; j <= hi; j++)
+            result |= col_or[j];
+        return (float) result;
     }
 
-    asfPrintError("Not reached");
-    return 0;
+    return box_window_mean(w, lo, hi);
 }
 
 static int
@@ -107,16 +130,19 @@ resample_impl(const char *infile, const char *outfile,
               int nn_flag)
 {
     FILE            *fpin, *fpout;  /* file pointer                   */
-    float           *inbuf,         /* stripped input buffer          */
-                    *outbuf;        /* stripped output buffer         */
+    float           *outbuf;        /* stripped output buffer         */
+    box_window      *window;        /* lines of the kernel            */
+    resample_reader  reader;
+    int             *col_or = NULL; /* per column OR, for nn_flag 2   */
+    int             *bit_count = NULL; /* and its bit counts          */
     meta_parameters *metaIn, *metaOut;
     int      np, nl,                /* in number of pixels,lines      */
              onp, onl,              /* out number of pixels,lines     */
              xnsk,                  /* kernel size in samples (x)     */
              ynsk,                  /* kernel size in samples (y)     */
              yhalf,                 /* half of the kernel size        */
-             n_lines,               /* number of lines in this kernel */
-             s_line,                /* start line for input file      */
+             s_line, e_line,        /* window of input lines          */
+             prev_s, prev_e,        /* and the previous window        */
              xi = 0,                /* inbuf int x sample #           */
              yi = 0,                /* inbuf int y line #             */
              i,j,k,l;               /* loop counters                  */
@@ -155,10 +181,16 @@ resample_impl(const char *infile, const char *outfile,
     ybase = 1.0 / (2.0 * yscalfact);
     yrate = 1.0 / yscalfact;
     yhalf = (ynsk-1)/2;
-    n_lines = ynsk;
 
-    inbuf= (float *) MALLOC (ynsk*np*sizeof(float));
+    // The kernel lines are kept in a ring buffer with running column sums,
+    // so that lines shared by consecutive output lines are only read once
+    // and each output pixel costs the same whatever the kernel size.
+    window = box_window_new(np, ynsk);
     outbuf = (float *) MALLOC (onp*sizeof(float));
+    if (nn_flag == 2) {
+        col_or = (int *) MALLOC (np*sizeof(int));
+        bit_count = (int *) MALLOC (32*np*sizeof(int));
+    }
 
    /*----------  Open the Input & Output Files ---------------------*/
     char *imgfile = MALLOC(sizeof(char) * (10 + strlen(outfile)));
@@ -225,32 +257,52 @@ resample_impl(const char *infile, const char *outfile,
             asfPrintStatus("Resampling band: %s\n", band_name[k]);
 
         fpout=fopenImage(imgfile, k==0 ? "wb" : "ab");
-        n_lines = ynsk;
-        /*--------  Process inbuf to give outbuf ------------------------*/
+
+        reader.fp = fpin;
+        reader.meta = metaIn;
+        reader.band_offset = k*nl;
+        reader.db = metaIn->general->radiometry >= r_SIGMA_DB &&
+                    metaIn->general->radiometry <= r_GAMMA_DB;
+        box_window_reset(window, 0);
+        prev_s = prev_e = 0;
+        if (nn_flag == 2) {
+            memset(col_or, 0, np*sizeof(int));
+            memset(bit_count, 0, 32*np*sizeof(int));
+        }
+
+        /*--------  Process the window to give outbuf -------------------*/
         for (i = 0; i < onl; i++)
         {
-            /*--------- Read next set of lines for kernel ---------------*/
+            /*--------- Move the window to the next kernel --------------*/
+            // The kernel is truncated at the edges of the image.
             yi = i * yrate + ybase;
             s_line = yi-yhalf;
             if (s_line < 0) s_line = 0;
-            if (nl < ynsk+s_line) n_lines = nl-s_line;
-
-            s_line += k*nl;
-            get_float_lines(fpin, metaIn, s_line, n_lines, inbuf);
-	    if (metaIn->general->radiometry >= r_SIGMA_DB &&
-		metaIn->general->radiometry <= r_GAMMA_DB) {
-	      for (l=0; l<(np*n_lines); l++) {
-		tmp = inbuf[l];
-		inbuf[l] = pow(10.0, tmp/10.0);
-	      }
-	    }
-	    
+            e_line = yi+yhalf+1;
+            if (e_line > nl) e_line = nl;
+
+            // Lines leaving the window come out of the OR while they are
+            // still in it, the new ones go in once they have been read.
+            if (nn_flag == 2)
+                for (l = prev_s; l < prev_e && l < s_line; l++)
+                    or_line(box_window_line(window, l), np, -1,
+                            bit_count, col_or);
+            box_window_move(window, s_line, e_line, read_resample_line,
+                            &reader);
+            if (nn_flag == 2)
+                for (l = prev_e > s_line ? prev_e : s_line; l < e_line; l++)
+                    or_line(box_window_line(window, l), np, 1,
+                            bit_count, col_or);
+            else if (nn_flag == 0)
+                box_window_prefix(window);
+            prev_s = s_line;
+            prev_e = e_line;
 
             /*--------- Produce the output line and write to disk -------*/
             for (j = 0; j < onp; j++)
             {
                 xi = j * xrate + xbase;
-                outbuf[j] = filter(inbuf,n_lines,np,xi,xnsk,nn_flag);
+                outbuf[j] = filter(window,xi,xnsk,nn_flag,col_or);
 		if (metaOut->general->radiometry >= r_SIGMA_DB &&
 		    metaOut->general->radiometry <= r_GAMMA_DB) {
 		  tmp = outbuf[j];
@@ -274,8 +326,12 @@ resample_impl(const char *infile, const char *outfile,
 
     FCLOSE(fpin);
 
-    FREE(inbuf);
+    box_window_free(window);
     FREE(outbuf);
+    if (col_or)
+        FREE(col_or);
+    if (bit_count)
+        FREE(bit_count);
 
     FREE(imgfile);
     FREE(metafile);
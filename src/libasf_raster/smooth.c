@@ -1,104 +1,17 @@
 #include "asf.h"
 #include "asf_raster.h"
-#include <assert.h>
-
-static float prev_col_result = -99999.99999;
-static int prev_col_total = -1;
-
-static float filter(      /****************************************/
-    float *inbuf,         /* input image buffer                   */
-    int    nl,            /* number of lines for inbuf            */
-    int    ns,            /* number of samples per line for inbuf */
-    int    y,             /* line number in the image             */
-    int    x,             /* sample in desired line               */
-    int    nsk)           /* number of samples in kernel          */
-{                         /****************************************/
-  // For pixels other than the first, use the saved result for the pixel
-  // right before this one in the same row, subtract that row that moved
-  // off the window, add the row that moved into the window
-  if (x>0) {
-
-    //assert(prev_col_result != -99999.99999);
-    assert(prev_col_total != -1);
-
-    int half = (nsk-1)/2;
-    float kersum = prev_col_result*prev_col_total;
-    int left = x-half-1;
-    int include_left = left>=0;
-    int right = x+half;
-    int include_right = x+half<ns;
-    int total = prev_col_total;
-    int i;
-
-    if (include_left) {
-      for (i = 0; i < nl; i++) {
-        if (inbuf[left]!=0) {
-          kersum -= inbuf[left];
-          --total;
-        }
-        left += ns;
-      }
-    }
-
-    if (include_right) {
-      for (i = 0; i < nl; i++) {
-        if (inbuf[right]!=0) {
-          kersum += inbuf[right];
-          ++total;
-        }
-        right += ns;
-      }
-    }
-
-    if (total != 0)
-      kersum /= (float)total;
-
-    prev_col_result = kersum;
-    prev_col_total = total;
-
-    return kersum;
-  }
 
-  // Otherwise, do the full calculation (this should occur only for the
-  // first pixel in each row)
-  else {
-    float  kersum =0.0;                    /* sum of kernel       */
-    int    half   =(nsk-1)/2,              /* half size kernel    */
-           total  =0,                      /* valid kernel values */
-           i, j;                           /* loop counters       */
-
-    int upper = x+half;
-    if (upper >= ns) upper = ns-1;
-
-    int lower = x-half;
-    if (lower < 0) lower = 0;
-    int wid = upper-lower+1;
-
-    int base = lower;
-    for (i = 0; i < nl; i++)
-    {
-      for (j = lower; j <= upper; j++)
-      {
-        if (inbuf[base] != 0)
-        {
-          kersum += inbuf[base];
-          total++;
-        }
-        base++;
-      }
-
-      base += ns;
-      base -= wid;
-    }
-
-    if (total != 0)
-      kersum /= (float) total;
+typedef struct {
+  FILE *fp;
+  meta_parameters *meta;
+  int band_offset;        /* first line of the band in the file */
+} smooth_reader;
 
-    prev_col_result = kersum;
-    prev_col_total = total;
-
-    return (kersum);
-  }
+// box_read_fn: read a line of the current band.
+static void read_smooth_line(int line, float *buf, void *data)
+{
+  smooth_reader *r = (smooth_reader *) data;
+  get_float_line(r->fp, r->meta, line + r->band_offset, buf);
 }
 
 static const char *edge_strat_to_string(edge_strategy_t edge_strategy)
@@ -144,7 +57,10 @@ int smooth(const char *infile, const char *outfile, int kernel_size,
   int nl = metaIn->general->line_count;
   int ns = metaIn->general->sample_count;
 
-  float *inbuf = (float *) MALLOC (kernel_size*ns*sizeof(float));
+  // The kernel lines are kept in a ring buffer with running column sums,
+  // so each pixel costs the same whatever the kernel size.
+  box_window *window = box_window_new(ns, kernel_size);
+  smooth_reader reader;
   float *outbuf = (float *) MALLOC (ns*sizeof(float));
 
   char **band_name = extract_band_names(metaIn->general->bands,
@@ -159,36 +75,28 @@ int smooth(const char *infile, const char *outfile, int kernel_size,
 
     FILE *fpout = fopenImage(out_img, kk==0 ? "wb" : "ab");
 
+    reader.fp = fpin;
+    reader.meta = metaIn;
+    reader.band_offset = kk*nl;
+    box_window_reset(window, 0);
+
     for (ii=0; ii<nl; ++ii) {
 
-      // figure out which window in the image we need to read
+      // move the window to the lines of the kernel, truncated at the
+      // top and bottom of the image
       int start_line = ii - half;
       if (start_line < 0) start_line = 0;
 
-      int n_lines = kernel_size;
-      if (nl < kernel_size + start_line)
-        n_lines = nl-start_line;
-
-      // adjust for the band number
-      start_line += kk*nl; 
-
-      if (ii==0) {
-        // read the window
-        get_float_lines(fpin, metaIn, start_line, n_lines, inbuf);
-      }
-      else {
-        // already read in most of these lines -- shift items in the buffer
-        if (start_line > 0)
-          for (jj = 0; jj < n_lines-1; ++jj)
-            memcpy(inbuf + jj*ns, inbuf + (jj+1)*ns, ns*sizeof(float));
-        int new_line = start_line + n_lines - 1;
-        if (new_line < nl)
-          get_float_line(fpin, metaIn, new_line, inbuf + (n_lines-1)*ns);
-      }
+      int end_line = ii + half + 1;
+      if (end_line > nl) end_line = nl;
+
+      box_window_move(window, start_line, end_line, read_smooth_line,
+                      &reader);
 
       // apply the smoothing
+      box_window_prefix(window);
       for (jj = 0; jj < ns; jj++)
-        outbuf[jj] = filter(inbuf,n_lines,ns,ii,jj,kernel_size);
+        outbuf[jj] = box_window_mean(window, jj-half, jj+half);
 
       put_float_line(fpout, metaOut, ii, outbuf);
       asfLineMeter(ii,nl);
@@ -209,7 +117,7 @@ int smooth(const char *infile, const char *outfile, int kernel_size,
   meta_free(metaOut);
   meta_free(metaIn);
 
-  FREE(inbuf);
+  box_window_free(window);
   FREE(outbuf);
 
   free(in_img);
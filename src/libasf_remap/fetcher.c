@@ -30,6 +30,12 @@ Extrapolating, it would probably take 736 minutes (11 hours) to remap all 8000 l
 *Using* image blocks, the same task took
 340.0u 44.0s 6:41 95% 0+0k 0+0io 0pf+0w
 or just under 7 minutes, a 100x speed increase.
+
+The block cache is shared by all the threads remapping an image.
+Looking a pixel up takes no locks; loading a missing block is done
+under a mutex.  Blocks are only paged out again by trimFetchCache,
+which perform_mapping calls between strips of output lines, when no
+other thread can be holding on to a block.
 */
 
 #include "asf.h"
@@ -38,12 +44,14 @@ or just under 7 minutes, a 100x speed increase.
 #include "las.h"
 #include "remap.h"
 #include <unistd.h> /*For getpid()*/
+#include <glib.h>
 
-#define BLOCK_SHIFT 8 /*Log base 2 of size (in pixels) of one side of a block*/
+#define BLOCK_SHIFT FETCH_BLOCK_SHIFT /*Log base 2 of size (in pixels) of one side of a block*/
 #define PIX2BLOCK(pix) ((pix)>>BLOCK_SHIFT) /*Return the block number of the given pixel.*/
 #define BLOCK_SIDE (1<<BLOCK_SHIFT) /*Size (in pixels) of one side of a block*/
-#define BLOCK_MASK (BLOCK_SIDE-1) /*Bitwise mask for block indices*/
+#define BLOCK_MASK FETCH_BLOCK_MASK /*Bitwise mask for block indices*/
 #define BLOCK_SIZE (sizeof(float)*BLOCK_SIDE*BLOCK_SIDE) /*Block size in bytes.*/
+#define CACHE_BYTES (30L*1024*1024) /*Keep no more than 30 MB of data in the cache*/
 
 #define IMAGE_SLOP 4 /*# of input image widths to pad with zeros in the cache*/
 #define CACHE_SLOP 20 /*# of extra cache blocks to allocate*/
@@ -78,6 +86,7 @@ testing.
 	int blocksInCache;/*Number of blocks currently stored in cache.*/
 	int doomedBlock;/*Pointer to next block to be removed from the cache.*/
 	float *zeroBlock;/*Pointer to a block containing all background pixels.*/
+	GMutex lock;/*Held while loading a block into the cache*/
 
 } fetchRec;/*Private pixel-fetching record, used below*/
 
@@ -85,7 +94,7 @@ testing.
 void read_line(fetchRec *g,int y,float *destBuf,int destLen);
 void createBlockingStore(fetchRec *g);
 float *readBlock(fetchRec *g,int imgX,int imgY);
-float *cacheMiss(fetchRec *g,int imgX,int imgY);
+float *cacheMiss(fetchRec *g,int index,int imgX,int imgY);
 
 
 /************ Internal Utilities:*************/
@@ -178,7 +187,7 @@ each block using outBuf.*/
 }
 
 /*Read in the block corresponding to to the given (in-bounds)
-location (in image pixels), making room in memory if needed.*/
+location (in image pixels).  Called with g->lock held.*/
 float *readBlock(fetchRec *g,int imgX,int imgY)
 {
 	float *retBlock=(float *)MALLOC(BLOCK_SIZE);
@@ -187,38 +196,32 @@ float *readBlock(fetchRec *g,int imgX,int imgY)
 	/*printf("Loading block at %d,%d: %d\n",imgX,imgY,by*g->blockWid+bx);*/
 	FSEEK64(g->blockIn,(long long)BLOCK_SIZE*(by*g->blockWid+bx),0);
 	ASF_FREAD(retBlock,1,BLOCK_SIZE,g->blockIn);
-	
-/*Now we make sure our pixel buffer isn't getting TOO big.*/
 	g->blocksInCache++;
-	while (g->blocksInCache*BLOCK_SIZE>30L*1024*1024) /*Keep no more than 30 MB of data in buffer.*/
-	{
-		/*start tossing blocks of data, starting from doomedBlock...*/
-		float **doomed=&(g->cache[g->doomedBlock]);
-		if ((*doomed!=NULL)&&(*doomed!=g->zeroBlock)) 
-		{ /*...until we get under the limit.*/
-			/*printf("...paging out block %i...\n",g->doomedBlock);*/
-			FREE(*doomed);
-			*doomed=NULL;
-			g->blocksInCache--;
-		}
-		g->doomedBlock++;
-		if (g->doomedBlock>=(g->cacheWid*g->cacheHt))
-			g->doomedBlock=0;
-	}
 	return retBlock;
 }
 
-/*CacheMiss: return the block that should occupy the
-location corresponding to this image point in the cache.
+/*CacheMiss: fill in (and return) the block that should occupy
+the given cache location, which corresponds to this image point.
+Another thread may have beaten us to it, in which case its block
+is returned.
 */
-float *cacheMiss(fetchRec *g,int imgX,int imgY)
+float *cacheMiss(fetchRec *g,int index,int imgX,int imgY)
 {
-	if ((imgX<0)||(imgY<0)||
-		(imgX>=BLOCK_SIDE*g->blockWid)||(imgY>=BLOCK_SIDE*g->blockHt))
-	/*Pixel is out of blocking store bounds-- add a zero block here*/
-		return g->zeroBlock;
-	else /*Pixel is in bounds-- read in the appropriate block*/
-		return readBlock(g,imgX,imgY);
+	float *block;
+	g_mutex_lock(&g->lock);
+	block=g->cache[index];
+	if (block==NULL)
+	{
+		if ((imgX<0)||(imgY<0)||
+			(imgX>=BLOCK_SIDE*g->blockWid)||(imgY>=BLOCK_SIDE*g->blockHt))
+		/*Pixel is out of blocking store bounds-- add a zero block here*/
+			block=g->zeroBlock;
+		else /*Pixel is in bounds-- read in the appropriate block*/
+			block=readBlock(g,imgX,imgY);
+		g_atomic_pointer_set(&g->cache[index],block);
+	}
+	g_mutex_unlock(&g->lock);
+	return block;
 }
 
 
@@ -247,6 +250,7 @@ pixelFetcher *createFetchRec(FILE *in,struct DDR *inDDR,int outDtype,int bandNo)
 	g->startY=BLOCK_SIDE*(CACHE_SLOP+IMAGE_SLOP*g->blockHt);
 	g->startX=BLOCK_SIDE*(CACHE_SLOP+IMAGE_SLOP*g->blockWid);
 	g->cache=(float **)MALLOC(sizeof(float *)*g->cacheHt*g->cacheWid);
+	g_mutex_init(&g->lock);
 	for (i=0;i<g->cacheHt*g->cacheWid;i++)
 		g->cache[i]=NULL;
 	g->blocksInCache=0;
@@ -277,6 +281,7 @@ void killFetchRec(pixelFetcher *inGetRec)
 		}
 	FREE(g->cache);g->cache=NULL;
 	FREE(g->zeroBlock);g->zeroBlock=NULL;
+	g_mutex_clear(&g->lock);
 	
 /*Free (& delete) block store*/
 	FCLOSE(g->blockIn);
@@ -287,17 +292,48 @@ void killFetchRec(pixelFetcher *inGetRec)
 }
 
 /************ External Entry Point:
-Get a single pixel's value, interpreted as a floating point number.*/
-float fetchPixelValue(pixelFetcher *inGetRec,int x, int y)
+TrimFetchCache:
+	Pages blocks out of the cache until it is back under CACHE_BYTES.
+No other thread may be fetching pixels while this runs.*/
+void trimFetchCache(pixelFetcher *inGetRec)
+{
+	fetchRec *g=(fetchRec *)inGetRec;
+	while (g->blocksInCache*BLOCK_SIZE>CACHE_BYTES)
+	{
+		/*start tossing blocks of data, starting from doomedBlock...*/
+		float **doomed=&(g->cache[g->doomedBlock]);
+		if ((*doomed!=NULL)&&(*doomed!=g->zeroBlock)) 
+		{ /*...until we get under the limit.*/
+			/*printf("...paging out block %i...\n",g->doomedBlock);*/
+			FREE(*doomed);
+			*doomed=NULL;
+			g->blocksInCache--;
+		}
+		g->doomedBlock++;
+		if (g->doomedBlock>=(g->cacheWid*g->cacheHt))
+			g->doomedBlock=0;
+	}
+}
+
+/************ External Entry Point:
+Return the cached block holding the given pixel.  The pixel itself is at
+[((y&FETCH_BLOCK_MASK)<<FETCH_BLOCK_SHIFT)+(x&FETCH_BLOCK_MASK)].*/
+const float *fetchBlock(pixelFetcher *inGetRec,int x, int y)
 {
 	register fetchRec *g=(fetchRec *)inGetRec;
-	float **cache=g->cache;
-	
 	int bx=PIX2BLOCK(g->startX+x);
 	int by=PIX2BLOCK(g->startY+y);
 	int index=by*g->cacheWid+bx;
-	if (cache[index]==NULL)
+	float *block=(float *)g_atomic_pointer_get(&g->cache[index]);
+	if (block==NULL)
 	/*The cache is empty for this location- refill it*/
-		cache[index]=cacheMiss(g,x,y);
-	return cache[index][((y&BLOCK_MASK)<<BLOCK_SHIFT)+(x&BLOCK_MASK)];
+		block=cacheMiss(g,index,x,y);
+	return block;
+}
+
+/************ External Entry Point:
+Get a single pixel's value, interpreted as a floating point number.*/
+float fetchPixelValue(pixelFetcher *inGetRec,int x, int y)
+{
+	return fetchBlock(inGetRec,x,y)[((y&BLOCK_MASK)<<BLOCK_SHIFT)+(x&BLOCK_MASK)];
 }
@@ -184,6 +184,54 @@ void poly_doMap(matrixMapRec * map,fPoint  in, fPoint  *out)
 	out->y=poly_eval(q->outToInY,in.x,in.y);
 }
 
+/***************
+mapLine:
+	Performs the inverse mapping for a whole output line (y) at once.
+Matrix and quadratic maps are evaluated right here, with the terms that
+only depend on y worked out once per line.  The terms are still added up
+in the same order as in matrix_doMap and quadratic_doMap, so the input
+locations come out exactly the same as calling doMap for each pixel.
+*/
+void mapLine(mappingFunction map, int y, int ns, fPoint *out)
+{
+	int x;
+	double dy=y;
+	if (map->type==matrixMap)
+	{
+		double (*e)[2]=mat->outToIn->e;
+		double yx=dy*e[1][0],yy=dy*e[1][1];
+		for (x=0;x<ns;x++)
+		{
+			double dx=x;
+			out[x].x=dx*e[0][0]+yx+e[2][0];
+			out[x].y=dx*e[0][1]+yy+e[2][1];
+		}
+	}
+	else if (map->type==quadraticMap)
+	{
+		quadraticMapRec *q=(quadraticMapRec *)map;
+		const quadratic_2d *cx=&q->outToInX,*cy=&q->outToInY;
+		double cxC=cx->C*dy,cxF=cx->F*dy*dy;
+		double cyC=cy->C*dy,cyF=cy->F*dy*dy;
+		for (x=0;x<ns;x++)
+		{
+			double dx=x;
+			out[x].x=cx->A+cx->B*dx+cxC+cx->D*dx*dx+cx->E*dx*dy+cxF;
+			out[x].y=cy->A+cy->B*dx+cyC+cy->D*dx*dx+cy->E*dx*dy+cyF;
+		}
+	}
+	else
+	{
+		fPoint outPt;
+		outPt.y=y;
+		for (x=0;x<ns;x++)
+		{
+			outPt.x=x;
+			map->doMap((void *)map,outPt,&out[x]);
+		}
+	}
+}
+
 /***************
 KillMap completely destroys a map.*/
 void killMap(mappingFunction map)
@@ -370,6 +418,51 @@ float sinc_doSamp(sincSampData * sinc,pixelFetcher *getRec,fPoint inPt)
 	return outValue;
 }
 
+/*sampleLine: samples the input image at each of the ns given locations.
+Nearest and bilinear sampling are done here directly, giving exactly the
+same values as their doSamp routines; bilinear sampling reads all four
+neighbours straight out of the cache block when they share one.*/
+void sampleLine(sampleFunction samp, pixelFetcher *getRec, const fPoint *in,
+	int ns, float *out)
+{
+	int x;
+	if (samp->type==nearestSamp)
+	{
+		for (x=0;x<ns;x++)
+			out[x]=fetchPixelValue(getRec,(int)(in[x].x+10)-10,(int)(in[x].y+10)-10);
+	}
+	else if (samp->type==bilinearSamp)
+	{
+		for (x=0;x<ns;x++)
+		{
+			int ix=(int)(in[x].x+10)-10,iy=(int)(in[x].y+10)-10;
+			register float dx=in[x].x-ix,dy=in[x].y-iy;
+			float tl,tr,bl,br,tc,bc;
+			if ((ix&FETCH_BLOCK_MASK)!=FETCH_BLOCK_MASK &&
+			    (iy&FETCH_BLOCK_MASK)!=FETCH_BLOCK_MASK)
+			{/*All four neighbours are in the same block*/
+				const float *p=fetchBlock(getRec,ix,iy)+
+					((iy&FETCH_BLOCK_MASK)<<FETCH_BLOCK_SHIFT)+(ix&FETCH_BLOCK_MASK);
+				tl=p[0];tr=p[1];
+				bl=p[1<<FETCH_BLOCK_SHIFT];br=p[(1<<FETCH_BLOCK_SHIFT)+1];
+			}
+			else
+			{
+				tl=fetchPixelValue(getRec,ix,iy);tr=fetchPixelValue(getRec,ix+1,iy);
+				bl=fetchPixelValue(getRec,ix,iy+1);br=fetchPixelValue(getRec,ix+1,iy+1);
+			}
+			tc=tl+(tr-tl)*dx;
+			bc=bl+(br-bl)*dx;
+			out[x]=tc+(bc-tc)*dy;
+		}
+	}
+	else
+	{
+		for (x=0;x<ns;x++)
+			out[x]=samp->doSamp((void *)samp,getRec,in[x]);
+	}
+}
+
 void killSamp(sampleFunction samp)
 {
 	if (samp->type==kernelSamp)
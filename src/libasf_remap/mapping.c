@@ -12,6 +12,34 @@ actual image processing, spec'd by the input and output DDRs, and its parameters
 #include "Matrix2D.h"
 #include "remap.h"
 
+/*Number of output lines remapped (in parallel) between writes*/
+#define REMAP_STRIP_LINES 64
+
+typedef struct {
+	mappingFunction map;
+	sampleFunction samp;
+	pixelFetcher *getRec;
+	int ns;/*Output line width*/
+	int y0;/*First output line of the current strip*/
+	float *strip;/*Output lines of the current strip*/
+} remapStrip;
+
+/*Remap lines [start,end) of the current strip.*/
+static void remap_lines(int start,int end,void *data)
+{
+	remapStrip *r=(remapStrip *)data;
+	fPoint *inPts=(fPoint *)MALLOC(r->ns*sizeof(fPoint));
+	int l;
+	for (l=start;l<end;l++)
+	{
+	   /*Compute each pixel's position in input space...*/
+		mapLine(r->map,r->y0+l,r->ns,inPts);
+	   /*...and read the values there.*/
+		sampleLine(r->samp,r->getRec,inPts,r->ns,&r->strip[l*r->ns]);
+	}
+	FREE(inPts);
+}
+
 /****************************Perform_mapping-- the most important call********************
   This is the function which does the file I/O and image manipulation.
   There are a few caveats:
@@ -26,9 +54,10 @@ actual image processing, spec'd by the input and output DDRs, and its parameters
 void perform_mapping(FILE *in, struct DDR *inDDR, FILE *out, struct DDR *outDDR,
 	mappingFunction map, sampleFunction samp,int bandNo)
 {
-	int x,y,maxOutX=outDDR->ns,maxOutY=outDDR->nl;
-	float *thisLine=(float *)MALLOC(maxOutX*sizeof(float));
+	int y,maxOutX=outDDR->ns,maxOutY=outDDR->nl;
+	float *strip=(float *)MALLOC(REMAP_STRIP_LINES*maxOutX*sizeof(float));
 	char *outBuf;
+	remapStrip r;
 	
 	char *pixelDescription;
 	pixelFetcher *getRec=createFetchRec(in,inDDR,outDDR->dtype,bandNo);
@@ -45,28 +74,29 @@ void perform_mapping(FILE *in, struct DDR *inDDR, FILE *out, struct DDR *outDDR,
 	  printLog(logbuf);
 	}
 	
-/*Iterate over each pixel of the output image.*/
-	for (y=0;y<maxOutY;y++)
+/*Remap the output image a strip of lines at a time: the lines of a strip
+are spread over the worker threads, then written out in order.*/
+	r.map=map;
+	r.samp=samp;
+	r.getRec=getRec;
+	r.ns=maxOutX;
+	r.strip=strip;
+	for (r.y0=0;r.y0<maxOutY;r.y0+=REMAP_STRIP_LINES)
 	{
-		fPoint outPt,inPt;
-		outPt.y=y;
-		for (x=0;x<maxOutX;x++)
-		{
-			outPt.x=x;
-		   /*Compute the pixel's position in input space...*/
-		   	map->doMap((void *)map,outPt,&inPt);
-			
-		   /*Now read that pixel's value and put it in the "thisLine" array as a float...*/
-		   	thisLine[x]=samp->doSamp((void *)samp,getRec,inPt);
-		}
+		int nLines=maxOutY-r.y0;
+		if (nLines>REMAP_STRIP_LINES)
+			nLines=REMAP_STRIP_LINES;
+		asf_parallel_for(nLines,1,remap_lines,&r);
 		
-		writePixelLine(out,outDDR,y,bandNo,thisLine,outBuf);
+		for (y=0;y<nLines;y++)
+			writePixelLine(out,outDDR,r.y0+y,bandNo,&strip[y*maxOutX],outBuf);
+		trimFetchCache(getRec);
 	}
 	
 /*	printf("\n\tperform_mapping complete!\n");*/
 	killFetchRec(getRec);
 	
-	FREE(thisLine);
+	FREE(strip);
 	FREE(outBuf);
 }
 
@@ -4,8 +4,16 @@ typedef int pixelFetcher;
 
 pixelFetcher *createFetchRec(FILE *in, struct DDR *inDDR,int outDtype,int bandNo);
 float fetchPixelValue(pixelFetcher *getRec,int x, int y);
+void trimFetchCache(pixelFetcher *getRec);
 void killFetchRec(pixelFetcher *getRec);
 
+/*The cache is made of square blocks of pixels; fetchBlock returns the block
+holding (x,y), in which that pixel is at
+[((y&FETCH_BLOCK_MASK)<<FETCH_BLOCK_SHIFT)+(x&FETCH_BLOCK_MASK)].*/
+#define FETCH_BLOCK_SHIFT 8
+#define FETCH_BLOCK_MASK ((1<<FETCH_BLOCK_SHIFT)-1)
+const float *fetchBlock(pixelFetcher *getRec,int x, int y);
+
 /*writer.c Interface:*/
 void writePixelLine(FILE *out, struct DDR *outDDR,int y, int bandNo, float *line, char *outBuf);
 
@@ -29,6 +37,7 @@ mappingFunction createMap(mappingType m,void *param);
 void addMatrix(mappingFunction map,Matrix2D *m);
 void updateDDR(mappingFunction map,struct DDR *inDDR, struct DDR *outDDR);
 void forwardMap(mappingFunction map, fPoint in, fPoint *out);
+void mapLine(mappingFunction map, int y, int ns, fPoint *out);
 void killMap(mappingFunction map);
 
 typedef enum {
@@ -49,6 +58,8 @@ typedef struct {
 sampleFunction createSamp(sampleType s);
 sampleFunction createKernelSamp(int x,int y);
 sampleFunction readKernelFile(char *fname);
+void sampleLine(sampleFunction samp, pixelFetcher *getRec, const fPoint *in,
+	int ns, float *out);
 void killSamp(sampleFunction samp);
 
 /*Mapping.c Interface:*/
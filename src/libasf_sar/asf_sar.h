@@ -1,7 +1,9 @@
 #ifndef _ASF_SAR_H_
 #define _ASF_SAR_H_
 
-#define MAX_IMG_SIZE 100000
+/* Longest line, or most lines, sr2gr and gr2sr will produce; bad pixel
+   sizes would otherwise have them build their vectors forever */
+#define MAX_RESAMPLE_SIZE 1000000
 
 /* values for the layover/shadow mask*/
 #define MASK_NORMAL 1
@@ -6,13 +6,18 @@
 
 #define MAX_OTHER 10
 
+// The 8 quad-pol bands, in the order they are kept in QuadPolData
+enum { HH_AMP, HH_PHASE, HV_AMP, HV_PHASE, VH_AMP, VH_PHASE, VV_AMP, VV_PHASE,
+       NUM_QP_BANDS };
+
 typedef struct {
-   int line;
-   quadPolS2Float *buf;
+   int line;              /* first line of the block in buf */
+   int block;             /* lines the buffers can hold */
+   quadPolS2Float *buf;   /* block of lines, filled by qpd_convert_lines() */
+   float *raw[NUM_QP_BANDS]; /* amplitude/phase lines as read */
 
    FILE *fp;
    meta_parameters *meta;
-   complexMatrix *r;
 
    int hh_amp_band, hh_phase_band;
    int hv_amp_band, hv_phase_band;
@@ -22,11 +27,13 @@ typedef struct {
    int other_bands[MAX_OTHER];
 } QuadPolData;
 
-QuadPolData *qpd_new(FILE *fp, meta_parameters *meta)
+QuadPolData *qpd_new(FILE *fp, meta_parameters *meta, int block)
 {
   QuadPolData *qpd = MALLOC(sizeof(QuadPolData));
   qpd->fp = fp;
   qpd->meta = meta;
+  qpd->line = 0;
+  qpd->block = block;
 
   int ok = TRUE;
   qpd->hh_amp_band = find_band(meta, "AMP-HH", &ok);
@@ -42,14 +49,14 @@ QuadPolData *qpd_new(FILE *fp, meta_parameters *meta)
       asfPrintError("Not all required bands found-- "
                     "is this SLC quad-pol data?\n");
 
-  complexFloat re1 = complex_new(1,0);
-  complexFloat im1 = complex_new(0,1);
-  qpd->r = complex_matrix_new22(re1,im1,im1,re1);
+  int ns = meta->general->sample_count;
+  qpd->buf = CALLOC(ns*block, sizeof(quadPolS2Float));
 
-  qpd->buf = CALLOC(meta->general->sample_count, sizeof(quadPolS2Float));
+  int i;
+  for (i=0; i<NUM_QP_BANDS; ++i)
+    qpd->raw[i] = MALLOC(sizeof(float)*ns*block);
 
   // find all the bands that we must "pass through" without changing
-  int i;
   for (i=0; i<MAX_OTHER; ++i)
     qpd->other_bands[i] = -1;
 
@@ -86,85 +93,248 @@ QuadPolData *qpd_new(FILE *fp, meta_parameters *meta)
 
 void qpd_free(QuadPolData *qpd)
 {
+  int i;
   FREE(qpd->buf);
-  complex_matrix_free(qpd->r);
+  for (i=0; i<NUM_QP_BANDS; ++i)
+    FREE(qpd->raw[i]);
   // do not free meta_parameters, or close the file
   FREE(qpd);
 }
 
-void qpd_get_line(QuadPolData *qpd, int line)
+// Read lines [line,line+n) of the quad pol bands (n <= block).  They are
+// converted to complex by qpd_convert_lines(), which may run in parallel.
+void qpd_get_lines(QuadPolData *qpd, int line, int n)
 {
-  // load quad pol data into the buffer
   meta_parameters *meta = qpd->meta;
-  int ns = meta->general->sample_count;
+  int bands[NUM_QP_BANDS] = {
+    qpd->hh_amp_band, qpd->hh_phase_band, qpd->hv_amp_band, qpd->hv_phase_band,
+    qpd->vh_amp_band, qpd->vh_phase_band, qpd->vv_amp_band, qpd->vv_phase_band
+  };
+  int i;
 
-  float *amp_buf = MALLOC(sizeof(float)*meta->general->sample_count);
-  float *phase_buf = MALLOC(sizeof(float)*meta->general->sample_count);
-  int k;
+  assert(n <= qpd->block);
+  for (i=0; i<NUM_QP_BANDS; ++i)
+    get_band_float_lines(qpd->fp, meta, bands[i], line, n, qpd->raw[i]);
 
-  get_band_float_line(qpd->fp, meta, qpd->hh_amp_band, line, amp_buf);
-  get_band_float_line(qpd->fp, meta, qpd->hh_phase_band, line, phase_buf);
-  for (k=0; k<ns; ++k)
-    qpd->buf[k].hh = complex_new_polar(amp_buf[k], phase_buf[k]);
+  qpd->line = line;
+}
 
-  get_band_float_line(qpd->fp, meta, qpd->hv_amp_band, line, amp_buf);
-  get_band_float_line(qpd->fp, meta, qpd->hv_phase_band, line, phase_buf);
-  for (k=0; k<ns; ++k)
-    qpd->buf[k].hv = complex_new_polar(amp_buf[k], phase_buf[k]);
-    
-  get_band_float_line(qpd->fp, meta, qpd->vh_amp_band, line, amp_buf);
-  get_band_float_line(qpd->fp, meta, qpd->vh_phase_band, line, phase_buf);
-  for (k=0; k<ns; ++k)
-    qpd->buf[k].vh = complex_new_polar(amp_buf[k], phase_buf[k]);
-    
-  get_band_float_line(qpd->fp, meta, qpd->vv_amp_band, line, amp_buf);
-  get_band_float_line(qpd->fp, meta, qpd->vv_phase_band, line, phase_buf);
-  for (k=0; k<ns; ++k)
-    qpd->buf[k].vv = complex_new_polar(amp_buf[k], phase_buf[k]);
+// Convert lines [start,end) of the block to complex.
+static void qpd_convert_lines(QuadPolData *qpd, int start, int end)
+{
+  int ns = qpd->meta->general->sample_count;
+  long k;
+  for (k=(long)start*ns; k<(long)end*ns; ++k) {
+    quadPolS2Float *q = qpd->buf + k;
+    q->hh = complex_new_polar(qpd->raw[HH_AMP][k], qpd->raw[HH_PHASE][k]);
+    q->hv = complex_new_polar(qpd->raw[HV_AMP][k], qpd->raw[HV_PHASE][k]);
+    q->vh = complex_new_polar(qpd->raw[VH_AMP][k], qpd->raw[VH_PHASE][k]);
+    q->vv = complex_new_polar(qpd->raw[VV_AMP][k], qpd->raw[VV_PHASE][k]);
+  }
+}
 
-  qpd->line = line;
+// Fixed size 2x2 complex matrices, so that the per-pixel work needs no
+// allocation.  The arithmetic is that of complex_matrix_mul().
+typedef struct {
+  complexFloat e[2][2];
+} cpx22;
+
+static inline complexFloat cf_mul(complexFloat a, complexFloat b)
+{
+  complexFloat r;
+  r.real = a.real*b.real - a.imag*b.imag;
+  r.imag = a.real*b.imag + a.imag*b.real;
+  return r;
 }
 
-static double get_omega(QuadPolData *qpd, int line, int samp)
+static inline void cpx22_mul(const cpx22 *a, const cpx22 *b, cpx22 *r)
 {
-  assert(line < qpd->meta->general->line_count);
-  assert(samp < qpd->meta->general->sample_count);
-  assert(line == qpd->line);
+  int i,j;
+  for (i=0; i<2; ++i) {
+    for (j=0; j<2; ++j) {
+      complexFloat p = cf_mul(a->e[i][0], b->e[0][j]);
+      complexFloat q = cf_mul(a->e[i][1], b->e[1][j]);
+      r->e[i][j].real = p.real + q.real;
+      r->e[i][j].imag = p.imag + q.imag;
+    }
+  }
+}
 
-  quadPolS2Float *qpf = qpd->buf + samp;
+static inline void cpx22_from_s2(const quadPolS2Float *qpf, cpx22 *m)
+{
+  m->e[0][0] = qpf->hh;
+  m->e[0][1] = qpf->hv;
+  m->e[1][0] = qpf->vh;
+  m->e[1][1] = qpf->vv;
+}
+
+static double get_omega(const quadPolS2Float *qpf)
+{
+  // r=[(1 j)(j 1)]
+  static const cpx22 r = { { { {1,0}, {0,1} }, { {0,1}, {1,0} } } };
 
   // This is the "M" matrix
-  complexMatrix *m = complex_matrix_new22(qpf->hh, qpf->hv, qpf->vh, qpf->vv);
+  cpx22 m, rm, z;
+  cpx22_from_s2(qpf, &m);
 
-  // Calculating z = r*M*r, where r=[(1 j)(j 1)]
-  complexMatrix *z = complex_matrix_mul3(qpd->r,m,qpd->r);
+  // Calculating z = r*M*r
+  cpx22_mul(&r, &m, &rm);
+  cpx22_mul(&rm, &r, &z);
 
   // omega = 1/4 arg(z12 * conj(z21))
-  float omega = 0.25 * (float)complex_arg(
-                      complex_mul(complex_matrix_get(z,0,1),
-                                 complex_conj(complex_matrix_get(z,1,0))));
+  complexFloat z21c = z.e[1][0];
+  z21c.imag = -z21c.imag;
+  float omega = 0.25 * (float)complex_arg(cf_mul(z.e[0][1], z21c));
 
   // omega = 1/4 arg(z21 * conj(z12))
   //float omega = 0.25 * (float)complex_arg(
   //                     complex_mul(complex_matrix_get(z,1,0),
   //                                complex_conj(complex_matrix_get(z,0,1))));
 
-  complex_matrix_free(z);
-  complex_matrix_free(m);
-
   return -omega;
 }
 
-static complexMatrix *make_cpx_rotation_matrix(double ang)
+static void make_cpx_rotation_matrix(double ang, cpx22 *rot)
 {
   float c = cos(ang);
   float s = sin(ang);
-  
-  complexFloat cpx_cos = complex_new(c, 0);
-  complexFloat cpx_sin = complex_new(s, 0);
-  complexFloat cpx_minus_sin = complex_new(-s, 0);
-  
-  return complex_matrix_new22(cpx_cos, cpx_minus_sin, cpx_sin, cpx_cos);
+
+  rot->e[0][0] = complex_new(c, 0);
+  rot->e[0][1] = complex_new(-s, 0);
+  rot->e[1][0] = complex_new(s, 0);
+  rot->e[1][1] = complex_new(c, 0);
+}
+
+// Lines per block: all of the per-line buffers of the correction step
+// together stay around 32 MB.
+static int farcorr_block_size(int ns, int nl)
+{
+  int block = (1 << 23) / (28*ns);
+  if (block < 1) block = 1;
+  if (block > nl) block = nl;
+  return block;
+}
+
+typedef struct {
+  QuadPolData *qpd;
+  float *omega;           /* per pixel rotation angle, degrees */
+  double *line_sum;       /* sum of the angles on each line */
+} omega_job;
+
+/* asf_parallel_fn: rotation angles for lines [start,end) of the block. */
+static void omega_lines(int start, int end, void *data)
+{
+  omega_job *job = (omega_job *) data;
+  int ns = job->qpd->meta->general->sample_count;
+  int i,j;
+
+  qpd_convert_lines(job->qpd, start, end);
+  for (i=start; i<end; ++i) {
+    double sum = 0;
+    for (j=0; j<ns; ++j) {
+      long k = (long)i*ns + j;
+      job->omega[k] = R2D * get_omega(job->qpd->buf + k);
+      sum += job->omega[k];
+    }
+    job->line_sum[i] = sum;
+  }
+}
+
+typedef struct {
+  QuadPolData *qpd;
+  meta_parameters *outMeta;
+  int do_farcorr;
+  int use_single_rotation_value;
+  double avg_omega;       /* radians */
+  const float *rotation_vals;  /* smoothed angles, degrees */
+  int save_intermediates;
+  float *res;             /* residuals */
+  float *out[NUM_QP_BANDS];
+  const float *incid;     /* for calibrate_lines() */
+  int db_flag;
+} correct_job;
+
+/* asf_parallel_fn: corrected values for lines [start,end) of the block. */
+static void correct_lines(int start, int end, void *data)
+{
+  correct_job *job = (correct_job *) data;
+  int ns = job->qpd->meta->general->sample_count;
+  float **out = job->out;
+  long k;
+
+  qpd_convert_lines(job->qpd, start, end);
+
+  for (k=(long)start*ns; k<(long)end*ns; ++k) {
+    quadPolS2Float *qpf = job->qpd->buf + k;
+
+    if (job->do_farcorr) {
+      double omega;
+      if (job->use_single_rotation_value)
+        omega = job->avg_omega;
+      else
+        omega = D2R*job->rotation_vals[k];
+
+      omega *= -1;
+
+      // This is the "M" matrix
+      cpx22 m, rot, rm, corr;
+      cpx22_from_s2(qpf, &m);
+
+      // rotate by the calculated faraday rotation angle
+      // note that make_cpx_rotation_matrix actually makes a fully real
+      // matrix, but we use the complex multiplication anyway
+      make_cpx_rotation_matrix(omega, &rot);
+      cpx22_mul(&rot, &m, &rm);
+      cpx22_mul(&rm, &rot, &corr);
+
+      out[HH_AMP][k] = complex_amp(corr.e[0][0]);
+      out[HH_PHASE][k] = complex_arg(corr.e[0][0]);
+      out[HV_AMP][k] = complex_amp(corr.e[0][1]);
+      out[HV_PHASE][k] = complex_arg(corr.e[0][1]);
+      out[VH_AMP][k] = complex_amp(corr.e[1][0]);
+      out[VH_PHASE][k] = complex_arg(corr.e[1][0]);
+      out[VV_AMP][k] = complex_amp(corr.e[1][1]);
+      out[VV_PHASE][k] = complex_arg(corr.e[1][1]);
+
+      // compute residual
+      if (job->save_intermediates)
+        job->res[k] = fabs(omega - get_omega(qpf));
+    }
+    else {
+      // do not rotate -- output same as input
+      out[HH_AMP][k] = complex_amp(qpf->hh);
+      out[HH_PHASE][k] = complex_arg(qpf->hh);
+      out[HV_AMP][k] = complex_amp(qpf->hv);
+      out[HV_PHASE][k] = complex_arg(qpf->hv);
+      out[VH_AMP][k] = complex_amp(qpf->vh);
+      out[VH_PHASE][k] = complex_arg(qpf->vh);
+      out[VV_AMP][k] = complex_amp(qpf->vv);
+      out[VV_PHASE][k] = complex_arg(qpf->vv);
+    }
+  }
+}
+
+/* asf_parallel_fn: calibrate the amplitude bands of lines [start,end) of
+   the block. */
+static void calibrate_lines(int start, int end, void *data)
+{
+  correct_job *job = (correct_job *) data;
+  meta_parameters *outMeta = job->outMeta;
+  int ns = outMeta->general->sample_count;
+  int db_flag = job->db_flag;
+  float **out = job->out;
+  int i,j;
+
+  for (i=start; i<end; ++i) {
+    for (j=0; j<ns; ++j) {
+      long k = (long)i*ns + j;
+      float incid = job->incid[j];
+      out[HH_AMP][k] = get_cal_dn(outMeta, incid, j, out[HH_AMP][k], "HH", db_flag);
+      out[HV_AMP][k] = get_cal_dn(outMeta, incid, j, out[HV_AMP][k], "HV", db_flag);
+      out[VH_AMP][k] = get_cal_dn(outMeta, incid, j, out[VH_AMP][k], "VH", db_flag);
+      out[VV_AMP][k] = get_cal_dn(outMeta, incid, j, out[VV_AMP][k], "VV", db_flag);
+    }
+  }
 }
 
 static void do_append(const char *file, const char *append_file,
@@ -271,10 +441,11 @@ void faraday_correct(const char *inFile, const char *outFile, double threshold,
 
   // STEP 1: Calculate the Faraday Rotation angle at each pixel
   //         and generate an output .img
+  int block = farcorr_block_size(ns, nl);
   FILE *fin = fopenImage(in_img_name, "rb");
-  QuadPolData *qpd = qpd_new(fin, inMeta);
+  QuadPolData *qpd = qpd_new(fin, inMeta, block);
 
-  float *buf = MALLOC(sizeof(float)*ns);
+  float *buf = MALLOC(sizeof(float)*ns*block);
   meta_parameters *rotMeta = NULL;
   FILE *fout = NULL;
 
@@ -305,20 +476,26 @@ void faraday_correct(const char *inFile, const char *outFile, double threshold,
   double avg_omega = 0;
 
   // now loop through the lines/samples of the image, calculating
-  // the faraday rotation angle
+  // the faraday rotation angle, a block of lines at a time
   int i,j;
-  for (i=0; i<nl; ++i) {
-    asfLineMeter(i,nl);
-    qpd_get_line(qpd,i);
-
-    for (j=0; j<ns; ++j) {
-      buf[j] = R2D * get_omega(qpd, i, j);
-      avg_omega += buf[j];
-    }
+  double *line_sum = MALLOC(sizeof(double)*block);
+  omega_job ojob;
+  ojob.qpd = qpd;
+  ojob.omega = buf;
+  ojob.line_sum = line_sum;
+  for (i=0; i<nl; i+=block) {
+    int n = i+block > nl ? nl-i : block;
+    qpd_get_lines(qpd, i, n);
+    asf_parallel_for(n, 1, omega_lines, &ojob);
+
+    for (j=0; j<n; ++j)
+      avg_omega += line_sum[j];
 
     if (save_rot_img)
-      put_float_line(fout, rotMeta, i, buf);
+      put_float_lines(fout, rotMeta, i, n, buf);
+    asfLineMeter(i+n-1,nl);
   }
+  FREE(line_sum);
 
   FCLOSE(fin);
   fin = NULL;
@@ -386,7 +563,7 @@ void faraday_correct(const char *inFile, const char *outFile, double threshold,
   // Opening the data files...
   fin = fopenImage(in_img_name, "rb");
   fout = fopenImage(out_img_name, "wb");
-  qpd = qpd_new(fin, inMeta);
+  qpd = qpd_new(fin, inMeta, block);
     
   // generate the output metadata
   char *out_meta_name = appendExt(outFile, ".meta");
@@ -456,24 +633,19 @@ void faraday_correct(const char *inFile, const char *outFile, double threshold,
   float *rotation_vals = NULL;
   if (!use_single_rotation_value) {
     fprot = fopenImage(smoothed_img_name, "rb");
-    rotation_vals = MALLOC(sizeof(float)*ns);
+    rotation_vals = MALLOC(sizeof(float)*ns*block);
   }
     
-  float *hh_amp = MALLOC(sizeof(float)*ns);
-  float *hh_phase = MALLOC(sizeof(float)*ns);
-  float *hv_amp = MALLOC(sizeof(float)*ns);
-  float *hv_phase = MALLOC(sizeof(float)*ns);
-  float *vh_amp = MALLOC(sizeof(float)*ns);
-  float *vh_phase = MALLOC(sizeof(float)*ns);
-  float *vv_amp = MALLOC(sizeof(float)*ns);
-  float *vv_phase = MALLOC(sizeof(float)*ns);
+  float *out[NUM_QP_BANDS];
+  for (i=0; i<NUM_QP_BANDS; ++i)
+    out[i] = MALLOC(sizeof(float)*ns*block);
     
   // residuals, if user has asked for them
   float *res = NULL;
   FILE *fpres = NULL;
   meta_parameters *resMeta = NULL;
   if (save_intermediates && do_farcorr) {
-    res = MALLOC(sizeof(float)*ns);
+    res = MALLOC(sizeof(float)*ns*block);
     fpres = fopenImage(residuals_img_name, "wb");
     
     // metadata for the residuals file
@@ -491,111 +663,54 @@ void faraday_correct(const char *inFile, const char *outFile, double threshold,
   if (output_radiometry != r_AMP)
     incid = incid_init(inMeta);
     
-  // now iterate through the input image's pixels...
-  for (i=0; i<nl; ++i) {
-    asfLineMeter(i,nl);
-    qpd_get_line(qpd,i);
-
-    if (do_farcorr) {
-      if (!use_single_rotation_value)
-        get_float_line(fprot, rotMeta, i, rotation_vals);
-      
-      for (j=0; j<ns; ++j) {
-        double omega;
-        if (use_single_rotation_value)
-          omega = avg_omega;
-        else
-          omega = D2R*rotation_vals[j];
-        
-        omega *= -1;
-        quadPolS2Float *qpf = qpd->buf + j;
-        
-        // This is the "M" matrix
-        complexMatrix *m =
-          complex_matrix_new22(qpf->hh, qpf->hv, qpf->vh, qpf->vv);
-        
-        // rotate by the calculated faraday rotation angle
-        // note that make_cpx_rotation_matrix actually makes a fully real
-        // matrix, but we want to use the cpx matrix multiplication fns
-        complexMatrix *rot = make_cpx_rotation_matrix(omega);
-        complexMatrix *corr = complex_matrix_mul3(rot,m,rot);
-        complex_matrix_free(rot);
-        
-        // save corrected values in an array for use with put_float_line()
-        complexFloat c = complex_matrix_get(corr, 0, 0);
-        hh_amp[j] = complex_amp(c);
-        hh_phase[j] = complex_arg(c);
-        
-        c = complex_matrix_get(corr, 0, 1);
-        hv_amp[j] = complex_amp(c);
-        hv_phase[j] = complex_arg(c);
-        
-        c = complex_matrix_get(corr, 1, 0);
-        vh_amp[j] = complex_amp(c);
-        vh_phase[j] = complex_arg(c);
-        
-        c = complex_matrix_get(corr, 1, 1);
-        vv_amp[j] = complex_amp(c);
-        vv_phase[j] = complex_arg(c);
-        
-        complex_matrix_free(m);
-        complex_matrix_free(corr);
-        
-        // compute residual
-        if (save_intermediates)
-          res[j] = fabs(omega - get_omega(qpd, i, j));
-      }
-      
-      // dump a corrected image before calibration, for debugging
-      if (fpdbg) {
-        put_band_float_line(fpdbg, dbgMeta, 0, i, hh_amp);
-        put_band_float_line(fpdbg, dbgMeta, 1, i, hh_phase);
-        put_band_float_line(fpdbg, dbgMeta, 2, i, hv_amp);
-        put_band_float_line(fpdbg, dbgMeta, 3, i, hv_phase);
-        put_band_float_line(fpdbg, dbgMeta, 4, i, vh_amp);
-        put_band_float_line(fpdbg, dbgMeta, 5, i, vh_phase);
-        put_band_float_line(fpdbg, dbgMeta, 6, i, vv_amp);
-        put_band_float_line(fpdbg, dbgMeta, 7, i, vv_phase);
-      }
-    }
-    else {
-      // do not rotate -- output same as input
-      for (j=0; j<ns; ++j) {
-        quadPolS2Float *qpf = qpd->buf + j;
-        hh_amp[j] = complex_amp(qpf->hh);
-        hh_phase[j] = complex_arg(qpf->hh);
-        hv_amp[j] = complex_amp(qpf->hv);
-        hv_phase[j] = complex_arg(qpf->hv);
-        vh_amp[j] = complex_amp(qpf->vh);
-        vh_phase[j] = complex_arg(qpf->vh);
-        vv_amp[j] = complex_amp(qpf->vv);
-        vv_phase[j] = complex_arg(qpf->vv);
-      }
-    }
+  correct_job cjob;
+  cjob.qpd = qpd;
+  cjob.outMeta = outMeta;
+  cjob.do_farcorr = do_farcorr;
+  cjob.use_single_rotation_value = use_single_rotation_value;
+  cjob.avg_omega = avg_omega;
+  cjob.rotation_vals = rotation_vals;
+  cjob.save_intermediates = save_intermediates;
+  cjob.res = res;
+  for (j=0; j<NUM_QP_BANDS; ++j)
+    cjob.out[j] = out[j];
+  cjob.incid = incid;
+  cjob.db_flag = db_flag;
+
+  int out_bands[NUM_QP_BANDS] = {
+    qpd->hh_amp_band, qpd->hh_phase_band, qpd->hv_amp_band, qpd->hv_phase_band,
+    qpd->vh_amp_band, qpd->vh_phase_band, qpd->vv_amp_band, qpd->vv_phase_band
+  };
+
+  // now iterate through the input image's pixels, a block of lines at
+  // a time...
+  for (i=0; i<nl; i+=block) {
+    int n = i+block > nl ? nl-i : block;
+    qpd_get_lines(qpd, i, n);
+
+    if (do_farcorr && !use_single_rotation_value)
+      get_float_lines(fprot, rotMeta, i, n, rotation_vals);
+
+    asf_parallel_for(n, 1, correct_lines, &cjob);
+
+    // dump a corrected image before calibration, for debugging
+    if (fpdbg)
+      for (j=0; j<NUM_QP_BANDS; ++j)
+        put_band_float_lines(fpdbg, dbgMeta, j, i, n, out[j]);
 
     // apply calibration to amplitude bands, if necessary
-    if (output_radiometry != r_AMP) {
-      for (j=0; j<ns; ++j) {
-        hh_amp[j] =  get_cal_dn(outMeta, incid[j], j, hh_amp[j], "HH", db_flag);
-        hv_amp[j] =  get_cal_dn(outMeta, incid[j], j, hv_amp[j], "HV", db_flag);
-        vh_amp[j] =  get_cal_dn(outMeta, incid[j], j, vh_amp[j], "VH", db_flag);
-        vv_amp[j] =  get_cal_dn(outMeta, incid[j], j, vv_amp[j], "VV", db_flag);
-      }
-    }
-      
+    if (output_radiometry != r_AMP)
+      asf_parallel_for(n, 1, calibrate_lines, &cjob);
+
     // write out all 8 bands of the output...
-    put_band_float_line(fout, outMeta, qpd->hh_amp_band, i, hh_amp);
-    put_band_float_line(fout, outMeta, qpd->hh_phase_band, i, hh_phase);
-    put_band_float_line(fout, outMeta, qpd->hv_amp_band, i, hv_amp);
-    put_band_float_line(fout, outMeta, qpd->hv_phase_band, i, hv_phase);
-    put_band_float_line(fout, outMeta, qpd->vh_amp_band, i, vh_amp);
-    put_band_float_line(fout, outMeta, qpd->vh_phase_band, i, vh_phase);
-    put_band_float_line(fout, outMeta, qpd->vv_amp_band, i, vv_amp);
-    put_band_float_line(fout, outMeta, qpd->vv_phase_band, i, vv_phase);
-    
+    for (j=0; j<NUM_QP_BANDS; ++j)
+      put_band_float_lines(fout, outMeta, out_bands[j], i, n, out[j]);
+
     // write out residuals
     if (do_farcorr && save_intermediates)
-      put_float_line(fpres, resMeta, i, res);
+      put_float_lines(fpres, resMeta, i, n, res);
+
+    asfLineMeter(i+n-1,nl);
   }
     
   // now the "pass through" bands (not part of the quad-pol data)
@@ -631,14 +746,8 @@ void faraday_correct(const char *inFile, const char *outFile, double threshold,
   if (incid)
     FREE(incid);
   
-  FREE(hh_amp);
-  FREE(hh_phase);
-  FREE(hv_amp);
-  FREE(hv_phase);
-  FREE(vh_amp);
-  FREE(vh_phase);
-  FREE(vv_amp);
-  FREE(vv_phase);
+  for (i=0; i<NUM_QP_BANDS; ++i)
+    FREE(out[i]);
   FREE(res);
     
   if (save_intermediates) {
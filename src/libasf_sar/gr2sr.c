@@ -30,10 +30,14 @@ BUGS:
 
 #define VERSION 0.1
 
-static void gr2sr_vec(meta_parameters *meta, float srinc, float *gr2sr,
-                      int apply_pp_earth_radius_fix)
+/* Fills in gr2sr (if not NULL) up to the output width, which it returns:
+   the last slant range sample whose ground range is still in the input
+   (np samples). */
+static int gr2sr_vec(meta_parameters *meta, float srinc, int np, float *gr2sr,
+                     int apply_pp_earth_radius_fix)
 {
   int    i;             /* Counter                                       */
+  int    onp = 0;       /* Output width                                  */
   float  r_sc;          /* radius from center of the earth for satellite */
   float  r_earth;       /* radius of the earth                           */
   float  r_close;       /* near slant range distance                     */
@@ -62,12 +66,18 @@ static void gr2sr_vec(meta_parameters *meta, float srinc, float *gr2sr,
   y = r_close/r_earth;
   rg0 = r_earth * acos((1.0 + x2 - y*y) / (2.0*x));
   /* begin loop */
-  for(i = 0; i<MAX_IMG_SIZE; i++) {
+  for(i = 0; ; i++) {
     rslant = r_close + i *srinc;
     y = rslant/r_earth;
     rg = r_earth*acos((1.0+x2-y*y)/(2.0*x));
-    gr2sr[i] = (rg - rg0)/grinc;
+    float v = (rg - rg0)/grinc;
+    if (!(v < np)) break; /* gr input is off end of image-- stop sr output */
+    if (i == MAX_RESAMPLE_SIZE)
+      asfPrintError("gr2sr: more than %d output samples\n", MAX_RESAMPLE_SIZE);
+    if (gr2sr) gr2sr[i] = v;
+    onp = i;              /* gr input still in range-- keep output */
   }
+  return onp;
 }
 
 static void update_doppler(int in_np, int out_np, float *gr2sr, meta_parameters *meta)
@@ -163,6 +173,28 @@ static char * replExt(const char *filename, const char *ext)
   return ret;
 }
 
+typedef struct {
+  int    np, onp;
+  int   *lower, *upper;
+  float *lfrac, *ufrac;
+  float *inBuf;          /* block of input lines  */
+  float *outBuf;         /* block of output lines */
+} gr2sr_job;
+
+/* asf_parallel_fn: resample lines [start,end) of the current block. */
+static void gr2sr_lines(int start, int end, void *data)
+{
+  gr2sr_job *job = (gr2sr_job *) data;
+  int line, ii;
+  for (line = start; line < end; line++) {
+    const float *inBuf = job->inBuf + (long)line*job->np;
+    float *outBuf = job->outBuf + (long)line*job->onp;
+    for (ii=0; ii<job->onp; ii++) /* resample to slant range */
+      outBuf[ii] = inBuf[job->lower[ii]]*job->lfrac[ii] +
+                   inBuf[job->upper[ii]]*job->ufrac[ii];
+  }
+}
+
 static int gr2sr_pixsiz_imp(const char *infile, const char *outfile,
                             float srPixSize, int apply_pp_earth_radius_fix)
 {
@@ -182,16 +214,11 @@ static int gr2sr_pixsiz_imp(const char *infile, const char *outfile,
   float *outBuf;         /* Output buffer                 */
   FILE  *fpi, *fpo;      /* File pointers                 */
   int   line;            /* Loop counter                  */
+  int   block;           /* Lines per block               */
   int   band;            /* Loop counter                  */
   char  *iimgfile;       /* .img input file               */
   char  *oimgfile;       /* .img output file              */
  
-  gr2sr = (float *) MALLOC(sizeof(float) * MAX_IMG_SIZE);
-  upper = (int *) MALLOC(sizeof(int) * MAX_IMG_SIZE);
-  lower = (int *) MALLOC(sizeof(int) * MAX_IMG_SIZE);
-  ufrac = (float *) MALLOC(sizeof(float) * MAX_IMG_SIZE);
-  lfrac = (float *) MALLOC(sizeof(float) * MAX_IMG_SIZE);
-
   inMeta = meta_read(infile);
 
   if (srPixSize < 0) {
@@ -212,6 +239,11 @@ static int gr2sr_pixsiz_imp(const char *infile, const char *outfile,
       inMeta->general->sample_count / osc);
   }
 
+  if (srPixSize <= 0 || inMeta->general->x_pixel_size <= 0)
+    asfPrintError("gr2sr: pixel sizes must be positive "
+                  "(input %g, output %g)\n",
+                  inMeta->general->x_pixel_size, srPixSize);
+
   nl = inMeta->general->line_count;
   np = inMeta->general->sample_count;
   nBands = inMeta->general->band_count;
@@ -219,18 +251,19 @@ static int gr2sr_pixsiz_imp(const char *infile, const char *outfile,
   char **band_name = extract_band_names(inMeta->general->bands, nBands);
 
   onl=nl;
-  gr2sr_vec(inMeta, srPixSize, gr2sr, apply_pp_earth_radius_fix);
-  
-  /* Determine the output image size */
-  onp = 0;
-  for (ii=0; ii<MAX_IMG_SIZE; ii++) {
-     if (gr2sr[ii]<np) onp=ii; /* gr input still in range-- keep output */
-     else break; /* gr input is off end of image-- stop sr output */
-  }
+
+  /* Determine the output image size, then build the vector */
+  onp = gr2sr_vec(inMeta, srPixSize, np, NULL, apply_pp_earth_radius_fix);
+  gr2sr = (float *) MALLOC(sizeof(float) * (onp+1));
+  gr2sr_vec(inMeta, srPixSize, np, gr2sr, apply_pp_earth_radius_fix);
   asfPrintStatus("Input image is %dx%d\n", nl, np);
   asfPrintStatus("Output image will be %dx%d\n", onl, onp);
   
-  /* Split gr2sr into resampling coefficients */
+  /* Split gr2sr into resampling coefficients, once for all the bands */
+  upper = (int *) MALLOC(sizeof(int) * onp);
+  lower = (int *) MALLOC(sizeof(int) * onp);
+  ufrac = (float *) MALLOC(sizeof(float) * onp);
+  lfrac = (float *) MALLOC(sizeof(float) * onp);
   for (ii=0; ii<onp; ii++) {
      lower[ii] = (int) gr2sr[ii];
      upper[ii] = lower[ii] + 1;
@@ -257,20 +290,37 @@ static int gr2sr_pixsiz_imp(const char *infile, const char *outfile,
 
   fpi = FOPEN(iimgfile,"rb");
   fpo = FOPEN(oimgfile,"wb");
-  inBuf = (float *) MALLOC (np*sizeof(float));
-  outBuf = (float *) MALLOC (onp*sizeof(float));
-
-  for (band = 0; band < nBands; band++) {
-    if (inMeta->general->band_count != 1)
-      asfPrintStatus("Converting to slant range: band %s\n", band_name[band]);
-    for (line = 0; line < onl; line++) {
-      get_float_line(fpi, inMeta, line + band*onl, inBuf);
-      for (ii=0; ii<onp; ii++) { /* resample to slant range */
-         outBuf[ii] = inBuf[lower[ii]]*lfrac[ii]+inBuf[upper[ii]]*ufrac[ii];
-      }
-      put_float_line(fpo,outMeta,line + band*onl,outBuf);
-      asfLineMeter(line,onl);
+  block = (1 << 22) / (np + onp);
+  if (block < 1) block = 1;
+  if (block > onl) block = onl;
+  inBuf = (float *) MALLOC (sizeof(float)*np*block);
+  outBuf = (float *) MALLOC (sizeof(float)*onp*block);
+
+  gr2sr_job job;
+  job.np = np;
+  job.onp = onp;
+  job.lower = lower;
+  job.upper = upper;
+  job.lfrac = lfrac;
+  job.ufrac = ufrac;
+  job.inBuf = inBuf;
+  job.outBuf = outBuf;
+
+  /* One pass over the lines, a block at a time, doing every band */
+  if (nBands > 1) {
+    asfPrintStatus("Converting to slant range: bands");
+    for (band = 0; band < nBands; band++)
+      asfPrintStatus(" %s", band_name[band]);
+    asfPrintStatus("\n");
+  }
+  for (line = 0; line < onl; line += block) {
+    int n = line + block > onl ? onl - line : block;
+    for (band = 0; band < nBands; band++) {
+      get_band_float_lines(fpi, inMeta, band, line, n, inBuf);
+      asf_parallel_for(n, 16, gr2sr_lines, &job);
+      put_band_float_lines(fpo, outMeta, band, line, n, outBuf);
     }
+    asfLineMeter(line + n - 1, onl);
   }
 
   for (ii=0; ii < inMeta->general->band_count; ii++)
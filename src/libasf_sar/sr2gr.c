@@ -19,15 +19,23 @@ DESCRIPTION:
 
 #define FUDGE_FACTOR 2
 
-/*Create vector for multilooking.*/
-static void ml_vec(float oldSize, float newSize,float *ml)
+/*Create vector for multilooking.  Returns the number of output lines,
+  the first at which the vector goes past the input's last line; the
+  vector is only filled if ml is not NULL.*/
+static int ml_vec(float oldSize, float newSize, int in_nl, float *ml)
 {
 	float  gr=0;
 	int    ii;
-	
-	for (ii=0; ii<MAX_IMG_SIZE; ii++)
+
+	for (ii=0; ; ii++)
 	{
-		ml[ii]=gr/oldSize;
+		float v = gr/oldSize;
+		if (ii > 0 && (int)v > in_nl)
+			return ii;
+		if (ii == MAX_RESAMPLE_SIZE)
+			asfPrintError("sr2gr: more than %d output lines\n",
+				      MAX_RESAMPLE_SIZE);
+		if (ml) ml[ii]=v;
 		gr+=newSize;
 	}
 }
@@ -48,7 +56,7 @@ static void ml_vec(float oldSize, float newSize,float *ml)
                  grinc = ground range increment in meters (real*4)
                          For ASF = 12.5meters
  
-        Output:    sr2gr = 8k (real*4) vector that contains the interpolation
+        Output:    sr2gr = (real*4) vector that contains the interpolation
                           points for slant range to ground range conversion.
                           The first element is always 0, which means the first
                           interpolation point is at r_close.  This vector
@@ -75,10 +83,13 @@ static void ml_vec(float oldSize, float newSize,float *ml)
     (grinc) is used to calculate the slant range to the interpolation points.
     Finally the interpolation points are normalized to slant range bins by
     dividing by the slant range bin size, rsinc.
+
+    Returns the number of output samples, the first at which the vector
+    goes past the input's last sample; sr2gr is only filled if not NULL.
 */
 
-static void sr2gr_vec(meta_parameters *meta, float srinc, float newSize,
-                      float *sr2gr)
+static int sr2gr_vec(meta_parameters *meta, float srinc, float newSize,
+                     int in_np, float *sr2gr)
 {
     double rg,rg0;/*Ground range distances from nadir, along curve of earth.*/
     double ht,re,sr;/*S/C height, earth radius, slant range [m]*/
@@ -93,10 +104,16 @@ static void sr2gr_vec(meta_parameters *meta, float srinc, float newSize,
     
     /* begin loop */
     rg = rg0;
-    for (ii = 0; ii<MAX_IMG_SIZE; ii++)
+    for (ii = 0; ; ii++)
     {
         double this_slant = sqrt(ht*ht+re*re-2.0*ht*re*cos(rg/re));
-        sr2gr[ii] = (this_slant - sr) / srinc;
+        float v = (this_slant - sr) / srinc;
+        if (ii > 0 && (int)v > in_np)
+            return ii;
+        if (ii == MAX_RESAMPLE_SIZE)
+            asfPrintError("sr2gr: more than %d output samples\n",
+                          MAX_RESAMPLE_SIZE);
+        if (sr2gr) sr2gr[ii] = v;
         rg += newSize;
     }
 }
@@ -216,19 +233,67 @@ static void update_doppler(int in_np, int out_np, float *sr2gr, meta_parameters
           meta->sar->range_doppler_coefficients[2] = c2;
 }
 
+typedef struct {
+	int    out_np;
+	int    in_stride;     /* in_np+FUDGE_FACTOR, the padding is zero */
+	int    first_line;    /* output line of the first line in obuf */
+	int   *slot;          /* row in ibuf of each line's a_src, for the block */
+	int   *a_src;         /* input line pair used by each output line */
+	float *a_lfrac, *a_ufrac;
+	int   *lower, *upper;
+	float *lfrac, *ufrac;
+	float *zero;          /* used before any input line pair is valid */
+	float *ibuf;          /* input line pairs of the block, current band */
+	float *obuf;          /* block of output lines */
+} sr2gr_job;
+
+/* asf_parallel_fn: resample lines [start,end) of the current block. */
+static void sr2gr_lines(int start, int end, void *data)
+{
+	sr2gr_job *job = (sr2gr_job *) data;
+	int jj, ii;
+
+	for (jj=start; jj<end; jj++)
+	{
+		int line = job->first_line + jj;
+		int src = job->a_src[line];
+		const float *ibuf1, *ibuf2;
+		if (src < 0)
+			ibuf1 = ibuf2 = job->zero;
+		else {
+			ibuf1 = job->ibuf + (long)job->slot[jj]*job->in_stride;
+			ibuf2 = ibuf1 + job->in_stride;
+		}
+		float *obuf = job->obuf + (long)jj*job->out_np;
+
+		for (ii=0; ii<job->out_np; ii++)
+		{
+			float val00,val01,val10,val11,tmp1,tmp2;
+			val00 = ibuf1[job->lower[ii]];
+			val01 = ibuf1[job->upper[ii]];
+			val10 = ibuf2[job->lower[ii]];
+			val11 = ibuf2[job->upper[ii]];
+
+			tmp1 = val00*job->lfrac[ii] + val01*job->ufrac[ii];
+			tmp2 = val10*job->lfrac[ii] + val11*job->ufrac[ii];
+
+			obuf[ii] = tmp1*job->a_lfrac[line] + tmp2*job->a_ufrac[line];
+		}
+	}
+}
+
 int sr2gr_pixsiz(const char *infile, const char *outfile, float grPixSize)
 {
 	int    in_np,  in_nl;               /* input number of pixels,lines  */
 	int    out_np, out_nl;              /* output number of pixels,lines */
 	int    ii,line,band;
 	float  oldX,oldY;
-	float  sr2gr[MAX_IMG_SIZE];
-	float  ml2gr[MAX_IMG_SIZE];
-	int    a_lower[MAX_IMG_SIZE];
-	int    lower[MAX_IMG_SIZE], upper[MAX_IMG_SIZE];
-	float  a_ufrac[MAX_IMG_SIZE], a_lfrac[MAX_IMG_SIZE];
-	float  ufrac[MAX_IMG_SIZE], lfrac[MAX_IMG_SIZE];
-	float *ibuf1,*ibuf2,*obuf;
+	float *sr2gr, *ml2gr;
+	int   *a_lower, *a_src;
+	int   *lower, *upper;
+	float *a_ufrac, *a_lfrac;
+	float *ufrac, *lfrac;
+	float *ibuf,*obuf,*zero;
 	char   infile_name[512],inmeta_name[512];
 	char   outfile_name[512],outmeta_name[512];
 	FILE  *fpi, *fpo;
@@ -255,6 +320,9 @@ int sr2gr_pixsiz(const char *infile, const char *outfile, float grPixSize)
            the y pixel size unchanged */
         if (grPixSize < 0)
             grPixSize = oldY;
+        if (grPixSize <= 0 || oldX <= 0 || oldY <= 0)
+            asfPrintError("sr2gr: pixel sizes must be positive "
+                          "(input %g x %g, output %g)\n", oldX, oldY, grPixSize);
 
         printf("Entering sr2gr_pixsiz\n");
         printf("\tinfile %s\n",infile);
@@ -285,17 +353,15 @@ int sr2gr_pixsiz(const char *infile, const char *outfile, float grPixSize)
 	out_meta->sar->image_type       = 'G'; 
 	out_meta->general->x_pixel_size = grPixSize;
 	out_meta->general->y_pixel_size = grPixSize;
-	sr2gr_vec(out_meta,oldX,grPixSize,sr2gr);
-	ml_vec(oldY,grPixSize,ml2gr);
-
-	out_np = MAX_IMG_SIZE;
-	out_nl = MAX_IMG_SIZE;
-	for (ii=MAX_IMG_SIZE-1; ii>0; ii--)
-		if ((int)sr2gr[ii] > in_np)
-			out_np = ii;
-	for (ii=MAX_IMG_SIZE-1; ii>0; ii--)
-		if ((int)ml2gr[ii] > in_nl)
-			out_nl = ii;
+
+	/*The vectors are sized to the output image: one pass to find it,
+	  one to fill them in.*/
+	out_np = sr2gr_vec(out_meta,oldX,grPixSize,in_np,NULL);
+	out_nl = ml_vec(oldY,grPixSize,in_nl,NULL);
+	sr2gr = (float *) MALLOC(sizeof(float)*out_np);
+	ml2gr = (float *) MALLOC(sizeof(float)*out_nl);
+	sr2gr_vec(out_meta,oldX,grPixSize,in_np,sr2gr);
+	ml_vec(oldY,grPixSize,in_nl,ml2gr);
 
 	out_meta->general->line_count   = out_nl;
         out_meta->general->line_scaling *= (double)in_nl/(double)out_nl;
@@ -315,59 +381,117 @@ int sr2gr_pixsiz(const char *infile, const char *outfile, float grPixSize)
 	
 	fpi = fopenImage(infile_name,"rb");
 	fpo = fopenImage(outfile_name,"wb");
-	
-	for (ii=0; ii<MAX_IMG_SIZE; ii++)
+
+	/*Integer indices and weights, computed once for all the bands.*/
+	lower = (int *) MALLOC(sizeof(int)*out_np);
+	upper = (int *) MALLOC(sizeof(int)*out_np);
+	ufrac = (float *) MALLOC(sizeof(float)*out_np);
+	lfrac = (float *) MALLOC(sizeof(float)*out_np);
+	for (ii=0; ii<out_np; ii++)
 	{
 		lower[ii] = (int) sr2gr[ii];
 		upper[ii] = lower[ii] + 1;
 		ufrac[ii] = sr2gr[ii] - (float) lower[ii];
 		lfrac[ii] = 1.0 - ufrac[ii]; 
-		
-		a_lower[ii] = (int) ml2gr[ii];
-		a_ufrac[ii] = ml2gr[ii] - (float) a_lower[ii];
-		a_lfrac[ii] = 1.0 - a_ufrac[ii]; 
 	}
 
-	ibuf1 = (float *) MALLOC ((in_np+FUDGE_FACTOR)*sizeof(float));
-	ibuf2 = (float *) MALLOC ((in_np+FUDGE_FACTOR)*sizeof(float));
-	obuf = (float *) MALLOC (out_np*sizeof(float));
+	/*Each output line interpolates between input lines a_src and
+	  a_src+1.  Past the last full pair of input lines, the last pair is
+	  reused; a_src is -1 (all zeros) if there is no pair at all.*/
+	a_lower = (int *) MALLOC(sizeof(int)*out_nl);
+	a_src = (int *) MALLOC(sizeof(int)*out_nl);
+	a_ufrac = (float *) MALLOC(sizeof(float)*out_nl);
+	a_lfrac = (float *) MALLOC(sizeof(float)*out_nl);
+	int src = -1;
+	for (line=0; line<out_nl; line++)
+	{
+		a_lower[line] = (int) ml2gr[line];
+		a_ufrac[line] = ml2gr[line] - (float) a_lower[line];
+		a_lfrac[line] = 1.0 - a_ufrac[line]; 
+		if (a_lower[line]+1 < in_nl)
+			src = a_lower[line];
+		a_src[line] = src;
+	}
+
+	/*Blocks of output lines.  Only the input line pairs a block uses
+	  are read, so a block never needs more than two input rows per
+	  output line, however much the lines are downsampled.*/
+	int in_stride = in_np+FUDGE_FACTOR;
+	int block = (1 << 22) / (2*in_stride + out_np);
+	if (block < 1) block = 1;
+	if (block > out_nl) block = out_nl;
+	int max_rows = 2*block;
+	int *rows = (int *) MALLOC(sizeof(int)*max_rows);
+	int *slot = (int *) MALLOC(sizeof(int)*block);
+
+	ibuf = (float *) MALLOC (sizeof(float)*in_stride*max_rows);
+	obuf = (float *) MALLOC (sizeof(float)*out_np*block);
+	zero = (float *) MALLOC (sizeof(float)*in_stride);
 
 	/* Initialize input arrays to 0 */
-	for (ii=0;ii<in_np+FUDGE_FACTOR;ii++) {
-		ibuf1[ii]=ibuf2[ii]=0.0;
-	}
+	for (ii=0;ii<in_stride*max_rows;ii++)
+		ibuf[ii]=0.0;
+	for (ii=0;ii<in_stride;ii++)
+		zero[ii]=0.0;
+
+	sr2gr_job job;
+	job.out_np = out_np;
+	job.in_stride = in_stride;
+	job.a_src = a_src;
+	job.a_lfrac = a_lfrac;
+	job.a_ufrac = a_ufrac;
+	job.lower = lower;
+	job.upper = upper;
+	job.lfrac = lfrac;
+	job.ufrac = ufrac;
+	job.slot = slot;
+	job.zero = zero;
+	job.ibuf = ibuf;
+	job.obuf = obuf;
 
         /* Get the band info */
         int bc = in_meta->general->band_count;
         char **band_name = extract_band_names(in_meta->general->bands, bc);
 
-	/* Work dat magic! */
-        for (band=0; band<bc; ++band) {
-          asfPrintStatus("Working on band: %s\n", band_name[band]);
-          for (line=0; line<out_nl; line++)
+	/* Work dat magic!  One pass over the output, a block of lines at a
+	   time, doing every band of each block. */
+        if (bc > 1) {
+          asfPrintStatus("Working on bands:");
+          for (band=0; band<bc; ++band)
+            asfPrintStatus(" %s", band_name[band]);
+          asfPrintStatus("\n");
+        }
+        for (line=0; line<out_nl; line+=block)
+        {
+          int n = line+block > out_nl ? out_nl-line : block;
+          int jj, nrows = 0;
+          job.first_line = line;
+
+          /* a_src does not decrease, so the pairs come in order, and
+             a_src and a_src+1 always end up next to each other. */
+          for (jj=0; jj<n; jj++)
           {
-            if (a_lower[line]+1 < in_nl)
-            {
-              get_band_float_line(fpi,in_meta,band,a_lower[line],  ibuf1);
-              get_band_float_line(fpi,in_meta,band,a_lower[line]+1,ibuf2);
-            }
-            
-            for (ii=0; ii<out_np; ii++)
-            {
-              float val00,val01,val10,val11,tmp1,tmp2;
-              val00 = ibuf1[lower[ii]];
-              val01 = ibuf1[upper[ii]];
-              val10 = ibuf2[lower[ii]];
-              val11 = ibuf2[upper[ii]];
-              
-              tmp1 = val00*lfrac[ii] + val01*ufrac[ii];
-              tmp2 = val10*lfrac[ii] + val11*ufrac[ii];
-              
-              obuf[ii] = tmp1*a_lfrac[line] + tmp2*a_ufrac[line];
-            }
-            put_band_float_line(fpo,out_meta,band,line,obuf);
-            asfLineMeter(line, out_nl);
+            int src = a_src[line+jj];
+            if (src < 0)
+              continue;
+            if (nrows == 0 || rows[nrows-1] < src)
+              rows[nrows++] = src;
+            if (rows[nrows-1] == src)
+              rows[nrows++] = src+1;
+            slot[jj] = nrows-2;
           }
+
+          for (band=0; band<bc; ++band)
+          {
+            int row;
+            for (row=0; row<nrows; row++)
+              get_band_float_line(fpi,in_meta,band,rows[row],
+                                  ibuf + (long)row*in_stride);
+
+            asf_parallel_for(n, 8, sr2gr_lines, &job);
+            put_band_float_lines(fpo,out_meta,band,line,n,obuf);
+          }
+          asfLineMeter(line+n-1, out_nl);
         }
         for (band=0; band<bc; ++band)
           FREE(band_name[band]);
@@ -376,7 +500,22 @@ int sr2gr_pixsiz(const char *infile, const char *outfile, float grPixSize)
         meta_free(out_meta);
 	FCLOSE(fpi);
 	FCLOSE(fpo);
+
+	FREE(sr2gr);
+	FREE(ml2gr);
+	FREE(lower);
+	FREE(upper);
+	FREE(ufrac);
+	FREE(lfrac);
+	FREE(a_lower);
+	FREE(a_src);
+	FREE(a_ufrac);
+	FREE(a_lfrac);
+	FREE(rows);
+	FREE(slot);
+	FREE(ibuf);
+	FREE(obuf);
+	FREE(zero);
 	
         return TRUE;
 }
-
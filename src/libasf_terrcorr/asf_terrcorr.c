@@ -1205,6 +1205,7 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
     which_dem = BACKCONVERTED_GR_DEM;
 
   asfPrintStatus("Starting terrain correction pre-processing.\n");
+  asf_trace_begin("asf_terrcorr");
   asfPrintStatus("Interplation method: %s\n",
                  use_nearest_neighbor ? "Nearest Neighbor" : "Bilinear");
 
@@ -1533,17 +1534,20 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
   demTrimSlant = getOutName(output_dir, demChunk, "_slant_trim");
   demGround = getOutName(output_dir, demFile, "_ground");
 
+  asf_trace_begin("match_dem");
   match_dem(metaSAR, sarFile, demChunk, srFile, output_dir, userMaskFile,
         demTrimSimSar, demTrimSlant, demGround, userMaskClipped, dem_grid_size,
         do_corner_matching, do_fftMatch_verification, FALSE,
         TRUE, TRUE, madssap, clean_files, matching_level, add_speckle,
         if_coreg_fails_use_zero_offsets,
         range_offset, azimuth_offset, &t_offset, &x_offset);
+  asf_trace_end();
 
   if (matching_level == MATCHING_GRID)
   {
       // when using grid matching, after generating the grid we are done.
       asfPrintStatus("Done.\n");
+      asf_trace_end();
       return 0;
   }
 
@@ -1570,6 +1574,7 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
       ensure_ext(&demTrimSlant, "img");
       ensure_ext(&srFile, "img");
       asfPrintStatus("\nTerrain correcting slant range image...\n");
+      asf_trace_begin("deskew_dem");
       padFile = getOutName(output_dir, srFile, "_pad");
       deskewDemFile = getOutName(output_dir, srFile, "_dd");
       deskewDemMask = getOutName(output_dir, srFile, "_ddm");
@@ -1600,6 +1605,7 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
       clean(padFile);
       clean(deskewDemFile);
       clean(deskewDemMask);
+      asf_trace_end();
 
 /*    
       Taking this out.  No need to degrade the image, now that we don't allow
@@ -1639,6 +1645,7 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
       if (doRadiometric) {
 
         asfPrintStatus("Generating smoothed DEM for radiometric correction.\n");
+        asf_trace_begin("radiometric correction");
 
         char *grDem = getOutName(output_dir, demChunk, "_gr");
         make_gr_dem(metaSAR, demChunk, grDem);
@@ -1649,6 +1656,7 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
         rtc(rtcFile, grDem, FALSE, NULL, outFile, save_incid_angles);
 
         asfPrintStatus("Radiometric correction complete.\n");
+        asf_trace_end();
 
         //clean(rtcFile);
         //clean(grDem);
@@ -1723,5 +1731,6 @@ int asf_terrcorr_ext(char *sarFile_in, char *demFile_in, char *userMaskFile,
   free(output_dir);
 
   asfPrintStatus("Done!\n");
+  asf_trace_end();
   return 0; // success
 }
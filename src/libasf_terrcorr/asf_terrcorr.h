@@ -84,6 +84,13 @@ int make_gr_dem_ext(meta_parameters *meta, const char *demImg, const char *demMe
                     int pad, double tolerance, const char *output_name,
                     int test_mode);
 
+/* Prototypes from make_sr_dem.c */
+int make_sr_dem(meta_parameters *meta_sar, const char *demBase,
+                const char *output_name);
+int make_sr_dem_ext(meta_parameters *meta, const char *demImg,
+                    const char *demMeta, int pad, double tolerance,
+                    const char *output_name, int test_mode);
+
 void cut_dem(meta_parameters *metaSAR, meta_parameters *metaDEM,
                     char *demFile, char *output_dir);
 
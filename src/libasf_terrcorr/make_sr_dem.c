@@ -44,50 +44,138 @@ sar_to_dem(meta_parameters *meta_sar, meta_parameters *meta_dem,
   }
 }
 
-static float get_from_float_image(FloatImage *fi, double samp, double line,
-               float_image_sample_method_t method)
+// Bilinear sample of an in-memory DEM, with the same arithmetic as
+// float_image_sample(), and zero outside the interior of the DEM.  The
+// DEM is only read, so any number of threads may sample it at once
+// (a FloatImage loads tiles on demand, so it may not be shared).
+static float dem_sample(const float *dem, int dnl, int dns,
+                        double line, double samp)
 {
-    if (samp > 0 && samp < fi->size_x-1 && line > 0 && line < fi->size_y-1)
-        return float_image_sample(fi, samp, line, method);
-    else
+    if (!(samp > 0 && samp < dns-1 && line > 0 && line < dnl-1))
         return 0;
+
+    int xb = (int)floor(samp), yb = (int)floor(line);
+    int xa = (int)ceil(samp), ya = (int)ceil(line);
+    float ul = dem[(long)yb*dns + xb];
+    float ur = dem[(long)yb*dns + xa];
+    float ll = dem[(long)ya*dns + xb];
+    float lr = dem[(long)ya*dns + xa];
+    float ux = ul + (ur - ul) * (samp - floor(samp));
+    float lx = ll + (lr - ll) * (samp - floor(samp));
+    return ux + (lx - ux) * (line - floor(line));
 }
 
-static double map(meta_parameters *meta_sar, meta_parameters *meta_dem,
-                  FloatImage *fiDem, float_image_sample_method_t method,
-                  double line, double samp)
+// The per-pixel mapping: full geolocation of one SAR pixel into the DEM.
+// Only used to check the gridded mapping.
+static float get_sr_height_at(meta_parameters *meta_sar, meta_parameters *meta_dem,
+                              const float *dem, double line, double samp)
 {
     double dem_line, dem_samp;
     sar_to_dem(meta_sar, meta_dem, line, samp, &dem_line, &dem_samp);
-    return (double)get_from_float_image(fiDem, dem_samp, dem_line, method);
+    return dem_sample(dem, meta_dem->general->line_count,
+                      meta_dem->general->sample_count, dem_line, dem_samp);
 }
-                
-static float get_sr_height_at(meta_parameters *meta_sar, meta_parameters *meta_dem,
-                              FloatImage *fiDem, double line, double samp)
+
+// Error (in DEM pixels) of bilinearly interpolating the SAR->DEM mapping
+// across a size x size cell, measured at the cell's center.
+static double grid_err(meta_parameters *meta_sar, meta_parameters *meta_dem,
+                       int line_lo, int samp_lo, int size)
+{
+    double l00, s00, l01, s01, l10, s10, l11, s11, l, s;
+    sar_to_dem(meta_sar, meta_dem, line_lo, samp_lo, &l00, &s00);
+    sar_to_dem(meta_sar, meta_dem, line_lo, samp_lo+size, &l01, &s01);
+    sar_to_dem(meta_sar, meta_dem, line_lo+size, samp_lo, &l10, &s10);
+    sar_to_dem(meta_sar, meta_dem, line_lo+size, samp_lo+size, &l11, &s11);
+    sar_to_dem(meta_sar, meta_dem, line_lo+size/2., samp_lo+size/2., &l, &s);
+    return hypot((l00+l01+l10+l11)/4. - l, (s00+s01+s10+s11)/4. - s);
+}
+
+// Largest grid spacing (a power of two, at most initial_size) at which
+// the interpolated mapping is within tolerance pixels of the real one.
+// The error is checked at all nine cells of a 3x3 layout: the middle,
+// the corners and the middle of each edge of the image, since the
+// mapping bends most at the edges of the swath.
+static int sr_grid_size(meta_parameters *meta_sar, meta_parameters *meta_dem,
+                        int initial_size, double tolerance)
 {
-    //const float_image_sample_method_t method = FLOAT_IMAGE_SAMPLE_METHOD_BICUBIC;
-    const float_image_sample_method_t method = FLOAT_IMAGE_SAMPLE_METHOD_BILINEAR;
-    return map(meta_sar, meta_dem, fiDem, method, line, samp);
+    int nl = meta_sar->general->line_count;
+    int ns = meta_sar->general->sample_count;
+    int sz;
+
+    for (sz = initial_size; sz > 1; sz /= 2) {
+        int lines[3] = { 0, nl/2 - sz/2, nl - sz };
+        int samps[3] = { 0, ns/2 - sz/2, ns - sz };
+        double err = 0;
+        int i, j;
+        for (i=0; i<3; ++i) {
+            for (j=0; j<3; ++j) {
+                double e = grid_err(meta_sar, meta_dem,
+                                    lines[i] > 0 ? lines[i] : 0,
+                                    samps[j] > 0 ? samps[j] : 0, sz);
+                if (e > err) err = e;
+            }
+        }
+        if (err < tolerance) {
+            asfPrintStatus("Using grid size %d (err %f < %f)\n", sz, err, tolerance);
+            return sz;
+        }
+        asfPrintStatus("Grid size %d, no good (err %f > %f)\n", sz, err, tolerance);
+    }
+    asfPrintStatus("Proceeding with grid size 1.\n");
+    return 1;
+}
+
+// One band of output lines, and the mapping at the grid nodes above and
+// below it.
+typedef struct {
+    const float *dem;
+    int dnl, dns;
+    int ns, size;
+    int n_nodes;                   // grid nodes per row
+    const double *lines_lo, *samps_lo, *lines_hi, *samps_hi;
+    float *buf;                    // size lines of ns samples
+} sr_band_job;
+
+// asf_parallel_fn: fill lines [start,end) of the band by interpolating
+// the SAR->DEM mapping between grid nodes and sampling the DEM.
+static void fill_sr_lines(int start, int end, void *data)
+{
+    sr_band_job *job = (sr_band_job *)data;
+    double t_step = 1.0 / job->size;
+    int iii, k, jjj;
+
+    for (iii=start; iii<end; ++iii) {
+        double t = iii * t_step;
+        float *out = job->buf + (long)iii*job->ns;
+        for (k=0; k<job->n_nodes-1; ++k) {
+            // mapping at the left and right ends of this cell, on this line
+            double l0 = job->lines_lo[k] + t*(job->lines_hi[k] - job->lines_lo[k]);
+            double s0 = job->samps_lo[k] + t*(job->samps_hi[k] - job->samps_lo[k]);
+            double l1 = job->lines_lo[k+1] + t*(job->lines_hi[k+1] - job->lines_lo[k+1]);
+            double s1 = job->samps_lo[k+1] + t*(job->samps_hi[k+1] - job->samps_lo[k+1]);
+            double dl = (l1 - l0) * t_step, ds = (s1 - s0) * t_step;
+            int jj = k*job->size;
+            for (jjj=0; jjj<job->size && jj+jjj<job->ns; ++jjj)
+                out[jj+jjj] = dem_sample(job->dem, job->dnl, job->dns,
+                                         l0 + jjj*dl, s0 + jjj*ds);
+        }
+    }
 }
 
-static void map_to_sr(meta_parameters *meta_sar, const char *demImg, const char *demMeta, const char *srDemImg, int pad)
+// Map the DEM into the geometry of meta_sar.  The SAR->DEM mapping is
+// only computed exactly on a grid, chosen so that interpolating it is
+// accurate to within tolerance DEM pixels; the output lines between two
+// grid rows are then filled in parallel from the DEM held in memory.
+static void map_to_sr(meta_parameters *meta_sar, const char *demImg,
+                      const char *demMeta, const char *srDemImg, int pad,
+                      double tolerance, int test_mode)
 {
   asfPrintStatus("Reading DEM...\n");
   meta_parameters *meta_dem = meta_read(demMeta);
-  float *demData = NULL;
-  FloatImage *fi_dem = NULL;
-
-  if (0)
-    demData = read_dem(meta_dem, demImg);
-  else
-    fi_dem = float_image_new_from_metadata(meta_dem, demImg);
+  float *demData = read_dem(meta_dem, demImg);
 
-  if (demData)
-    asfPrintStatus("Old method: reading entire DEM.\n");
-  if (fi_dem)
-    asfPrintStatus("New method: float image\n");
-  if (demData && fi_dem)
-    asfPrintError("Impossible.\n");
+  int dnl = meta_dem->general->line_count;
+  int dns = meta_dem->general->sample_count;
 
   // add the padding if requested
   meta_parameters *meta_out = meta_copy(meta_sar);
@@ -116,22 +204,82 @@ static void map_to_sr(meta_parameters *meta_sar, const char *demImg, const char
   int nl = meta_out->general->line_count;
   int ns = meta_out->general->sample_count;
 
-  float *buf = MALLOC(sizeof(float)*ns);
+  int size = sr_grid_size(meta_sar, meta_dem, 512, tolerance);
+
+  // grid nodes every size samples, with one past the last sample
+  int n_nodes = (ns + size - 1)/size + 1;
+  double *lines_lo = MALLOC(sizeof(double)*n_nodes);
+  double *samps_lo = MALLOC(sizeof(double)*n_nodes);
+  double *lines_hi = MALLOC(sizeof(double)*n_nodes);
+  double *samps_hi = MALLOC(sizeof(double)*n_nodes);
+
+  float *buf = MALLOC(sizeof(float)*ns*size);
   FILE *fpOut = FOPEN(srDemImg, "wb");
 
+  // A height error comes from a position error, and is at most about
+  // the position error in meters on a 45 degree slope.
+  double height_tol = tolerance * meta_dem->general->x_pixel_size;
+  int num_checked = 0, num_out_of_tol = 0;
+  double max_err = 0, avg_err = 0;
+
   asfPrintStatus("Creating slant range DEM...\n");
 
-  int ii, jj;
-  for (ii=0; ii<nl; ii++) {
-    for (jj=0; jj<ns; jj++) {
-        buf[jj] = get_sr_height_at(meta_sar, meta_dem, fi_dem, ii, jj);
+  sr_band_job job;
+  job.dem = demData;
+  job.dnl = dnl;
+  job.dns = dns;
+  job.ns = ns;
+  job.size = size;
+  job.n_nodes = n_nodes;
+  job.buf = buf;
+
+  int ii, k;
+  for (k=0; k<n_nodes; ++k)
+    sar_to_dem(meta_sar, meta_dem, 0, k*size, &lines_hi[k], &samps_hi[k]);
+
+  for (ii=0; ii<nl; ii += size) {
+    double *tmp;
+    tmp = lines_lo; lines_lo = lines_hi; lines_hi = tmp;
+    tmp = samps_lo; samps_lo = samps_hi; samps_hi = tmp;
+    for (k=0; k<n_nodes; ++k)
+      sar_to_dem(meta_sar, meta_dem, ii+size, k*size, &lines_hi[k], &samps_hi[k]);
+
+    int nlines = ii+size > nl ? nl-ii : size;
+
+    job.lines_lo = lines_lo;
+    job.samps_lo = samps_lo;
+    job.lines_hi = lines_hi;
+    job.samps_hi = samps_hi;
+    asf_parallel_for(nlines, 8, fill_sr_lines, &job);
+
+    // compare a sample of pixels against the per-pixel mapping
+    if (test_mode) {
+      int iii, jj;
+      for (iii=0; iii<nlines; iii += 11) {
+        for (jj=0; jj<ns; jj += 13) {
+          double err = fabs(buf[iii*ns+jj] -
+              get_sr_height_at(meta_sar, meta_dem, demData, ii+iii, jj));
+          avg_err += err;
+          if (err > max_err) max_err = err;
+          if (err > height_tol) ++num_out_of_tol;
+          ++num_checked;
+        }
+      }
     }
 
-    put_float_line(fpOut, meta_out, ii, buf);
-    asfPrintStatus("Completed %.1f%%  \r", 100.*ii/(double)nl);
+    put_float_lines(fpOut, meta_out, ii, nlines, buf);
+    asfLineMeter(ii+nlines-1, nl);
   }
-  asfPrintStatus("Completed 100%%   \n");
-  
+
+  if (test_mode && num_checked > 0) {
+    asfPrintStatus("Height tolerance was %f m (%f pixels)\n", height_tol, tolerance);
+    asfPrintStatus("%d/%d checked pixels had error exceeding tolerance. (%.1f%%)\n",
+                   num_out_of_tol, num_checked,
+                   100.*num_out_of_tol/(double)num_checked);
+    asfPrintStatus("Maximum height error: %f m\n", max_err);
+    asfPrintStatus("Average height error: %f m\n", avg_err/(double)num_checked);
+  }
+
   FCLOSE(fpOut);
   meta_write(meta_out, srDemImg);
 
@@ -140,8 +288,10 @@ static void map_to_sr(meta_parameters *meta_sar, const char *demImg, const char
 
   FREE(buf);
   FREE(demData);
-  if (fi_dem)
-    float_image_free(fi_dem);
+  FREE(lines_lo);
+  FREE(samps_lo);
+  FREE(lines_hi);
+  FREE(samps_hi);
 }
 
 static double bilinear_interp(double *xi, double *yi, int N, double x)
@@ -377,14 +527,12 @@ int make_sr_dem_ext(meta_parameters *meta_sar, const char *demImg, const char *d
   }
 
   // step 1 -- map DEM from projected to slant range (no height corrections)
-  int already_have_slant_range = TRUE;
-  if (already_have_slant_range) {
+  // A DEM without a map projection is taken to be in slant range already.
+  if (!meta_dem->projection) {
     copyImgAndMeta(demImg, outImgStep1);
   } else {
-    if (0)
-      map_to_sr(meta_sar, demImg, demMeta, outImgStep1, pad);
-    else 
-      make_gr_dem_ext(meta_sar, demImg, demMeta, pad, .1, outImgStep1, 0);
+    map_to_sr(meta_sar, demImg, demMeta, outImgStep1, pad, tolerance,
+              test_mode);
   }
 
   // step 2 -- apply 3x3 filter
@@ -401,6 +549,7 @@ int make_sr_dem_ext(meta_parameters *meta_sar, const char *demImg, const char *d
   FREE(outImgStep2);
   FREE(output_step1);
   FREE(output_step2);
+  meta_free(meta_dem);
 
   // success
   return 0;
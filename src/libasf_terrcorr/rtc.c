@@ -4,7 +4,6 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
-#include "vector.h"
 
 static char *matrix[32] = 
   {"T11","T12_real","T12_imag","T13_real","T13_imag","T14_real","T14_imag",
@@ -46,7 +45,16 @@ static int isDecomposition(char *bandExt)
   return found;
 }
 
-static void geodetic_to_ecef(double lat, double lon, double h, Vector *v)
+// Number of image lines corrected together.  The DEM, ground positions,
+// incidence angles and all bands for a block are held in memory.
+#define RTC_BLOCK_LINES 64
+
+// How each band is corrected
+#define RTC_COPY  0   // phase: never corrected
+#define RTC_SCALE 1   // matrix elements and decompositions: scaled by corr
+#define RTC_CAL   2   // amplitude, I or Q: radiometric calibration
+
+static void geodetic_to_ecef(double lat, double lon, double h, double *v)
 {
   //const double a = 6378144.0;    // GEM-06 Ellipsoid.
   //const double e = 8.1827385e-2; // GEM-06 Eccentricity
@@ -63,12 +71,12 @@ static void geodetic_to_ecef(double lat, double lon, double h, Vector *v)
   double f = sqrt(1. - e2*sin_lat*sin_lat);
   double af = a/f;
 
-  v->x = (af + h)*cos_lat*cos(lon);
-  v->y = (af + h)*cos_lat*sin(lon);
-  v->z = (af*(1.-e2) + h)*sin_lat;
+  v[0] = (af + h)*cos_lat*cos(lon);
+  v[1] = (af + h)*cos_lat*sin(lon);
+  v[2] = (af*(1.-e2) + h)*sin_lat;
 }
 
-static Vector get_satpos(meta_parameters *meta, int line)
+static void get_satpos(meta_parameters *meta, int line, double *satpos)
 {
   int ns = meta->general->sample_count;
   double t = meta_get_time(meta, line, ns/2);
@@ -89,117 +97,176 @@ static Vector get_satpos(meta_parameters *meta, int line)
 
   stateVector stVec = propagate(closest_vec, closest_time, t);
 
-  Vector satpos;
-  satpos.x = stVec.pos.x;
-  satpos.y = stVec.pos.y;
-  satpos.z = stVec.pos.z;
-  return satpos;
+  satpos[0] = stVec.pos.x;
+  satpos[1] = stVec.pos.y;
+  satpos[2] = stVec.pos.z;
 }
 
-static void calculate_vectors_for_line(meta_parameters *meta_dem, meta_parameters *meta_img, int line, FILE *dem_fp, Vector **vectorLine, Vector *nextVectors)
+// Ground positions (ECEF, 3 doubles per sample) for num_lines lines of
+// the image, starting at line, from the DEM heights in dem.
+static void calculate_positions(meta_parameters *meta_img, int line,
+                                int num_lines, const float *dem, double *pos)
 {
-  int jj;
+  int ii, jj;
   double lat, lon;
   int ns = meta_img->general->sample_count;
-  float demLine[ns];
 
-  get_float_line(dem_fp, meta_dem, line, demLine);
-
-  for(jj = 0; jj < ns; ++jj) {
-    Vector *v = MALLOC(sizeof(Vector));
-    meta_get_latLon(meta_img, line, jj, 0, &lat, &lon);
-    geodetic_to_ecef(lat, lon, demLine[jj], v);
-    vectorLine[jj] = v;
+  for (ii = 0; ii < num_lines; ++ii) {
+    for (jj = 0; jj < ns; ++jj) {
+      long k = (long)ii*ns + jj;
+      meta_get_latLon(meta_img, line + ii, jj, 0, &lat, &lon);
+      geodetic_to_ecef(lat, lon, dem[k], pos + 3*k);
+    }
   }
 }
 
-static void push_next_vector_line(Vector ***localVectors, Vector *nextVectors, meta_parameters *meta_dem, meta_parameters *meta_img, FILE *dem_fp, int line)
+static double dot3(const double *a, const double *b)
 {
-  int ns = meta_img->general->sample_count;
-  Vector **vectorsLine = MALLOC(sizeof(Vector*)*ns);
-  calculate_vectors_for_line(meta_dem, meta_img, line, dem_fp, vectorsLine, nextVectors);
-
-  int i;
-  for(i = 0; i < ns; i++)
-    if(localVectors[0] != NULL)
-      vector_free(localVectors[0][i]);
-  FREE(localVectors[0]);
-
-  localVectors[0] = localVectors[1];
-  localVectors[1] = localVectors[2];
-  localVectors[2] = vectorsLine;
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
 }
 
-static Vector * calculate_normal(Vector ***localVectors, int sample)
+static void cross3(const double *a, const double *b, double *c)
 {
-  Vector *v1, *v2, *normal;
-
-  v1 = vector_copy(localVectors[0][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
-
-  v2 = vector_copy(localVectors[1][sample-1]);
-  vector_subtract(v2, localVectors[1][sample+1]);
-
-  normal = vector_cross(v2, v1);
-  vector_multiply(normal, 1./vector_magnitude(normal));
-
-  vector_free(v1);
-  vector_free(v2);
- /*
-  v1 = vector_copy(localVectors[1][sample]);
-  v2 = vector_copy(localVectors[1][sample]);
-  vector_subtract(v1, localVectors[2][sample]);
-  vector_subtract(v2, localVectors[1][sample+1]);
-  normal = vector_cross(v1, v2);
-  vector_multiply(normal, 1./vector_magnitude(normal));
-  vector_free(v1);
-  vector_free(v2);
- */
-  return normal;
+  c[0] = a[1]*b[2] - a[2]*b[1];
+  c[1] = a[2]*b[0] - a[0]*b[2];
+  c[2] = a[0]*b[1] - a[1]*b[0];
 }
 
-static float
-calculate_local_incidence(Vector *n, Vector *satpos, Vector *p)
-                          
+static void normalize3(double *a)
 {
-  // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, -1./vector_magnitude(R));
+  double m = sqrt(dot3(a,a));
+  a[0] /= m;
+  a[1] /= m;
+  a[2] /= m;
+}
 
-  double local_incidence = acos(vector_dot(n,R)) * R2D;
+// Surface normal at ground point mid[s], from its neighbors above and
+// below (up, down) and to either side.
+static void calculate_normal(const double *up, const double *mid,
+                             const double *down, int s, double *normal)
+{
+  double v1[3], v2[3];
+  int i;
 
-  vector_free(R);
+  for (i = 0; i < 3; ++i) {
+    v1[i] = up[3*s+i] - down[3*s+i];
+    v2[i] = mid[3*(s-1)+i] - mid[3*(s+1)+i];
+  }
 
-  return local_incidence;
+  cross3(v2, v1, normal);
+  normalize3(normal);
 }
 
-static float
-calculate_correction(meta_parameters *meta_in, int line, int samp,
-                     Vector *satpos, Vector *n, Vector *p, Vector *p_next, float incid_angle)
+// One block of lines.  Positions are held for the line above and the line
+// below the block too: row r of pos is image line first_line-1+r.
+typedef struct {
+  int first_line;
+  int nl, ns, nb;
+  const double *pos;
+  const double *satpos;          // 3 per line
+  const double *incid;           // radians, ns per line
+  float *corr;                   // ns per line
+  float *side_incid, *side_local, *side_cos;  // NULL if not saved
+  meta_parameters *meta;
+  char **bands;
+  const int *band_kind;
+  float *data;                   // nb bands of band_size floats
+  long band_size;
+} rtc_block_job;
+
+// asf_parallel_fn: the Ulander correction, and the side products, for
+// lines [start,end) of the block.  The first and last image lines and
+// the first and last samples of each line are not corrected.
+static void correct_lines(int start, int end, void *data)
 {
+  rtc_block_job *job = (rtc_block_job *)data;
+  int ns = job->ns;
+  int ii, jj;
+
+  for (ii = start; ii < end; ++ii) {
+    int line = job->first_line + ii;
+    long off = (long)ii*ns;
+    float *corr = job->corr + off;
+    const double *incid = job->incid + off;
+
+    for (jj = 0; jj < ns; ++jj)
+      corr[jj] = 1;
+    if (job->side_incid) {
+      for (jj = 0; jj < ns; ++jj)
+        job->side_incid[off+jj] = job->side_local[off+jj] =
+          job->side_cos[off+jj] = 0;
+    }
+    if (line == 0 || line == job->nl - 1)
+      continue;
+
+    const double *up = job->pos + 3*off;
+    const double *mid = up + 3*ns;
+    const double *down = mid + 3*ns;
+    const double *satpos = job->satpos + 3*ii;
+
+    for (jj = 1; jj < ns - 1; ++jj) {
+      double n[3], R[3], x[3], Rx[3];
+      const double *p = mid + 3*jj;
+
+      calculate_normal(up, mid, down, jj, n);
+
+      // R: unit vector from ground point (p) to satellite (satpos)
+      R[0] = satpos[0] - p[0];
+      R[1] = satpos[1] - p[1];
+      R[2] = satpos[2] - p[2];
+      normalize3(R);
+
+      cross3(p, R, x);
+      normalize3(x);
+
+      // Rx: R cross x -- image plane normal
+      cross3(R, x, Rx);
+
+      // cos(phi) is the correction factor we need; we also need to remove
+      // the old correction factor (sin of the incidence angle)
+      double cosphi = fabs(dot3(Rx, n));
+      corr[jj] = cosphi / sin(incid[jj]);
+
+      // saving some intermediate products if requested
+      if (job->side_incid) {
+        job->side_incid[off+jj] = incid[jj] * R2D;
+        job->side_local[off+jj] = acos(-dot3(n, R)) * R2D;
+        job->side_cos[off+jj] = corr[jj] * sin(incid[jj]);
+      }
+    }
+  }
+}
 
-  // R: vector from ground point (p) to satellite (satpos)
-  Vector *R = vector_copy(satpos);
-  vector_subtract(R, p);
-  vector_multiply(R, 1./vector_magnitude(R));
-
-  Vector *x = vector_cross(p,R);
-  vector_multiply(x, 1./vector_magnitude(x));
-
-  // Rx: R cross x -- image plane normal
-  Vector *Rx = vector_cross(R,x);
+// asf_parallel_fn: apply the correction to every band of lines
+// [start,end) of the block.
+static void apply_correction(int start, int end, void *data)
+{
+  rtc_block_job *job = (rtc_block_job *)data;
+  int ns = job->ns;
+  int ii, jj, kk;
 
-  // cos(phi) is the correction factor we need
-  double cosphi = vector_dot(Rx,n);
-  if (cosphi < 0) cosphi = -cosphi;
+  for (ii = start; ii < end; ++ii) {
+    long off = (long)ii*ns;
+    const float *corr = job->corr + off;
+    const double *incid = job->incid + off;
 
-  vector_free(x);
-  vector_free(R);
-  vector_free(Rx);
+    for (kk = 0; kk < job->nb; ++kk) {
+      float *buf = job->data + kk*job->band_size + off;
 
-  // need to remove old correction factor (sin of the incidence angle)
-  return cosphi / sin(incid_angle);
+      // we never apply the correction to phase
+      if (job->band_kind[kk] == RTC_SCALE) {
+        // correct matrix element without applying calibration parameters
+        for (jj = 0; jj < ns; ++jj)
+          buf[jj] *= corr[jj];
+      }
+      else if (job->band_kind[kk] == RTC_CAL) {
+        // amplitude, or complex I or Q -- apply the radiometric correction
+        for (jj = 0; jj < ns; ++jj)
+          buf[jj] = get_rad_cal_dn_incid(job->meta, incid[jj], jj,
+                                         job->bands[kk], buf[jj], corr[jj]);
+      }
+    }
+  }
 }
 
 int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
@@ -280,160 +347,132 @@ int rtc(char *input_file, char *dem_file, int maskFlag, char *mask_file,
                    nl, ns, dnl, dns);
   }
 
-  Vector **localVectors[3] = { NULL, NULL, NULL };
-  Vector nextVectors[ns];
+  int ii, jj, kk;
+  int *band_kind = MALLOC(sizeof(int)*nb);
+  for (kk=0; kk<nb; ++kk) {
+    if (strstr(bands[kk], "PHASE") != NULL)
+      band_kind[kk] = RTC_COPY;
+    else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk]))
+      band_kind[kk] = RTC_SCALE;
+    else
+      band_kind[kk] = RTC_CAL;
+  }
+
+  // The calibration of the output is to sigma.  Setting this once, up
+  // front, means the threads only ever read meta_in.
+  meta_in->general->radiometry = r_SIGMA;
 
   FILE *fpIn = FOPEN(inputImg, "rb");
   FILE *fpOut = FOPEN(outputImg, "wb");
   FILE *dem_fp = FOPEN(demImg, "rb");
 
-  float corr[ns];
-  float incid_angles[ns];
-  float bufIn[ns];
-  float bufOut[ns];
-
-  asfPrintStatus("Applying radiometric correction...\n");
-
-  int ii, jj, kk;
-  for(ii = 1; ii < 3; ++ii) {
-    localVectors[ii] = MALLOC(sizeof(Vector**)*ns);
-    calculate_vectors_for_line(meta_in, meta_dem, ii - 1, dem_fp, localVectors[ii], nextVectors);
-  }
-
-  for (jj=0; jj<ns; ++jj) {
-    incid_angles[jj] = 0;
-    corr[jj] = 1;
-  }
-
-  if(save_incid_angles) {
-    put_band_float_line(fpSide, side_meta, 0, 0, incid_angles);
-    put_band_float_line(fpSide, side_meta, 0, nl - 1, incid_angles);
-    put_band_float_line(fpSide, side_meta, 1, 0, incid_angles);
-    put_band_float_line(fpSide, side_meta, 1, nl - 1, incid_angles);
-    put_band_float_line(fpSide, side_meta, 2, 0, corr);
-    put_band_float_line(fpSide, side_meta, 2, nl - 1, corr);
-    // put zeros in for cos(phi) around the edges, not correct though
-    put_band_float_line(fpSide, side_meta, 3, 0, incid_angles);
-    put_band_float_line(fpSide, side_meta, 3, nl - 1, incid_angles);
+  int block = RTC_BLOCK_LINES;
+  long block_size = (long)block*ns;
+  long window_size = (long)(block+2)*ns;
+  float *dem = MALLOC(sizeof(float)*window_size);
+  double *pos = MALLOC(sizeof(double)*3*window_size);
+  double *satpos = MALLOC(sizeof(double)*3*block);
+  double *incid = MALLOC(sizeof(double)*block_size);
+  float *corr = MALLOC(sizeof(float)*block_size);
+  float *prev_corr = MALLOC(sizeof(float)*ns);
+  float *data = MALLOC(sizeof(float)*nb*block_size);
+
+  rtc_block_job job;
+  job.nl = nl;
+  job.ns = ns;
+  job.nb = nb;
+  job.pos = pos;
+  job.satpos = satpos;
+  job.incid = incid;
+  job.corr = corr;
+  job.side_incid = job.side_local = job.side_cos = NULL;
+  if (save_incid_angles) {
+    job.side_incid = MALLOC(sizeof(float)*block_size);
+    job.side_local = MALLOC(sizeof(float)*block_size);
+    job.side_cos = MALLOC(sizeof(float)*block_size);
   }
+  job.meta = meta_in;
+  job.bands = bands;
+  job.band_kind = band_kind;
+  job.data = data;
+  job.band_size = block_size;
 
-  // We aren't applying the correction to the edges of the image
-  // (corr[jj] == 1 for the whole row)
-  for(kk = 0; kk < nb; ++kk) {
-    get_band_float_line(fpIn, meta_in, kk, 0, bufIn);
-    if (strstr(bands[kk], "PHASE") != NULL) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj];
-    }
-    else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk])) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj]*corr[jj];
-    }
-    else {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = 
-	  get_rad_cal_dn(meta_in, 0, jj, bands[kk], bufIn[jj], corr[jj]);
-    }
-    put_band_float_line(fpOut, meta_out, kk, 0, bufOut);
-  }
+  asfPrintStatus("Applying radiometric correction...\n");
 
-  for(ii = 1; ii < nl - 1; ++ii) {
-    push_next_vector_line(localVectors, nextVectors, meta_dem, meta_in, dem_fp,
-			  ii + 1);
-    corr[0] = corr[ns-1] = 1;
-    Vector satpos = get_satpos(meta_in, ii);
-    incid_angles[0] = incid_angles[nl-1] = 0;
-
-    // calculate the Ulander correction for this line
-    for(jj = 1; jj < ns - 1; ++jj) {
-      incid_angles[jj] = meta_incid(meta_in, ii, jj);
-      Vector * normal = calculate_normal(localVectors, jj);
-      corr[jj] = calculate_correction(meta_in, ii, jj, &satpos, normal, 
-				      localVectors[1][jj], &nextVectors[jj], 
-				      incid_angles[jj]);
-      vector_free(normal);
+  for (ii = 0; ii < nl; ii += block) {
+    int n = ii + block > nl ? nl - ii : block;
+
+    // Ground positions for lines ii-1 .. ii+n.  The two rows at the
+    // bottom of the previous block are the two at the top of this one.
+    int first = ii == 0 ? ii : ii + 1;
+    int last = ii + n < nl ? ii + n : nl - 1;
+    int row = first - (ii - 1);
+    if (ii > 0)
+      memmove(pos, pos + 3L*block*ns, sizeof(double)*3*2*ns);
+    if (last >= first) {
+      get_float_lines(dem_fp, meta_dem, first, last - first + 1,
+                      dem + (long)row*ns);
+      calculate_positions(meta_in, first, last - first + 1,
+                          dem + (long)row*ns, pos + 3L*row*ns);
     }
 
-    // saving some intermediate products if requested
-    if(save_incid_angles) {
-      float *tmp_buf = MALLOC(sizeof(float)*ns);
-      for (jj=0; jj<ns; ++jj)
-        tmp_buf[jj] = incid_angles[jj] * R2D;
-      put_band_float_line(fpSide, side_meta, 0, ii, tmp_buf);
-      put_band_float_line(fpSide, side_meta, 2, ii, corr);
-      for (jj=0; jj<ns; ++jj)
-        tmp_buf[jj] = corr[jj] * sin(incid_angles[jj]);
-      put_band_float_line(fpSide, side_meta, 3, ii, tmp_buf);
-      for (jj=1; jj<ns-1; ++jj) {
-        Vector * normal = calculate_normal(localVectors, jj);
-        tmp_buf[jj] = calculate_local_incidence(normal, &satpos,
-				      localVectors[1][jj]);
-        vector_free(normal);
-      }
-      tmp_buf[jj] = tmp_buf[jj-1] = 0;
-      put_band_float_line(fpSide, side_meta, 1, ii, tmp_buf);
-      FREE(tmp_buf);
+    // The rest of the geolocation, done here as not all of the metadata
+    // routines may be called from several threads at once
+    for (kk = 0; kk < n; ++kk) {
+      int line = ii + kk;
+      if (line > 0 && line < nl - 1)
+        get_satpos(meta_in, line, satpos + 3*kk);
+      for (jj = 0; jj < ns; ++jj)
+        incid[(long)kk*ns + jj] = meta_incid(meta_in, line, jj);
     }
 
-    // correct all the bands with the calculated scale factor
-    for (kk=0; kk<nb; ++kk) {
-      get_band_float_line(fpIn, meta_in, kk, ii, bufIn);
-
-      // we never apply the correction to phase
-      if (strstr(bands[kk], "PHASE") != NULL) {
-        for (jj=0; jj<ns; ++jj)
-          bufOut[jj] = bufIn[jj];
-      }
-      // correct matrix element without applying calibration parameters
-      else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk])) {
-	for (jj=0; jj<ns; ++jj)
-	  bufOut[jj] = bufIn[jj]*corr[jj];
-      }
-      // amplitude, or complex I or Q -- apply the radiometric correction
-      else {
-        for (jj=0; jj<ns; ++jj)
-          bufOut[jj] = 
-	    get_rad_cal_dn(meta_in, ii, jj, bands[kk], bufIn[jj], corr[jj]);
-      }
+    job.first_line = ii;
+    asf_parallel_for(n, 4, correct_lines, &job);
 
-      // write out the corrected line
-      put_band_float_line(fpOut, meta_out, kk, ii, bufOut);
+    if (save_incid_angles) {
+      put_band_float_lines(fpSide, side_meta, 0, ii, n, job.side_incid);
+      put_band_float_lines(fpSide, side_meta, 1, ii, n, job.side_local);
+      put_band_float_lines(fpSide, side_meta, 2, ii, n, corr);
+      put_band_float_lines(fpSide, side_meta, 3, ii, n, job.side_cos);
     }
 
-    asfLineMeter(ii+1, nl);
-  }
-
-  // bottom line of the image, here we are cheating and reusing the previous
-  // line's correction factors
-  for(kk = 0; kk < nb; ++kk) {
-    get_band_float_line(fpIn, meta_in, kk, nl-1, bufIn);
-    if (strstr(bands[kk], "PHASE") != NULL) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj];
-    }
-    else if (isMatrixElement(bands[kk]) || isDecomposition(bands[kk])) {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = bufIn[jj]*corr[jj];
-    }
-    else {
-      for (jj=0; jj<ns; ++jj)
-	bufOut[jj] = 
-	  get_rad_cal_dn(meta_in, nl-1, jj, bands[kk], bufIn[jj], corr[jj]);
+    // bottom line of the image, here we are cheating and reusing the
+    // previous line's correction factors
+    if (ii + n == nl && nl > 2) {
+      float *bottom = corr + (long)(n-1)*ns;
+      memcpy(bottom, n > 1 ? bottom - ns : prev_corr, sizeof(float)*ns);
     }
-    put_band_float_line(fpOut, meta_out, kk, nl-1, bufIn);
-  }
+    memcpy(prev_corr, corr + (long)(n-1)*ns, sizeof(float)*ns);
 
-  for(ii = 0; ii < 3; ++ii) {
-    for(jj = 0; jj < ns; ++jj) {
-      vector_free(localVectors[ii][jj]);
-    }
-    FREE(localVectors[ii]);
+    // correct all the bands with the calculated scale factor
+    for (kk = 0; kk < nb; ++kk)
+      get_band_float_lines(fpIn, meta_in, kk, ii, n, data + kk*block_size);
+    asf_parallel_for(n, 4, apply_correction, &job);
+    for (kk = 0; kk < nb; ++kk)
+      put_band_float_lines(fpOut, meta_out, kk, ii, n, data + kk*block_size);
+
+    asfLineMeter(ii + n - 1, nl);
   }
 
   FCLOSE(fpOut);
   FCLOSE(fpIn);
+  FCLOSE(dem_fp);
   if (fpSide) FCLOSE(fpSide);
 
+  FREE(dem);
+  FREE(pos);
+  FREE(satpos);
+  FREE(incid);
+  FREE(corr);
+  FREE(prev_corr);
+  FREE(data);
+  FREE(band_kind);
+  if (save_incid_angles) {
+    FREE(job.side_incid);
+    FREE(job.side_local);
+    FREE(job.side_cos);
+  }
+
   // update output metadata
   for (ii=0; ii<meta_out->general->band_count; ii++) {
     FREE(bands[ii]);
@@ -424,6 +424,7 @@ do_convert(int pid, GtkTreeIter *iter, char *cfg_file, int save_dem,
         /* child */
         logflag = TRUE;
         fLog = fopen(logFile, "a");
+        asf_watch_stop_file();
 
         asfPrintStatus("Running MapReady with configuration file: %s\n",
                        cfg_file);
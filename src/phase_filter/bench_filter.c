@@ -0,0 +1,111 @@
+/*****************************************************************************
+NAME: bench_filter
+
+SYNOPSIS: bench_filter <in> [<strength>]
+
+DESCRIPTION:
+	Times the Goldstein phase filter (phase_filter_image) on a full
+interferogram, first on one thread and then on all available threads,
+and checks that both runs produce exactly the same output.  The filtered
+images are written to bench_filter_1.img and bench_filter_N.img in the
+current directory, and removed afterwards.
+
+	The number of threads for the second run can be set with the
+ASF_THREADS environment variable.
+*****************************************************************************/
+#include <sys/time.h>
+
+#include "asf.h"
+#include "asf_meta.h"
+#include "asf_insar.h"
+
+static double wall_clock(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1.0e-6;
+}
+
+/*Filter inFile into outFile with the given number of threads, and return
+the elapsed wall clock time.*/
+static double time_filter(char *inFile, char *outFile, float strength,
+	int threads)
+{
+	FILE *in, *out;
+	meta_parameters *meta;
+	double start;
+
+	asf_set_thread_count(threads);
+	in = fopenImage(inFile, "rb");
+	out = fopenImage(outFile, "wb");
+	meta = meta_read(inFile);
+	meta_write(meta, outFile);
+
+	start = wall_clock();
+	phase_filter_image(in, meta, out, strength);
+	FCLOSE(out);
+	FCLOSE(in);
+	meta_free(meta);
+
+	return wall_clock() - start;
+}
+
+/*Return TRUE if the two images are byte for byte the same.*/
+static int same_image(char *file1, char *file2)
+{
+	FILE *fp1 = fopenImage(file1, "rb");
+	FILE *fp2 = fopenImage(file2, "rb");
+	char buf1[65536], buf2[65536];
+	size_t n1, n2;
+	int same = TRUE;
+
+	do {
+		n1 = fread(buf1, 1, sizeof(buf1), fp1);
+		n2 = fread(buf2, 1, sizeof(buf2), fp2);
+		if (n1 != n2 || memcmp(buf1, buf2, n1) != 0)
+			same = FALSE;
+	} while (same && n1 > 0);
+
+	FCLOSE(fp1);
+	FCLOSE(fp2);
+	return same;
+}
+
+int main(int argc, char **argv)
+{
+	char *inFile;
+	float strength = 1.6;
+	double t1, tN;
+	int nThreads;
+
+	if (argc < 2 || argc > 3) {
+		printf("\nUSAGE: bench_filter <in> [<strength>]\n\n"
+		"Times phase_filter on <in> serially and threaded, and checks\n"
+		"that the results match.\n\n");
+		exit(1);
+	}
+	inFile = argv[1];
+	if (argc == 3 && 1 != sscanf(argv[2], "%f", &strength))
+		asfPrintError("'%s' is not a floating-point number.\n", argv[2]);
+
+	asf_set_thread_count(0);
+	nThreads = asf_get_thread_count();
+
+	t1 = time_filter(inFile, "bench_filter_1", strength, 1);
+	tN = time_filter(inFile, "bench_filter_N", strength, nThreads);
+
+	asfPrintStatus("\n   1 thread:   %8.3f seconds\n", t1);
+	asfPrintStatus("   %d threads: %8.3f seconds (%.2fx)\n",
+		nThreads, tN, t1/tN);
+
+	if (!same_image("bench_filter_1", "bench_filter_N"))
+		asfPrintError("Threaded output differs from serial output!\n");
+	asfPrintStatus("   Outputs are identical.\n\n");
+
+	remove("bench_filter_1.img");
+	remove("bench_filter_1.meta");
+	remove("bench_filter_N.img");
+	remove("bench_filter_N.meta");
+
+	return 0;
+}
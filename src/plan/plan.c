@@ -12,6 +12,7 @@
 #include "sgpsdp.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 static int iabs(int a)
@@ -246,6 +247,77 @@ static void get_latitude_range(Poly *region, int zone, char dir,
   }
 }
 
+// Great circle distance in meters, between points given in degrees.
+static double ground_distance(double lat1, double lon1,
+                              double lat2, double lon2)
+{
+  double dlat = D2R*(lat2-lat1);
+  double dlon = D2R*(lon2-lon1);
+  double a = sin(dlat/2)*sin(dlat/2) +
+    cos(D2R*lat1)*cos(D2R*lat2)*sin(dlon/2)*sin(dlon/2);
+  return 2*6371000.*asin(sqrt(a > 1 ? 1 : a));
+}
+
+// Distance from the target center beyond which the viewable region
+// cannot overlap the aoi: the half diagonal of the imaged rectangle plus
+// the farthest aoi corner, padded for the projection's scale error.
+static double get_search_reach(BeamModeInfo *bmi, int zone, Poly *aoi,
+                               double clat, double clon)
+{
+  double aoi_radius = 0;
+  int i;
+  for (i=0; i<aoi->n; ++i) {
+    double lat, lon;
+    pr2ll(aoi->x[i], aoi->y[i], zone, &lat, &lon);
+    double d = ground_distance(lat, lon, clat, clon);
+    if (d > aoi_radius)
+      aoi_radius = d;
+  }
+  double half_diag = 0.5*hypot(bmi->length_m, bmi->width_m);
+  return 1.5*(half_diag + aoi_radius) + 20000.;
+}
+
+// Faster than the beam center can move along the ground, in m/s.
+#define MAX_BEAM_GROUND_SPEED 10000.
+
+typedef struct {
+  const sat_t *sat;       /* each worker propagates its own copy */
+  const double *times;    /* time of each search step */
+  double incr;            /* time between steps */
+  double look_angle;
+  double clat, clon;      /* target center */
+  double reach;           /* from get_search_reach() */
+  char *near;             /* set for steps that need the full test */
+} search_job;
+
+// asf_parallel_fn: flag the steps in [start,end) at which the beam center
+// is within reach of the target.  When it is far away, skip the steps it
+// could not possibly get within reach in.
+static void find_near_steps(int start, int end, void *data)
+{
+  search_job *job = (search_job *) data;
+  sat_t sat = *job->sat;
+  int k = start;
+
+  while (k < end) {
+    stateVector st = tle_propagate(&sat, job->times[k]);
+    double lat, lon;
+    if (!get_target_latlon(&st, job->look_angle, &lat, &lon)) {
+      job->near[k++] = TRUE;
+      continue;
+    }
+
+    double d = ground_distance(lat, lon, job->clat, job->clon) - job->reach;
+    if (d <= 0) {
+      job->near[k++] = TRUE;
+    }
+    else {
+      int skip = (int)(d / (MAX_BEAM_GROUND_SPEED * job->incr));
+      k += skip > 1 ? skip : 1;
+    }
+  }
+}
+
 int plan(const char *satellite, const char *beam_mode, double look_angle,
          long startdate, long enddate, double min_lat, double max_lat,
          double clat, double clon, int pass_type,
@@ -340,7 +412,35 @@ int plan(const char *satellite, const char *beam_mode, double look_angle,
   double incr = bmi->image_time;
   stateVector st = tle_propagate(&sat, start_secs-incr);
   double lat_prev = sat.ssplat;
-  int i,num_found = 0;
+  int lat_prev_valid = TRUE;
+  int i,k,num_found = 0;
+
+  // Times of the search steps, accumulated exactly as the loop below does.
+  int n_steps = 0;
+  double t;
+  for (t=start_secs; t<end_secs; t+=incr)
+    ++n_steps;
+  double *times = MALLOC(sizeof(double)*(n_steps+1));
+  for (k=0, t=start_secs; k<=n_steps; ++k, t+=incr)
+    times[k] = t;
+
+  // Coarse pass: a cheap ground distance test, on disjoint time windows in
+  // parallel, finds the steps near the target.  Only those get the full
+  // overlap test below, which gives the same passes as testing them all.
+  char *near = MALLOC(sizeof(char)*(n_steps+1));
+  memset(near, 0, n_steps+1);
+  near[n_steps] = TRUE;   // the step past the end, see the pass loop
+
+  search_job job;
+  job.sat = &sat;
+  job.times = times;
+  job.incr = incr;
+  job.look_angle = look_angle;
+  job.clat = clat;
+  job.clon = clon;
+  job.reach = get_search_reach(bmi, zone, aoi, clat, clon);
+  job.near = near;
+  asf_parallel_for(n_steps, 1024, find_near_steps, &job);
 
   // 
   // Calculate the number of frames to include before we hit the
@@ -349,7 +449,22 @@ int plan(const char *satellite, const char *beam_mode, double look_angle,
   PassCollection *pc = pass_collection_new(clat, clon, aoi);
 
   asfPrintStatus("Searching...\n");
+  k = 0;
   while (curr < end_secs) {
+    if (!near[k]) {
+      // too far away for overlap() to find anything
+      curr += incr;
+      ++k;
+      lat_prev_valid = FALSE;
+      asfPercentMeter((curr-start_secs)/(end_secs-start_secs));
+      continue;
+    }
+    if (!lat_prev_valid) {
+      tle_propagate(&sat, k > 0 ? times[k-1] : start_secs-incr);
+      lat_prev = sat.ssplat;
+      lat_prev_valid = TRUE;
+    }
+
     st = tle_propagate(&sat, curr);
     char dir = sat.ssplat > lat_prev ? 'A' : 'D';
 
@@ -414,9 +529,11 @@ int plan(const char *satellite, const char *beam_mode, double look_angle,
           ++n;
 
           curr += incr;
+          ++k;
           st = tle_propagate(&sat, curr);
 
-          oi = overlap(curr, &st, bmi, look_angle, zone, clat, clon, aoi);
+          oi = near[k] ?
+            overlap(curr, &st, bmi, look_angle, zone, clat, clon, aoi) : NULL;
         }
 
         double end_time = curr + (bmi->num_buffer_frames-1)*incr;
@@ -469,6 +586,7 @@ int plan(const char *satellite, const char *beam_mode, double look_angle,
     }
 
     curr += incr;
+    ++k;
     lat_prev = sat.ssplat;
 
     //printf("Lat: %f, Orbit: %d, Orbit Part: %f\n", sat.ssplat,
@@ -478,6 +596,9 @@ int plan(const char *satellite, const char *beam_mode, double look_angle,
   }
   asfPercentMeter(1.0);
 
+  FREE(times);
+  FREE(near);
+
   *pc_out = pc;
   return num_found;
 }
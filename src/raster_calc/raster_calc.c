@@ -82,8 +82,7 @@ BUGS:
 #include "asf_raster.h"
 #include "expression.h"
 
-#define MAXIMGS 20
-#define VERSION 1.5
+#define VERSION 1.6
 
 static
 void usage(char *name)
@@ -105,7 +104,11 @@ void usage(char *name)
  printf("\n"
 	"DESCRIPTION:\n"
 	"   Creates an output ASF tools format image based upon the\n"
-	"   mathematical expression you give it.\n");
+	"   mathematical expression you give it.  The input images are\n"
+	"   called a, b, c, ... in the order given; any of them can also be\n"
+	"   referred to by number: [1] is a, [2] is b, and so on, which is\n"
+	"   the only way to get at inputs past the 23rd.  x and y are the\n"
+	"   sample and line number.\n");
  printf("\n"
 	"Version %.2f, ASF SAR Tools\n"
 	"\n",VERSION);
@@ -116,7 +119,7 @@ int main(int argc,char **argv)
 {
   int ii;
   char *expression;
-  char *outFile,*inFiles[MAXIMGS];
+  char *outFile,**inFiles;
   int input_count;
   extern int currArg;         /* in cla.h from asf.h; initialized to 1 */
 
@@ -137,12 +140,14 @@ int main(int argc,char **argv)
   outFile = argv[currArg++];
   expression = argv[currArg++];
   input_count = argc - currArg;
+  inFiles = (char **) MALLOC(sizeof(char *)*input_count);
   for (ii=0; ii<input_count; ii++)
     inFiles[ii] = argv[currArg+ii];
 
   asfSplashScreen(argc, argv);
 
   raster_calc(outFile, expression, input_count, inFiles);
+  FREE(inFiles);
 
   exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,124 @@
+// Measure the latency of TableFile lock operations.
+//
+// Some threads repeatedly go through the read sequence described in
+// table_file.h (table reader lock, field reader lock, table reader
+// unlock, get value, field reader unlock), and one thread repeatedly
+// goes through the corresponding write sequence on a field of its
+// own.  We report the mean wall clock time of each sequence, which is
+// almost entirely lock acquisition and release.
+//
+// Usage: bench_table_file [reader_thread_count [iterations]]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "table_file.h"
+#include "utilities.h"
+
+// The path name to the benchmark table file we will create.
+#define BENCH_TABLE_FILE_NAME "/tmp/bench_table_file"
+
+static TableFile *tf;
+
+static int iterations = 10000;
+
+static double
+wall_clock (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1.0e-6;
+}
+
+static gpointer
+reader (gpointer data)
+{
+  double start = wall_clock ();
+
+  int ii;
+  for ( ii = 0 ; ii < iterations ; ii++ ) {
+    table_file_table_reader_lock (tf);
+    gboolean lock_result = table_file_field_reader_lock (tf, "shared");
+    g_assert (lock_result);
+    table_file_table_reader_unlock (tf);
+    GString *value = table_file_get_field_value (tf, "shared");
+    my_g_string_free (value);
+    table_file_field_reader_unlock (tf, "shared");
+  }
+
+  double *result = g_new (double, 1);
+  *result = (wall_clock () - start) / iterations;
+
+  return result;
+}
+
+static gpointer
+writer (gpointer data)
+{
+  double start = wall_clock ();
+
+  int ii;
+  for ( ii = 0 ; ii < iterations ; ii++ ) {
+    table_file_table_reader_lock (tf);
+    gboolean lock_result = table_file_field_writer_lock (tf, "private");
+    g_assert (lock_result);
+    table_file_table_reader_unlock (tf);
+    table_file_set_field_value (tf, "private", ii % 2 ? "odd" : "even");
+    table_file_field_writer_unlock (tf, "private");
+  }
+
+  double *result = g_new (double, 1);
+  *result = (wall_clock () - start) / iterations;
+
+  return result;
+}
+
+int
+main (int argc, char **argv)
+{
+  int reader_count = 3;
+
+  if ( argc > 1 ) {
+    reader_count = atoi (argv[1]);
+  }
+  if ( argc > 2 ) {
+    iterations = atoi (argv[2]);
+  }
+  g_assert (reader_count >= 0 && iterations > 0);
+
+  unlink (BENCH_TABLE_FILE_NAME);
+  tf = table_file_new (BENCH_TABLE_FILE_NAME);
+
+  table_file_table_writer_lock (tf);
+  table_file_add_field (tf, "shared", "value");
+  table_file_field_writer_unlock (tf, "shared");
+  table_file_add_field (tf, "private", "value");
+  table_file_field_writer_unlock (tf, "private");
+  table_file_table_writer_unlock (tf);
+
+  GPtrArray *threads = g_ptr_array_new ();
+  int ii;
+  for ( ii = 0 ; ii < reader_count ; ii++ ) {
+    g_ptr_array_add (threads, g_thread_create (reader, NULL, TRUE, NULL));
+  }
+  GThread *writer_thread = g_thread_create (writer, NULL, TRUE, NULL);
+
+  for ( ii = 0 ; ii < reader_count ; ii++ ) {
+    double *latency = g_thread_join (g_ptr_array_index (threads, ii));
+    printf ("reader %d: %.2f us per lock sequence\n", ii, *latency * 1e6);
+    g_free (latency);
+  }
+  double *latency = g_thread_join (writer_thread);
+  printf ("writer:   %.2f us per lock sequence\n", *latency * 1e6);
+  g_free (latency);
+
+  g_ptr_array_free (threads, TRUE);
+  table_file_unref (tf);
+  unlink (BENCH_TABLE_FILE_NAME);
+
+  exit (EXIT_SUCCESS);
+}
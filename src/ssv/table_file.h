@@ -1,17 +1,6 @@
 // This class is really a simple sort of interthread/interprocces
 // synchronization and communication mechanism.
 //
-// Actually, at the moment its a ghastly kludge to contend with the
-// fact that POSIX fcntl based file locking doesn't appear to work as
-// one could wish when threads are involved.  Linux at least thinks it
-// detects deadlock in fcntl when two threads in a single process are
-// involved in a blocking situation with another process which would
-// only be a block cycle if those threads are viewed as a single graph
-// node.  To work around this issue and still support the interface
-// described below we have to do some strange things.  The code as we
-// would like it to be is in files
-// table_file_if_fcntl_worked_righ.[hc].
-//
 // Specifically, it is an interface to a file consisting of key-value
 // pairs, with full support for explicit interthread and interprocess
 // read/write lock synchronization.  The locking is explicit so that
@@ -26,13 +15,14 @@
 // instances referring to the same file in different threads in the
 // same process (but see below).
 //
-// A given instance will also work correctly in processes created with
-// fork, or new threads spawned with g_thread_new or the like.
-// However, any locks maintained by the instance will be mangled in
-// the forked child or spawned thread.  In other words, besides the
-// arrangement described in the previous paragraph, the supported
-// paradigm for use of this class in a multithread or multiprocess
-// program is:
+// A given instance will also work correctly in new threads spawned
+// with g_thread_new or the like, and each thread is a separate lock
+// owner: threads in one process contend for table and field locks
+// exactly as separate processes do.  An instance may also be used in
+// a child created with fork, provided the instance had never been
+// locked in the parent.  In other words, besides the arrangement
+// described in the previous paragraph, the supported paradigm for use
+// of this class in a multithread or multiprocess program is:
 // 
 //   1. Create instance with table_file_new method.
 //   2. Fork processes or spawn threads.
@@ -45,22 +35,12 @@
 // this class' trapping of this error condition with extra slashes or
 // the like.  So don't do that.
 //
-// It should also be noted that opening and closing the file an
-// instance of this class is created with via any interface other than
-// the one defined by this class will break that instance (because all
-// POSIX advisory locks are dropped whenever any descriptor is
-// closed).
-//
-// Finally, since fcntl file locking currently gets confused when
-// multiple threads in the same process try to lock files, the truth
-// is that threads actually create slave process to do their locking
-// for them.  Probably all this means for correct clients is that they
-// might get a SIGCHLD they weren't expecting when threads exit.  By
-// default this signal is ignored.  For clients that get themselves in
-// deadlock situations, its possible that these spawned processes
-// might persist in a deadlocked state and cause confusing problems on
-// subsequent runs even if the original erroneas parent process is
-// killed.
+// File locking is done with open file description locks (F_OFD_SETLK
+// and friends, Linux 3.15 or later), through a descriptor of the
+// table file belonging to each thread.  Unlike traditional POSIX
+// record locks these belong to the descriptor rather than the
+// process, so they work between threads, and opening and closing the
+// table file through some other interface doesn't drop them.
 //
 // The following fundamental operations are supported:
 //
@@ -156,33 +136,22 @@ typedef struct {
   GString *path;		// Path of table file.
   ECLock *ds_lock;		// Lock for this data structure itself.
   gboolean unused;		// True iff self hasn't been locked.
-  // File descriptor of open table file.  Each process using a given
-  // table file maintains its own open file descriptor of that file:
-  // all the methods detect a change in PID and open a new descriptor
-  // if necessary.
-  int table_fd;		
-  // The pid in which the table_fd data member originated.  If this is
-  // not equal to getpid (), the methods open a new descriptor.
+  // The pid in which self was first used.  It is an error to use an
+  // instance in a process forked after it was first used, since the
+  // child would share its parent's descriptors and so its locks.
   pid_t pid;
   // Hash of known (pid, thread) tupple GString instances (as returned
-  // by pid_thread_string() to structures detailing how those threads
-  // perform lock operations (directly or through a slave).
+  // by pid_thread_string() to structures holding the descriptor of
+  // the table file through which that thread does its locking.
   GHashTable *thread_table;
   ECLock *table_lock;           // Intraprocess lock for entire table.
   // Hash of GString key representations to individual ECLock
   // instances (for intraprocess locking).
   GHashTable *field_locks;
-  // Hash of GString key representations to guint reader lock counts.
-  GHashTable *field_reader_lock_counts;
-  // Hash of GString key representations to field value GStrings,
-  // which are correct and useful only when multiple readers lock a
-  // field at the same time.
-  GHashTable *field_values;
   // Hash of field offset guint values, which are guaranteed to stay
   // correct only while somebody continually holds at least a reader
-  // lock on the field.  Note that we can only easily be sure of
-  // continuous locking between the time we (we the inhabitants of a
-  // single thread) acquire and release a field reader or writer lock.
+  // lock on the field.  Otherwise they are only hints, and are
+  // checked against the file before being trusted.
   GHashTable *field_offsets;
   int reference_count;
 } TableFile;
@@ -191,13 +160,6 @@ typedef struct {
 #define TABLE_FILE_MAX_KEY_LENGTH 2000
 #define TABLE_FILE_MAX_VALUE_LENGTH 2000
 
-// We have a smallish maximum number of fields only because the IPC
-// that forwards requiest to lock slaves is lazy code that does
-// everything in one write.  IMPROVEME: this could be fixed by making
-// the protocol that threads use to communicate with their proxy
-// slaves slightly more sophisticated.
-#define MAX_FIELD_COUNT 200
-
 // Create a new table instance.  The file argument is the path name of
 // a table file which already exists or is to be created.  It is an
 // error if an instance already exists for file in the current